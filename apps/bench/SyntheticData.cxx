@@ -0,0 +1,288 @@
+// DCMQI includes
+#include "SyntheticData.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcuid.h>
+
+// STD includes
+#include <cmath>
+#include <sstream>
+
+namespace {
+
+string generateUID(const char* root)
+{
+  char uid[100];
+  dcmGenerateUniqueIdentifier(uid, root);
+  return uid;
+}
+
+string formatNumbers(const double* values, unsigned count)
+{
+  stringstream stream;
+  for(unsigned i=0;i<count;i++)
+    stream << (i ? "\\" : "") << values[i];
+  return stream.str();
+}
+
+Json::Value createCode(const char* value, const char* designator, const char* meaning)
+{
+  Json::Value code;
+  code["CodeValue"] = value;
+  code["CodingSchemeDesignator"] = designator;
+  code["CodeMeaning"] = meaning;
+  return code;
+}
+
+string toString(const Json::Value& root)
+{
+  Json::StreamWriterBuilder writerBuilder;
+  return Json::writeString(writerBuilder, root);
+}
+
+}
+
+//-----------------------------------------------------------------------------
+// CT series
+
+SyntheticSeries::SyntheticSeries(const SyntheticParameters& parameters)
+  : parameters(parameters)
+{
+  spacing[0] = spacing[1] = 0.75;
+  spacing[2] = 2.5;
+  // centered on the isocenter in x and y
+  origin[0] = -0.5 * spacing[0] * parameters.columns;
+  origin[1] = -0.5 * spacing[1] * parameters.rows;
+  origin[2] = 0;
+
+  studyInstanceUID = generateUID(SITE_STUDY_UID_ROOT);
+  seriesInstanceUID = generateUID(SITE_SERIES_UID_ROOT);
+  const string frameOfReferenceUID = generateUID(SITE_UID_ROOT);
+  for(unsigned slice=0;slice<parameters.slices;slice++)
+    datasets.emplace_back(createSlice(slice, frameOfReferenceUID));
+}
+
+vector<DcmItem*> SyntheticSeries::getDatasets() const
+{
+  vector<DcmItem*> result;
+  for(size_t i=0;i<datasets.size();i++)
+    result.push_back(datasets[i].get());
+  return result;
+}
+
+// Patient, study, series, frame of reference, equipment and image modules of
+// a CT image, with an ellipse of soft tissue in air as pixel data
+DcmDataset* SyntheticSeries::createSlice(unsigned slice, const string& frameOfReferenceUID) const
+{
+  std::unique_ptr<DcmDataset> dataset(new DcmDataset());
+  const double position[3] = {origin[0], origin[1], origin[2] + slice * spacing[2]};
+  const double orientation[6] = {1, 0, 0, 0, 1, 0};
+  const double pixelSpacing[2] = {spacing[1], spacing[0]};
+  stringstream sliceThickness, instanceNumber;
+  sliceThickness << spacing[2];
+  instanceNumber << slice + 1;
+
+  const struct {
+    const DcmTagKey tag;
+    const string value;
+  } attributes[] = {
+    {DCM_SpecificCharacterSet, "ISO_IR 100"},
+    {DCM_ImageType, "ORIGINAL\\PRIMARY\\AXIAL"},
+    {DCM_SOPClassUID, UID_CTImageStorage},
+    {DCM_SOPInstanceUID, generateUID(SITE_INSTANCE_UID_ROOT)},
+    {DCM_StudyDate, "20240101"},
+    {DCM_SeriesDate, "20240101"},
+    {DCM_ContentDate, "20240101"},
+    {DCM_StudyTime, "120000"},
+    {DCM_SeriesTime, "120000"},
+    {DCM_ContentTime, "120000"},
+    {DCM_AccessionNumber, ""},
+    {DCM_Modality, "CT"},
+    {DCM_Manufacturer, "dcmqi"},
+    {DCM_ReferringPhysicianName, ""},
+    {DCM_StudyDescription, "Synthetic study"},
+    {DCM_SeriesDescription, "Synthetic CT"},
+    {DCM_PatientName, "Synthetic^Bench"},
+    {DCM_PatientID, "dcmqi_bench"},
+    {DCM_PatientBirthDate, ""},
+    {DCM_PatientSex, "O"},
+    {DCM_BodyPartExamined, "ABDOMEN"},
+    {DCM_SliceThickness, sliceThickness.str()},
+    {DCM_KVP, "120"},
+    {DCM_PatientPosition, "HFS"},
+    {DCM_StudyInstanceUID, studyInstanceUID},
+    {DCM_SeriesInstanceUID, seriesInstanceUID},
+    {DCM_StudyID, "1"},
+    {DCM_SeriesNumber, "1"},
+    {DCM_InstanceNumber, instanceNumber.str()},
+    {DCM_ImagePositionPatient, formatNumbers(position, 3)},
+    {DCM_ImageOrientationPatient, formatNumbers(orientation, 6)},
+    {DCM_FrameOfReferenceUID, frameOfReferenceUID},
+    {DCM_PositionReferenceIndicator, ""},
+    {DCM_PhotometricInterpretation, "MONOCHROME2"},
+    {DCM_PixelSpacing, formatNumbers(pixelSpacing, 2)},
+    {DCM_RescaleIntercept, "0"},
+    {DCM_RescaleSlope, "1"},
+  };
+  for(size_t i=0;i<sizeof(attributes)/sizeof(attributes[0]);i++)
+    dataset->putAndInsertOFStringArray(attributes[i].tag, attributes[i].value.c_str());
+  dataset->putAndInsertUint16(DCM_SamplesPerPixel, 1);
+  dataset->putAndInsertUint16(DCM_Rows, static_cast<Uint16>(parameters.rows));
+  dataset->putAndInsertUint16(DCM_Columns, static_cast<Uint16>(parameters.columns));
+  dataset->putAndInsertUint16(DCM_BitsAllocated, 16);
+  dataset->putAndInsertUint16(DCM_BitsStored, 16);
+  dataset->putAndInsertUint16(DCM_HighBit, 15);
+  dataset->putAndInsertUint16(DCM_PixelRepresentation, 1);
+
+  vector<Sint16> pixels(static_cast<size_t>(parameters.rows) * parameters.columns);
+  const double radiusX = 0.45 * parameters.columns, radiusY = 0.35 * parameters.rows;
+  for(unsigned y=0;y<parameters.rows;y++){
+    for(unsigned x=0;x<parameters.columns;x++){
+      const double dx = (x - 0.5 * parameters.columns) / radiusX;
+      const double dy = (y - 0.5 * parameters.rows) / radiusY;
+      // soft tissue with some texture inside the body, air outside
+      pixels[static_cast<size_t>(y) * parameters.columns + x] =
+        dx * dx + dy * dy <= 1 ? static_cast<Sint16>(40 + (x * 7 + y * 13 + slice * 3) % 21 - 10) : -1000;
+    }
+  }
+  dataset->putAndInsertUint16Array(DCM_PixelData, reinterpret_cast<const Uint16*>(pixels.data()),
+                                   static_cast<unsigned long>(pixels.size()));
+  return dataset.release();
+}
+
+//-----------------------------------------------------------------------------
+// Labels
+
+SyntheticLabels::SyntheticLabels(const SyntheticParameters& parameters, const SyntheticSeries& series)
+  : parameters(parameters), series(series)
+{
+  labelColumns = parameters.columns / parameters.labels;
+  overlapColumns = static_cast<unsigned>(std::lround(parameters.overlap * labelColumns));
+  const unsigned labeledSlices = std::max(1u, static_cast<unsigned>(std::lround((1 - parameters.sparsity) * parameters.slices)));
+  firstSlice = (parameters.slices - labeledSlices) / 2;
+  lastSlice = firstSlice + labeledSlices - 1;
+  firstRow = parameters.rows / 4;
+  lastRow = std::max(firstRow + 1, parameters.rows - parameters.rows / 4);
+}
+
+Json::Value SyntheticLabels::getSegmentAttributes(unsigned label) const
+{
+  stringstream name;
+  name << "Segment " << label;
+  Json::Value segment;
+  segment["labelID"] = label;
+  segment["SegmentDescription"] = name.str();
+  segment["SegmentLabel"] = name.str();
+  segment["SegmentedPropertyCategoryCodeSequence"] = createCode("85756007", "SCT", "Tissue");
+  segment["SegmentedPropertyTypeCodeSequence"] = createCode("10200004", "SCT", "Liver");
+  segment["SegmentAlgorithmType"] = "AUTOMATIC";
+  segment["SegmentAlgorithmName"] = "dcmqi_bench";
+  segment["recommendedDisplayRGBValue"].append((label * 67) % 256);
+  segment["recommendedDisplayRGBValue"].append((label * 131) % 256);
+  segment["recommendedDisplayRGBValue"].append((label * 199) % 256);
+  segment["TrackingIdentifier"] = name.str();
+  return segment;
+}
+
+// One array of segments per image, in the order of the labels in the image
+string SyntheticLabels::getSegmentationMetadata(bool labelMap) const
+{
+  Json::Value root;
+  root["ContentCreatorName"] = "Bench^Synthetic";
+  root["ClinicalTrialSeriesID"] = "Session1";
+  root["ClinicalTrialTimePointID"] = "1";
+  root["ClinicalTrialCoordinatingCenterName"] = "dcmqi";
+  root["SeriesDescription"] = labelMap ? "Synthetic labelmap segmentation" : "Synthetic segmentation";
+  root["SeriesNumber"] = "300";
+  root["InstanceNumber"] = "1";
+
+  const unsigned step = labelMap || overlapColumns == 0 ? 1 : 2;
+  Json::Value& segmentAttributes = root["segmentAttributes"] = Json::Value(Json::arrayValue);
+  for(unsigned first=0;first<std::min(step, parameters.labels);first++){
+    Json::Value segments(Json::arrayValue);
+    for(unsigned label=first;label<parameters.labels;label+=step)
+      segments.append(getSegmentAttributes(label + 1));
+    segmentAttributes.append(segments);
+  }
+  return toString(root);
+}
+
+//-----------------------------------------------------------------------------
+// Parametric map
+
+FloatImageType::Pointer createParametricMap(const SyntheticSeries& series)
+{
+  FloatImageType::Pointer image = series.createImage<FloatImageType>();
+  const FloatImageType::SizeType size = image->GetLargestPossibleRegion().GetSize();
+  float* voxel = image->GetBufferPointer();
+  for(size_t z=0;z<size[2];z++)
+    for(size_t y=0;y<size[1];y++)
+      for(size_t x=0;x<size[0];x++)
+        *voxel++ = static_cast<float>(1000 + 400 * std::sin(0.05 * x) * std::cos(0.05 * y) + 10 * z);
+  return image;
+}
+
+string getParametricMapMetadata()
+{
+  Json::Value root;
+  root["SeriesDescription"] = "Synthetic parametric map";
+  root["SeriesNumber"] = "701";
+  root["InstanceNumber"] = "1";
+  root["BodyPartExamined"] = "ABDOMEN";
+  root["QuantityValueCode"] = createCode("113041", "DCM", "Apparent Diffusion Coefficient");
+  root["DerivationCode"] = createCode("113041", "DCM", "Apparent Diffusion Coefficient");
+  root["MeasurementUnitsCode"] = createCode("um2/s", "UCUM", "um2/s");
+  root["MeasurementMethodCode"] = createCode("113250", "DCM", "Mono-exponential diffusion model");
+  root["AnatomicRegionSequence"] = createCode("10200004", "SCT", "Liver");
+  root["FrameLaterality"] = "U";
+  root["RealWorldValueSlope"] = "1";
+  return toString(root);
+}
+
+//-----------------------------------------------------------------------------
+// Measurement report
+
+Json::Value getMeasurementReportMetadata(const SyntheticParameters& parameters, const SyntheticSeries& series,
+                                         const string& segmentationSOPInstanceUID,
+                                         const string& segmentationFileName,
+                                         const vector<string>& sliceFileNames)
+{
+  Json::Value root;
+  root["SeriesDescription"] = "Synthetic measurements";
+  root["SeriesNumber"] = "1001";
+  root["InstanceNumber"] = "1";
+  root["compositeContext"].append(segmentationFileName);
+  for(size_t i=0;i<sliceFileNames.size();i++)
+    root["imageLibrary"].append(sliceFileNames[i]);
+  root["observerContext"]["ObserverType"] = "DEVICE";
+  root["observerContext"]["DeviceObserverName"] = "dcmqi_bench";
+  root["VerificationFlag"] = "UNVERIFIED";
+  root["CompletionFlag"] = "COMPLETE";
+  root["activitySession"] = "1";
+  root["timePoint"] = "1";
+
+  Json::Value& measurements = root["Measurements"] = Json::Value(Json::arrayValue);
+  for(unsigned segment=1;segment<=parameters.labels;segment++){
+    stringstream trackingIdentifier, value;
+    trackingIdentifier << "Measurements of segment " << segment;
+    value << 35 + segment % 10;
+
+    Json::Value group;
+    group["TrackingIdentifier"] = trackingIdentifier.str();
+    group["ReferencedSegment"] = segment;
+    group["SourceSeriesForImageSegmentation"] = series.getSeriesInstanceUID();
+    group["segmentationSOPInstanceUID"] = segmentationSOPInstanceUID;
+    group["Finding"] = createCode("113343008", "SCT", "Organ");
+    group["FindingSite"] = createCode("10200004", "SCT", "Liver");
+
+    Json::Value item;
+    item["value"] = value.str();
+    item["quantity"] = createCode("112031", "DCM", "Attenuation Coefficient");
+    item["units"] = createCode("[hnsf'U]", "UCUM", "Hounsfield unit");
+    item["derivationModifier"] = createCode("373098007", "SCT", "Mean");
+    group["measurementItems"].append(item);
+    measurements.append(group);
+  }
+  return root;
+}
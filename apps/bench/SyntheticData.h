@@ -0,0 +1,165 @@
+#ifndef DCMQI_SYNTHETICDATA_H
+#define DCMQI_SYNTHETICDATA_H
+
+// DCMQI includes
+#include "dcmqi/ConverterBase.h"
+#include "dcmqi/ParaMapConverter.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdatset.h>
+
+// STD includes
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+using namespace std;
+
+// Synthetic inputs of dcmqi_bench: a CT series and label volumes on its grid,
+// generated in memory so that the benchmarks need no external data.
+
+// Size of the CT series and layout of the labels
+struct SyntheticParameters {
+  unsigned rows;
+  unsigned columns;
+  unsigned slices;
+  /// number of labels (segments), 1..65535
+  unsigned labels;
+  /// fraction of the width of a label by which it extends into the next one, 0..1
+  double overlap;
+  /// fraction of the slices without any label, 0..1
+  double sparsity;
+};
+
+// CT series, axial slices of signed 16 bit pixels, 0.75x0.75x2.5 mm
+class SyntheticSeries {
+public:
+  explicit SyntheticSeries(const SyntheticParameters& parameters);
+
+  /// Datasets of the slices in order of increasing z, owned by the series
+  vector<DcmItem*> getDatasets() const;
+
+  const string& getStudyInstanceUID() const { return studyInstanceUID; }
+  const string& getSeriesInstanceUID() const { return seriesInstanceUID; }
+
+  /// Empty image on the grid of the series (columns x rows x slices)
+  template<class ImageType>
+  typename ImageType::Pointer createImage() const
+  {
+    typename ImageType::Pointer image = ImageType::New();
+    typename ImageType::RegionType region;
+    region.SetSize(0, parameters.columns);
+    region.SetSize(1, parameters.rows);
+    region.SetSize(2, parameters.slices);
+    typename ImageType::PointType origin;
+    typename ImageType::SpacingType spacing;
+    for(unsigned i=0;i<3;i++){
+      origin[i] = this->origin[i];
+      spacing[i] = this->spacing[i];
+    }
+    image->SetRegions(region);
+    image->SetOrigin(origin);
+    image->SetSpacing(spacing);
+    image->Allocate();
+    image->FillBuffer(0);
+    return image;
+  }
+
+private:
+  DcmDataset* createSlice(unsigned slice, const string& frameOfReferenceUID) const;
+
+  const SyntheticParameters parameters;
+  double origin[3];
+  double spacing[3];
+  string studyInstanceUID;
+  string seriesInstanceUID;
+  vector<std::unique_ptr<DcmDataset> > datasets;
+};
+
+// Labels 1..N as vertical slabs of equal width side by side, in a band of rows
+// in the middle of the image, on a contiguous range of slices. With overlap,
+// every slab extends into the next one; labels with odd and even numbers are
+// then stored in two images, since each pixel of an image holds one label.
+class SyntheticLabels {
+public:
+  SyntheticLabels(const SyntheticParameters& parameters, const SyntheticSeries& series);
+
+  /// Labels without overlap, in one image
+  template<class ImageType>
+  typename ImageType::Pointer createLabelMap() const
+  {
+    return createLabelImage<ImageType>(0, 1, 0);
+  }
+
+  /// Labels with overlap: one image, or two if the labels overlap
+  template<class ImageType>
+  vector<typename ImageType::ConstPointer> createLayers() const
+  {
+    vector<typename ImageType::ConstPointer> layers;
+    if(overlapColumns == 0){
+      layers.push_back(createLabelMap<ImageType>().GetPointer());
+    } else {
+      layers.push_back(createLabelImage<ImageType>(0, 2, overlapColumns).GetPointer());
+      if(parameters.labels > 1)
+        layers.push_back(createLabelImage<ImageType>(1, 2, overlapColumns).GetPointer());
+    }
+    return layers;
+  }
+
+  /// Segmentation metadata for createLayers() (binary) or createLabelMap() (labelmap)
+  string getSegmentationMetadata(bool labelMap) const;
+
+  /// Number of slices with labels
+  unsigned getLabeledSlices() const { return lastSlice - firstSlice + 1; }
+
+private:
+  /// Image with every step-th label, starting at the label with index first
+  template<class ImageType>
+  typename ImageType::Pointer createLabelImage(unsigned first, unsigned step, unsigned extension) const
+  {
+    typedef typename ImageType::PixelType PixelType;
+    typename ImageType::Pointer image = series.createImage<ImageType>();
+    PixelType* buffer = image->GetBufferPointer();
+    const size_t sliceSize = static_cast<size_t>(parameters.rows) * parameters.columns;
+    for(unsigned z=firstSlice;z<=lastSlice;z++){
+      for(unsigned y=firstRow;y<lastRow;y++){
+        PixelType* row = buffer + z * sliceSize + static_cast<size_t>(y) * parameters.columns;
+        for(unsigned label=first;label<parameters.labels;label+=step){
+          const unsigned begin = label * labelColumns;
+          const unsigned end = std::min(begin + labelColumns + extension, parameters.columns);
+          std::fill(row + begin, row + end, static_cast<PixelType>(label + 1));
+        }
+      }
+    }
+    return image;
+  }
+
+  Json::Value getSegmentAttributes(unsigned label) const;
+
+  const SyntheticParameters parameters;
+  const SyntheticSeries& series;
+  unsigned labelColumns;
+  unsigned overlapColumns;
+  unsigned firstSlice;
+  unsigned lastSlice;
+  unsigned firstRow;
+  unsigned lastRow;
+};
+
+/// Parametric map on the grid of the series, a smooth float field
+FloatImageType::Pointer createParametricMap(const SyntheticSeries& series);
+
+/// Metadata of the parametric map of createParametricMap()
+string getParametricMapMetadata();
+
+/// TID 1500 metadata with one measurement group per segment of a segmentation
+/// of the series, for the files written to a directory
+Json::Value getMeasurementReportMetadata(const SyntheticParameters& parameters, const SyntheticSeries& series,
+                                         const string& segmentationSOPInstanceUID,
+                                         const string& segmentationFileName,
+                                         const vector<string>& sliceFileNames);
+
+#endif //DCMQI_SYNTHETICDATA_H
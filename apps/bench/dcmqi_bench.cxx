@@ -0,0 +1,687 @@
+// CLP includes
+#include "dcmqi_benchCLP.h"
+
+// DCMQI includes
+#undef HAVE_SSTREAM // Avoid redefinition warning
+#include "SyntheticData.h"
+#include "dcmqi/Bin2Label.h"
+#include "dcmqi/Dicom2ItkConverterBase.h"
+#include "dcmqi/Itk2DicomConverter.h"
+#include "dcmqi/LabelHistogram.h"
+#include "dcmqi/MemoryIO.h"
+#include "dcmqi/SegmentationMetadataPlan.h"
+#include "dcmqi/TID1500Reader.h"
+#include "dcmqi/TID1500Writer.h"
+#include "dcmqi/internal/VersionConfigure.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcrledrg.h>
+#include <dcmtk/dcmdata/dcrleerg.h>
+#include <dcmtk/oflog/configrt.h>
+
+// ITK includes
+#include <itkMultiThreaderBase.h>
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+// Outcome of one run of a benchmark
+struct Sample {
+  Sample() : seconds(0), frames(0), bytes(0) {}
+
+  /// time of the measured phase only, without preparing its input
+  double seconds;
+  /// frames produced or read
+  size_t frames;
+  /// bytes of the input (voxels or encoded object) or of the encoded output
+  size_t bytes;
+};
+
+class Stopwatch {
+public:
+  Stopwatch() : start(std::chrono::steady_clock::now()) {}
+
+  double seconds() const
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+private:
+  const std::chrono::steady_clock::time_point start;
+};
+
+// Discards what the converters print to standard output while it exists, so
+// that console output is not part of the measured time
+class QuietOutput {
+public:
+  explicit QuietOutput(bool quiet) : buffer(quiet ? std::cout.rdbuf(discard.rdbuf()) : NULL) {}
+  ~QuietOutput()
+  {
+    if(buffer)
+      std::cout.rdbuf(buffer);
+  }
+
+private:
+  std::ostringstream discard;
+  std::streambuf* const buffer;
+};
+
+size_t getNumberOfFrames(DcmItem* dataset)
+{
+  Sint32 numberOfFrames = 0;
+  dataset->findAndGetSint32(DCM_NumberOfFrames, numberOfFrames);
+  return static_cast<size_t>(std::max<Sint32>(numberOfFrames, 0));
+}
+
+void checkCondition(const OFCondition& condition, const string& what)
+{
+  if(condition.bad())
+    throw std::runtime_error(what + ": " + condition.text());
+}
+
+DcmDataset* checkResult(DcmDataset* result, const string& what)
+{
+  if(result == NULL)
+    throw std::runtime_error(what + " failed");
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// Benchmarks of the converter phases on synthetic data. Inputs of a phase that
+// are outputs of another one (e.g. the encoded SEG for reading) are produced
+// once, on first use, outside of the measured time.
+
+template<class LabelImageType>
+class BenchmarkSuite {
+public:
+  typedef Sample (BenchmarkSuite::*Function)();
+
+  struct Benchmark {
+    const char* name;
+    const char* description;
+    Function function;
+  };
+
+  static const vector<Benchmark>& getBenchmarks()
+  {
+    static const vector<Benchmark> benchmarks = {
+      {"labelscan", "distinct labels and their slice ranges of the label map", &BenchmarkSuite::scanLabels},
+      {"metadata", "segmentation metadata parsed and compiled into a plan", &BenchmarkSuite::compileMetadata},
+      {"export-binary", "BINARY SEG from the label images (frames and functional groups)", &BenchmarkSuite::exportBinary},
+      {"export-labelmap", "LABELMAP SEG from the label map", &BenchmarkSuite::exportLabelMap},
+      {"write", "BINARY SEG encoded, explicit little endian", &BenchmarkSuite::writeBinary},
+      {"write-deflate", "BINARY SEG encoded, deflated", &BenchmarkSuite::writeDeflated},
+      {"write-rle", "LABELMAP SEG encoded, RLE lossless", &BenchmarkSuite::writeLabelMapRLE},
+      {"read", "BINARY SEG decoded and converted into label images", &BenchmarkSuite::readBinary},
+      {"read-labelmap", "RLE LABELMAP SEG decoded and converted into label images", &BenchmarkSuite::readLabelMap},
+      {"bin2label", "BINARY SEG converted into a LABELMAP SEG", &BenchmarkSuite::convertBinToLabel},
+      {"paramap-export", "parametric map from a float volume", &BenchmarkSuite::exportParametricMap},
+      {"paramap-import", "parametric map decoded and converted into a float volume", &BenchmarkSuite::importParametricMap},
+      {"sr-write", "TID 1500 report of all segments created from the files of the SEG and the series", &BenchmarkSuite::writeReport},
+      {"sr-read", "TID 1500 report decoded and read into JSON", &BenchmarkSuite::readReport},
+    };
+    return benchmarks;
+  }
+
+  BenchmarkSuite(const SyntheticParameters& parameters, const string& workDirectory,
+                 unsigned numThreads, bool quiet)
+    : parameters(parameters), workDirectory(workDirectory), numThreads(numThreads), quiet(quiet),
+      series(parameters), labels(parameters, series)
+  {
+    labelMap = labels.createLabelMap<LabelImageType>();
+    layers = labels.createLayers<LabelImageType>();
+    parametricMap = createParametricMap(series);
+    parametricMapMetadata = getParametricMapMetadata();
+    binaryMetadata = labels.getSegmentationMetadata(false);
+    labelMapMetadata = labels.getSegmentationMetadata(true);
+    binaryPlan = dcmqi::SegmentationMetadataPlan::compile(binaryMetadata);
+    labelMapPlan = dcmqi::SegmentationMetadataPlan::compile(labelMapMetadata);
+    if(!binaryPlan || !labelMapPlan)
+      throw std::runtime_error("invalid synthetic segmentation metadata");
+  }
+
+  unsigned getLabeledSlices() const { return labels.getLabeledSlices(); }
+
+  /// Runs a benchmark, the result has the time of every repetition and their statistics
+  Json::Value run(const Benchmark& benchmark, unsigned repetitions)
+  {
+    Json::Value result;
+    result["name"] = benchmark.name;
+    result["description"] = benchmark.description;
+    vector<double> seconds;
+    Sample sample;
+    try {
+      QuietOutput output(quiet);
+      for(unsigned i=0;i<repetitions;i++){
+        sample = (this->*benchmark.function)();
+        seconds.push_back(sample.seconds);
+      }
+    } catch(const itk::ExceptionObject& e) {
+      result["error"] = e.GetDescription();
+    } catch(const std::exception& e) {
+      result["error"] = e.what();
+    } catch(int) {
+      result["error"] = "DICOM error";
+    }
+    result["status"] = result.isMember("error") ? "failed" : "succeeded";
+    Json::Value& secondsList = result["seconds"] = Json::Value(Json::arrayValue);
+    for(size_t i=0;i<seconds.size();i++)
+      secondsList.append(seconds[i]);
+    if(seconds.empty())
+      return result;
+
+    vector<double> sorted(seconds);
+    std::sort(sorted.begin(), sorted.end());
+    const size_t middle = sorted.size() / 2;
+    const double median = sorted.size() % 2 ? sorted[middle] : (sorted[middle - 1] + sorted[middle]) / 2;
+    result["min"] = sorted.front();
+    result["max"] = sorted.back();
+    result["median"] = median;
+    result["mean"] = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+    result["frames"] = static_cast<Json::UInt64>(sample.frames);
+    result["bytes"] = static_cast<Json::UInt64>(sample.bytes);
+    if(median > 0){
+      result["framesPerSecond"] = sample.frames / median;
+      result["megabytesPerSecond"] = sample.bytes / median / (1024 * 1024);
+    }
+    return result;
+  }
+
+private:
+  //---------------------------------------------------------------------------
+  // Segmentations
+
+  Sample scanLabels()
+  {
+    Sample sample;
+    Stopwatch stopwatch;
+    map<typename LabelImageType::PixelType, dcmqi::LabelHistogram::SliceRange> histogram =
+      dcmqi::LabelHistogram::compute(labelMap.GetPointer());
+    sample.seconds = stopwatch.seconds();
+    histogram.erase(0);
+    if(histogram.size() != parameters.labels)
+      throw std::runtime_error("unexpected number of labels");
+    sample.bytes = getVoxelBytes(labelMap.GetPointer());
+    return sample;
+  }
+
+  Sample compileMetadata()
+  {
+    Sample sample;
+    Stopwatch stopwatch;
+    dcmqi::SegmentationMetadataPlan::ConstPointer plan = dcmqi::SegmentationMetadataPlan::compile(binaryMetadata);
+    sample.seconds = stopwatch.seconds();
+    if(!plan)
+      throw std::runtime_error("metadata compilation failed");
+    sample.bytes = binaryMetadata.size();
+    return sample;
+  }
+
+  DcmDataset* createBinarySegmentation()
+  {
+    return checkResult(dcmqi::Itk2DicomConverter::itkimage2dcmSegmentation(series.getDatasets(), layers, *binaryPlan),
+                       "BINARY SEG export");
+  }
+
+  DcmDataset* createLabelMapSegmentation()
+  {
+    vector<typename LabelImageType::ConstPointer> segmentations(1, labelMap.GetPointer());
+    return checkResult(dcmqi::Itk2DicomConverter::itkimage2dcmSegmentation(series.getDatasets(), segmentations, *labelMapPlan,
+                                                                           true, false, true, true, true),
+                       "LABELMAP SEG export");
+  }
+
+  Sample exportBinary()
+  {
+    Sample sample;
+    Stopwatch stopwatch;
+    std::unique_ptr<DcmDataset> result(createBinarySegmentation());
+    sample.seconds = stopwatch.seconds();
+    sample.frames = getNumberOfFrames(result.get());
+    for(size_t i=0;i<layers.size();i++)
+      sample.bytes += getVoxelBytes(layers[i].GetPointer());
+    if(!binarySegmentation)
+      binarySegmentation = std::move(result);
+    return sample;
+  }
+
+  Sample exportLabelMap()
+  {
+    Sample sample;
+    Stopwatch stopwatch;
+    std::unique_ptr<DcmDataset> result(createLabelMapSegmentation());
+    sample.seconds = stopwatch.seconds();
+    sample.frames = getNumberOfFrames(result.get());
+    sample.bytes = getVoxelBytes(labelMap.GetPointer());
+    if(!labelMapSegmentation)
+      labelMapSegmentation = std::move(result);
+    return sample;
+  }
+
+  DcmDataset& getBinarySegmentation()
+  {
+    if(!binarySegmentation)
+      binarySegmentation.reset(createBinarySegmentation());
+    return *binarySegmentation;
+  }
+
+  DcmDataset& getLabelMapSegmentation()
+  {
+    if(!labelMapSegmentation)
+      labelMapSegmentation.reset(createLabelMapSegmentation());
+    return *labelMapSegmentation;
+  }
+
+  /// Encodes a copy of the dataset, so that the dataset itself keeps its transfer syntax
+  Sample write(DcmDataset& dataset, E_TransferSyntax xfer, vector<Uint8>& encoded)
+  {
+    Sample sample;
+    DcmFileFormat fileFormat(&dataset);
+    Stopwatch stopwatch;
+    checkCondition(dcmqi::MemoryIO::writeDICOM(fileFormat, encoded, xfer, numThreads), "encoding failed");
+    sample.seconds = stopwatch.seconds();
+    sample.frames = getNumberOfFrames(&dataset);
+    sample.bytes = encoded.size();
+    return sample;
+  }
+
+  Sample writeBinary()
+  {
+    return write(getBinarySegmentation(), EXS_LittleEndianExplicit, encodedBinary);
+  }
+
+  Sample writeDeflated()
+  {
+    vector<Uint8> encoded;
+    return write(getBinarySegmentation(), EXS_DeflatedLittleEndianExplicit, encoded);
+  }
+
+  Sample writeLabelMapRLE()
+  {
+    return write(getLabelMapSegmentation(), EXS_RLELossless, encodedLabelMapRLE);
+  }
+
+  const vector<Uint8>& getEncoded(vector<Uint8>& encoded, DcmDataset& dataset, E_TransferSyntax xfer)
+  {
+    if(encoded.empty()){
+      DcmFileFormat fileFormat(&dataset);
+      checkCondition(dcmqi::MemoryIO::writeDICOM(fileFormat, encoded, xfer, numThreads), "encoding failed");
+    }
+    return encoded;
+  }
+
+  Sample read(const vector<Uint8>& encoded)
+  {
+    Sample sample;
+    Stopwatch stopwatch;
+    DcmFileFormat fileFormat;
+    checkCondition(dcmqi::MemoryIO::readDICOM(encoded.data(), encoded.size(), fileFormat, numThreads), "decoding failed");
+    DcmDataset* dataset = fileFormat.getDataset();
+    std::unique_ptr<dcmqi::Dicom2ItkConverterBase> converter(dcmqi::Dicom2ItkConverter::getConverter(dataset));
+    if(!converter)
+      throw std::runtime_error("not a DICOM segmentation");
+    std::string metaInfo;
+    checkCondition(converter->dcmSegmentation2itkimage(dataset, metaInfo), "conversion into label images failed");
+    size_t numberOfImages = 0;
+    if(converter->bytesPerPixel() > 1 || !converter->isLabelmap()){
+      for(ShortImageType::Pointer image = converter->begin16Bit(); image; image = converter->next16Bit())
+        numberOfImages++;
+    } else {
+      for(CharImageType::Pointer image = converter->begin8Bit(); image; image = converter->next8Bit())
+        numberOfImages++;
+    }
+    sample.seconds = stopwatch.seconds();
+    if(!numberOfImages)
+      throw std::runtime_error("no label images");
+    sample.frames = getNumberOfFrames(dataset);
+    sample.bytes = encoded.size();
+    return sample;
+  }
+
+  Sample readBinary()
+  {
+    return read(getEncoded(encodedBinary, getBinarySegmentation(), EXS_LittleEndianExplicit));
+  }
+
+  Sample readLabelMap()
+  {
+    return read(getEncoded(encodedLabelMapRLE, getLabelMapSegmentation(), EXS_RLELossless));
+  }
+
+  Sample convertBinToLabel()
+  {
+    Sample sample;
+    DcmDataset input(getBinarySegmentation());
+    Stopwatch stopwatch;
+    dcmqi::DcmBinToLabelConverter converter;
+    dcmqi::DcmBinToLabelConverter::ConversionFlags convFlags;
+    convFlags.m_numThreads = numThreads ? numThreads : itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+    converter.setInput(&input);
+    checkCondition(converter.convert(convFlags), "conversion into a LABELMAP SEG failed");
+    OFshared_ptr<DcmSegmentation> labelSeg;
+    checkCondition(converter.getOutputSegmentation(labelSeg), "no LABELMAP SEG");
+    DcmDataset result;
+    checkCondition(labelSeg->writeDataset(result), "LABELMAP SEG export failed");
+    sample.seconds = stopwatch.seconds();
+    sample.frames = getNumberOfFrames(&result);
+    sample.bytes = getEncoded(encodedBinary, getBinarySegmentation(), EXS_LittleEndianExplicit).size();
+    return sample;
+  }
+
+  //---------------------------------------------------------------------------
+  // Parametric maps
+
+  DcmDataset* createParametricMapDataset()
+  {
+    return checkResult(dcmqi::ParaMapConverter::itkimage2paramap(parametricMap, series.getDatasets(), parametricMapMetadata),
+                       "parametric map export");
+  }
+
+  Sample exportParametricMap()
+  {
+    Sample sample;
+    Stopwatch stopwatch;
+    std::unique_ptr<DcmDataset> result(createParametricMapDataset());
+    sample.seconds = stopwatch.seconds();
+    sample.frames = getNumberOfFrames(result.get());
+    sample.bytes = getVoxelBytes(parametricMap.GetPointer());
+    return sample;
+  }
+
+  Sample importParametricMap()
+  {
+    if(encodedParametricMap.empty()){
+      std::unique_ptr<DcmDataset> dataset(createParametricMapDataset());
+      getEncoded(encodedParametricMap, *dataset, EXS_LittleEndianExplicit);
+    }
+
+    Sample sample;
+    Stopwatch stopwatch;
+    DcmFileFormat fileFormat;
+    checkCondition(dcmqi::MemoryIO::readDICOM(encodedParametricMap.data(), encodedParametricMap.size(), fileFormat, numThreads),
+                   "decoding failed");
+    pair<FloatImageType::Pointer, string> result = dcmqi::ParaMapConverter::paramap2itkimage(fileFormat.getDataset());
+    sample.seconds = stopwatch.seconds();
+    if(result.first.IsNull())
+      throw std::runtime_error("parametric map import failed");
+    sample.frames = getNumberOfFrames(fileFormat.getDataset());
+    sample.bytes = encodedParametricMap.size();
+    return sample;
+  }
+
+  //---------------------------------------------------------------------------
+  // Structured reports
+
+  /// The writer reads the SEG and the series from files, which are written to
+  /// the work directory on first use
+  const Json::Value& getReportMetadata()
+  {
+    if(reportMetadata.isNull()){
+      vector<string> sliceFileNames;
+      const vector<DcmItem*> datasets = series.getDatasets();
+      for(size_t i=0;i<datasets.size();i++){
+        stringstream fileName;
+        fileName << "ct-" << std::setw(5) << std::setfill('0') << i + 1 << ".dcm";
+        saveDataset(*datasets[i], fileName.str());
+        sliceFileNames.push_back(fileName.str());
+      }
+      DcmDataset& segmentation = getBinarySegmentation();
+      saveDataset(segmentation, "seg.dcm");
+      OFString segmentationSOPInstanceUID;
+      checkCondition(segmentation.findAndGetOFString(DCM_SOPInstanceUID, segmentationSOPInstanceUID), "SEG without SOP Instance UID");
+      reportMetadata = getMeasurementReportMetadata(parameters, series, segmentationSOPInstanceUID.c_str(), "seg.dcm", sliceFileNames);
+    }
+    return reportMetadata;
+  }
+
+  void saveDataset(DcmItem& dataset, const string& fileName)
+  {
+    DcmFileFormat fileFormat(OFstatic_cast(DcmDataset*, &dataset));
+    const string path = workDirectory + "/" + fileName;
+    checkCondition(fileFormat.saveFile(path.c_str(), EXS_LittleEndianExplicit), "cannot write " + path);
+  }
+
+  /// Like the export benchmarks, the report is created but not encoded in the
+  /// measured time; it is encoded afterwards for sr-read and the sample size
+  Sample writeReport()
+  {
+    const Json::Value& metadata = getReportMetadata();
+    Sample sample;
+    Stopwatch stopwatch;
+    std::unique_ptr<DcmDataset> result(checkResult(TID1500Writer::writeReport(metadata, workDirectory, workDirectory),
+                                                   "TID 1500 report"));
+    sample.seconds = stopwatch.seconds();
+    sample.bytes = getEncoded(encodedReport, *result, EXS_LittleEndianExplicit).size();
+    return sample;
+  }
+
+  Sample readReport()
+  {
+    if(encodedReport.empty())
+      writeReport();
+
+    Sample sample;
+    Stopwatch stopwatch;
+    DcmFileFormat fileFormat;
+    checkCondition(dcmqi::MemoryIO::readDICOM(encodedReport.data(), encodedReport.size(), fileFormat), "decoding failed");
+    DSRDocument doc;
+    Json::Value metaRoot;
+    TID1500Reader::readReport(*fileFormat.getDataset(), doc, metaRoot);
+    sample.seconds = stopwatch.seconds();
+    if(metaRoot["Measurements"].size() != parameters.labels)
+      throw std::runtime_error("unexpected number of measurement groups");
+    sample.bytes = encodedReport.size();
+    return sample;
+  }
+
+  //---------------------------------------------------------------------------
+
+  template<class ImageType>
+  static size_t getVoxelBytes(const ImageType* image)
+  {
+    return image->GetBufferedRegion().GetNumberOfPixels() * sizeof(typename ImageType::PixelType);
+  }
+
+  const SyntheticParameters parameters;
+  const string workDirectory;
+  const unsigned numThreads;
+  const bool quiet;
+
+  // inputs
+  SyntheticSeries series;
+  SyntheticLabels labels;
+  typename LabelImageType::Pointer labelMap;
+  vector<typename LabelImageType::ConstPointer> layers;
+  FloatImageType::Pointer parametricMap;
+  string parametricMapMetadata;
+  string binaryMetadata;
+  string labelMapMetadata;
+  dcmqi::SegmentationMetadataPlan::ConstPointer binaryPlan;
+  dcmqi::SegmentationMetadataPlan::ConstPointer labelMapPlan;
+
+  // outputs of phases that are inputs of others
+  std::unique_ptr<DcmDataset> binarySegmentation;
+  std::unique_ptr<DcmDataset> labelMapSegmentation;
+  vector<Uint8> encodedBinary;
+  vector<Uint8> encodedLabelMapRLE;
+  vector<Uint8> encodedParametricMap;
+  vector<Uint8> encodedReport;
+  Json::Value reportMetadata;
+};
+
+//-----------------------------------------------------------------------------
+
+/// Benchmarks selected by a comma separated list of names, all if the list is empty
+template<class Suite>
+bool selectBenchmarks(const string& names, vector<typename Suite::Benchmark>& selected)
+{
+  const vector<typename Suite::Benchmark>& benchmarks = Suite::getBenchmarks();
+  if(names.empty()){
+    selected = benchmarks;
+    return true;
+  }
+  std::set<string> requested;
+  stringstream stream(names);
+  for(string name;std::getline(stream, name, ',');)
+    if(!name.empty())
+      requested.insert(name);
+  for(size_t i=0;i<benchmarks.size();i++)
+    if(requested.erase(benchmarks[i].name))
+      selected.push_back(benchmarks[i]);
+  if(!requested.empty()){
+    cerr << "ERROR: unknown benchmark " << *requested.begin() << ", available are:";
+    for(size_t i=0;i<benchmarks.size();i++)
+      cerr << " " << benchmarks[i].name;
+    cerr << endl;
+    return false;
+  }
+  return true;
+}
+
+template<class LabelImageType>
+bool runBenchmarks(const SyntheticParameters& parameters, const string& names, unsigned repetitions,
+                   const string& workDirectory, unsigned numThreads, bool quiet, Json::Value& results)
+{
+  typedef BenchmarkSuite<LabelImageType> Suite;
+  vector<typename Suite::Benchmark> benchmarks;
+  if(!selectBenchmarks<Suite>(names, benchmarks))
+    return false;
+
+  cout << "Generating " << parameters.slices << " slices of " << parameters.columns << "x" << parameters.rows
+       << " with " << parameters.labels << " labels" << endl;
+  Stopwatch stopwatch;
+  Suite suite(parameters, workDirectory, numThreads, quiet);
+  results["generationSeconds"] = stopwatch.seconds();
+  results["labeledSlices"] = suite.getLabeledSlices();
+  results["labelBits"] = static_cast<unsigned>(8 * sizeof(typename LabelImageType::PixelType));
+
+  bool succeeded = true;
+  Json::Value& benchmarkResults = results["benchmarks"] = Json::Value(Json::arrayValue);
+  cout << std::left << std::setw(16) << "benchmark" << std::right << std::setw(12) << "median s"
+       << std::setw(12) << "min s" << std::setw(10) << "frames" << std::setw(12) << "MB/s" << endl;
+  for(size_t i=0;i<benchmarks.size();i++){
+    const Json::Value result = suite.run(benchmarks[i], repetitions);
+    benchmarkResults.append(result);
+    cout << std::left << std::setw(16) << benchmarks[i].name << std::right;
+    if(result.isMember("error")){
+      succeeded = false;
+      cout << " FAILED: " << result["error"].asString() << endl;
+      continue;
+    }
+    cout << std::fixed << std::setprecision(4) << std::setw(12) << result["median"].asDouble()
+         << std::setw(12) << result["min"].asDouble() << std::setw(10) << result["frames"].asUInt64()
+         << std::setprecision(1) << std::setw(12) << result.get("megabytesPerSecond", 0.0).asDouble() << endl;
+  }
+  return succeeded;
+}
+
+int main(int argc, char* argv[])
+{
+  PARSE_ARGS;
+
+  std::cout << dcmqi_INFO << std::endl;
+
+  if (verbose) {
+    // Display DCMTK debug, warning, and error logs in the console
+    dcmtk::log4cplus::BasicConfigurator::doConfigure();
+  }
+
+  if(rows < 1 || columns < 1 || slices < 1 || rows > 65535 || columns > 65535){
+    cerr << "ERROR: rows and columns must be between 1 and 65535, slices at least 1" << endl;
+    return EXIT_FAILURE;
+  }
+  if(labels < 1 || labels > 65535 || labels > columns){
+    cerr << "ERROR: the number of labels must be between 1 and 65535, and not exceed the number of columns" << endl;
+    return EXIT_FAILURE;
+  }
+  if(overlap < 0 || overlap > 1 || sparsity < 0 || sparsity > 1){
+    cerr << "ERROR: overlap and sparsity must be between 0 and 1" << endl;
+    return EXIT_FAILURE;
+  }
+  if(repetitions < 1){
+    cerr << "ERROR: at least one repetition is needed" << endl;
+    return EXIT_FAILURE;
+  }
+
+  SyntheticParameters parameters;
+  parameters.rows = static_cast<unsigned>(rows);
+  parameters.columns = static_cast<unsigned>(columns);
+  parameters.slices = static_cast<unsigned>(slices);
+  parameters.labels = static_cast<unsigned>(labels);
+  parameters.overlap = overlap;
+  parameters.sparsity = sparsity;
+
+  // files of the structured report benchmarks; a temporary directory is removed afterwards
+  std::error_code error;
+  std::filesystem::path workPath = workDirectory;
+  const bool temporaryWorkDirectory = workDirectory.empty();
+  if(temporaryWorkDirectory)
+    workPath = std::filesystem::temp_directory_path(error) / ("dcmqi_bench-" + std::to_string(
+      std::chrono::steady_clock::now().time_since_epoch().count()));
+  std::filesystem::create_directories(workPath, error);
+  if(!std::filesystem::is_directory(workPath)){
+    cerr << "ERROR: cannot create work directory " << workPath.string() << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned numThreads = static_cast<unsigned>(std::max(0, threads));
+  if(numThreads)
+    itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads(numThreads);
+
+  DcmRLEDecoderRegistration::registerCodecs();
+  DcmRLEEncoderRegistration::registerCodecs();
+
+  Json::Value results;
+  results["dcmqi"] = dcmqi_INFO;
+  Json::Value& resultParameters = results["parameters"];
+  resultParameters["rows"] = rows;
+  resultParameters["columns"] = columns;
+  resultParameters["slices"] = slices;
+  resultParameters["labels"] = labels;
+  resultParameters["overlap"] = overlap;
+  resultParameters["sparsity"] = sparsity;
+  resultParameters["repetitions"] = repetitions;
+  resultParameters["threads"] = itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+
+  bool succeeded = false;
+  try {
+    // labels are stored in 8 bits where possible, as the label images of the command line tools
+    if(labels <= 255)
+      succeeded = runBenchmarks<CharImageType>(parameters, benchmarks, static_cast<unsigned>(repetitions),
+                                               workPath.string(), numThreads, !verbose, results);
+    else
+      succeeded = runBenchmarks<UShortLabelImageType>(parameters, benchmarks, static_cast<unsigned>(repetitions),
+                                                      workPath.string(), numThreads, !verbose, results);
+  } catch(const itk::ExceptionObject& e) {
+    cerr << "ERROR: " << e.GetDescription() << endl;
+  } catch(const std::exception& e) {
+    cerr << "ERROR: " << e.what() << endl;
+  } catch(int) {
+    cerr << "ERROR: generating the synthetic data failed" << endl;
+  }
+
+  DcmRLEDecoderRegistration::cleanup();
+  DcmRLEEncoderRegistration::cleanup();
+  if(temporaryWorkDirectory)
+    std::filesystem::remove_all(workPath, error);
+
+  if(!resultsFileName.empty() && results.isMember("benchmarks")){
+    ofstream stream(resultsFileName.c_str(), ios_base::binary);
+    Json::StreamWriterBuilder writerBuilder;
+    stream << Json::writeString(writerBuilder, results) << endl;
+    if(!stream.good()){
+      cerr << "ERROR: cannot write " << resultsFileName << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,151 @@
+// Slice placement test for dcmqi::ParaMapConverter::paramap2itkimage.
+//
+// The frames of a parametric map are placed onto slices by their Image Position
+// (Patient), at the spacing of those positions. Converts a map as written and
+// then with
+// - a declared Spacing Between Slices and Slice Thickness that differ from the
+//   spacing of the frame positions, which must not change the slices
+// - a frame moved off the regular grid of positions, which places the frames
+//   in the order they are stored
+// Fails unless both result in the same slices as the map as written.
+//
+// Usage: ParaMapSliceSpacingTest <parametric map>
+
+#include "dcmqi/ParaMapConverter.h"
+
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace
+{
+#define REQUIRE(expr)                                                                  \
+  do {                                                                                 \
+    if (!(expr)) {                                                                     \
+      std::cerr << "FAIL: " << #expr << " at " << __FILE__ << ":" << __LINE__ << std::endl; \
+      return false;                                                                    \
+    }                                                                                  \
+  } while (0)
+
+bool convert(DcmFileFormat& fileFormat, FloatImageType::Pointer& image)
+{
+  try
+  {
+    image = dcmqi::ParaMapConverter::paramap2itkimage(fileFormat.getDataset()).first;
+  }
+  catch (...)
+  {
+    return false;
+  }
+  return image.IsNotNull();
+}
+
+bool sameSlices(const FloatImageType::Pointer& image, const FloatImageType::Pointer& reference)
+{
+  REQUIRE(image->GetLargestPossibleRegion().GetSize() == reference->GetLargestPossibleRegion().GetSize());
+  REQUIRE(image->GetOrigin() == reference->GetOrigin());
+  const size_t count = reference->GetLargestPossibleRegion().GetNumberOfPixels();
+  REQUIRE(memcmp(image->GetBufferPointer(), reference->GetBufferPointer(), count * sizeof(FloatPixelType)) == 0);
+  return true;
+}
+
+// Pixel Measures may be shared or per frame
+void setDeclaredSpacing(DcmItem* functionalGroups, const std::string& spacing)
+{
+  DcmItem* pixelMeasures = NULL;
+  if (functionalGroups && functionalGroups->findAndGetSequenceItem(DCM_PixelMeasuresSequence, pixelMeasures, 0).good())
+  {
+    pixelMeasures->putAndInsertString(DCM_SpacingBetweenSlices, spacing.c_str());
+    pixelMeasures->putAndInsertString(DCM_SliceThickness, spacing.c_str());
+  }
+}
+
+bool getPosition(DcmDataset* dataset, unsigned long frame, double position[3])
+{
+  DcmItem* frameGroups = NULL;
+  DcmItem* planePosition = NULL;
+  REQUIRE(dataset->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, frameGroups, frame).good());
+  REQUIRE(frameGroups->findAndGetSequenceItem(DCM_PlanePositionSequence, planePosition, 0).good());
+  for (unsigned long i = 0; i < 3; ++i)
+    REQUIRE(planePosition->findAndGetFloat64(DCM_ImagePositionPatient, position[i], i).good());
+  return true;
+}
+
+bool checkDeclaredSpacing(const std::string& fileName, const FloatImageType::Pointer& reference)
+{
+  DcmFileFormat fileFormat;
+  REQUIRE(fileFormat.loadFile(fileName.c_str()).good());
+  DcmDataset* dataset = fileFormat.getDataset();
+
+  std::ostringstream spacing;
+  spacing << 2.5 * reference->GetSpacing()[2];
+  DcmItem* sharedGroups = NULL;
+  dataset->findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, sharedGroups, 0);
+  setDeclaredSpacing(sharedGroups, spacing.str());
+  DcmItem* frameGroups = NULL;
+  for (unsigned long frame = 0; dataset->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, frameGroups, frame).good(); ++frame)
+    setDeclaredSpacing(frameGroups, spacing.str());
+
+  FloatImageType::Pointer image;
+  REQUIRE(convert(fileFormat, image));
+  REQUIRE(sameSlices(image, reference));
+  std::cout << "declared spacing of " << spacing.str() << " ignored for the placement of the frames" << std::endl;
+  return true;
+}
+
+bool checkIrregularPositions(const std::string& fileName, const FloatImageType::Pointer& reference)
+{
+  DcmFileFormat fileFormat;
+  REQUIRE(fileFormat.loadFile(fileName.c_str()).good());
+  DcmDataset* dataset = fileFormat.getDataset();
+  REQUIRE(reference->GetLargestPossibleRegion().GetSize()[2] >= 3);
+
+  // the second frame is moved to 30% of the way between the first two slices
+  double first[3], second[3];
+  REQUIRE(getPosition(dataset, 0, first));
+  REQUIRE(getPosition(dataset, 1, second));
+  std::ostringstream position;
+  position.precision(17);
+  for (int i = 0; i < 3; ++i)
+    position << (i ? "\\" : "") << first[i] + 0.3 * (second[i] - first[i]);
+  DcmItem* frameGroups = NULL;
+  DcmItem* planePosition = NULL;
+  REQUIRE(dataset->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, frameGroups, 1).good());
+  REQUIRE(frameGroups->findAndGetSequenceItem(DCM_PlanePositionSequence, planePosition, 0).good());
+  REQUIRE(planePosition->putAndInsertString(DCM_ImagePositionPatient, position.str().c_str()).good());
+
+  FloatImageType::Pointer image;
+  REQUIRE(convert(fileFormat, image));
+  REQUIRE(sameSlices(image, reference));
+  std::cout << "frames off the grid of positions placed in the order they are stored" << std::endl;
+  return true;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " <parametric map>" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::string fileName = argv[1];
+
+  DcmFileFormat fileFormat;
+  FloatImageType::Pointer reference;
+  if (fileFormat.loadFile(fileName.c_str()).bad() || !convert(fileFormat, reference))
+  {
+    std::cerr << "FAIL: " << fileName << " could not be converted" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  bool ok = true;
+  ok &= checkDeclaredSpacing(fileName, reference);
+  ok &= checkIrregularPositions(fileName, reference);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -3,28 +3,251 @@
 
 // DCMQI includes
 #undef HAVE_SSTREAM // Avoid redefinition warning
+#include "dcmqi/Instrumentation.h"
 #include "dcmqi/ParaMapConverter.h"
 #include "dcmqi/internal/VersionConfigure.h"
 
+// ITK includes
+#include <itkImageIOFactory.h>
+#include <itkMetaDataObject.h>
+#include <itkVectorImage.h>
+
+// STD includes
+#include <cmath>
+#include <iomanip>
+#include <limits>
+
 
 typedef dcmqi::Helper helper;
 
+template<class ImageType>
+DcmDataset* convertParametricMap(const string& inputFileName, vector<DcmItem*>& dcmDatasets, const string& metadata,
+                                 const bool doDicomValueChecks)
+{
+  typedef itk::ImageFileReader<ImageType> ReaderType;
+  typename ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(inputFileName.c_str());
+  {
+    dcmqi::Profiler::Scope profilerScope("readImages");
+    reader->Update();
+  }
+  typename ImageType::Pointer parametricMapImage = reader->GetOutput();
+
+  return dcmqi::ParaMapConverter::itkimage2paramap(parametricMapImage, dcmDatasets, metadata, doDicomValueChecks);
+}
+
+// Vector images hold one volume per component; the converter extracts the
+// components one at a time instead of copying them into a 4D image
+template<class PixelType>
+DcmDataset* convertVectorParametricMap(const string& inputFileName, vector<DcmItem*>& dcmDatasets, const string& metadata,
+                                       const bool doDicomValueChecks)
+{
+  typedef itk::VectorImage<PixelType, 3> VectorImageType;
+  typedef itk::ImageFileReader<VectorImageType> ReaderType;
+  typename ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(inputFileName.c_str());
+  {
+    dcmqi::Profiler::Scope profilerScope("readImages");
+    reader->Update();
+  }
+  typename VectorImageType::Pointer vectorImage = reader->GetOutput();
+
+  return dcmqi::ParaMapConverter::itkvectorimage2paramap<PixelType>(vectorImage, dcmDatasets, metadata, doDicomValueChecks);
+}
+
+// Slope and intercept the stored values of the input are scaled with (NIfTI
+// scl_slope and scl_inter). The NIfTI reader of ITK applies them and promotes
+// integer maps to float; other readers leave the values as they are stored.
+struct InputScaling {
+  InputScaling() : present(false), slope(1), intercept(0) {}
+  bool present;
+  double slope;
+  double intercept;
+};
+
+bool getMetaDataNumber(const itk::MetaDataDictionary& dictionary, const string& key, double& value)
+{
+  string text;
+  float floatValue = 0;
+  if(itk::ExposeMetaData<double>(dictionary, key, value))
+    return true;
+  if(itk::ExposeMetaData<float>(dictionary, key, floatValue)){
+    value = floatValue;
+    return true;
+  }
+  if(itk::ExposeMetaData<string>(dictionary, key, text) && !text.empty()){
+    value = atof(text.c_str());
+    return true;
+  }
+  return false;
+}
+
+InputScaling getInputScaling(const itk::ImageIOBase::Pointer& imageIO)
+{
+  InputScaling scaling;
+  const itk::MetaDataDictionary& dictionary = imageIO->GetMetaDataDictionary();
+  getMetaDataNumber(dictionary, "scl_slope", scaling.slope);
+  getMetaDataNumber(dictionary, "scl_inter", scaling.intercept);
+  // a slope of 0 means no scaling in NIfTI
+  if(scaling.slope == 0 || !std::isfinite(scaling.slope) || !std::isfinite(scaling.intercept)){
+    scaling.slope = 1;
+    scaling.intercept = 0;
+  }
+  scaling.present = scaling.slope != 1 || scaling.intercept != 0;
+  return scaling;
+}
+
+double getMetadataNumber(const Json::Value& value, double defaultValue)
+{
+  if(value.isNull())
+    return defaultValue;
+  return value.isString() ? atof(value.asCString()) : value.asDouble();
+}
+
+// The stored values are mapped to real world values by the slope and intercept
+// of the metadata, which are applied after those of the input
+string addScalingToMetadata(const string& metadata, const InputScaling& scaling)
+{
+  Json::Value root;
+  istringstream metadataStream(metadata);
+  try {
+    metadataStream >> root;
+  } catch (Json::Exception&) {
+    // reported by the converter, which parses the metadata again
+    return metadata;
+  }
+  const double slope = getMetadataNumber(root["RealWorldValueSlope"], 1);
+  const double intercept = getMetadataNumber(root["RealWorldValueIntercept"], 0);
+  ostringstream slopeStream, interceptStream;
+  slopeStream << setprecision(numeric_limits<double>::max_digits10) << slope * scaling.slope;
+  interceptStream << setprecision(numeric_limits<double>::max_digits10) << slope * scaling.intercept + intercept;
+  root["RealWorldValueSlope"] = slopeStream.str();
+  root["RealWorldValueIntercept"] = interceptStream.str();
+  return Json::writeString(Json::StreamWriterBuilder(), root);
+}
+
+// Range of the values before the reader scaled them, false if they were not integers
+bool getStoredRange(const double* values, const size_t count, const InputScaling& scaling,
+                    double& minimum, double& maximum)
+{
+  minimum = numeric_limits<double>::max();
+  maximum = numeric_limits<double>::lowest();
+  for(size_t i=0;i<count;i++){
+    const double stored = (values[i] - scaling.intercept) / scaling.slope;
+    const double rounded = std::round(stored);
+    if(!(std::fabs(stored - rounded) <= 1e-3))
+      return false;
+    minimum = std::min(minimum, rounded);
+    maximum = std::max(maximum, rounded);
+  }
+  return true;
+}
+
+// Image of the stored integers of a map the reader scaled
+template<class StoredImageType, class ScaledImageType>
+typename StoredImageType::Pointer unscaleImage(const ScaledImageType* image, const InputScaling& scaling)
+{
+  typedef typename StoredImageType::PixelType StoredType;
+  typename StoredImageType::Pointer stored = StoredImageType::New();
+  stored->CopyInformation(image);
+  stored->SetRegions(image->GetLargestPossibleRegion());
+  stored->Allocate();
+  const double* values = image->GetBufferPointer();
+  StoredType* storedValues = stored->GetBufferPointer();
+  const size_t count = image->GetPixelContainer()->Size();
+  for(size_t i=0;i<count;i++)
+    storedValues[i] = static_cast<StoredType>(std::lround((values[i] - scaling.intercept) / scaling.slope));
+  return stored;
+}
+
+// Integer maps the reader scaled are stored as the integers of the file, with
+// the scaling in the Real World Value Mapping. integerValues is false if the
+// values of the file were not 16 bit integers; nothing is converted then.
+template<unsigned Dimension>
+DcmDataset* convertScaledParametricMap(const string& inputFileName, vector<DcmItem*>& dcmDatasets, const string& metadata,
+                                       const bool doDicomValueChecks, const InputScaling& scaling, bool& integerValues)
+{
+  typedef itk::Image<double, Dimension> ScaledImageType;
+  typename itk::ImageFileReader<ScaledImageType>::Pointer reader = itk::ImageFileReader<ScaledImageType>::New();
+  reader->SetFileName(inputFileName.c_str());
+  {
+    dcmqi::Profiler::Scope profilerScope("readImages");
+    reader->Update();
+  }
+  typename ScaledImageType::Pointer image = reader->GetOutput();
+
+  double minimum = 0, maximum = 0;
+  integerValues = getStoredRange(image->GetBufferPointer(), image->GetPixelContainer()->Size(), scaling, minimum, maximum);
+  if(integerValues && minimum >= numeric_limits<Sint16>::min() && maximum <= numeric_limits<Sint16>::max()){
+    std::cout << "Storing integer frames (signed 16 bit) with slope " << scaling.slope
+              << " and intercept " << scaling.intercept << std::endl;
+    return dcmqi::ParaMapConverter::itkimage2paramap(unscaleImage<itk::Image<Sint16, Dimension> >(image.GetPointer(), scaling),
+                                                     dcmDatasets, addScalingToMetadata(metadata, scaling), doDicomValueChecks);
+  }
+  if(integerValues && minimum >= 0 && maximum <= numeric_limits<Uint16>::max()){
+    std::cout << "Storing integer frames (unsigned 16 bit) with slope " << scaling.slope
+              << " and intercept " << scaling.intercept << std::endl;
+    return dcmqi::ParaMapConverter::itkimage2paramap(unscaleImage<itk::Image<Uint16, Dimension> >(image.GetPointer(), scaling),
+                                                     dcmDatasets, addScalingToMetadata(metadata, scaling), doDicomValueChecks);
+  }
+  integerValues = false;
+  return NULL;
+}
+
+// 3D images become a single volume map, 4D and vector images a multi-volume map
+template<class PixelType>
+DcmDataset* convertParametricMapOfPixelType(const itk::ImageIOBase::Pointer& imageIO, const string& inputFileName,
+                                            vector<DcmItem*>& dcmDatasets, const string& metadata,
+                                            const bool doDicomValueChecks)
+{
+  if(imageIO->GetNumberOfComponents() > 1){
+    // the metadata describes a single quantity, which the components of colors,
+    // tensors or complex values are not
+    const itk::IOPixelEnum pixelType = imageIO->GetPixelType();
+    if(pixelType != itk::IOPixelEnum::VECTOR && pixelType != itk::IOPixelEnum::VARIABLELENGTHVECTOR
+       && pixelType != itk::IOPixelEnum::ARRAY && pixelType != itk::IOPixelEnum::FIXEDARRAY){
+      cerr << "ERROR: the components of " << itk::ImageIOBase::GetPixelTypeAsString(pixelType)
+           << " pixels are different quantities, but a parametric map holds a single one."
+           << " Convert every component into a map of its own." << endl;
+      return NULL;
+    }
+    std::cout << "Storing " << imageIO->GetNumberOfComponents() << " volumes (one per component)" << std::endl;
+    return convertVectorParametricMap<PixelType>(inputFileName, dcmDatasets, metadata, doDicomValueChecks);
+  }
+  if(imageIO->GetNumberOfDimensions() == 4){
+    std::cout << "Storing " << imageIO->GetDimensions(3) << " volumes" << std::endl;
+    return convertParametricMap<itk::Image<PixelType, 4> >(inputFileName, dcmDatasets, metadata, doDicomValueChecks);
+  }
+  return convertParametricMap<itk::Image<PixelType, 3> >(inputFileName, dcmDatasets, metadata, doDicomValueChecks);
+}
+
 int main(int argc, char *argv[])
 {
   std::cout << dcmqi_INFO << std::endl;
 
   PARSE_ARGS;
 
+  dcmqi::Profiler::Session profilerSession(profileFileName);
+
+  if (verbose)
+    dcmqi::Verbosity::setLevel(dcmqi::Verbosity::Detail);
+
   if(helper::isUndefinedOrPathDoesNotExist(inputFileName, "Input image file")
      || helper::isUndefinedOrPathDoesNotExist(metaDataFileName, "Input metadata file")
      || helper::isUndefined(outputParaMapFileName, "Output DICOM file")) {
     return EXIT_FAILURE;
   }
 
-  FloatReaderType::Pointer reader = FloatReaderType::New();
-  reader->SetFileName(inputFileName.c_str());
-  reader->Update();
-  FloatImageType::Pointer parametricMapImage = reader->GetOutput();
+  // keep the pixel type of the input: 8 and 16 bit integer maps are stored as integer
+  // frames, double maps as Double Float Pixel Data, everything else as float
+  itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO(inputFileName.c_str(), itk::IOFileModeEnum::ReadMode);
+  if(imageIO.IsNull()){
+    cerr << "ERROR: cannot read " << inputFileName << endl;
+    return EXIT_FAILURE;
+  }
+  imageIO->SetFileName(inputFileName);
+  imageIO->ReadImageInformation();
+  const itk::IOComponentEnum componentType = imageIO->GetComponentType();
 
   if(dicomDirectory.size()){
     if (!helper::pathExists(dicomDirectory))
@@ -45,12 +268,47 @@ int main(int argc, char *argv[])
                         (std::istreambuf_iterator<char>()));
 
   try {
-    DcmDataset* result = dcmqi::ParaMapConverter::itkimage2paramap(parametricMapImage, dcmDatasets, metadata, !noDicomValueChecks);
+    DcmDataset* result = NULL;
+    const InputScaling scaling = getInputScaling(imageIO);
+    bool converted = false;
+    if(scaling.present && string(imageIO->GetNameOfClass()) == "NiftiImageIO" && imageIO->GetNumberOfComponents() == 1
+       && (componentType == itk::IOComponentEnum::FLOAT || componentType == itk::IOComponentEnum::DOUBLE)){
+      // scaled by the reader, the integers of the file are recovered
+      if(imageIO->GetNumberOfDimensions() == 4)
+        result = convertScaledParametricMap<4>(inputFileName, dcmDatasets, metadata, !noDicomValueChecks, scaling, converted);
+      else
+        result = convertScaledParametricMap<3>(inputFileName, dcmDatasets, metadata, !noDicomValueChecks, scaling, converted);
+    } else if(scaling.present){
+      // stored values as read, mapped to real world values by the scaling of the file
+      metadata = addScalingToMetadata(metadata, scaling);
+    }
+    if(!converted){
+      switch(componentType){
+        case itk::IOComponentEnum::CHAR:
+        case itk::IOComponentEnum::SHORT:
+          std::cout << "Storing integer frames (signed 16 bit)" << std::endl;
+          result = convertParametricMapOfPixelType<Sint16>(imageIO, inputFileName, dcmDatasets, metadata, !noDicomValueChecks);
+          break;
+        case itk::IOComponentEnum::UCHAR:
+        case itk::IOComponentEnum::USHORT:
+          std::cout << "Storing integer frames (unsigned 16 bit)" << std::endl;
+          result = convertParametricMapOfPixelType<Uint16>(imageIO, inputFileName, dcmDatasets, metadata, !noDicomValueChecks);
+          break;
+        case itk::IOComponentEnum::DOUBLE:
+          std::cout << "Storing double precision floating point frames" << std::endl;
+          result = convertParametricMapOfPixelType<DoublePixelType>(imageIO, inputFileName, dcmDatasets, metadata, !noDicomValueChecks);
+          break;
+        default:
+          result = convertParametricMapOfPixelType<FloatPixelType>(imageIO, inputFileName, dcmDatasets, metadata, !noDicomValueChecks);
+          break;
+      }
+    }
 
     if (result == NULL) {
       std::cerr << "ERROR: Conversion failed." << std::endl;
       return EXIT_FAILURE;
     } else {
+      dcmqi::Profiler::Scope profilerScope("saveFile");
       DcmFileFormat segdocFF(result);
       CHECK_COND(segdocFF.saveFile(outputParaMapFileName.c_str(), EXS_LittleEndianExplicit));
 
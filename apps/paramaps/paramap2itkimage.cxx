@@ -3,12 +3,25 @@
 
 // DCMQI includes
 #undef HAVE_SSTREAM // Avoid redefinition warning
+#include "dcmqi/Compression.h"
+#include "dcmqi/Instrumentation.h"
 #include "dcmqi/ParaMapConverter.h"
 #include "dcmqi/internal/VersionConfigure.h"
 
 
 typedef dcmqi::Helper helper;
 
+template<class ImageType>
+void writeImage(const typename ImageType::Pointer& image, const string& fileName)
+{
+  typedef itk::ImageFileWriter<ImageType> WriterType;
+  typename WriterType::Pointer writer = WriterType::New();
+  writer->SetFileName(fileName.c_str());
+  writer->SetInput(image);
+  writer->SetUseCompression(1);
+  dcmqi::Profiler::Scope profilerScope("writeImage");
+  writer->Update();
+}
 
 int main(int argc, char *argv[])
 {
@@ -16,29 +29,36 @@ int main(int argc, char *argv[])
 
   PARSE_ARGS;
 
+  dcmqi::Profiler::Session profilerSession(profileFileName);
+
   if(helper::isUndefinedOrPathDoesNotExist(inputFileName, "Input DICOM file")
      || helper::isUndefinedOrPathDoesNotExist(outputDirName, "Output directory"))
     return EXIT_FAILURE;
 
   DcmFileFormat sliceFF;
   std::cout << "Opening input file " << inputFileName.c_str() << std::endl;
-  CHECK_COND(sliceFF.loadFile(inputFileName.c_str()));
+  {
+    dcmqi::Profiler::Scope profilerScope("loadFile");
+    CHECK_COND(dcmqi::Compression::loadFile(sliceFF, inputFileName));
+  }
   DcmDataset* dataset = sliceFF.getDataset();
 
   try {
-    pair <FloatImageType::Pointer, string> result =  dcmqi::ParaMapConverter::paramap2itkimage(dataset);
+    pair <Float4DImageType::Pointer, string> result =  dcmqi::ParaMapConverter::paramap2itkimage4D(dataset);
 
     string fileExtension = helper::getFileExtensionFromType(outputType);
 
-    typedef itk::ImageFileWriter<FloatImageType> WriterType;
     string outputPrefix = prefix.empty() ? "" : prefix + "-";
-    WriterType::Pointer writer = WriterType::New();
     stringstream imageFileNameSStream;
     imageFileNameSStream << outputDirName << "/" << outputPrefix << "pmap" << fileExtension;
-    writer->SetFileName(imageFileNameSStream.str().c_str());
-    writer->SetInput(result.first);
-    writer->SetUseCompression(1);
-    writer->Update();
+    const unsigned numberOfVolumes = result.first->GetLargestPossibleRegion().GetSize()[3];
+    if(numberOfVolumes > 1){
+      // multi-volume maps are written as 4D image
+      std::cout << "Writing " << numberOfVolumes << " volumes" << std::endl;
+      writeImage<Float4DImageType>(result.first, imageFileNameSStream.str());
+    } else {
+      writeImage<FloatImageType>(dcmqi::ParaMapConverter::getFirstVolume(result.first), imageFileNameSStream.str());
+    }
 
     stringstream jsonOutput;
     jsonOutput << outputDirName << "/" << outputPrefix << "meta.json";
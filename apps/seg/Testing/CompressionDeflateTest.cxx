@@ -0,0 +1,155 @@
+// Inflate test for dcmqi::Compression on deflated data written by other tools.
+//
+// dcmqi writes deflated datasets in independent blocks and inflates them in
+// parallel. Deflated data written by other tools is a single stream, which
+// inflateParallel must still inflate as a whole, also when the stream happens
+// to contain the byte pattern of a block boundary. The data is several MB so
+// that it spans several of dcmqi's blocks. Checked are
+// - a raw deflate stream written by zlib in one piece
+// - the round trip through deflateParallel and inflateParallel
+// - a deflated file written by DCMTK, read with Compression::loadFile
+//
+// Usage: CompressionDeflateTest <temporary directory>
+
+#include "dcmqi/Compression.h"
+
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcuid.h>
+
+#include <zlib.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+const Uint16 Rows = 512;
+const Uint16 Columns = 512;
+const Sint32 NumberOfFrames = 12;
+
+#define REQUIRE(expr)                                                                  \
+  do {                                                                                 \
+    if (!(expr)) {                                                                     \
+      std::cerr << "FAIL: " << #expr << " at " << __FILE__ << ":" << __LINE__ << std::endl; \
+      return false;                                                                    \
+    }                                                                                  \
+  } while (0)
+
+// Runs of labels mixed with noise, so that the deflated stream is neither tiny
+// nor incompressible
+std::vector<Uint8> createData(size_t length)
+{
+  std::vector<Uint8> data(length);
+  Uint32 noise = 12345;
+  for (size_t i = 0; i < length; ++i)
+  {
+    noise = noise * 1103515245 + 12345;
+    data[i] = (i % 1000 < 600) ? static_cast<Uint8>((i / 4096) & 0x07) : static_cast<Uint8>(noise >> 16);
+  }
+  return data;
+}
+
+bool checkSingleStream()
+{
+  const std::vector<Uint8> data = createData(5 * dcmqi::Compression::DeflateBlockSize + 123);
+
+  // raw deflate (no zlib header), written in one piece like DCMTK and other tools do
+  std::vector<Uint8> deflated(compressBound(static_cast<uLong>(data.size())) + 16);
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  REQUIRE(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+  zs.next_in = const_cast<Bytef*>(data.data());
+  zs.avail_in = static_cast<uInt>(data.size());
+  zs.next_out = deflated.data();
+  zs.avail_out = static_cast<uInt>(deflated.size());
+  const int status = deflate(&zs, Z_FINISH);
+  deflated.resize(deflated.size() - zs.avail_out);
+  deflateEnd(&zs);
+  REQUIRE(status == Z_STREAM_END);
+
+  std::vector<Uint8> inflated;
+  REQUIRE(dcmqi::Compression::inflateParallel(deflated.data(), deflated.size(), inflated).good());
+  REQUIRE(inflated == data);
+
+  // a sync flush in the middle of the stream produces a block boundary marker
+  // after which the rest cannot be inflated on its own
+  std::vector<Uint8> flushed(deflated.size() + 1024);
+  memset(&zs, 0, sizeof(zs));
+  REQUIRE(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+  zs.next_in = const_cast<Bytef*>(data.data());
+  zs.avail_in = static_cast<uInt>(data.size() / 3);
+  zs.next_out = flushed.data();
+  zs.avail_out = static_cast<uInt>(flushed.size());
+  REQUIRE(deflate(&zs, Z_SYNC_FLUSH) == Z_OK);
+  zs.avail_in = static_cast<uInt>(data.size() - data.size() / 3);
+  REQUIRE(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+  flushed.resize(flushed.size() - zs.avail_out);
+  deflateEnd(&zs);
+
+  REQUIRE(dcmqi::Compression::inflateParallel(flushed.data(), flushed.size(), inflated).good());
+  REQUIRE(inflated == data);
+
+  // dcmqi's own blocks
+  std::vector<Uint8> blocks;
+  REQUIRE(dcmqi::Compression::deflateParallel(data.data(), data.size(), blocks).good());
+  REQUIRE(dcmqi::Compression::inflateParallel(blocks.data(), blocks.size(), inflated).good());
+  REQUIRE(inflated == data);
+
+  std::cout << data.size() << " bytes inflated from a single stream, a flushed stream and "
+            << (data.size() + dcmqi::Compression::DeflateBlockSize - 1) / dcmqi::Compression::DeflateBlockSize
+            << " blocks" << std::endl;
+  return true;
+}
+
+bool checkDCMTKFile(const std::string& fileName)
+{
+  const std::vector<Uint8> pixels = createData(static_cast<size_t>(Rows) * Columns * NumberOfFrames);
+  {
+    DcmFileFormat fileFormat;
+    DcmDataset* dataset = fileFormat.getDataset();
+    REQUIRE(dataset->putAndInsertString(DCM_SOPClassUID, UID_SegmentationStorage).good());
+    REQUIRE(dataset->putAndInsertString(DCM_SOPInstanceUID, "1.2.3.4").good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_SamplesPerPixel, 1).good());
+    REQUIRE(dataset->putAndInsertString(DCM_PhotometricInterpretation, "MONOCHROME2").good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_Rows, Rows).good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_Columns, Columns).good());
+    REQUIRE(dataset->putAndInsertString(DCM_NumberOfFrames, std::to_string(NumberOfFrames).c_str()).good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_BitsAllocated, 8).good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_BitsStored, 8).good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_HighBit, 7).good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_PixelRepresentation, 0).good());
+    REQUIRE(dataset->putAndInsertUint8Array(DCM_PixelData, pixels.data(), static_cast<unsigned long>(pixels.size())).good());
+    // deflated by DCMTK as one stream while the file is written
+    REQUIRE(fileFormat.saveFile(fileName.c_str(), EXS_DeflatedLittleEndianExplicit).good());
+  }
+
+  DcmFileFormat fileFormat;
+  REQUIRE(dcmqi::Compression::loadFile(fileFormat, fileName).good());
+  const Uint8* loaded = NULL;
+  unsigned long count = 0;
+  REQUIRE(fileFormat.getDataset()->findAndGetUint8Array(DCM_PixelData, loaded, &count).good() && loaded != NULL);
+  REQUIRE(count == pixels.size());
+  REQUIRE(memcmp(loaded, pixels.data(), pixels.size()) == 0);
+  std::cout << "deflated file written by DCMTK loaded" << std::endl;
+  return true;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " <temporary directory>" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::string directory = argv[1];
+
+  bool ok = true;
+  ok &= checkSingleStream();
+  ok &= checkDCMTKFile(directory + "/deflate_dcmtk.dcm");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
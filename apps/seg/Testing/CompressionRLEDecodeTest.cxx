@@ -0,0 +1,147 @@
+// Decoder test for dcmqi::Compression::decodeRLE.
+//
+// The round trip tests only decode what dcmqi::Compression::encodeRLE wrote,
+// i.e. exactly one fragment per frame. Here multi-frame 8 and 16 bit datasets
+// are RLE encoded by DCMTK, once with one fragment per frame and once with
+// frames split into 1 KB fragments and a Basic Offset Table, saved and loaded
+// again. decodeRLE must decode all of them itself (the transfer syntax of the
+// dataset is no longer RLE afterwards) and reproduce the original pixels.
+//
+// Usage: CompressionRLEDecodeTest <temporary directory>
+
+#include "dcmqi/Compression.h"
+
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcpixel.h>
+#include <dcmtk/dcmdata/dcpixseq.h>
+#include <dcmtk/dcmdata/dcrleerg.h>
+#include <dcmtk/dcmdata/dcuid.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+const Uint16 Rows = 64;
+const Uint16 Columns = 61;
+const Sint32 NumberOfFrames = 5;
+
+#define REQUIRE(expr)                                                                  \
+  do {                                                                                 \
+    if (!(expr)) {                                                                     \
+      std::cerr << "FAIL: " << #expr << " at " << __FILE__ << ":" << __LINE__ << std::endl; \
+      return false;                                                                    \
+    }                                                                                  \
+  } while (0)
+
+// Runs of background and labels, mixed with literal stretches so that a
+// compressed frame is several KB and is split into several 1 KB fragments
+std::vector<Uint16> createPixels(unsigned bitsAllocated)
+{
+  const size_t count = static_cast<size_t>(Rows) * Columns * NumberOfFrames;
+  std::vector<Uint16> pixels(count);
+  Uint32 noise = 12345;
+  for (size_t i = 0; i < count; ++i)
+  {
+    noise = noise * 1103515245 + 12345;
+    const size_t column = i % Columns;
+    Uint16 value = 0;
+    if (column < 20)
+      value = static_cast<Uint16>(1 + (i / (static_cast<size_t>(Rows) * Columns)));
+    else if (column > 30)
+      value = static_cast<Uint16>(noise >> 16);
+    pixels[i] = bitsAllocated == 8 ? static_cast<Uint16>(value & 0xFF) : value;
+  }
+  return pixels;
+}
+
+bool checkDecoding(const std::string& fileName, unsigned bitsAllocated, Uint32 fragmentSizeKB)
+{
+  const std::vector<Uint16> pixels = createPixels(bitsAllocated);
+  {
+    DcmFileFormat fileFormat;
+    DcmDataset* dataset = fileFormat.getDataset();
+    REQUIRE(dataset->putAndInsertString(DCM_SOPClassUID, UID_SegmentationStorage).good());
+    REQUIRE(dataset->putAndInsertString(DCM_SOPInstanceUID, "1.2.3.4").good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_SamplesPerPixel, 1).good());
+    REQUIRE(dataset->putAndInsertString(DCM_PhotometricInterpretation, "MONOCHROME2").good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_Rows, Rows).good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_Columns, Columns).good());
+    REQUIRE(dataset->putAndInsertString(DCM_NumberOfFrames, std::to_string(NumberOfFrames).c_str()).good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_BitsAllocated, static_cast<Uint16>(bitsAllocated)).good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_BitsStored, static_cast<Uint16>(bitsAllocated)).good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_HighBit, static_cast<Uint16>(bitsAllocated - 1)).good());
+    REQUIRE(dataset->putAndInsertUint16(DCM_PixelRepresentation, 0).good());
+    if (bitsAllocated == 8)
+    {
+      std::vector<Uint8> pixels8(pixels.begin(), pixels.end());
+      REQUIRE(dataset->putAndInsertUint8Array(DCM_PixelData, pixels8.data(), static_cast<unsigned long>(pixels8.size())).good());
+    }
+    else
+      REQUIRE(dataset->putAndInsertUint16Array(DCM_PixelData, pixels.data(), static_cast<unsigned long>(pixels.size())).good());
+
+    DcmRLEEncoderRegistration::registerCodecs(OFFalse, fragmentSizeKB, OFTrue);
+    const OFCondition encoded = dataset->chooseRepresentation(EXS_RLELossless, NULL);
+    DcmRLEEncoderRegistration::cleanup();
+    REQUIRE(encoded.good());
+    REQUIRE(fileFormat.saveFile(fileName.c_str(), EXS_RLELossless).good());
+  }
+
+  DcmFileFormat fileFormat;
+  REQUIRE(fileFormat.loadFile(fileName.c_str()).good());
+  DcmDataset* dataset = fileFormat.getDataset();
+  REQUIRE(dataset->getOriginalXfer() == EXS_RLELossless);
+
+  DcmElement* element = NULL;
+  DcmPixelSequence* pixelSequence = NULL;
+  REQUIRE(dataset->findAndGetElement(DCM_PixelData, element).good());
+  REQUIRE(OFstatic_cast(DcmPixelData*, element)->getEncapsulatedRepresentation(EXS_RLELossless, NULL, pixelSequence).good());
+  const unsigned long numberOfFragments = pixelSequence->card() - 1;
+  if (fragmentSizeKB == 0)
+    REQUIRE(numberOfFragments == static_cast<unsigned long>(NumberOfFrames));
+  else
+    REQUIRE(numberOfFragments > static_cast<unsigned long>(NumberOfFrames));
+
+  REQUIRE(dcmqi::Compression::decodeRLE(dataset).good());
+  // decoded by dcmqi, not left for DCMTK
+  REQUIRE(dataset->getOriginalXfer() != EXS_RLELossless);
+
+  if (bitsAllocated == 8)
+  {
+    const Uint8* decoded = NULL;
+    REQUIRE(dataset->findAndGetUint8Array(DCM_PixelData, decoded).good() && decoded != NULL);
+    for (size_t i = 0; i < pixels.size(); ++i)
+      REQUIRE(decoded[i] == pixels[i]);
+  }
+  else
+  {
+    const Uint16* decoded = NULL;
+    REQUIRE(dataset->findAndGetUint16Array(DCM_PixelData, decoded).good() && decoded != NULL);
+    for (size_t i = 0; i < pixels.size(); ++i)
+      REQUIRE(decoded[i] == pixels[i]);
+  }
+  std::cout << bitsAllocated << " bit, " << NumberOfFrames << " frames in " << numberOfFragments
+            << " fragments decoded" << std::endl;
+  return true;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " <temporary directory>" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const std::string directory = argv[1];
+
+  bool ok = true;
+  ok &= checkDecoding(directory + "/rle_8bit_one_fragment.dcm", 8, 0);
+  ok &= checkDecoding(directory + "/rle_16bit_one_fragment.dcm", 16, 0);
+  ok &= checkDecoding(directory + "/rle_8bit_fragments.dcm", 8, 1);
+  ok &= checkDecoding(directory + "/rle_16bit_fragments.dcm", 16, 1);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
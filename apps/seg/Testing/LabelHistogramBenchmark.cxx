@@ -0,0 +1,139 @@
+// Benchmark and consistency check for dcmqi::LabelHistogram.
+//
+// itkimage2dcmSegmentation used to enumerate the labels of every input with
+// itk::LabelImageToLabelMapFilter (plus itk::LabelStatisticsImageFilter for the
+// slice range of each label). This program builds a synthetic parcellation with
+// many labels, runs both approaches, reports run time and memory use of each,
+// and fails if they disagree on the label set or the slice ranges.
+//
+// Usage: LabelHistogramBenchmark [numberOfLabels [columns rows slices]]
+// Defaults to 1000 labels in a 256x256x64 volume.
+
+#include "dcmqi/LabelHistogram.h"
+
+#include <itkImage.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkLabelImageToLabelMapFilter.h>
+#include <itkLabelStatisticsImageFilter.h>
+#include <itkMemoryProbe.h>
+#include <itkTimeProbe.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+namespace
+{
+using ImageType = itk::Image<short, 3U>;
+
+// Blocks of 8x8x4 voxels, labels assigned in a repeating pattern so that every
+// label occurs in several disjoint places (like the left/right structures of an
+// atlas) and all labels are spread over a range of slices.
+ImageType::Pointer createParcellation(unsigned numberOfLabels, const ImageType::SizeType& size)
+{
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(ImageType::RegionType(size));
+  image->Allocate();
+
+  const unsigned blocksPerRow = (size[0] + 7) / 8;
+  const unsigned blocksPerSlice = blocksPerRow * ((size[1] + 7) / 8);
+  itk::ImageRegionIteratorWithIndex<ImageType> it(image, image->GetLargestPossibleRegion());
+  for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+  {
+    const ImageType::IndexType idx = it.GetIndex();
+    const unsigned block = idx[0] / 8 + (idx[1] / 8) * blocksPerRow + (idx[2] / 4) * blocksPerSlice;
+    // keep a background border around every block
+    const bool border = (idx[0] % 8 == 0) || (idx[1] % 8 == 0);
+    it.Set(border ? 0 : static_cast<short>(1 + block % numberOfLabels));
+  }
+  return image;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  unsigned numberOfLabels = 1000;
+  ImageType::SizeType size = {{256, 256, 64}};
+  if (argc > 1)
+    numberOfLabels = static_cast<unsigned>(atoi(argv[1]));
+  if (argc > 4)
+  {
+    size[0] = atoi(argv[2]);
+    size[1] = atoi(argv[3]);
+    size[2] = atoi(argv[4]);
+  }
+  if (numberOfLabels < 1 || numberOfLabels > 32767)
+  {
+    std::cerr << "ERROR: number of labels must be between 1 and 32767" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  ImageType::Pointer image = createParcellation(numberOfLabels, size);
+  std::cout << "Synthetic parcellation: " << size << ", " << numberOfLabels << " labels" << std::endl;
+
+  // Label map filter + label statistics, as used before
+  std::map<short, dcmqi::LabelHistogram::SliceRange> labelMapRanges;
+  itk::TimeProbe labelMapTime;
+  itk::MemoryProbe labelMapMemory;
+  {
+    labelMapMemory.Start();
+    labelMapTime.Start();
+    using LabelMapFilterType = itk::LabelImageToLabelMapFilter<ImageType>;
+    LabelMapFilterType::Pointer l2lm = LabelMapFilterType::New();
+    l2lm->SetInput(image);
+    // by default the background is the smallest short, which would report label 0
+    l2lm->SetBackgroundValue(0);
+    l2lm->Update();
+    using LabelStatisticsType = itk::LabelStatisticsImageFilter<ImageType, ImageType>;
+    LabelStatisticsType::Pointer labelStats = LabelStatisticsType::New();
+    labelStats->SetInput(image);
+    labelStats->SetLabelInput(image);
+    labelStats->Update();
+    for (unsigned n = 0; n < l2lm->GetOutput()->GetNumberOfLabelObjects(); n++)
+    {
+      const short label = l2lm->GetOutput()->GetNthLabelObject(n)->GetLabel();
+      const LabelStatisticsType::BoundingBoxType bbox = labelStats->GetBoundingBox(label);
+      dcmqi::LabelHistogram::SliceRange range = { static_cast<unsigned>(bbox[4]), static_cast<unsigned>(bbox[5]) };
+      labelMapRanges[label] = range;
+    }
+    labelMapTime.Stop();
+    labelMapMemory.Stop();
+  }
+
+  // LabelHistogram
+  std::map<short, dcmqi::LabelHistogram::SliceRange> histogramRanges;
+  itk::TimeProbe histogramTime;
+  itk::MemoryProbe histogramMemory;
+  {
+    histogramMemory.Start();
+    histogramTime.Start();
+    histogramRanges = dcmqi::LabelHistogram::compute(image.GetPointer());
+    // the background 0 of the label map filter is not compared
+    histogramRanges.erase(0);
+    histogramTime.Stop();
+    histogramMemory.Stop();
+  }
+
+  std::cout << "LabelImageToLabelMapFilter + LabelStatisticsImageFilter: " << labelMapTime.GetTotal() << " s, "
+            << labelMapMemory.GetTotal() << " " << labelMapMemory.GetUnit() << std::endl;
+  std::cout << "LabelHistogram:                                          " << histogramTime.GetTotal() << " s, "
+            << histogramMemory.GetTotal() << " " << histogramMemory.GetUnit() << std::endl;
+
+  if (labelMapRanges.size() != histogramRanges.size())
+  {
+    std::cerr << "ERROR: label count differs: " << labelMapRanges.size() << " vs. " << histogramRanges.size() << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (std::map<short, dcmqi::LabelHistogram::SliceRange>::const_iterator it = labelMapRanges.begin();
+       it != labelMapRanges.end(); ++it)
+  {
+    std::map<short, dcmqi::LabelHistogram::SliceRange>::const_iterator found = histogramRanges.find(it->first);
+    if (found == histogramRanges.end() || found->second.first != it->second.first || found->second.last != it->second.last)
+    {
+      std::cerr << "ERROR: slice range of label " << it->first << " differs" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::cout << "Label sets and slice ranges agree (" << histogramRanges.size() << " labels)" << std::endl;
+  return EXIT_SUCCESS;
+}
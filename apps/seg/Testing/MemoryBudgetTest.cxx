@@ -0,0 +1,96 @@
+// Checks the memory estimate of dcmqi::MemoryBudget and the strategy it
+// selects for a budget, on the geometry of a 512x512x200 CT with 10 segments.
+//
+// Usage: MemoryBudgetTest
+
+#include "dcmqi/MemoryBudget.h"
+
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+bool check(bool condition, const char* message)
+{
+  if (!condition)
+    std::cerr << "FAILED: " << message << std::endl;
+  return condition;
+}
+
+dcmqi::MemoryBudget::SegmentationInput createInput(DcmSegTypes::E_SegmentationType segmentationType, const char* compress)
+{
+  dcmqi::MemoryBudget::SegmentationInput input;
+  input.segmentationType = segmentationType;
+  input.rows = 512;
+  input.columns = 512;
+  input.slices = 200;
+  input.volumes = 1;
+  input.bytesPerVoxel = 2;
+  input.segments = 10;
+  input.compress = compress;
+  input.inputsReleasedBeforeSave = true;
+  return input;
+}
+} // namespace
+
+int main(int, char*[])
+{
+  const size_t framePixels = 512 * 512;
+  const size_t fgBytes = dcmqi::MemoryBudget::PerFrameOverhead;
+  bool ok = true;
+
+  // binary: one bit per pixel, one frame per segment and slice
+  {
+    const dcmqi::MemoryBudget::SegmentationInput input = createInput(DcmSegTypes::ST_BINARY, "none");
+    const dcmqi::MemoryBudget::Estimate estimate = dcmqi::MemoryBudget::estimateSegmentation(input);
+    ok &= check(estimate.inputImages == 200 * framePixels * 2, "binary input images");
+    ok &= check(estimate.dataset == 10 * 200 * framePixels / 8 + 10 * 200 * fgBytes, "binary dataset");
+    ok &= check(estimate.frames == estimate.dataset, "binary frames");
+    ok &= check(estimate.saveBuffers == 0, "binary save buffers");
+    ok &= check(estimate.peak == estimate.inputImages + estimate.frames + estimate.dataset, "binary peak");
+  }
+
+  // labelmap: one frame per slice, 16 bit pixels
+  {
+    dcmqi::MemoryBudget::SegmentationInput input = createInput(DcmSegTypes::ST_LABELMAP, "rle");
+    input.labelmap16Bit = true;
+    const dcmqi::MemoryBudget::Estimate estimate = dcmqi::MemoryBudget::estimateSegmentation(input);
+    ok &= check(estimate.dataset == 200 * framePixels * 2 + 200 * fgBytes, "labelmap dataset");
+    ok &= check(estimate.saveBuffers == 200 * framePixels * 2, "labelmap RLE save buffers");
+  }
+
+  // deflate: parallel if it fits, streamed if only that fits, none if neither does
+  {
+    dcmqi::MemoryBudget::SegmentationInput input = createInput(DcmSegTypes::ST_FRACTIONAL, "deflate");
+    // make the save dominate the peak
+    input.volumes = 0;
+    const dcmqi::MemoryBudget::Estimate parallel = dcmqi::MemoryBudget::estimateSegmentation(input, false);
+    const dcmqi::MemoryBudget::Estimate streamed = dcmqi::MemoryBudget::estimateSegmentation(input, true);
+    ok &= check(parallel.saveBuffers == 2 * parallel.dataset, "parallel deflate save buffers");
+    ok &= check(streamed.peak < parallel.peak, "streamed deflate needs less memory");
+
+    dcmqi::MemoryBudget::Estimate selected;
+    ok &= check(dcmqi::MemoryBudget::selectSegmentationStrategy(input, 0, selected) && !selected.streamingWrite,
+                "no limit selects parallel deflate");
+    ok &= check(dcmqi::MemoryBudget::selectSegmentationStrategy(input, parallel.peak, selected) && !selected.streamingWrite,
+                "budget of the parallel peak selects parallel deflate");
+    ok &= check(dcmqi::MemoryBudget::selectSegmentationStrategy(input, streamed.peak, selected) && selected.streamingWrite,
+                "budget of the streamed peak selects streamed deflate");
+    ok &= check(!dcmqi::MemoryBudget::selectSegmentationStrategy(input, streamed.peak - 1, selected) && selected.streamingWrite,
+                "budget below the streamed peak fails");
+  }
+
+  // without compression there is nothing to choose
+  {
+    const dcmqi::MemoryBudget::SegmentationInput input = createInput(DcmSegTypes::ST_BINARY, "none");
+    const dcmqi::MemoryBudget::Estimate estimate = dcmqi::MemoryBudget::estimateSegmentation(input);
+    dcmqi::MemoryBudget::Estimate selected;
+    ok &= check(!dcmqi::MemoryBudget::selectSegmentationStrategy(input, estimate.peak - 1, selected) && !selected.streamingWrite,
+                "budget below the peak of uncompressed output fails");
+  }
+
+  dcmqi::MemoryBudget::Estimate estimate = dcmqi::MemoryBudget::estimateSegmentation(createInput(DcmSegTypes::ST_BINARY, "none"));
+  dcmqi::MemoryBudget::printEstimate(estimate, std::cout);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
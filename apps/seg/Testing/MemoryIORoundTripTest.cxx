@@ -0,0 +1,309 @@
+// Round trip test for dcmqi::MemoryIO.
+//
+// Converts without any intermediate files: the source images are parsed from
+// byte buffers, the label volume is passed as a voxel buffer, the results are
+// encoded into byte buffers, parsed back and converted again. Checked are
+// - a binary SEG, encoded uncompressed and deflated
+// - a labelmap SEG, encoded RLE compressed
+// - a float parametric map made from the labels, whose voxels must read back
+//   unchanged
+// - a TID 1500 report that references the SEG and the source images, whose
+//   measurements must read back
+// Fails if the voxel buffer is copied on import, or if a segment read back
+// does not cover the same voxels as the input labels.
+//
+// Usage: MemoryIORoundTripTest <seg metadata.json> <segmentation.nrrd>
+//          <pm metadata.json> <sr metadata.json> <dicomFile1> [<dicomFile2> ...]
+
+#include "dcmqi/Dicom2ItkConverterBase.h"
+#include "dcmqi/Itk2DicomConverter.h"
+#include "dcmqi/MemoryIO.h"
+#include "dcmqi/ParaMapConverter.h"
+#include "dcmqi/TID1500Reader.h"
+#include "dcmqi/TID1500Writer.h"
+
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmsr/dsrdoc.h>
+
+#include <itkImageFileReader.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+using ImageType = itk::Image<short, 3U>;
+using ReaderType = itk::ImageFileReader<ImageType>;
+
+#define REQUIRE(expr)                                                                  \
+  do {                                                                                 \
+    if (!(expr)) {                                                                     \
+      std::cerr << "FAIL: " << #expr << " at " << __FILE__ << ":" << __LINE__ << std::endl; \
+      return false;                                                                    \
+    }                                                                                  \
+  } while (0)
+
+std::vector<Uint8> readBytes(const std::string& path)
+{
+  std::ifstream in(path.c_str(), std::ios::binary);
+  return std::vector<Uint8>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+std::string readText(const std::string& path)
+{
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::ostringstream text;
+  text << in.rdbuf();
+  return text.str();
+}
+
+template <class PixelType>
+size_t countNonZero(const PixelType* voxels, size_t count)
+{
+  size_t nonZero = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (voxels[i] != 0)
+      ++nonZero;
+  }
+  return nonZero;
+}
+
+// Encodes the dataset into memory with the given transfer syntax and parses
+// it back
+bool roundTrip(DcmDataset* dataset, E_TransferSyntax xfer, std::vector<Uint8>& bytes, DcmFileFormat& readBack)
+{
+  {
+    DcmFileFormat fileFormat(dataset);
+    REQUIRE(dcmqi::MemoryIO::writeDICOM(fileFormat, bytes, xfer).good());
+  }
+  REQUIRE(bytes.size() > 132);
+  REQUIRE(memcmp(&bytes[128], "DICM", 4) == 0);
+  REQUIRE(dcmqi::MemoryIO::readDICOM(bytes.data(), bytes.size(), readBack).good());
+  OFString transferSyntax;
+  REQUIRE(readBack.getMetaInfo()->findAndGetOFString(DCM_TransferSyntaxUID, transferSyntax).good());
+  REQUIRE(transferSyntax == DcmXfer(xfer).getXferID());
+
+  OFString sopInstanceUID, readBackSOPInstanceUID;
+  dataset->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUID);
+  readBack.getDataset()->findAndGetOFString(DCM_SOPInstanceUID, readBackSOPInstanceUID);
+  REQUIRE(sopInstanceUID == readBackSOPInstanceUID);
+  return true;
+}
+
+bool checkSegmentation(const std::vector<DcmItem*>& dcmDatasets,
+                       const std::vector<ImageType::ConstPointer>& segmentations,
+                       const std::string& metadata, const dcmqi::MemoryIO::VolumeGeometry& geometry,
+                       size_t labelVoxels, bool outputLabelMap, E_TransferSyntax xfer,
+                       std::unique_ptr<DcmDataset>& segDataset)
+{
+  segDataset.reset(dcmqi::Itk2DicomConverter::itkimage2dcmSegmentation(
+      dcmDatasets, segmentations, metadata, true, false, true, true, outputLabelMap));
+  REQUIRE(segDataset != nullptr);
+
+  std::vector<Uint8> segBytes;
+  DcmFileFormat readBack;
+  REQUIRE(roundTrip(segDataset.get(), xfer, segBytes, readBack));
+  DcmDataset* readBackDataset = readBack.getDataset();
+
+  std::unique_ptr<dcmqi::Dicom2ItkConverterBase> converter(dcmqi::Dicom2ItkConverter::getConverter(readBackDataset));
+  REQUIRE(converter != nullptr);
+  std::string metaInfo;
+  REQUIRE(converter->dcmSegmentation2itkimage(readBackDataset, metaInfo).good());
+
+  const size_t numberOfVoxels = static_cast<size_t>(geometry.size[0]) * geometry.size[1] * geometry.size[2];
+  dcmqi::MemoryIO::VolumeGeometry resultGeometry;
+  size_t resultVoxels = 0;
+  if (converter->bytesPerPixel() == 2)
+  {
+    ShortImageType::Pointer result = converter->begin16Bit();
+    REQUIRE(result.IsNotNull());
+    const short* data = dcmqi::MemoryIO::getVoxels(result.GetPointer(), resultGeometry);
+    resultVoxels = countNonZero(data, numberOfVoxels);
+  }
+  else
+  {
+    CharImageType::Pointer result = converter->begin8Bit();
+    REQUIRE(result.IsNotNull());
+    const CharImageType::PixelType* data = dcmqi::MemoryIO::getVoxels(result.GetPointer(), resultGeometry);
+    resultVoxels = countNonZero(data, numberOfVoxels);
+  }
+  for (unsigned i = 0; i < 3; ++i)
+  {
+    REQUIRE(resultGeometry.size[i] == geometry.size[i]);
+  }
+  REQUIRE(resultVoxels == labelVoxels);
+
+  std::cout << (outputLabelMap ? "labelmap" : "binary") << " segmentation converted through memory buffers as "
+            << DcmXfer(xfer).getXferName() << ", " << segBytes.size() << " bytes, " << resultVoxels
+            << " segment voxels" << std::endl;
+  return true;
+}
+
+bool checkParametricMap(const std::vector<DcmItem*>& dcmDatasets, const ImageType::ConstPointer& labels,
+                        const std::string& metadata)
+{
+  // non-integer values, so that the map is stored as floating point frames
+  FloatImageType::Pointer map = FloatImageType::New();
+  map->CopyInformation(labels);
+  map->SetRegions(labels->GetLargestPossibleRegion());
+  map->Allocate();
+  const size_t numberOfVoxels = labels->GetLargestPossibleRegion().GetNumberOfPixels();
+  for (size_t i = 0; i < numberOfVoxels; ++i)
+  {
+    map->GetBufferPointer()[i] = 0.25f * labels->GetBufferPointer()[i] + 0.5f;
+  }
+
+  std::unique_ptr<DcmDataset> pmDataset;
+  FloatImageType::Pointer result;
+  try
+  {
+    pmDataset.reset(dcmqi::ParaMapConverter::itkimage2paramap(map, dcmDatasets, metadata));
+    REQUIRE(pmDataset != nullptr);
+
+    std::vector<Uint8> pmBytes;
+    DcmFileFormat readBack;
+    REQUIRE(roundTrip(pmDataset.get(), EXS_DeflatedLittleEndianExplicit, pmBytes, readBack));
+    result = dcmqi::ParaMapConverter::paramap2itkimage(readBack.getDataset()).first;
+    std::cout << "parametric map converted through memory buffers, " << pmBytes.size() << " bytes" << std::endl;
+  }
+  catch (...)
+  {
+    std::cerr << "FAIL: parametric map conversion threw an exception" << std::endl;
+    return false;
+  }
+  REQUIRE(result.IsNotNull());
+  REQUIRE(result->GetLargestPossibleRegion().GetSize() == map->GetLargestPossibleRegion().GetSize());
+  REQUIRE(memcmp(result->GetBufferPointer(), map->GetBufferPointer(), numberOfVoxels * sizeof(FloatPixelType)) == 0);
+  return true;
+}
+
+bool checkStructuredReport(const std::string& metadata, DcmDataset* segDataset,
+                           const std::vector<DcmItem*>& dcmDatasets)
+{
+  Json::Value metaRoot;
+  std::istringstream metadataStream(metadata);
+  metadataStream >> metaRoot;
+
+  std::unique_ptr<DcmDataset> report;
+  try
+  {
+    report.reset(TID1500Writer::writeReport(metaRoot, std::vector<DcmItem*>(1, segDataset), dcmDatasets));
+  }
+  catch (...)
+  {
+    std::cerr << "FAIL: TID1500Writer::writeReport threw an exception" << std::endl;
+    return false;
+  }
+  REQUIRE(report != nullptr);
+
+  std::vector<Uint8> reportBytes;
+  {
+    DcmFileFormat reportFile(report.get());
+    REQUIRE(dcmqi::MemoryIO::writeDICOM(reportFile, reportBytes).good());
+  }
+  DSRDocument document;
+  REQUIRE(dcmqi::MemoryIO::readStructuredReport(reportBytes.data(), reportBytes.size(), document).good());
+
+  // the patient is taken from the composite context
+  OFString patientID, reportPatientID;
+  segDataset->findAndGetOFString(DCM_PatientID, patientID);
+  document.getPatientID(reportPatientID);
+  REQUIRE(patientID == reportPatientID);
+
+  TID1500Reader reader(document.getTree());
+  const Json::Value measurements = reader.getMeasurements();
+  REQUIRE(measurements.size() == metaRoot["Measurements"].size());
+  std::cout << "TID 1500 report converted through memory buffers, " << reportBytes.size() << " bytes, "
+            << measurements.size() << " measurement groups" << std::endl;
+  return true;
+}
+
+bool run(int argc, char* argv[])
+{
+  const std::string segMetadata = readText(argv[1]);
+  const std::string pmMetadata = readText(argv[3]);
+  const std::string srMetadata = readText(argv[4]);
+  REQUIRE(!segMetadata.empty());
+  REQUIRE(!pmMetadata.empty());
+  REQUIRE(!srMetadata.empty());
+
+  // Source images as they would arrive over the network
+  std::vector<std::vector<Uint8> > dicomBytes;
+  std::vector<dcmqi::MemoryIO::Buffer> dicomBuffers;
+  for (int i = 5; i < argc; ++i)
+  {
+    dicomBytes.push_back(readBytes(argv[i]));
+    REQUIRE(!dicomBytes.back().empty());
+  }
+  for (size_t i = 0; i < dicomBytes.size(); ++i)
+  {
+    dicomBuffers.push_back(dcmqi::MemoryIO::Buffer(dicomBytes[i].data(), dicomBytes[i].size()));
+  }
+  std::vector<std::unique_ptr<DcmItem> > ownedDatasets;
+  std::vector<DcmItem*> dcmDatasets = dcmqi::MemoryIO::readDatasets(dicomBuffers);
+  for (DcmItem* item : dcmDatasets) { ownedDatasets.emplace_back(item); }
+  REQUIRE(dcmDatasets.size() == dicomBuffers.size());
+
+  // Label volume as a plain voxel buffer with its geometry
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(argv[2]);
+  try
+  {
+    reader->Update();
+  }
+  catch (const itk::ExceptionObject& e)
+  {
+    std::cerr << "ERROR: failed to load segmentation: " << e.what() << std::endl;
+    return false;
+  }
+  dcmqi::MemoryIO::VolumeGeometry geometry;
+  const short* readerVoxels = dcmqi::MemoryIO::getVoxels(reader->GetOutput(), geometry);
+  const size_t numberOfVoxels = static_cast<size_t>(geometry.size[0]) * geometry.size[1] * geometry.size[2];
+  std::vector<short> voxels(readerVoxels, readerVoxels + numberOfVoxels);
+  const size_t labelVoxels = countNonZero(voxels.data(), voxels.size());
+  REQUIRE(labelVoxels > 0);
+
+  ImageType::ConstPointer labels = dcmqi::MemoryIO::importVolume(voxels.data(), geometry);
+  REQUIRE(labels->GetBufferPointer() == voxels.data());
+  std::vector<ImageType::ConstPointer> segmentations;
+  segmentations.push_back(labels);
+
+  // binary frames cannot be RLE compressed, labelmap frames can
+  std::unique_ptr<DcmDataset> segDataset, deflatedSegDataset, labelMapDataset;
+  bool ok = true;
+  ok &= checkSegmentation(dcmDatasets, segmentations, segMetadata, geometry, labelVoxels, false,
+                          EXS_LittleEndianExplicit, segDataset);
+  ok &= checkSegmentation(dcmDatasets, segmentations, segMetadata, geometry, labelVoxels, false,
+                          EXS_DeflatedLittleEndianExplicit, deflatedSegDataset);
+  ok &= checkSegmentation(dcmDatasets, segmentations, segMetadata, geometry, labelVoxels, true,
+                          EXS_RLELossless, labelMapDataset);
+  ok &= checkParametricMap(dcmDatasets, labels, pmMetadata);
+  if (segDataset != nullptr)
+    ok &= checkStructuredReport(srMetadata, segDataset.get(), dcmDatasets);
+  return ok;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc < 6)
+  {
+    std::cerr << "Usage: " << argv[0]
+              << " <seg metadata.json> <segmentation.nrrd> <pm metadata.json> <sr metadata.json>"
+              << " <dicomFile1> [<dicomFile2> ...]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!run(argc, argv))
+    return EXIT_FAILURE;
+  std::cout << "PASS" << std::endl;
+  return EXIT_SUCCESS;
+}
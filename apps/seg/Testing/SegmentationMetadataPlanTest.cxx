@@ -0,0 +1,162 @@
+// Unit test for dcmqi::SegmentationMetadataPlan.
+//
+// - label lookups in the dense index and above it (labels of 32 bit label
+//   images, which are searched in the sorted segments)
+// - a segment with incomplete metadata only fails when it is created, so
+//   metadata with such a segment compiles as long as no label uses it
+// - one compiled plan converts the same segmentation several times with the
+//   same result
+//
+// Usage: SegmentationMetadataPlanTest <seg-example.json> <labels.nrrd> <dicom1> [<dicom2> ...]
+
+#include "dcmqi/Itk2DicomConverter.h"
+#include "dcmqi/SegmentationMetadataPlan.h"
+
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcsequen.h>
+
+#include <itkImageFileReader.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+using ImageType = itk::Image<short, 3U>;
+using ReaderType = itk::ImageFileReader<ImageType>;
+
+#define REQUIRE(expr)                                                                  \
+  do {                                                                                 \
+    if (!(expr)) {                                                                     \
+      std::cerr << "FAIL: " << #expr << " at " << __FILE__ << ":" << __LINE__ << std::endl; \
+      return false;                                                                    \
+    }                                                                                  \
+  } while (0)
+
+std::string readFile(const std::string& path)
+{
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+std::string segmentJSON(unsigned labelID, bool withAlgorithmName)
+{
+  std::ostringstream ss;
+  ss << "{\"labelID\": " << labelID << ", \"SegmentLabel\": \"Label " << labelID << "\","
+     << " \"SegmentedPropertyCategoryCodeSequence\": {\"CodeValue\": \"85756007\", \"CodingSchemeDesignator\": \"SCT\", \"CodeMeaning\": \"Tissue\"},"
+     << " \"SegmentedPropertyTypeCodeSequence\": {\"CodeValue\": \"10200004\", \"CodingSchemeDesignator\": \"SCT\", \"CodeMeaning\": \"Liver\"},"
+     << " \"SegmentAlgorithmType\": \"SEMIAUTOMATIC\","
+     << (withAlgorithmName ? " \"SegmentAlgorithmName\": \"Test\"," : "")
+     << " \"recommendedDisplayRGBValue\": [221, 130, 101]}";
+  return ss.str();
+}
+
+bool checkLookups()
+{
+  // label 3 has no algorithm name, which is required for SEMIAUTOMATIC segments
+  const unsigned labels[] = { 1, 3, 7, 65535, 65536, 70000, 1000000 };
+  std::ostringstream json;
+  json << "{\"SeriesDescription\": \"Plan\", \"segmentAttributes\": [[";
+  for (size_t i = 0; i < sizeof(labels) / sizeof(labels[0]); ++i)
+    json << (i ? ", " : "") << segmentJSON(labels[i], labels[i] != 3);
+  json << "]]}";
+
+  dcmqi::SegmentationMetadataPlan::ConstPointer plan = dcmqi::SegmentationMetadataPlan::compile(json.str());
+  REQUIRE(plan);
+  REQUIRE(plan->getNumberOfInputs() == 1);
+  REQUIRE(plan->getSegments(0).size() == 7);
+
+  for (size_t i = 0; i < sizeof(labels) / sizeof(labels[0]); ++i)
+  {
+    const dcmqi::SegmentationMetadataPlan::Segment* segment = plan->findSegment(0, labels[i]);
+    REQUIRE(segment != NULL);
+    REQUIRE(segment->labelID == labels[i]);
+  }
+  const long missing[] = { -1, 0, 2, 65534, 65537, 69999, 70001, 999999, 2000000 };
+  for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); ++i)
+    REQUIRE(plan->findSegment(0, missing[i]) == NULL);
+  REQUIRE(plan->findSegment(1, 1) == NULL);
+
+  // every segment is created on its own, as often as needed
+  for (unsigned round = 0; round < 2; ++round)
+  {
+    std::unique_ptr<DcmSegment> valid(dcmqi::SegmentationMetadataPlan::createSegment(*plan->findSegment(0, 70000)));
+    REQUIRE(valid);
+    OFString label;
+    REQUIRE(valid->getSegmentLabel(label).good() && label == "Label 70000");
+  }
+  REQUIRE(dcmqi::SegmentationMetadataPlan::createSegment(*plan->findSegment(0, 3)) == NULL);
+  return true;
+}
+
+std::vector<std::string> segmentLabels(DcmDataset* dataset)
+{
+  std::vector<std::string> labels;
+  DcmSequenceOfItems* sequence = NULL;
+  if (dataset->findAndGetSequence(DCM_SegmentSequence, sequence).bad() || sequence == NULL)
+    return labels;
+  for (unsigned long i = 0; i < sequence->card(); ++i)
+  {
+    OFString label;
+    sequence->getItem(i)->findAndGetOFString(DCM_SegmentLabel, label);
+    labels.push_back(label.c_str());
+  }
+  return labels;
+}
+
+bool checkReuse(const std::string& metadataPath, const std::string& labelPath, const std::vector<std::string>& dicomPaths)
+{
+  dcmqi::SegmentationMetadataPlan::ConstPointer plan = dcmqi::SegmentationMetadataPlan::compile(readFile(metadataPath));
+  REQUIRE(plan);
+
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(labelPath);
+  reader->Update();
+  std::vector<itk::SmartPointer<const ImageType> > segmentations(1, reader->GetOutput());
+
+  std::vector<std::unique_ptr<DcmFileFormat> > files;
+  std::vector<DcmItem*> dcmDatasets;
+  for (size_t i = 0; i < dicomPaths.size(); ++i)
+  {
+    files.emplace_back(new DcmFileFormat);
+    REQUIRE(files.back()->loadFile(dicomPaths[i].c_str()).good());
+    dcmDatasets.push_back(files.back()->getDataset());
+  }
+
+  std::vector<std::string> firstLabels;
+  for (unsigned round = 0; round < 2; ++round)
+  {
+    std::unique_ptr<DcmDataset> result(
+      dcmqi::Itk2DicomConverter::itkimage2dcmSegmentation<ImageType>(dcmDatasets, segmentations, *plan));
+    REQUIRE(result);
+    const std::vector<std::string> labels = segmentLabels(result.get());
+    REQUIRE(!labels.empty());
+    if (round == 0)
+      firstLabels = labels;
+    else
+      REQUIRE(labels == firstLabels);
+  }
+  return true;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc < 4)
+  {
+    std::cerr << "Usage: " << argv[0] << " <seg-example.json> <labels.nrrd> <dicom1> [<dicom2> ...]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  bool ok = checkLookups();
+  ok &= checkReuse(argv[1], argv[2], std::vector<std::string>(argv + 3, argv + argc));
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
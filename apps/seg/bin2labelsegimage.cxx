@@ -5,6 +5,8 @@
 // DCMQI includes
 #undef HAVE_SSTREAM // Avoid redefinition warning
 #include "dcmqi/Bin2Label.h"
+#include "dcmqi/Compression.h"
+#include "dcmqi/Instrumentation.h"
 #include "dcmqi/internal/VersionConfigure.h"
 
 // DCMTK includes
@@ -22,10 +24,13 @@ int main(int argc, char* argv[])
     PARSE_ARGS;
     E_TransferSyntax outputTS = EXS_LittleEndianExplicit;
 
+    dcmqi::Profiler::Session profilerSession(profileFileName);
+
     if (verbose)
     {
         // Display DCMTK debug, warning, and error logs in the console
         dcmtk::log4cplus::BasicConfigurator::doConfigure();
+        dcmqi::Verbosity::setLevel(dcmqi::Verbosity::Detail);
     }
 
     if (helper::isUndefinedOrPathDoesNotExist(inputSEGFileName, "Input DICOM file"))
@@ -37,7 +42,10 @@ int main(int argc, char* argv[])
 
     DcmFileFormat sliceFF;
     std::cout << "Loading DICOM SEG file " << inputSEGFileName << std::endl;
-    CHECK_COND(sliceFF.loadFile(inputSEGFileName.c_str()));
+    {
+        dcmqi::Profiler::Scope profilerScope("loadFile");
+        CHECK_COND(dcmqi::Compression::loadFile(sliceFF, inputSEGFileName));
+    }
     DcmDataset* dataset = sliceFF.getDataset();
     int returnCode = EXIT_SUCCESS;
     try
@@ -99,14 +107,26 @@ int main(int argc, char* argv[])
                   labelSeg->setValueCheckOnWrite(OFFalse);
                 }
 
-                CHECK_COND(labelSeg->writeDataset(*(outputFF.getDataset())));
+                {
+                    dcmqi::Profiler::Scope profilerScope("writeDataset");
+                    CHECK_COND(labelSeg->writeDataset(*(outputFF.getDataset())));
+                }
+                dcmqi::Profiler::Scope saveScope("saveFile");
                 std::cout << "Writing output DICOM label map SEG file to " << outputSEGFileName << std::endl;
-                // choose representation
-                result = outputFF.chooseRepresentation(outputTS, NULL);
+                // choose representation; RLE frames are encoded in parallel by dcmqi rather than
+                // one after another by the DCMTK codec
+                if (outputTS == EXS_RLELossless)
+                    result = dcmqi::Compression::encodeRLE(outputFF.getDataset());
+                else
+                    result = outputFF.chooseRepresentation(outputTS, NULL);
                 if (result.good())
                 {
                     std::cout << "Using transfer syntax: " << DcmXfer(outputTS).getXferName() << std::endl;
-                    CHECK_COND(outputFF.saveFile(outputSEGFileName.c_str(), outputTS));
+                    // deflate blocks of the dataset in parallel instead of as a single zlib stream
+                    if (outputTS == EXS_DeflatedLittleEndianExplicit)
+                        CHECK_COND(dcmqi::Compression::saveDeflated(outputFF, outputSEGFileName));
+                    else
+                        CHECK_COND(outputFF.saveFile(outputSEGFileName.c_str(), outputTS));
                 }
                 else
                 {
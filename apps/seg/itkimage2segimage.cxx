@@ -1,5 +1,9 @@
 // CLP includes
 #include "dcmqi/Itk2DicomConverter.h"
+#include "dcmqi/Compression.h"
+#include "dcmqi/Instrumentation.h"
+#include "dcmqi/MemoryBudget.h"
+#include "dcmqi/JSONSegmentationMetaInformationHandler.h"
 #include "itkimage2segimageCLP.h"
 
 // DCMQI includes
@@ -9,44 +13,248 @@
 // DCMTK includes
 #include <dcmtk/oflog/configrt.h>
 
+// ITK includes
+#include <itkImageIOFactory.h>
+#include <itkVectorImage.h>
+#include <itkVectorImageToImageAdaptor.h>
+
 typedef dcmqi::Helper helper;
 
-int main(int argc, char *argv[])
+// Multi-channel (e.g. one-hot) segmentations: either a vector image with one
+// component per channel, or a 4D image with one volume per channel
+typedef itk::VectorImage<short, 3> ShortVectorImageType;
+typedef itk::VectorImageToImageAdaptor<short, 3> ChannelAdaptorType;
+typedef itk::Image<short, 4> ShortChannelsImageType;
+
+// Multi-channel probability maps (--segmentationType fractional)
+typedef itk::VectorImage<float, 3> FractionalVectorImageType;
+typedef itk::VectorImageToImageAdaptor<float, 3> FractionalChannelAdaptorType;
+typedef itk::Image<float, 4> FractionalChannelsImageType;
+
+// Returns the volumes of a 4D image as 3D images that share its pixel buffer, so
+// the channels are not copied. The 4D image must outlive the returned volumes.
+template<class PixelType>
+vector<typename itk::Image<PixelType, 3>::ConstPointer> getChannelVolumes(const typename itk::Image<PixelType, 4>::Pointer& image)
 {
-  std::cout << dcmqi_INFO << std::endl;
+  typedef itk::Image<PixelType, 3> VolumeType;
+  const typename itk::Image<PixelType, 4>::SizeType size = image->GetLargestPossibleRegion().GetSize();
+  typename VolumeType::RegionType region;
+  typename VolumeType::PointType origin;
+  typename VolumeType::SpacingType spacing;
+  typename VolumeType::DirectionType direction;
+  for(unsigned i=0;i<3;i++){
+    region.SetSize(i, size[i]);
+    origin[i] = image->GetOrigin()[i];
+    spacing[i] = image->GetSpacing()[i];
+    for(unsigned j=0;j<3;j++)
+      direction[i][j] = image->GetDirection()[i][j];
+  }
+  const size_t volumeSize = size[0] * size[1] * size[2];
 
-  PARSE_ARGS;
+  vector<typename VolumeType::ConstPointer> volumes;
+  for(unsigned channel=0;channel<size[3];channel++){
+    typename VolumeType::PixelContainerPointer container = VolumeType::PixelContainer::New();
+    container->SetImportPointer(image->GetBufferPointer() + channel * volumeSize, volumeSize, false);
+    typename VolumeType::Pointer volume = VolumeType::New();
+    volume->SetRegions(region);
+    volume->SetOrigin(origin);
+    volume->SetSpacing(spacing);
+    volume->SetDirection(direction);
+    volume->SetPixelContainer(container);
+    volumes.push_back(volume.GetPointer());
+  }
+  return volumes;
+}
 
-  if(helper::isUndefinedOrPathsDoNotExist(segImageFiles, "Input image files")
-     || helper::isUndefinedOrPathDoesNotExist(metaDataFileName, "Input metadata file")
-     || helper::isUndefined(outputSEGFileName, "Output DICOM file")) {
+// Writes the converted segmentation (compressed as requested) and releases it
+// and the source datasets. DCMTK errors are thrown (CHECK_COND) to the caller.
+// With streamingWrite, deflated output is compressed by DCMTK while it is
+// written instead of in parallel blocks in memory (see dcmqi::MemoryBudget).
+int saveSegmentation(DcmDataset* result, vector<DcmItem*>& dcmDatasets,
+                     const string& outputSEGFileName, const string& compress, bool streamingWrite)
+{
+  if (result == NULL){
+    std::cerr << "ERROR: Conversion failed." << std::endl;
     return EXIT_FAILURE;
+  } else {
+    dcmqi::Profiler::Scope profilerScope("saveFile");
+    // the file takes over the dataset instead of copying it
+    DcmFileFormat segdocFF(result, OFFalse);
+    if(compress == "deflate" && streamingWrite){
+      CHECK_COND(segdocFF.saveFile(outputSEGFileName.c_str(), EXS_DeflatedLittleEndianExplicit));
+    } else if(compress == "deflate"){
+      CHECK_COND(dcmqi::Compression::saveDeflated(segdocFF, outputSEGFileName));
+    } else if(compress == "rle"){
+      CHECK_COND(dcmqi::Compression::encodeRLE(segdocFF.getDataset()));
+      CHECK_COND(segdocFF.saveFile(outputSEGFileName.c_str(), EXS_RLELossless));
+    } else {
+      CHECK_COND(segdocFF.saveFile(outputSEGFileName.c_str(), EXS_LittleEndianExplicit));
+    }
+
+    std::cout << "Saved segmentation as " << outputSEGFileName << endl;
   }
 
-  if(dicomImageFiles.empty() && dicomDirectory.empty()){
-    cerr << "Error: No input DICOM files specified!" << endl;
+  for(size_t i=0;i<dcmDatasets.size();i++) {
+    delete dcmDatasets[i];
+  }
+  return EXIT_SUCCESS;
+}
+
+// The input images are released after the conversion, before the file is
+// saved, unless the caller holds further references to them
+template<class ImageSourceType>
+int convertSegmentations(vector<DcmItem*>& dcmDatasets, vector<itk::SmartPointer<const ImageSourceType> >& segmentations,
+                         const dcmqi::JSONSegmentationMetaInformationHandler& metaInfo, const string& outputSEGFileName,
+                         const string& compress, bool streamingWrite,
+                         bool skipEmptySlices, bool useLabelIDAsSegmentNumber, bool referencesGeometryCheck,
+                         bool doDicomValueChecks, bool outputLabelMap)
+{
+  try {
+    DcmDataset* result = dcmqi::Itk2DicomConverter::itkimage2dcmSegmentation(dcmDatasets,
+                                                                             segmentations,
+                                                                             metaInfo,
+                                                                             skipEmptySlices,
+                                                                             useLabelIDAsSegmentNumber,
+                                                                             referencesGeometryCheck,
+                                                                             doDicomValueChecks,
+                                                                             outputLabelMap);
+    segmentations.clear();
+    return saveSegmentation(result, dcmDatasets, outputSEGFileName, compress, streamingWrite);
+  } catch (int e) {
+    std::cerr << "Fatal error encountered." << std::endl;
     return EXIT_FAILURE;
   }
+}
 
-  vector<ShortImageType::ConstPointer> segmentations;
+template<class ImageSourceType>
+int convertFractionalSegmentations(vector<DcmItem*>& dcmDatasets, vector<itk::SmartPointer<const ImageSourceType> >& fractionalMaps,
+                                   const dcmqi::JSONSegmentationMetaInformationHandler& metaInfo, const string& outputSEGFileName,
+                                   const string& compress, bool streamingWrite,
+                                   DcmSegTypes::E_SegmentationFractionalType fractionalType, Uint16 maxFractionalValue,
+                                   bool skipEmptySlices, bool referencesGeometryCheck, bool doDicomValueChecks)
+{
+  try {
+    DcmDataset* result = dcmqi::Itk2DicomConverter::itkimage2dcmFractionalSegmentation(dcmDatasets,
+                                                                                       fractionalMaps,
+                                                                                       metaInfo,
+                                                                                       fractionalType,
+                                                                                       maxFractionalValue,
+                                                                                       skipEmptySlices,
+                                                                                       referencesGeometryCheck,
+                                                                                       doDicomValueChecks);
+    fractionalMaps.clear();
+    return saveSegmentation(result, dcmDatasets, outputSEGFileName, compress, streamingWrite);
+  } catch (int e) {
+    std::cerr << "Fatal error encountered." << std::endl;
+    return EXIT_FAILURE;
+  }
+}
 
+// Reads the segmentation files with the given pixel type; all of them need the
+// same in-plane dimensions
+template<class ImageType>
+bool readSegmentationFiles(const vector<string>& segImageFiles, vector<typename ImageType::ConstPointer>& segmentations)
+{
+  dcmqi::Profiler::Scope profilerScope("readImages");
   for(size_t segFileNumber=0; segFileNumber<segImageFiles.size(); segFileNumber++){
-    ShortReaderType::Pointer reader = ShortReaderType::New();
+    typename itk::ImageFileReader<ImageType>::Pointer reader = itk::ImageFileReader<ImageType>::New();
     reader->SetFileName(segImageFiles[segFileNumber]);
     reader->Update();
     cout << "Loaded segmentation from " << segImageFiles[segFileNumber] << endl;
 
-    ShortImageType::Pointer labelImage = reader->GetOutput();
-    segmentations.push_back(labelImage);
+    typename ImageType::Pointer labelImage = reader->GetOutput();
+    segmentations.push_back(labelImage.GetPointer());
 
-    ShortImageType::SizeType ref_size, cmp_size;
+    typename ImageType::SizeType ref_size, cmp_size;
     ref_size = segmentations[0]->GetLargestPossibleRegion().GetSize();
     cmp_size = labelImage->GetLargestPossibleRegion().GetSize();
     if(ref_size[0] != cmp_size[0] || ref_size[1] != cmp_size[1]){
       cerr << "Error: In-plane dimensions of segmentations are inconsistent!" << endl;
       cerr << ref_size << " vs " << cmp_size << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+template<class ImageType>
+int convertSegmentationFiles(vector<DcmItem*>& dcmDatasets, const vector<string>& segImageFiles,
+                             const dcmqi::JSONSegmentationMetaInformationHandler& metaInfo, const string& outputSEGFileName,
+                             const string& compress, bool streamingWrite,
+                             bool skipEmptySlices, bool useLabelIDAsSegmentNumber, bool referencesGeometryCheck,
+                             bool doDicomValueChecks, bool outputLabelMap)
+{
+  vector<typename ImageType::ConstPointer> segmentations;
+  if(!readSegmentationFiles<ImageType>(segImageFiles, segmentations))
+    return EXIT_FAILURE;
+
+  return convertSegmentations(dcmDatasets, segmentations, metaInfo, outputSEGFileName, compress, streamingWrite,
+                              skipEmptySlices, useLabelIDAsSegmentNumber, referencesGeometryCheck,
+                              doDicomValueChecks, outputLabelMap);
+}
+
+int main(int argc, char *argv[])
+{
+  std::cout << dcmqi_INFO << std::endl;
+
+  PARSE_ARGS;
+
+  dcmqi::Profiler::Session profilerSession(profileFileName);
+
+  if(helper::isUndefinedOrPathsDoNotExist(segImageFiles, "Input image files")
+     || helper::isUndefinedOrPathDoesNotExist(metaDataFileName, "Input metadata file")
+     || (!dryRun && helper::isUndefined(outputSEGFileName, "Output DICOM file"))) {
+    return EXIT_FAILURE;
+  }
+
+  if(dicomImageFiles.empty() && dicomDirectory.empty()){
+    cerr << "Error: No input DICOM files specified!" << endl;
+    return EXIT_FAILURE;
+  }
+
+  bool outputLabelMap = false;
+  bool outputFractional = false;
+  if (segmentationType == "binary")
+    outputLabelMap = false;
+  else if (segmentationType == "labelmap")
+    outputLabelMap = true;
+  else if (segmentationType == "fractional")
+    outputFractional = true;
+  else {
+    cerr << "Error: --segmentationType must be one of 'binary', 'labelmap' or 'fractional'" << endl;
+    return EXIT_FAILURE;
+  }
+
+  if(compress == "rle" && segmentationType == "binary"){
+    cerr << "Error: --compress rle requires --segmentationType labelmap or fractional, binary (1 bit) frames cannot be RLE encoded" << endl;
+    return EXIT_FAILURE;
+  }
+
+  // A single multi-channel input is converted channel by channel: every channel
+  // is handled like a separate input file, without splitting it on disk
+  unsigned numberOfChannels = 0;
+  bool vectorChannels = false;
+  if(segImageFiles.size() == 1){
+    itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO(segImageFiles[0].c_str(), itk::IOFileModeEnum::ReadMode);
+    if(imageIO.IsNull()){
+      cerr << "Error: cannot read " << segImageFiles[0] << endl;
       return EXIT_FAILURE;
     }
+    imageIO->SetFileName(segImageFiles[0]);
+    imageIO->ReadImageInformation();
+    if(imageIO->GetNumberOfComponents() > 1){
+      numberOfChannels = imageIO->GetNumberOfComponents();
+      vectorChannels = true;
+    } else if(imageIO->GetNumberOfDimensions() == 4)
+      numberOfChannels = imageIO->GetDimensions(3);
+  }
+
+  // Label image files are read in their own pixel type (see Helper::getLabelComponentType)
+  itk::IOComponentEnum labelComponentType = itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE;
+  if(!numberOfChannels && !outputFractional){
+    labelComponentType = helper::getLabelComponentType(segImageFiles);
+    if(labelComponentType == itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE)
+      return EXIT_FAILURE;
   }
 
   if (verbose) {
@@ -54,6 +262,87 @@ int main(int argc, char *argv[])
     // For some reason, this code has no effect if it is called too early (e.g., directly after PARSE_ARGS)
     // therefore we call it here.
     dcmtk::log4cplus::BasicConfigurator::doConfigure();
+    dcmqi::Verbosity::setLevel(dcmqi::Verbosity::Detail);
+  }
+
+  // The metadata is parsed only once: the document is validated here and then
+  // handed over to the metadata handler the converter works with
+  ifstream metainfoStream(metaDataFileName.c_str(), ios_base::binary);
+  Json::Value metaRoot;
+  try {
+    metainfoStream >> metaRoot;
+  } catch (Json::Exception& e) {
+    cerr << "ERROR: JSON parameter file " << metaDataFileName << " could not be parsed!" << endl;
+    cerr << "You can validate the JSON file here: http://qiicr.org/dcmqi/#/validators" << endl;
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  if(metaRoot.isMember("segmentAttributes")){
+    if(numberOfChannels && metaRoot["segmentAttributes"].size() != numberOfChannels){
+      cerr << "Error: number of items in the \"segmentAttributes\" metadata array should match the number of channels of the input segmentation!" << endl;
+      cerr << "segmentAttributes has: " << metaRoot["segmentAttributes"].size() << " items, the input segmentation has " << numberOfChannels << " channels!" << endl;
+      return EXIT_FAILURE;
+    }
+    if(!numberOfChannels && metaRoot["segmentAttributes"].size() != segImageFiles.size()){
+      cerr << "Error: number of items in the \"segmentAttributes\" metadata array should match the number of input segmentation files!" << endl;
+      cerr << "segmentAttributes has: " << metaRoot["segmentAttributes"].size() << " items, the are " << segImageFiles.size() << " input segmentation files!" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(!numberOfChannels && metaRoot.isMember("segmentAttributesFileMapping")
+     && !helper::applySegmentAttributesFileMapping(metaRoot, segImageFiles))
+    return EXIT_FAILURE;
+
+  size_t numberOfSegments = 0, maxLabelID = 0;
+  dcmqi::MemoryBudget::countSegments(metaRoot, numberOfSegments, maxLabelID);
+
+  dcmqi::JSONSegmentationMetaInformationHandler metaInfo;
+  try {
+    metaInfo.read(std::move(metaRoot));
+  } catch (dcmqi::JSONReadErrorException& e) {
+    return EXIT_FAILURE;
+  }
+
+  // The peak memory is estimated before any image or DICOM file is read, so
+  // that a conversion that does not fit into the budget is not even started
+  dcmqi::MemoryBudget::Estimate memoryEstimate;
+  if(maxMemory < 0){
+    cerr << "Error: --maxMemory must not be negative" << endl;
+    return EXIT_FAILURE;
+  }
+  if(maxMemory > 0 || dryRun){
+    dcmqi::MemoryBudget::SegmentationInput budgetInput;
+    if(!dcmqi::MemoryBudget::readSegmentationGeometry(segImageFiles, budgetInput))
+      return EXIT_FAILURE;
+    budgetInput.segmentationType = outputFractional ? DcmSegTypes::ST_FRACTIONAL
+                                 : (outputLabelMap ? DcmSegTypes::ST_LABELMAP : DcmSegTypes::ST_BINARY);
+    budgetInput.volumes = numberOfChannels ? numberOfChannels : segImageFiles.size();
+    if(outputFractional)
+      budgetInput.bytesPerVoxel = sizeof(float);
+    else if(numberOfChannels)
+      budgetInput.bytesPerVoxel = sizeof(short);
+    else if(labelComponentType == itk::IOComponentEnum::UCHAR)
+      budgetInput.bytesPerVoxel = 1;
+    else if(labelComponentType == itk::IOComponentEnum::USHORT || labelComponentType == itk::IOComponentEnum::SHORT)
+      budgetInput.bytesPerVoxel = 2;
+    else
+      budgetInput.bytesPerVoxel = 4;
+    budgetInput.segments = numberOfSegments;
+    budgetInput.labelmap16Bit = (useLabelIDAsSegmentNumber ? maxLabelID : numberOfSegments) > 255;
+    budgetInput.compress = compress;
+    // the 4D channel volumes refer to the pixels of the 4D image, which is held
+    // until the end (see getChannelVolumes)
+    budgetInput.inputsReleasedBeforeSave = !numberOfChannels || vectorChannels;
+
+    const size_t maxBytes = static_cast<size_t>(maxMemory) * 1024 * 1024;
+    const bool fits = dcmqi::MemoryBudget::selectSegmentationStrategy(budgetInput, maxBytes, memoryEstimate);
+    dcmqi::MemoryBudget::printEstimate(memoryEstimate, cout);
+    if(!fits)
+      cerr << "Error: the conversion does not fit into the memory budget of --maxMemory " << maxMemory << " MB" << endl;
+    if(dryRun || !fits)
+      return fits ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
   if(dicomDirectory.size()){
@@ -73,96 +362,124 @@ int main(int argc, char *argv[])
     return EXIT_FAILURE;
   }
 
-  ifstream metainfoStream(metaDataFileName.c_str(), ios_base::binary);
-  std::string metadata( (std::istreambuf_iterator<char>(metainfoStream) ),
-                       (std::istreambuf_iterator<char>()));
-
-  Json::Value metaRoot;
-  istringstream metainfoisstream(metadata);
-  metainfoisstream >> metaRoot;
-
-  if(metaRoot.isMember("segmentAttributes")){
-    if(metaRoot["segmentAttributes"].size() != segImageFiles.size()){
-      cerr << "Error: number of items in the \"segmentAttributes\" metadata array should match the number of input segmentation files!" << endl;
-      cerr << "segmentAttributes has: " << metaRoot["segmentAttributes"].size() << " items, the are " << segImageFiles.size() << " input segmentation files!" << endl;
+  if(outputFractional){
+    const DcmSegTypes::E_SegmentationFractionalType fractionalSegmentationType =
+      fractionalType == "occupancy" ? DcmSegTypes::SFT_OCCUPANCY : DcmSegTypes::SFT_PROBABILITY;
+    if(maxFractionalValue < 1 || maxFractionalValue > 255){
+      cerr << "Error: --maxFractionalValue must be between 1 and 255" << endl;
       return EXIT_FAILURE;
     }
-  }
-
-  bool outputLabelMap = false;
-  if (segmentationType == "binary")
-    outputLabelMap = false;
-  else if (segmentationType == "labelmap")
-    outputLabelMap = true;
-  else {
-    cerr << "Error: --segmentationType must be either 'binary' or 'labelmap'" << endl;
-    return EXIT_FAILURE;
-  }
 
-  if(metaRoot.isMember("segmentAttributesFileMapping")){
-    if(metaRoot["segmentAttributesFileMapping"].size() != metaRoot["segmentAttributes"].size()){
-      cerr << "Number of files in segmentAttributesFileMapping should match the number of entries in segmentAttributes!" << endl;
-      return EXIT_FAILURE;
-    }
-    // otherwise, re-order the entries in the segmentAtrributes list to match the order of files in segmentAttributesFileMapping
-    Json::Value reorderedSegmentAttributes;
-    vector<int> fileOrder(segImageFiles.size());
-    fill(fileOrder.begin(), fileOrder.end(), -1);
-    vector<ShortImageType::ConstPointer> segmentationsReordered(segImageFiles.size());
-    for(size_t filePosition=0;filePosition<segImageFiles.size();filePosition++){
-      for(size_t mappingPosition=0;mappingPosition<segImageFiles.size();mappingPosition++){
-        string mappingItem = metaRoot["segmentAttributesFileMapping"][static_cast<int>(mappingPosition)].asCString();
-        size_t foundPos = segImageFiles[filePosition].rfind(mappingItem);
-        if(foundPos != std::string::npos){
-          fileOrder[filePosition] = mappingPosition;
-          break;
+    if(vectorChannels){
+      // only the adaptors hold the image, so it is released together with them
+      vector<FractionalChannelAdaptorType::ConstPointer> fractionalMaps;
+      {
+        typedef itk::ImageFileReader<FractionalVectorImageType> VectorReaderType;
+        VectorReaderType::Pointer reader = VectorReaderType::New();
+        reader->SetFileName(segImageFiles[0]);
+        {
+          dcmqi::Profiler::Scope profilerScope("readImages");
+          reader->Update();
+        }
+        FractionalVectorImageType::Pointer mapsImage = reader->GetOutput();
+        for(unsigned channel=0;channel<numberOfChannels;channel++){
+          FractionalChannelAdaptorType::Pointer adaptor = FractionalChannelAdaptorType::New();
+          adaptor->SetImage(mapsImage);
+          adaptor->SetExtractComponentIndex(channel);
+          fractionalMaps.push_back(adaptor.GetPointer());
         }
       }
-      if(fileOrder[filePosition] == -1){
-        cerr << "Failed to map " << segImageFiles[filePosition] << " from the segmentAttributesFileMapping attribute to an input file name!" << endl;
-        return EXIT_FAILURE;
-      }
-    }
-    cout << "Order of input ITK images updated as shown below based on the segmentAttributesFileMapping attribute:" << endl;
-    for(size_t i=0;i<segImageFiles.size();i++){
-      cout << " image " << i << " moved to position " << fileOrder[i] << endl;
-      segmentationsReordered[fileOrder[i]] = segmentations[i];
+      cout << "Loaded " << numberOfChannels << " probability map channels from " << segImageFiles[0] << endl;
+      return convertFractionalSegmentations(dcmDatasets, fractionalMaps, metaInfo, outputSEGFileName,
+                                            compress, memoryEstimate.streamingWrite,
+                                            fractionalSegmentationType, static_cast<Uint16>(maxFractionalValue),
+                                            skipEmptySlices, referencesGeometryCheck, !noDicomValueChecks);
     }
-    segmentations = segmentationsReordered;
-  }
-
-  try {
-    DcmDataset* result = dcmqi::Itk2DicomConverter::itkimage2dcmSegmentation(dcmDatasets,
-                                                                             segmentations,
-                                                                             metadata,
-                                                                             skipEmptySlices,
-                                                                             useLabelIDAsSegmentNumber,
-                                                                             referencesGeometryCheck,
-                                                                             !noDicomValueChecks,
-                                                                             outputLabelMap);
 
-    if (result == NULL){
-      std::cerr << "ERROR: Conversion failed." << std::endl;
-      return EXIT_FAILURE;
-    } else {
-      DcmFileFormat segdocFF(result);
-      if(compress == "deflate"){
-        CHECK_COND(segdocFF.saveFile(outputSEGFileName.c_str(), EXS_DeflatedLittleEndianExplicit));
-      } else {
-        CHECK_COND(segdocFF.saveFile(outputSEGFileName.c_str(), EXS_LittleEndianExplicit));
+    vector<FractionalImageType::ConstPointer> fractionalMaps;
+    FractionalChannelsImageType::Pointer mapsImage;
+    if(numberOfChannels){
+      typedef itk::ImageFileReader<FractionalChannelsImageType> ChannelsReaderType;
+      ChannelsReaderType::Pointer reader = ChannelsReaderType::New();
+      reader->SetFileName(segImageFiles[0]);
+      {
+        dcmqi::Profiler::Scope profilerScope("readImages");
+        reader->Update();
       }
+      mapsImage = reader->GetOutput();
+      fractionalMaps = getChannelVolumes<float>(mapsImage);
+      cout << "Loaded " << numberOfChannels << " probability map volumes from " << segImageFiles[0] << endl;
+    } else if(!readSegmentationFiles<FractionalImageType>(segImageFiles, fractionalMaps))
+      return EXIT_FAILURE;
+    return convertFractionalSegmentations(dcmDatasets, fractionalMaps, metaInfo, outputSEGFileName,
+                                          compress, memoryEstimate.streamingWrite,
+                                          fractionalSegmentationType, static_cast<Uint16>(maxFractionalValue),
+                                          skipEmptySlices, referencesGeometryCheck, !noDicomValueChecks);
+  }
 
-      std::cout << "Saved segmentation as " << outputSEGFileName << endl;
-    }
+  // probability maps are read as float above
+  vector<ShortImageType::ConstPointer> segmentations;
+  // the 4D image owns the pixel data of the per-channel volumes; the channel
+  // adaptors of a vector image hold the image themselves
+  ShortChannelsImageType::Pointer channelsImage;
+  vector<ChannelAdaptorType::ConstPointer> channelSegmentations;
 
-    for(size_t i=0;i<dcmDatasets.size();i++) {
-      delete dcmDatasets[i];
+  if(vectorChannels){
+    dcmqi::Profiler::Scope profilerScope("readImages");
+    typedef itk::ImageFileReader<ShortVectorImageType> VectorReaderType;
+    VectorReaderType::Pointer reader = VectorReaderType::New();
+    reader->SetFileName(segImageFiles[0]);
+    reader->Update();
+    ShortVectorImageType::Pointer channelsVectorImage = reader->GetOutput();
+    for(unsigned channel=0;channel<numberOfChannels;channel++){
+      ChannelAdaptorType::Pointer adaptor = ChannelAdaptorType::New();
+      adaptor->SetImage(channelsVectorImage);
+      adaptor->SetExtractComponentIndex(channel);
+      channelSegmentations.push_back(adaptor.GetPointer());
     }
-    if (result != NULL)
-      delete result;
-    return EXIT_SUCCESS;
-  } catch (int e) {
-    std::cerr << "Fatal error encountered." << std::endl;
-    return EXIT_FAILURE;
+    cout << "Loaded " << numberOfChannels << " segmentation channels from " << segImageFiles[0] << endl;
+  } else if(numberOfChannels){
+    dcmqi::Profiler::Scope profilerScope("readImages");
+    typedef itk::ImageFileReader<ShortChannelsImageType> ChannelsReaderType;
+    ChannelsReaderType::Pointer reader = ChannelsReaderType::New();
+    reader->SetFileName(segImageFiles[0]);
+    reader->Update();
+    channelsImage = reader->GetOutput();
+    segmentations = getChannelVolumes<short>(channelsImage);
+    cout << "Loaded " << numberOfChannels << " segmentation volumes from " << segImageFiles[0] << endl;
+  }
+
+  if(vectorChannels)
+    return convertSegmentations(dcmDatasets, channelSegmentations, metaInfo, outputSEGFileName,
+                                compress, memoryEstimate.streamingWrite,
+                                skipEmptySlices, useLabelIDAsSegmentNumber, referencesGeometryCheck,
+                                !noDicomValueChecks, outputLabelMap);
+  if(numberOfChannels)
+    return convertSegmentations(dcmDatasets, segmentations, metaInfo, outputSEGFileName,
+                                compress, memoryEstimate.streamingWrite,
+                                skipEmptySlices, useLabelIDAsSegmentNumber, referencesGeometryCheck,
+                                !noDicomValueChecks, outputLabelMap);
+
+  switch(labelComponentType){
+    case itk::IOComponentEnum::UCHAR:
+      return convertSegmentationFiles<CharImageType>(dcmDatasets, segImageFiles, metaInfo, outputSEGFileName,
+                                                     compress, memoryEstimate.streamingWrite,
+                                                     skipEmptySlices, useLabelIDAsSegmentNumber, referencesGeometryCheck,
+                                                     !noDicomValueChecks, outputLabelMap);
+    case itk::IOComponentEnum::USHORT:
+      return convertSegmentationFiles<UShortLabelImageType>(dcmDatasets, segImageFiles, metaInfo, outputSEGFileName,
+                                                            compress, memoryEstimate.streamingWrite,
+                                                            skipEmptySlices, useLabelIDAsSegmentNumber, referencesGeometryCheck,
+                                                            !noDicomValueChecks, outputLabelMap);
+    case itk::IOComponentEnum::SHORT:
+      return convertSegmentationFiles<ShortImageType>(dcmDatasets, segImageFiles, metaInfo, outputSEGFileName,
+                                                      compress, memoryEstimate.streamingWrite,
+                                                      skipEmptySlices, useLabelIDAsSegmentNumber, referencesGeometryCheck,
+                                                      !noDicomValueChecks, outputLabelMap);
+    default:
+      return convertSegmentationFiles<IntLabelImageType>(dcmDatasets, segImageFiles, metaInfo, outputSEGFileName,
+                                                         compress, memoryEstimate.streamingWrite,
+                                                         skipEmptySlices, useLabelIDAsSegmentNumber, referencesGeometryCheck,
+                                                         !noDicomValueChecks, outputLabelMap);
   }
 }
@@ -4,7 +4,9 @@
 
 // DCMQI includes
 #undef HAVE_SSTREAM // Avoid redefinition warning
+#include "dcmqi/Compression.h"
 #include "dcmqi/Dicom2ItkConverterBin.h"
+#include "dcmqi/Instrumentation.h"
 #include "dcmqi/internal/VersionConfigure.h"
 
 // DCMTK includes
@@ -32,6 +34,7 @@ int writeImages(itk::SmartPointer<TImageType> itkImage,
       writer->SetFileName(imageFileNameSStream.str().c_str());
       writer->SetInput(itkImage);
       writer->SetUseCompression(1);
+      dcmqi::Profiler::Scope profilerScope("writeImage");
       writer->Update();
       cout << " ... done" << endl;
     } catch (itk::ExceptionObject & error) {
@@ -51,9 +54,12 @@ int main(int argc, char *argv[])
 
   PARSE_ARGS;
 
+  dcmqi::Profiler::Session profilerSession(profileFileName);
+
   if (verbose) {
     // Display DCMTK debug, warning, and error logs in the console
     dcmtk::log4cplus::BasicConfigurator::doConfigure();
+    dcmqi::Verbosity::setLevel(dcmqi::Verbosity::Detail);
   }
 
   if(helper::isUndefinedOrPathDoesNotExist(inputSEGFileName, "Input DICOM file")
@@ -64,7 +70,10 @@ int main(int argc, char *argv[])
 
   DcmFileFormat sliceFF;
   std::cout << "Loading DICOM SEG file " << inputSEGFileName << std::endl;
-  CHECK_COND(sliceFF.loadFile(inputSEGFileName.c_str()));
+  {
+    dcmqi::Profiler::Scope profilerScope("loadFile");
+    CHECK_COND(dcmqi::Compression::loadFile(sliceFF, inputSEGFileName));
+  }
   DcmDataset* dataset = sliceFF.getDataset();
 
   try {
@@ -0,0 +1,805 @@
+// DCMQI includes
+#include "ConversionJobs.h"
+
+#undef HAVE_SSTREAM // Avoid redefinition warning
+#include "dcmqi/Bin2Label.h"
+#include "dcmqi/Compression.h"
+#include "dcmqi/Dicom2ItkConverterBin.h"
+#include "dcmqi/Helper.h"
+#include "dcmqi/Itk2DicomConverter.h"
+#include "dcmqi/JSONSegmentationMetaInformationHandler.h"
+#include "dcmqi/MemoryBudget.h"
+#include "dcmqi/ParaMapConverter.h"
+#include "dcmqi/TID1500Reader.h"
+#include "dcmqi/TID1500Writer.h"
+
+// ITK includes
+#include <itkImageIOFactory.h>
+#include <itkSmartPointer.h>
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+typedef dcmqi::Helper helper;
+
+//-----------------------------------------------------------------------------
+// Job parameters, named like the command line flags of the converters
+
+string getString(const Json::Value& params, const char* name, const string& defaultValue = "")
+{
+  if(!params.isMember(name))
+    return defaultValue;
+  if(!params[name].isString())
+    throw JobError(string("parameter ") + name + " must be a string", InvalidParams);
+  return params[name].asString();
+}
+
+string requireString(const Json::Value& params, const char* name)
+{
+  const string value = getString(params, name);
+  if(value.empty())
+    throw JobError(string("missing parameter ") + name, InvalidParams);
+  return value;
+}
+
+bool getBool(const Json::Value& params, const char* name, bool defaultValue)
+{
+  if(!params.isMember(name))
+    return defaultValue;
+  if(!params[name].isBool())
+    throw JobError(string("parameter ") + name + " must be true or false", InvalidParams);
+  return params[name].asBool();
+}
+
+// Lists are given as array of strings, or as comma-separated string like on the command line
+vector<string> getStringList(const Json::Value& params, const char* name)
+{
+  vector<string> values;
+  if(!params.isMember(name))
+    return values;
+  const Json::Value& list = params[name];
+  if(list.isString()){
+    helper::tokenizeString(list.asString(), values, ",");
+  } else if(list.isArray()){
+    for(Json::ArrayIndex i=0;i<list.size();i++){
+      if(!list[i].isString())
+        throw JobError(string("parameter ") + name + " must be a list of strings", InvalidParams);
+      values.push_back(list[i].asString());
+    }
+  } else {
+    throw JobError(string("parameter ") + name + " must be a list of strings", InvalidParams);
+  }
+  return values;
+}
+
+void requirePath(const string& path)
+{
+  if(!helper::pathExists(path))
+    throw JobError("path does not exist: " + path, InvalidParams);
+}
+
+// Source images of inputDICOMList and inputDICOMDirectory
+vector<string> getSourceFiles(const Json::Value& params, JobContext& context)
+{
+  vector<string> fileNames = getStringList(params, "inputDICOMList");
+  const string directory = getString(params, "inputDICOMDirectory");
+  if(!directory.empty()){
+    requirePath(directory);
+    vector<string> directoryFiles = context.listDirectory(directory);
+    fileNames.insert(fileNames.end(), directoryFiles.begin(), directoryFiles.end());
+  }
+  if(fileNames.empty())
+    throw JobError("no input DICOM files specified (inputDICOMList or inputDICOMDirectory)", InvalidParams);
+  return fileNames;
+}
+
+void checkCondition(const OFCondition& condition, const string& what)
+{
+  if(condition.bad())
+    throw JobError(what + ": " + condition.text());
+}
+
+string readFile(const string& fileName)
+{
+  requirePath(fileName);
+  ifstream stream(fileName.c_str(), ios_base::binary);
+  return string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const string& fileName, const string& content)
+{
+  ofstream stream(fileName.c_str(), ios_base::binary);
+  stream << content;
+  if(!stream)
+    throw JobError("cannot write " + fileName);
+}
+
+//-----------------------------------------------------------------------------
+
+HeaderCache::HeaderCache(size_t capacity)
+  : files(capacity, readHeader)
+{
+}
+
+vector<DcmItem*> HeaderCache::loadDatasets(const vector<string>& fileNames)
+{
+  vector<DcmItem*> datasets;
+  std::set<OFString> sopInstanceUIDs;
+  for(size_t i=0;i<fileNames.size();i++){
+    std::shared_ptr<Header> header = files.get(fileNames[i]);
+    if(!header){
+      cerr << "Failed to read " << fileNames[i] << ". Skipping it." << endl;
+      continue;
+    }
+    if(!header->dataset){
+      cerr << "Source DICOM file does not contain PixelData, skipping: " << std::endl
+           << "  >>>   " << fileNames[i] << std::endl;
+      continue;
+    }
+    if(!sopInstanceUIDs.insert(header->sopInstanceUID).second){
+      cout << fileNames[i] << " with SOPInstanceUID: " << header->sopInstanceUID << " already exists" << endl;
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(header->copyMutex);
+    datasets.push_back(new DcmDataset(*header->dataset));
+  }
+  return datasets;
+}
+
+std::shared_ptr<HeaderCache::Header> HeaderCache::readHeader(const string& fileName)
+{
+  // parsing stops at the Pixel Data element, which is therefore never read;
+  // files with pixel data are recognized by their image dimensions instead
+  DcmFileFormat fileFormat;
+  if(fileFormat.loadFileUntilTag(fileName.c_str(), EXS_Unknown, EGL_noChange,
+                                 DCM_MaxReadLength, ERM_autoDetect, DCM_PixelData).bad())
+    return std::shared_ptr<Header>();
+  std::shared_ptr<Header> header = std::make_shared<Header>();
+  header->dataset.reset(fileFormat.getAndRemoveDataset());
+  if(!header->dataset->tagExistsWithValue(DCM_Rows) || !header->dataset->tagExistsWithValue(DCM_Columns)){
+    header->dataset.reset();
+    return header;
+  }
+  // large values are read on first access otherwise, which would tie the
+  // header to the file contents at that time
+  header->dataset->loadAllDataIntoMemory();
+  header->dataset->findAndGetOFString(DCM_SOPInstanceUID, header->sopInstanceUID);
+  return header;
+}
+
+MetadataCache::MetadataCache(size_t capacity)
+  : files(capacity, readMetadata)
+{
+}
+
+std::shared_ptr<MetadataCache::Metadata> MetadataCache::readMetadata(const string& fileName)
+{
+  std::shared_ptr<Metadata> metadata = std::make_shared<Metadata>();
+  metadata->text = readFile(fileName);
+  return metadata;
+}
+
+std::shared_ptr<MetadataCache::Metadata> MetadataCache::get(const string& fileName)
+{
+  requirePath(fileName);
+  std::shared_ptr<Metadata> metadata = files.get(fileName);
+  if(!metadata)
+    throw JobError("cannot read " + fileName, InvalidParams);
+  // parsed when first used, the text is enough for the parametric map converter
+  std::lock_guard<std::mutex> lock(metadata->planMutex);
+  if(metadata->root.isNull()){
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    string errors;
+    if(!reader->parse(metadata->text.data(), metadata->text.data() + metadata->text.size(), &metadata->root, &errors)){
+      metadata->root = Json::Value();
+      throw JobError("cannot parse " + fileName + ": " + errors, InvalidParams);
+    }
+  }
+  return metadata;
+}
+
+dcmqi::SegmentationMetadataPlan::ConstPointer MetadataCache::getSegmentationPlan(const string& fileName)
+{
+  std::shared_ptr<Metadata> metadata = get(fileName);
+  std::lock_guard<std::mutex> lock(metadata->planMutex);
+  if(!metadata->plan){
+    dcmqi::JSONSegmentationMetaInformationHandler metaInfo;
+    try {
+      metaInfo.read(Json::Value(metadata->root));
+    } catch (dcmqi::JSONReadErrorException&) {
+      throw JobError("invalid metadata in " + fileName, InvalidParams);
+    }
+    metadata->plan = dcmqi::SegmentationMetadataPlan::compile(metaInfo);
+    if(!metadata->plan)
+      throw JobError("invalid metadata in " + fileName, InvalidParams);
+  }
+  return metadata->plan;
+}
+
+JobContext::JobContext(size_t headerCacheSize, bool cacheDirectoryListings)
+  : headers(headerCacheSize), metadata(headerCacheSize ? 256 : 0),
+    cacheDirectoryListings(cacheDirectoryListings)
+{
+}
+
+vector<string> JobContext::listDirectory(const string& directory)
+{
+  if(!cacheDirectoryListings)
+    return helper::getFileListRecursively(directory);
+  {
+    std::lock_guard<std::mutex> lock(directoryMutex);
+    std::map<string, vector<string> >::const_iterator it = directoryListings.find(directory);
+    if(it != directoryListings.end())
+      return it->second;
+  }
+  vector<string> fileNames = helper::getFileListRecursively(directory);
+  std::lock_guard<std::mutex> lock(directoryMutex);
+  directoryListings[directory] = fileNames;
+  return fileNames;
+}
+
+Json::Value JobContext::getStatistics()
+{
+  Json::Value statistics;
+  statistics["headerCache"] = headers.getStatistics();
+  statistics["metadataCache"] = metadata.getStatistics();
+  return statistics;
+}
+
+// Source datasets of a job, released when the job is done
+class SourceDatasets {
+public:
+  explicit SourceDatasets(const vector<DcmItem*>& datasets) : datasets(datasets) {
+    if(datasets.empty())
+      throw JobError("no DICOM could be loaded from the specified list/directory");
+  }
+  ~SourceDatasets() {
+    for(size_t i=0;i<datasets.size();i++)
+      delete datasets[i];
+  }
+
+  const vector<DcmItem*> datasets;
+
+private:
+  SourceDatasets(const SourceDatasets&);
+  SourceDatasets& operator=(const SourceDatasets&);
+};
+
+//-----------------------------------------------------------------------------
+// Conversions. Every method reads its parameters, runs the conversion like the
+// command line tool of the same name and returns the result of the job.
+
+void saveDICOM(DcmDataset* dataset, const string& fileName, const string& compress)
+{
+  if(dataset == NULL)
+    throw JobError("conversion failed");
+  // the file takes over the dataset instead of copying it
+  DcmFileFormat fileFormat(dataset, OFFalse);
+  if(compress == "deflate"){
+    checkCondition(dcmqi::Compression::saveDeflated(fileFormat, fileName), "cannot write " + fileName);
+  } else if(compress == "rle"){
+    checkCondition(dcmqi::Compression::encodeRLE(fileFormat.getDataset()), "RLE compression failed");
+    checkCondition(fileFormat.saveFile(fileName.c_str(), EXS_RLELossless), "cannot write " + fileName);
+  } else {
+    checkCondition(fileFormat.saveFile(fileName.c_str(), EXS_LittleEndianExplicit), "cannot write " + fileName);
+  }
+}
+
+template<class ImageType>
+void writeImage(const ImageType* image, const string& fileName)
+{
+  typedef itk::ImageFileWriter<ImageType> WriterType;
+  typename WriterType::Pointer writer = WriterType::New();
+  writer->SetFileName(fileName.c_str());
+  writer->SetInput(image);
+  writer->SetUseCompression(1);
+  writer->Update();
+}
+
+template<typename TImageType, typename TNextFn>
+void writeImages(itk::SmartPointer<TImageType> image, TNextFn nextFn,
+                 const string& fileNamePrefix, const string& fileExtension, Json::Value& fileNames)
+{
+  for(size_t fileIndex=1; image; fileIndex++, image = nextFn()){
+    stringstream fileName;
+    fileName << fileNamePrefix << fileIndex << fileExtension;
+    writeImage<TImageType>(image.GetPointer(), fileName.str());
+    fileNames.append(fileName.str());
+  }
+}
+
+// Output directory and file name prefix as used by segimage2itkimage and paramap2itkimage
+string getOutputPrefix(const Json::Value& params)
+{
+  const string outputDirName = requireString(params, "outputDirectory");
+  requirePath(outputDirName);
+  const string prefix = getString(params, "prefix");
+  return outputDirName + "/" + (prefix.empty() ? "" : prefix + "-");
+}
+
+itk::ImageIOBase::Pointer readImageInformation(const string& fileName)
+{
+  itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO(fileName.c_str(), itk::IOFileModeEnum::ReadMode);
+  if(imageIO.IsNull())
+    throw JobError("cannot read " + fileName);
+  imageIO->SetFileName(fileName);
+  imageIO->ReadImageInformation();
+  return imageIO;
+}
+
+template<class ImageType>
+DcmDataset* convertLabelFiles(const vector<DcmItem*>& dcmDatasets, const vector<string>& segImageFiles,
+                              const dcmqi::SegmentationMetadataPlan& plan,
+                              const Json::Value& params, bool outputLabelMap)
+{
+  vector<typename ImageType::ConstPointer> segmentations;
+  for(size_t i=0;i<segImageFiles.size();i++){
+    typename itk::ImageFileReader<ImageType>::Pointer reader = itk::ImageFileReader<ImageType>::New();
+    reader->SetFileName(segImageFiles[i]);
+    reader->Update();
+    typename ImageType::Pointer labelImage = reader->GetOutput();
+    segmentations.push_back(labelImage.GetPointer());
+
+    const typename ImageType::SizeType referenceSize = segmentations[0]->GetLargestPossibleRegion().GetSize();
+    const typename ImageType::SizeType size = labelImage->GetLargestPossibleRegion().GetSize();
+    if(referenceSize[0] != size[0] || referenceSize[1] != size[1])
+      throw JobError("in-plane dimensions of segmentations are inconsistent", InvalidParams);
+  }
+
+  return dcmqi::Itk2DicomConverter::itkimage2dcmSegmentation(dcmDatasets, segmentations, plan,
+                                                             getBool(params, "skip", true),
+                                                             getBool(params, "useLabelIDAsSegmentNumber", false),
+                                                             getBool(params, "referencesGeometryCheck", true),
+                                                             !getBool(params, "noDicomValueChecks", false),
+                                                             outputLabelMap);
+}
+
+Json::Value itkimage2segimage(const Json::Value& params, JobContext& context)
+{
+  vector<string> segImageFiles = getStringList(params, "inputImageList");
+  const string metaDataFileName = requireString(params, "inputMetadata");
+  const string outputSEGFileName = requireString(params, "outputDICOM");
+  const string segmentationType = getString(params, "segmentationType", "binary");
+  const string compress = getString(params, "compress", "none");
+
+  if(segImageFiles.empty())
+    throw JobError("missing parameter inputImageList", InvalidParams);
+  for(size_t i=0;i<segImageFiles.size();i++)
+    requirePath(segImageFiles[i]);
+  if(segmentationType != "binary" && segmentationType != "labelmap")
+    throw JobError("segmentationType must be 'binary' or 'labelmap', fractional segmentations are only converted by itkimage2segimage", InvalidParams);
+  if(compress == "rle" && segmentationType == "binary")
+    throw JobError("compress rle requires segmentationType labelmap", InvalidParams);
+
+  const itk::IOComponentEnum labelComponentType = dcmqi::Helper::getLabelComponentType(segImageFiles);
+  if(labelComponentType == itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE)
+    throw JobError("cannot read the label images, multi-channel segmentations are only converted by itkimage2segimage", InvalidParams);
+
+  // metadata that does not depend on the order of the input files is compiled
+  // once for all jobs that use it
+  dcmqi::SegmentationMetadataPlan::ConstPointer plan;
+  {
+    std::shared_ptr<MetadataCache::Metadata> metadata = context.metadata.get(metaDataFileName);
+    const Json::Value& metaRoot = metadata->root;
+    if(metaRoot.isMember("segmentAttributes") && metaRoot["segmentAttributes"].size() != segImageFiles.size())
+      throw JobError("number of items in the \"segmentAttributes\" metadata array should match the number of input segmentation files", InvalidParams);
+    if(metaRoot.isMember("segmentAttributesFileMapping")){
+      if(!dcmqi::Helper::applySegmentAttributesFileMapping(metaRoot, segImageFiles))
+        throw JobError("segmentAttributesFileMapping does not match the input files", InvalidParams);
+      dcmqi::JSONSegmentationMetaInformationHandler metaInfo;
+      try {
+        metaInfo.read(Json::Value(metaRoot));
+      } catch (dcmqi::JSONReadErrorException&) {
+        throw JobError("invalid metadata in " + metaDataFileName, InvalidParams);
+      }
+      plan = dcmqi::SegmentationMetadataPlan::compile(metaInfo);
+      if(!plan)
+        throw JobError("invalid metadata in " + metaDataFileName, InvalidParams);
+    }
+  }
+  if(!plan)
+    plan = context.metadata.getSegmentationPlan(metaDataFileName);
+
+  SourceDatasets sources(context.headers.loadDatasets(getSourceFiles(params, context)));
+
+  const bool outputLabelMap = segmentationType == "labelmap";
+  DcmDataset* result = NULL;
+  switch(labelComponentType){
+    case itk::IOComponentEnum::UCHAR:
+      result = convertLabelFiles<CharImageType>(sources.datasets, segImageFiles, *plan, params, outputLabelMap);
+      break;
+    case itk::IOComponentEnum::USHORT:
+      result = convertLabelFiles<UShortLabelImageType>(sources.datasets, segImageFiles, *plan, params, outputLabelMap);
+      break;
+    case itk::IOComponentEnum::SHORT:
+      result = convertLabelFiles<ShortImageType>(sources.datasets, segImageFiles, *plan, params, outputLabelMap);
+      break;
+    default:
+      result = convertLabelFiles<IntLabelImageType>(sources.datasets, segImageFiles, *plan, params, outputLabelMap);
+      break;
+  }
+  saveDICOM(result, outputSEGFileName, compress);
+
+  Json::Value response;
+  response["outputDICOM"] = outputSEGFileName;
+  response["sourceImages"] = static_cast<Json::UInt64>(sources.datasets.size());
+  return response;
+}
+
+Json::Value segimage2itkimage(const Json::Value& params, JobContext&)
+{
+  const string inputSEGFileName = requireString(params, "inputDICOM");
+  requirePath(inputSEGFileName);
+  const string outputPrefix = getOutputPrefix(params);
+  const string fileExtension = helper::getFileExtensionFromType(getString(params, "outputType", "nrrd"));
+
+  DcmFileFormat sliceFF;
+  checkCondition(dcmqi::Compression::loadFile(sliceFF, inputSEGFileName), "cannot read " + inputSEGFileName);
+  DcmDataset* dataset = sliceFF.getDataset();
+
+  std::unique_ptr<dcmqi::Dicom2ItkConverterBase> converter(dcmqi::Dicom2ItkConverter::getConverter(dataset));
+  if(!converter)
+    throw JobError(inputSEGFileName + " is not a DICOM segmentation", InvalidParams);
+  std::string metaInfo;
+  checkCondition(converter->dcmSegmentation2itkimage(dataset, metaInfo, getBool(params, "mergeSegments", false)),
+                 "failed to convert DICOM SEG to ITK image");
+
+  Json::Value response;
+  Json::Value& outputImages = response["outputImages"] = Json::Value(Json::arrayValue);
+  if(converter->bytesPerPixel() > 1 || !converter->isLabelmap()){
+    writeImages(converter->begin16Bit(), [&]() { return converter->next16Bit(); },
+                outputPrefix, fileExtension, outputImages);
+  } else {
+    writeImages(converter->begin8Bit(), [&]() { return converter->next8Bit(); },
+                outputPrefix, fileExtension, outputImages);
+  }
+  writeFile(outputPrefix + "meta.json", metaInfo);
+  response["outputMetadata"] = outputPrefix + "meta.json";
+  return response;
+}
+
+template<class ImageType>
+DcmDataset* convertParametricMap(const string& inputFileName, const vector<DcmItem*>& dcmDatasets,
+                                 const string& metadata, bool doDicomValueChecks)
+{
+  typedef itk::ImageFileReader<ImageType> ReaderType;
+  typename ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(inputFileName.c_str());
+  reader->Update();
+  typename ImageType::Pointer parametricMapImage = reader->GetOutput();
+  return dcmqi::ParaMapConverter::itkimage2paramap(parametricMapImage, dcmDatasets, metadata, doDicomValueChecks);
+}
+
+template<class PixelType>
+DcmDataset* convertParametricMapOfPixelType(const itk::ImageIOBase::Pointer& imageIO, const string& inputFileName,
+                                            const vector<DcmItem*>& dcmDatasets, const string& metadata,
+                                            bool doDicomValueChecks)
+{
+  if(imageIO->GetNumberOfDimensions() == 4)
+    return convertParametricMap<itk::Image<PixelType, 4> >(inputFileName, dcmDatasets, metadata, doDicomValueChecks);
+  return convertParametricMap<itk::Image<PixelType, 3> >(inputFileName, dcmDatasets, metadata, doDicomValueChecks);
+}
+
+Json::Value itkimage2paramap(const Json::Value& params, JobContext& context)
+{
+  const string inputFileName = requireString(params, "inputImage");
+  requirePath(inputFileName);
+  std::shared_ptr<MetadataCache::Metadata> metadata = context.metadata.get(requireString(params, "inputMetadata"));
+  const string outputParaMapFileName = requireString(params, "outputDICOM");
+  const bool doDicomValueChecks = !getBool(params, "noDicomValueChecks", false);
+
+  itk::ImageIOBase::Pointer imageIO = readImageInformation(inputFileName);
+  if(imageIO->GetNumberOfComponents() > 1)
+    throw JobError("vector images are only converted by itkimage2paramap", InvalidParams);
+
+  SourceDatasets sources(context.headers.loadDatasets(getSourceFiles(params, context)));
+
+  DcmDataset* result = NULL;
+  switch(imageIO->GetComponentType()){
+    case itk::IOComponentEnum::CHAR:
+    case itk::IOComponentEnum::SHORT:
+      result = convertParametricMapOfPixelType<Sint16>(imageIO, inputFileName, sources.datasets, metadata->text, doDicomValueChecks);
+      break;
+    case itk::IOComponentEnum::UCHAR:
+    case itk::IOComponentEnum::USHORT:
+      result = convertParametricMapOfPixelType<Uint16>(imageIO, inputFileName, sources.datasets, metadata->text, doDicomValueChecks);
+      break;
+    case itk::IOComponentEnum::DOUBLE:
+      result = convertParametricMapOfPixelType<DoublePixelType>(imageIO, inputFileName, sources.datasets, metadata->text, doDicomValueChecks);
+      break;
+    default:
+      result = convertParametricMapOfPixelType<FloatPixelType>(imageIO, inputFileName, sources.datasets, metadata->text, doDicomValueChecks);
+      break;
+  }
+  saveDICOM(result, outputParaMapFileName, "none");
+
+  Json::Value response;
+  response["outputDICOM"] = outputParaMapFileName;
+  response["sourceImages"] = static_cast<Json::UInt64>(sources.datasets.size());
+  return response;
+}
+
+Json::Value paramap2itkimage(const Json::Value& params, JobContext&)
+{
+  const string inputFileName = requireString(params, "inputDICOM");
+  requirePath(inputFileName);
+  const string outputPrefix = getOutputPrefix(params);
+  const string fileExtension = helper::getFileExtensionFromType(getString(params, "outputType", "nrrd"));
+
+  DcmFileFormat sliceFF;
+  checkCondition(dcmqi::Compression::loadFile(sliceFF, inputFileName), "cannot read " + inputFileName);
+  pair<Float4DImageType::Pointer, string> result = dcmqi::ParaMapConverter::paramap2itkimage4D(sliceFF.getDataset());
+  if(result.first.IsNull())
+    throw JobError("failed to convert parametric map " + inputFileName);
+
+  const string imageFileName = outputPrefix + "pmap" + fileExtension;
+  if(result.first->GetLargestPossibleRegion().GetSize()[3] > 1)
+    writeImage<Float4DImageType>(result.first.GetPointer(), imageFileName);
+  else
+    writeImage<FloatImageType>(dcmqi::ParaMapConverter::getFirstVolume(result.first).GetPointer(), imageFileName);
+  writeFile(outputPrefix + "meta.json", result.second);
+
+  Json::Value response;
+  response["outputImages"].append(imageFileName);
+  response["outputMetadata"] = outputPrefix + "meta.json";
+  return response;
+}
+
+Json::Value bin2labelsegimage(const Json::Value& params, JobContext&)
+{
+  const string inputSEGFileName = requireString(params, "inputDICOM");
+  requirePath(inputSEGFileName);
+  const string outputSEGFileName = requireString(params, "outputDICOM");
+  const string compress = getString(params, "compress", "none");
+
+  DcmFileFormat sliceFF;
+  checkCondition(dcmqi::Compression::loadFile(sliceFF, inputSEGFileName), "cannot read " + inputSEGFileName);
+
+  dcmqi::DcmBinToLabelConverter converter;
+  dcmqi::DcmBinToLabelConverter::ConversionFlags convFlags;
+  if(getBool(params, "usePalette", false)){
+    convFlags.m_outputColorModel = DcmSegTypes::SLCM_PALETTE;
+    convFlags.m_forcePalette = OFTrue;
+  } else {
+    convFlags.m_outputColorModel = DcmSegTypes::SLCM_MONOCHROME2;
+  }
+  if(getBool(params, "force16Bit", false))
+    convFlags.m_force16Bit = OFTrue;
+  if(getBool(params, "noCheck", false)){
+    convFlags.m_checkExportFG = OFFalse;
+    convFlags.m_checkExportValues = OFFalse;
+  }
+  converter.setInput(sliceFF.getDataset());
+  checkCondition(converter.convert(convFlags), "failed to convert DICOM binary SEG to DICOM labelmap SEG");
+
+  OFshared_ptr<DcmSegmentation> labelSeg;
+  checkCondition(converter.getOutputSegmentation(labelSeg), "failed to get output label segmentation");
+  if(!convFlags.m_checkExportFG)
+    labelSeg->getFunctionalGroups().setCheckOnWrite(OFFalse);
+  if(!convFlags.m_checkExportValues)
+    labelSeg->setValueCheckOnWrite(OFFalse);
+
+  std::unique_ptr<DcmDataset> result(new DcmDataset());
+  checkCondition(labelSeg->writeDataset(*result), "failed to write label map segmentation");
+  saveDICOM(result.release(), outputSEGFileName, compress);
+
+  Json::Value response;
+  response["outputDICOM"] = outputSEGFileName;
+  return response;
+}
+
+// The metadata is returned in the response, and written to outputMetadata if given
+Json::Value tid1500reader(const Json::Value& params, JobContext&)
+{
+  const string inputSRFileName = requireString(params, "inputDICOM");
+  requirePath(inputSRFileName);
+  const string metaDataFileName = getString(params, "outputMetadata");
+
+  DcmFileFormat sliceFF;
+  checkCondition(dcmqi::Compression::loadFile(sliceFF, inputSRFileName), "cannot read " + inputSRFileName);
+  Json::Value metaRoot;
+  DSRDocument doc;
+  TID1500Reader::readReport(*sliceFF.getDataset(), doc, metaRoot);
+
+  Json::Value response;
+  if(!metaDataFileName.empty()){
+    stringstream metadata;
+    metadata << metaRoot;
+    writeFile(metaDataFileName, metadata.str());
+    response["outputMetadata"] = metaDataFileName;
+  }
+  response["metadata"] = metaRoot;
+  return response;
+}
+
+Json::Value tid1500writer(const Json::Value& params, JobContext& context)
+{
+  const string metaDataFileName = requireString(params, "inputMetadata");
+  const string outputSRFileName = requireString(params, "outputDICOM");
+  const string imageLibraryDataDir = getString(params, "inputImageLibraryDirectory");
+  const string compositeContextDataDir = getString(params, "inputCompositeContextDirectory");
+
+  std::shared_ptr<MetadataCache::Metadata> metadata = context.metadata.get(metaDataFileName);
+  DcmDataset* result = TID1500Writer::writeReport(metadata->root, imageLibraryDataDir, compositeContextDataDir);
+  if(result == NULL)
+    throw JobError("failed to create the report described by " + metaDataFileName);
+  DcmFileFormat fileFormat(result, OFFalse);
+  checkCondition(fileFormat.saveFile(outputSRFileName.c_str(), EXS_LittleEndianExplicit), "cannot write " + outputSRFileName);
+
+  Json::Value response;
+  response["outputDICOM"] = outputSRFileName;
+  return response;
+}
+
+//-----------------------------------------------------------------------------
+
+const std::map<string, JobMethod>& getJobMethodMap()
+{
+  static const std::map<string, JobMethod> methods = {
+    {"itkimage2segimage", itkimage2segimage},
+    {"segimage2itkimage", segimage2itkimage},
+    {"itkimage2paramap", itkimage2paramap},
+    {"paramap2itkimage", paramap2itkimage},
+    {"bin2labelsegimage", bin2labelsegimage},
+    {"tid1500reader", tid1500reader},
+    {"tid1500writer", tid1500writer}
+  };
+  return methods;
+}
+
+JobMethod findJobMethod(const string& method)
+{
+  const std::map<string, JobMethod>& methods = getJobMethodMap();
+  std::map<string, JobMethod>::const_iterator it = methods.find(method);
+  return it == methods.end() ? NULL : it->second;
+}
+
+vector<string> getJobMethods()
+{
+  vector<string> names;
+  const std::map<string, JobMethod>& methods = getJobMethodMap();
+  for(std::map<string, JobMethod>::const_iterator it = methods.begin(); it != methods.end(); ++it)
+    names.push_back(it->first);
+  return names;
+}
+
+JobOutcome runJob(const string& method, const Json::Value& params, JobContext& context)
+{
+  const std::chrono::steady_clock::time_point jobStart = std::chrono::steady_clock::now();
+  JobOutcome outcome;
+  outcome.errorCode = 0;
+  try {
+    const JobMethod jobMethod = findJobMethod(method);
+    if(!jobMethod)
+      throw JobError("unknown method " + method, MethodNotFound);
+    outcome.result = jobMethod(params, context);
+  } catch (const JobError& e) {
+    outcome.errorCode = e.code;
+    outcome.errorMessage = e.what();
+  } catch (const itk::ExceptionObject& e) {
+    outcome.errorCode = ConversionError;
+    outcome.errorMessage = e.GetDescription();
+  } catch (const std::exception& e) {
+    outcome.errorCode = ConversionError;
+    outcome.errorMessage = e.what();
+  } catch (int) {
+    // CHECK_COND of the converters
+    outcome.errorCode = ConversionError;
+    outcome.errorMessage = "Fatal error encountered.";
+  }
+  outcome.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - jobStart).count();
+  if(!outcome.errorCode)
+    outcome.result["seconds"] = outcome.seconds;
+  return outcome;
+}
+
+//-----------------------------------------------------------------------------
+// Memory estimates, computed from the image and DICOM headers before a job is
+// started. Segmentation exports use the estimate of dcmqi::MemoryBudget that
+// itkimage2segimage checks --maxMemory against. For the other conversions the
+// estimate counts the representations of the voxels that are held at the same
+// time; it is meant for scheduling, not as a bound.
+
+namespace {
+
+// process overhead of a job: dictionaries, codecs, source headers
+const size_t BaseJobMemory = 64 * 1024 * 1024;
+
+size_t getImageFileBytes(const string& fileName, size_t& numberOfVoxels)
+{
+  itk::ImageIOBase::Pointer imageIO = readImageInformation(fileName);
+  numberOfVoxels = static_cast<size_t>(imageIO->GetImageSizeInPixels());
+  return static_cast<size_t>(imageIO->GetImageSizeInBytes());
+}
+
+// Size of the frames of a DICOM object, read from its header
+size_t getDICOMFrameBytes(const string& fileName, size_t& numberOfPixels)
+{
+  DcmFileFormat fileFormat;
+  checkCondition(fileFormat.loadFileUntilTag(fileName.c_str(), EXS_Unknown, EGL_noChange,
+                                             DCM_MaxReadLength, ERM_autoDetect, DCM_PixelData),
+                 "cannot read " + fileName);
+  DcmDataset* dataset = fileFormat.getDataset();
+  Uint16 rows = 0, columns = 0, bitsAllocated = 8;
+  Sint32 numberOfFrames = 1;
+  dataset->findAndGetUint16(DCM_Rows, rows);
+  dataset->findAndGetUint16(DCM_Columns, columns);
+  dataset->findAndGetUint16(DCM_BitsAllocated, bitsAllocated);
+  dataset->findAndGetSint32(DCM_NumberOfFrames, numberOfFrames);
+  numberOfPixels = static_cast<size_t>(rows) * columns * std::max<Sint32>(numberOfFrames, 1);
+  return (numberOfPixels * bitsAllocated + 7) / 8;
+}
+
+size_t estimateSegmentationExport(const Json::Value& params, JobContext& context)
+{
+  const vector<string> segImageFiles = getStringList(params, "inputImageList");
+  dcmqi::MemoryBudget::SegmentationInput input;
+  if(!dcmqi::MemoryBudget::readSegmentationGeometry(segImageFiles, input))
+    throw JobError("cannot read the label images");
+  input.segmentationType = getString(params, "segmentationType", "binary") == "labelmap"
+                           ? DcmSegTypes::ST_LABELMAP : DcmSegTypes::ST_BINARY;
+  input.volumes = segImageFiles.size();
+  // the label images are read with the pixel type of convertLabelFiles
+  switch(dcmqi::Helper::getLabelComponentType(segImageFiles)){
+    case itk::IOComponentEnum::UCHAR:
+      input.bytesPerVoxel = 1;
+      break;
+    case itk::IOComponentEnum::USHORT:
+    case itk::IOComponentEnum::SHORT:
+      input.bytesPerVoxel = 2;
+      break;
+    default:
+      input.bytesPerVoxel = 4;
+      break;
+  }
+  size_t maxLabelID = 0;
+  std::shared_ptr<MetadataCache::Metadata> metadata = context.metadata.get(requireString(params, "inputMetadata"));
+  dcmqi::MemoryBudget::countSegments(metadata->root, input.segments, maxLabelID);
+  input.labelmap16Bit = (getBool(params, "useLabelIDAsSegmentNumber", false) ? maxLabelID : input.segments) > 255;
+  input.compress = getString(params, "compress", "none");
+  // the label images are released when convertLabelFiles returns, before saveDICOM
+  input.inputsReleasedBeforeSave = true;
+  // saveDICOM deflates in parallel blocks
+  return dcmqi::MemoryBudget::estimateSegmentation(input, false).peak;
+}
+
+size_t estimate(const string& method, const Json::Value& params, JobContext& context)
+{
+  size_t numberOfVoxels = 0;
+  if(method == "itkimage2segimage")
+    return estimateSegmentationExport(params, context);
+  // input image, then its frames in the Parametric Map and in the written dataset, as float
+  if(method == "itkimage2paramap")
+    return getImageFileBytes(requireString(params, "inputImage"), numberOfVoxels) + numberOfVoxels * 4 * 2;
+  // SEG file, the unpacked frames (one byte per pixel) and the label images (two bytes per voxel)
+  if(method == "segimage2itkimage")
+    return getDICOMFrameBytes(requireString(params, "inputDICOM"), numberOfVoxels) + numberOfVoxels * 3;
+  // SEG file, its unpacked frames and the labelmap frames in the DcmSegmentation and the dataset (16 bit)
+  if(method == "bin2labelsegimage")
+    return getDICOMFrameBytes(requireString(params, "inputDICOM"), numberOfVoxels) + numberOfVoxels * 5;
+  // Parametric Map file and the float image
+  if(method == "paramap2itkimage")
+    return getDICOMFrameBytes(requireString(params, "inputDICOM"), numberOfVoxels) + numberOfVoxels * 4;
+  // the metadata as JSON tree, SR document tree and dataset; a rough allowance of
+  // 20 bytes per character, small next to BaseJobMemory in any case
+  if(method == "tid1500writer")
+    return context.metadata.get(requireString(params, "inputMetadata"))->text.size() * 20;
+  return 0;
+}
+
+}
+
+size_t estimateJobMemory(const string& method, const Json::Value& params, JobContext& context)
+{
+  try {
+    return BaseJobMemory + estimate(method, params, context);
+  } catch (...) {
+    // the job fails as soon as it runs, nothing to reserve
+    return BaseJobMemory;
+  }
+}
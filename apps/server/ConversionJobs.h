@@ -0,0 +1,232 @@
+#ifndef DCMQI_CONVERSIONJOBS_H
+#define DCMQI_CONVERSIONJOBS_H
+
+// DCMQI includes
+#include "dcmqi/SegmentationMetadataPlan.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdatset.h>
+
+// STD includes
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <json/json.h>
+
+using namespace std;
+
+// Conversion jobs of dcmqiserver and dcmqibatch: every job runs one of the
+// conversions of the command line tools, with parameters named like the
+// command line flags, and returns its result as JSON.
+
+// Error codes of failed jobs (JSON-RPC 2.0)
+const int ParseError = -32700;
+const int InvalidRequest = -32600;
+const int MethodNotFound = -32601;
+const int InvalidParams = -32602;
+const int ConversionError = -32000;
+
+// Failure of a job
+class JobError : public std::runtime_error {
+public:
+  explicit JobError(const string& message, int code = ConversionError)
+    : std::runtime_error(message), code(code) {}
+
+  const int code;
+};
+
+// Objects read from files, kept by path until the file changes (size or
+// modification time). Beyond the capacity the least recently used objects are
+// dropped.
+template<class Entry>
+class FileCache {
+public:
+  typedef std::shared_ptr<Entry> EntryPointer;
+  /// Reads the object of a file, NULL if the file cannot be read
+  typedef std::function<EntryPointer(const string& fileName)> ReadFunction;
+
+  FileCache(size_t capacity, ReadFunction read) : capacity(capacity), read(read), hits(0), misses(0) {}
+
+  /// Cached object of a file, read if not cached or outdated; NULL if the file cannot be read
+  EntryPointer get(const string& fileName)
+  {
+    std::error_code sizeError, timeError;
+    const uintmax_t fileSize = std::filesystem::file_size(fileName, sizeError);
+    const std::filesystem::file_time_type modificationTime = std::filesystem::last_write_time(fileName, timeError);
+    if(sizeError || timeError)
+      return EntryPointer();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      typename EntryMap::iterator it = entries.find(fileName);
+      if(it != entries.end() && it->second.fileSize == fileSize && it->second.modificationTime == modificationTime){
+        recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, it->second.position);
+        hits++;
+        return it->second.entry;
+      }
+      misses++;
+    }
+
+    // read without holding the lock, so that jobs can read files at the same time
+    EntryPointer entry = read(fileName);
+    if(!entry || !capacity)
+      return entry;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    typename EntryMap::iterator it = entries.find(fileName);
+    if(it != entries.end()){
+      recentlyUsed.erase(it->second.position);
+      entries.erase(it);
+    }
+    recentlyUsed.push_front(fileName);
+    CachedFile& cachedFile = entries[fileName];
+    cachedFile.entry = entry;
+    cachedFile.fileSize = fileSize;
+    cachedFile.modificationTime = modificationTime;
+    cachedFile.position = recentlyUsed.begin();
+    while(entries.size() > capacity){
+      entries.erase(recentlyUsed.back());
+      recentlyUsed.pop_back();
+    }
+    return entry;
+  }
+
+  Json::Value getStatistics()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    Json::Value statistics;
+    statistics["files"] = static_cast<Json::UInt64>(entries.size());
+    statistics["capacity"] = static_cast<Json::UInt64>(capacity);
+    statistics["hits"] = static_cast<Json::UInt64>(hits);
+    statistics["misses"] = static_cast<Json::UInt64>(misses);
+    return statistics;
+  }
+
+private:
+  struct CachedFile {
+    EntryPointer entry;
+    uintmax_t fileSize;
+    std::filesystem::file_time_type modificationTime;
+    std::list<string>::iterator position;
+  };
+  typedef std::map<string, CachedFile> EntryMap;
+
+  const size_t capacity;
+  const ReadFunction read;
+  std::mutex mutex;
+  EntryMap entries;
+  /// file names, most recently used first
+  std::list<string> recentlyUsed;
+  size_t hits;
+  size_t misses;
+};
+
+// Headers of source image files (all attributes but Pixel Data, which the
+// converters do not use), so that a series referenced by many conversions is
+// read only once
+class HeaderCache {
+public:
+  explicit HeaderCache(size_t capacity);
+
+  /// Same as Helper::loadDatasets(): files without Pixel Data and repeated SOP
+  /// instances are skipped. The datasets are copies owned by the caller.
+  vector<DcmItem*> loadDatasets(const vector<string>& fileNames);
+
+  Json::Value getStatistics() { return files.getStatistics(); }
+
+private:
+  struct Header {
+    /// NULL if the file has no Pixel Data (no Rows and Columns)
+    std::unique_ptr<DcmDataset> dataset;
+    OFString sopInstanceUID;
+    /// copying a dataset moves its element cursor, so copies are made one at a time
+    std::mutex copyMutex;
+  };
+
+  static std::shared_ptr<Header> readHeader(const string& fileName);
+
+  FileCache<Header> files;
+};
+
+// Metadata files (JSON), parsed once. Segmentation metadata is compiled into a
+// SegmentationMetadataPlan on first use, so that all segmentations described
+// by the same file share one plan.
+class MetadataCache {
+public:
+  explicit MetadataCache(size_t capacity);
+
+  struct Metadata {
+    string text;
+    Json::Value root;
+
+    std::mutex planMutex;
+    dcmqi::SegmentationMetadataPlan::ConstPointer plan;
+  };
+
+  /// Parsed metadata file, throws JobError if it cannot be read or parsed
+  std::shared_ptr<Metadata> get(const string& fileName);
+
+  /// Plan of a segmentation metadata file, throws JobError if the metadata is not valid
+  dcmqi::SegmentationMetadataPlan::ConstPointer getSegmentationPlan(const string& fileName);
+
+  Json::Value getStatistics() { return files.getStatistics(); }
+
+private:
+  static std::shared_ptr<Metadata> readMetadata(const string& fileName);
+
+  FileCache<Metadata> files;
+};
+
+// State shared by the jobs of a process
+class JobContext {
+public:
+  /// Directory listings are only cached if the directories do not change
+  /// while the process runs (dcmqibatch), the server lists them for every job
+  JobContext(size_t headerCacheSize, bool cacheDirectoryListings);
+
+  HeaderCache headers;
+  MetadataCache metadata;
+
+  /// Files of a directory and its subdirectories
+  vector<string> listDirectory(const string& directory);
+
+  Json::Value getStatistics();
+
+private:
+  const bool cacheDirectoryListings;
+  std::mutex directoryMutex;
+  std::map<string, vector<string> > directoryListings;
+};
+
+typedef Json::Value (*JobMethod)(const Json::Value& params, JobContext& context);
+
+/// Conversion of the given name (the name of the command line tool), NULL if there is none
+JobMethod findJobMethod(const string& method);
+
+/// Names of all conversions
+vector<string> getJobMethods();
+
+// Outcome of a job
+struct JobOutcome {
+  /// result of the conversion, with the run time in "seconds"
+  Json::Value result;
+  /// 0 if the job succeeded
+  int errorCode;
+  string errorMessage;
+  double seconds;
+};
+
+/// Runs a job; errors of the conversion are returned, not thrown
+JobOutcome runJob(const string& method, const Json::Value& params, JobContext& context);
+
+/// Rough peak memory of a job in bytes, estimated from the headers of its inputs
+size_t estimateJobMemory(const string& method, const Json::Value& params, JobContext& context);
+
+#endif //DCMQI_CONVERSIONJOBS_H
@@ -0,0 +1,394 @@
+// CLP includes
+#include "dcmqibatchCLP.h"
+
+// DCMQI includes
+#undef HAVE_SSTREAM // Avoid redefinition warning
+#include "ConversionJobs.h"
+#include "dcmqi/Helper.h"
+#include "dcmqi/internal/VersionConfigure.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcrledrg.h>
+#include <dcmtk/dcmdata/dcrleerg.h>
+#include <dcmtk/oflog/configrt.h>
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+typedef dcmqi::Helper helper;
+
+// Job of the manifest
+struct BatchJob {
+  string id;
+  string method;
+  Json::Value params;
+};
+
+//-----------------------------------------------------------------------------
+// Manifests
+
+// Parameters of the "defaults" object are used by every job that does not set them
+bool readJSONManifest(const string& fileName, vector<BatchJob>& jobs)
+{
+  Json::Value root;
+  {
+    ifstream stream(fileName.c_str(), ios_base::binary);
+    Json::CharReaderBuilder builder;
+    string errors;
+    if(!Json::parseFromStream(builder, stream, &root, &errors)){
+      cerr << "ERROR: cannot parse " << fileName << ": " << errors << endl;
+      return false;
+    }
+  }
+  Json::Value defaults(Json::objectValue);
+  Json::Value jobList = root;
+  if(root.isObject()){
+    defaults = root.get("defaults", Json::Value(Json::objectValue));
+    jobList = root["jobs"];
+  }
+  if(!jobList.isArray() || !defaults.isObject()){
+    cerr << "ERROR: " << fileName << " must contain an array of jobs, or an object with \"defaults\" and \"jobs\"" << endl;
+    return false;
+  }
+
+  for(Json::ArrayIndex i=0;i<jobList.size();i++){
+    const Json::Value& item = jobList[i];
+    if(!item.isObject() || !item["method"].isString()
+       || (item.isMember("params") && !item["params"].isObject())){
+      cerr << "ERROR: job " << i+1 << " of " << fileName << " needs a \"method\" and an object of \"params\"" << endl;
+      return false;
+    }
+    BatchJob job;
+    job.id = item.isMember("id") ? item["id"].asString() : std::to_string(i+1);
+    job.method = item["method"].asString();
+    job.params = item.get("params", Json::Value(Json::objectValue));
+    const vector<string> names = defaults.getMemberNames();
+    for(size_t n=0;n<names.size();n++)
+      if(!job.params.isMember(names[n]))
+        job.params[names[n]] = defaults[names[n]];
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+// Fields of a CSV line; quoted fields may contain separators and "" for quotes
+vector<string> splitCSVLine(const string& line)
+{
+  vector<string> fields(1);
+  bool quoted = false;
+  for(size_t i=0;i<line.size();i++){
+    const char c = line[i];
+    if(quoted){
+      if(c == '"' && i+1 < line.size() && line[i+1] == '"'){
+        fields.back() += '"';
+        i++;
+      } else if(c == '"'){
+        quoted = false;
+      } else {
+        fields.back() += c;
+      }
+    } else if(c == '"'){
+      quoted = true;
+    } else if(c == ','){
+      fields.push_back(string());
+    } else if(c != '\r'){
+      fields.back() += c;
+    }
+  }
+  return fields;
+}
+
+// The header names the parameters; "method" is required, "id" is optional.
+// Empty cells are left out, true and false are flags.
+bool readCSVManifest(const string& fileName, vector<BatchJob>& jobs)
+{
+  ifstream stream(fileName.c_str(), ios_base::binary);
+  string line;
+  if(!std::getline(stream, line)){
+    cerr << "ERROR: " << fileName << " is empty" << endl;
+    return false;
+  }
+  const vector<string> columns = splitCSVLine(line);
+  if(std::find(columns.begin(), columns.end(), "method") == columns.end()){
+    cerr << "ERROR: " << fileName << " has no \"method\" column" << endl;
+    return false;
+  }
+
+  for(size_t lineNumber=2; std::getline(stream, line); lineNumber++){
+    if(line.find_first_not_of(" \t\r") == string::npos)
+      continue;
+    const vector<string> fields = splitCSVLine(line);
+    if(fields.size() > columns.size()){
+      cerr << "ERROR: line " << lineNumber << " of " << fileName << " has more fields than the header" << endl;
+      return false;
+    }
+    BatchJob job;
+    job.id = std::to_string(jobs.size()+1);
+    job.params = Json::Value(Json::objectValue);
+    for(size_t i=0;i<fields.size();i++){
+      if(fields[i].empty())
+        continue;
+      if(columns[i] == "method")
+        job.method = fields[i];
+      else if(columns[i] == "id")
+        job.id = fields[i];
+      else if(fields[i] == "true" || fields[i] == "false")
+        job.params[columns[i]] = fields[i] == "true";
+      else
+        job.params[columns[i]] = fields[i];
+    }
+    if(job.method.empty()){
+      cerr << "ERROR: line " << lineNumber << " of " << fileName << " has no method" << endl;
+      return false;
+    }
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Report, one line per finished job
+
+class Report {
+public:
+  Report(const string& fileName, bool jsonLines)
+    : stream(fileName.c_str(), ios_base::binary), jsonLines(jsonLines)
+  {
+    writerBuilder["indentation"] = "";
+    if(!jsonLines)
+      stream << "index,id,method,status,startSeconds,seconds,memoryEstimateMB,message" << endl;
+  }
+
+  bool good() const { return stream.good(); }
+
+  void write(size_t index, const BatchJob& job, double startSeconds, size_t memoryEstimate, const JobOutcome& outcome)
+  {
+    const double memoryEstimateMB = static_cast<double>(memoryEstimate) / (1024 * 1024);
+    std::lock_guard<std::mutex> lock(mutex);
+    if(jsonLines){
+      Json::Value line;
+      line["index"] = static_cast<Json::UInt64>(index);
+      line["id"] = job.id;
+      line["method"] = job.method;
+      line["status"] = outcome.errorCode ? "failed" : "succeeded";
+      line["startSeconds"] = startSeconds;
+      line["seconds"] = outcome.seconds;
+      line["memoryEstimateMB"] = memoryEstimateMB;
+      if(outcome.errorCode){
+        line["error"]["code"] = outcome.errorCode;
+        line["error"]["message"] = outcome.errorMessage;
+      } else {
+        line["result"] = outcome.result;
+      }
+      stream << Json::writeString(writerBuilder, line) << endl;
+    } else {
+      stream << index << "," << quote(job.id) << "," << quote(job.method) << ","
+             << (outcome.errorCode ? "failed" : "succeeded") << ","
+             << std::fixed << std::setprecision(3) << startSeconds << "," << outcome.seconds << ","
+             << std::setprecision(1) << memoryEstimateMB << "," << quote(outcome.errorMessage) << endl;
+    }
+  }
+
+private:
+  static string quote(const string& field)
+  {
+    if(field.find_first_of(",\"\n\r") == string::npos)
+      return field;
+    string quoted = "\"";
+    for(size_t i=0;i<field.size();i++){
+      if(field[i] == '"')
+        quoted += '"';
+      quoted += field[i];
+    }
+    return quoted + "\"";
+  }
+
+  std::mutex mutex;
+  ofstream stream;
+  const bool jsonLines;
+  Json::StreamWriterBuilder writerBuilder;
+};
+
+//-----------------------------------------------------------------------------
+
+// Physical memory of the machine in bytes, 0 if unknown
+size_t getPhysicalMemory()
+{
+#if !defined(_WIN32) && defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+  const long pages = sysconf(_SC_PHYS_PAGES);
+  const long pageSize = sysconf(_SC_PAGESIZE);
+  if(pages > 0 && pageSize > 0)
+    return static_cast<size_t>(pages) * static_cast<size_t>(pageSize);
+#endif
+  return 0;
+}
+
+// Runs the jobs with a fixed number of workers. Jobs are started in manifest
+// order, skipping those whose memory estimate does not fit into what is left
+// of the budget; a job that does not fit at all runs when nothing else does.
+class BatchRunner {
+public:
+  BatchRunner(const vector<BatchJob>& jobs, JobContext& context, Report& report, size_t memoryBudget)
+    : jobs(jobs), context(context), report(report), memoryBudget(memoryBudget),
+      started(jobs.size(), false), memoryEstimates(jobs.size(), 0),
+      memoryInUse(0), jobsRunning(0), jobsFinished(0), jobsFailed(0),
+      startTime(std::chrono::steady_clock::now())
+  {
+    for(size_t i=0;i<jobs.size();i++)
+      memoryEstimates[i] = estimateJobMemory(jobs[i].method, jobs[i].params, context);
+  }
+
+  /// Runs all jobs, returns the number of failed jobs
+  size_t run(unsigned numberOfWorkers)
+  {
+    vector<std::thread> workers;
+    for(unsigned i=0;i<numberOfWorkers;i++)
+      workers.push_back(std::thread(&BatchRunner::runWorker, this));
+    for(size_t i=0;i<workers.size();i++)
+      workers[i].join();
+    return jobsFailed;
+  }
+
+private:
+  static const size_t NoJob = static_cast<size_t>(-1);
+
+  // First job that is not started and fits into the budget; NoJob if there is none yet
+  size_t findNextJob() const
+  {
+    for(size_t i=0;i<jobs.size();i++){
+      if(started[i])
+        continue;
+      if(!memoryBudget || !jobsRunning || memoryInUse + memoryEstimates[i] <= memoryBudget)
+        return i;
+    }
+    return NoJob;
+  }
+
+  bool allStarted() const
+  {
+    return std::find(started.begin(), started.end(), false) == started.end();
+  }
+
+  void runWorker()
+  {
+    for(;;){
+      size_t index;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        finishedCondition.wait(lock, [this]() { return allStarted() || findNextJob() != NoJob; });
+        if(allStarted())
+          return;
+        index = findNextJob();
+        started[index] = true;
+        memoryInUse += memoryEstimates[index];
+        jobsRunning++;
+      }
+
+      const BatchJob& job = jobs[index];
+      const double startSeconds = getSeconds();
+      const JobOutcome outcome = runJob(job.method, job.params, context);
+      report.write(index+1, job, startSeconds, memoryEstimates[index], outcome);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      memoryInUse -= memoryEstimates[index];
+      jobsRunning--;
+      jobsFinished++;
+      if(outcome.errorCode){
+        jobsFailed++;
+        cerr << "ERROR: job " << job.id << " (" << job.method << ") failed: " << outcome.errorMessage << endl;
+      }
+      cout << "[" << jobsFinished << "/" << jobs.size() << "] " << job.id << " " << job.method
+           << (outcome.errorCode ? " failed" : " done") << " in " << outcome.seconds << "s" << endl;
+      finishedCondition.notify_all();
+    }
+  }
+
+  double getSeconds() const
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  }
+
+  const vector<BatchJob>& jobs;
+  JobContext& context;
+  Report& report;
+  const size_t memoryBudget;
+
+  std::mutex mutex;
+  std::condition_variable finishedCondition;
+  vector<bool> started;
+  vector<size_t> memoryEstimates;
+  size_t memoryInUse;
+  size_t jobsRunning;
+  size_t jobsFinished;
+  size_t jobsFailed;
+  const std::chrono::steady_clock::time_point startTime;
+};
+
+int main(int argc, char* argv[])
+{
+  PARSE_ARGS;
+
+  std::cout << dcmqi_INFO << std::endl;
+
+  if (verbose) {
+    // Display DCMTK debug, warning, and error logs in the console
+    dcmtk::log4cplus::BasicConfigurator::doConfigure();
+  }
+
+  if(helper::isUndefinedOrPathDoesNotExist(manifestFileName, "Manifest"))
+    return EXIT_FAILURE;
+  if(reportFileName.empty()){
+    cerr << "ERROR: --outputReport must be specified" << endl;
+    return EXIT_FAILURE;
+  }
+
+  vector<BatchJob> jobs;
+  const string extension = manifestFileName.size() > 4 ? manifestFileName.substr(manifestFileName.size() - 4) : "";
+  const bool csvManifest = extension == ".csv" || extension == ".CSV";
+  if(!(csvManifest ? readCSVManifest(manifestFileName, jobs) : readJSONManifest(manifestFileName, jobs)))
+    return EXIT_FAILURE;
+
+  unsigned workers = numberOfWorkers > 0 ? static_cast<unsigned>(numberOfWorkers) : std::thread::hardware_concurrency();
+  workers = std::max(1u, std::min(workers, static_cast<unsigned>(std::max<size_t>(jobs.size(), 1))));
+  size_t memoryBudget = static_cast<size_t>(std::max(0, maxMemory)) * 1024 * 1024;
+  if(!memoryBudget)
+    memoryBudget = getPhysicalMemory() / 4 * 3;
+
+  Report report(reportFileName, reportFormat == "jsonl");
+  if(!report.good()){
+    cerr << "ERROR: cannot write " << reportFileName << endl;
+    return EXIT_FAILURE;
+  }
+
+  DcmRLEDecoderRegistration::registerCodecs();
+  DcmRLEEncoderRegistration::registerCodecs();
+
+  cout << "Running " << jobs.size() << " jobs with " << workers << " workers";
+  if(memoryBudget)
+    cout << " within " << memoryBudget / (1024 * 1024) << " MB";
+  cout << endl;
+
+  // the source series are listed once, the manifest does not change them
+  JobContext context(static_cast<size_t>(std::max(0, cacheSize)), true);
+  size_t jobsFailed;
+  {
+    BatchRunner runner(jobs, context, report, memoryBudget);
+    jobsFailed = runner.run(workers);
+  }
+
+  DcmRLEDecoderRegistration::cleanup();
+  DcmRLEEncoderRegistration::cleanup();
+
+  cout << jobs.size() - jobsFailed << " of " << jobs.size() << " jobs succeeded" << endl;
+  return jobsFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,458 @@
+// CLP includes
+#include "dcmqiserverCLP.h"
+#include <itkSmartPointer.h>
+
+// DCMQI includes
+#undef HAVE_SSTREAM // Avoid redefinition warning
+#include "ConversionJobs.h"
+#include "dcmqi/internal/VersionConfigure.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcrledrg.h>
+#include <dcmtk/dcmdata/dcrleerg.h>
+#include <dcmtk/oflog/configrt.h>
+
+// STD includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//-----------------------------------------------------------------------------
+
+// Client that sends requests and receives the responses to them. Responses are
+// written as one line each; jobs finish in any order, so several workers may
+// respond at the same time.
+class Connection {
+public:
+  Connection() {
+    writerBuilder["indentation"] = "";
+  }
+  virtual ~Connection() {}
+
+  void send(const Json::Value& message) {
+    const string line = Json::writeString(writerBuilder, message) + "\n";
+    std::lock_guard<std::mutex> lock(mutex);
+    write(line);
+  }
+
+protected:
+  virtual void write(const string& line) = 0;
+
+private:
+  std::mutex mutex;
+  Json::StreamWriterBuilder writerBuilder;
+};
+
+class StreamConnection : public Connection {
+public:
+  explicit StreamConnection(std::streambuf* buffer) : stream(buffer) {}
+
+protected:
+  void write(const string& line) {
+    stream << line << std::flush;
+  }
+
+private:
+  std::ostream stream;
+};
+
+#ifndef _WIN32
+class SocketConnection : public Connection {
+public:
+  explicit SocketConnection(int socketDescriptor) : socketDescriptor(socketDescriptor) {}
+  ~SocketConnection() {
+    close(socketDescriptor);
+  }
+
+  bool readLine(string& line) {
+    size_t end;
+    while((end = buffer.find('\n')) == string::npos){
+      char chunk[4096];
+      const ssize_t length = recv(socketDescriptor, chunk, sizeof(chunk), 0);
+      if(length <= 0)
+        return false;
+      buffer.append(chunk, length);
+    }
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return true;
+  }
+
+  // ends readLine(), responses to pending jobs are still sent
+  void stopReading() {
+    shutdown(socketDescriptor, SHUT_RD);
+  }
+
+protected:
+  void write(const string& line) {
+    // a client that disconnected does not get its responses
+    for(size_t written = 0; written < line.size();){
+      const ssize_t length = ::send(socketDescriptor, line.data() + written, line.size() - written, 0);
+      if(length <= 0)
+        return;
+      written += length;
+    }
+  }
+
+private:
+  const int socketDescriptor;
+  string buffer;
+};
+#endif
+
+// Runs the conversion jobs of all clients with a fixed number of workers.
+// ping, stats and shutdown are answered right away, everything else is queued.
+class Server {
+public:
+  Server(unsigned numberOfWorkers, size_t cacheSize)
+    : context(cacheSize, false), stopping(false), shutdownRequested(false),
+      jobsRunning(0), jobsCompleted(0), jobsFailed(0),
+      startTime(std::chrono::steady_clock::now())
+  {
+    for(unsigned i=0;i<numberOfWorkers;i++)
+      workers.push_back(std::thread(&Server::runWorker, this));
+  }
+
+  ~Server() {
+    stop();
+  }
+
+  void handleRequest(const string& line, const std::shared_ptr<Connection>& connection) {
+    if(line.find_first_not_of(" \t\r") == string::npos)
+      return;
+
+    Json::Value request;
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    string errors;
+    if(!reader->parse(line.data(), line.data() + line.size(), &request, &errors)){
+      connection->send(createError(Json::Value(), ParseError, "parse error: " + errors));
+      return;
+    }
+    const Json::Value id = request.isObject() ? request["id"] : Json::Value();
+    if(!request.isObject() || !request["method"].isString()
+       || (request.isMember("params") && !request["params"].isObject())){
+      connection->send(createError(id, InvalidRequest, "invalid request"));
+      return;
+    }
+
+    const string method = request["method"].asString();
+    if(method == "ping"){
+      Json::Value result;
+      result["version"] = dcmqi_INFO;
+      respond(connection, id, result);
+    } else if(method == "stats"){
+      respond(connection, id, getStatistics());
+    } else if(method == "shutdown"){
+      shutdownRequested = true;
+      respond(connection, id, Json::Value(Json::objectValue));
+    } else if(!findJobMethod(method)){
+      if(!id.isNull())
+        connection->send(createError(id, MethodNotFound, "unknown method " + method));
+    } else {
+      Job job;
+      job.id = id;
+      job.method = method;
+      job.params = request.isMember("params") ? request["params"] : Json::Value(Json::objectValue);
+      job.connection = connection;
+      std::lock_guard<std::mutex> lock(queueMutex);
+      queue.push_back(job);
+      queueCondition.notify_one();
+    }
+  }
+
+  /// Waits until all queued jobs are done and stops the workers
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      stopping = true;
+      queueCondition.notify_all();
+    }
+    for(size_t i=0;i<workers.size();i++)
+      if(workers[i].joinable())
+        workers[i].join();
+  }
+
+  bool isShutdownRequested() const {
+    return shutdownRequested;
+  }
+
+private:
+
+  struct Job {
+    Json::Value id;
+    string method;
+    Json::Value params;
+    std::shared_ptr<Connection> connection;
+  };
+
+  static Json::Value createError(const Json::Value& id, int code, const string& message) {
+    Json::Value response;
+    response["jsonrpc"] = "2.0";
+    response["id"] = id;
+    response["error"]["code"] = code;
+    response["error"]["message"] = message;
+    return response;
+  }
+
+  // Requests without id are notifications, which are not answered
+  static void respond(const std::shared_ptr<Connection>& connection, const Json::Value& id, const Json::Value& result) {
+    if(id.isNull())
+      return;
+    Json::Value response;
+    response["jsonrpc"] = "2.0";
+    response["id"] = id;
+    response["result"] = result;
+    connection->send(response);
+  }
+
+  Json::Value getStatistics() {
+    Json::Value statistics;
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      statistics["jobsQueued"] = static_cast<Json::UInt64>(queue.size());
+    }
+    statistics["jobsRunning"] = static_cast<Json::UInt64>(jobsRunning);
+    statistics["jobsCompleted"] = static_cast<Json::UInt64>(jobsCompleted);
+    statistics["jobsFailed"] = static_cast<Json::UInt64>(jobsFailed);
+    statistics["workers"] = static_cast<Json::UInt64>(workers.size());
+    statistics["uptimeSeconds"] = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    const Json::Value cacheStatistics = context.getStatistics();
+    statistics["headerCache"] = cacheStatistics["headerCache"];
+    statistics["metadataCache"] = cacheStatistics["metadataCache"];
+    return statistics;
+  }
+
+  void runWorker() {
+    for(;;){
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueCondition.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if(queue.empty())
+          return;
+        job = queue.front();
+        queue.pop_front();
+      }
+      jobsRunning++;
+      runJob(job);
+      jobsRunning--;
+    }
+  }
+
+  void runJob(const Job& job) {
+    const JobOutcome outcome = ::runJob(job.method, job.params, context);
+    if(outcome.errorCode){
+      jobsFailed++;
+      cerr << "ERROR: " << job.method << " failed: " << outcome.errorMessage << endl;
+      if(!job.id.isNull())
+        job.connection->send(createError(job.id, outcome.errorCode, outcome.errorMessage));
+      return;
+    }
+    jobsCompleted++;
+    respond(job.connection, job.id, outcome.result);
+  }
+
+  JobContext context;
+
+  std::mutex queueMutex;
+  std::condition_variable queueCondition;
+  std::deque<Job> queue;
+  bool stopping;
+  std::vector<std::thread> workers;
+
+  std::atomic<bool> shutdownRequested;
+  std::atomic<size_t> jobsRunning;
+  std::atomic<size_t> jobsCompleted;
+  std::atomic<size_t> jobsFailed;
+  const std::chrono::steady_clock::time_point startTime;
+};
+
+//-----------------------------------------------------------------------------
+
+// Requests on standard input, responses on standard output
+void serveStream(Server& server, std::streambuf* responseBuffer)
+{
+  std::shared_ptr<Connection> connection = std::make_shared<StreamConnection>(responseBuffer);
+  string line;
+  while(!server.isShutdownRequested() && std::getline(std::cin, line))
+    server.handleRequest(line, connection);
+  server.stop();
+}
+
+#ifndef _WIN32
+// Every connection is read by a thread of its own, the jobs of all connections
+// share the workers of the server
+int serveSocket(Server& server, const string& socketPath)
+{
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(socketPath.size() >= sizeof(address.sun_path)){
+    cerr << "ERROR: socket path is too long: " << socketPath << endl;
+    return EXIT_FAILURE;
+  }
+  strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+  // a socket left behind by a previous server is replaced, other files are not
+  std::error_code error;
+  if(std::filesystem::is_socket(socketPath, error))
+    unlink(socketPath.c_str());
+
+  const int listenSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listenSocket < 0 || ::bind(listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+     || ::listen(listenSocket, 16) != 0){
+    cerr << "ERROR: cannot listen on " << socketPath << ": " << strerror(errno) << endl;
+    if(listenSocket >= 0)
+      close(listenSocket);
+    return EXIT_FAILURE;
+  }
+  // clients that disconnect before their responses are sent must not end the server
+  signal(SIGPIPE, SIG_IGN);
+
+  // a reader that receives shutdown wakes up the accept loop through this pipe;
+  // shutdown() on a listening socket only interrupts accept() on Linux
+  int wakeupPipe[2];
+  if(pipe(wakeupPipe) != 0){
+    cerr << "ERROR: cannot create the wakeup pipe: " << strerror(errno) << endl;
+    close(listenSocket);
+    return EXIT_FAILURE;
+  }
+  cout << "Listening on " << socketPath << endl;
+
+  // readers of closed connections are joined, and expired connections dropped,
+  // whenever a new client connects, so neither list grows with the clients served
+  struct Reader {
+    std::thread thread;
+    std::shared_ptr<std::atomic<bool> > finished;
+  };
+  std::vector<std::weak_ptr<SocketConnection> > connections;
+  std::vector<Reader> readers;
+  while(!server.isShutdownRequested()){
+    pollfd descriptors[2] = { { listenSocket, POLLIN, 0 }, { wakeupPipe[0], POLLIN, 0 } };
+    if(poll(descriptors, 2, -1) < 0){
+      if(errno == EINTR)
+        continue;
+      break;
+    }
+    if(descriptors[1].revents || !(descriptors[0].revents & POLLIN))
+      break;
+    const int clientSocket = ::accept(listenSocket, NULL, NULL);
+    if(clientSocket < 0){
+      if(errno == EINTR || errno == ECONNABORTED)
+        continue;
+      break;
+    }
+
+    for(std::vector<Reader>::iterator reader = readers.begin(); reader != readers.end();){
+      if(*reader->finished){
+        reader->thread.join();
+        reader = readers.erase(reader);
+      } else {
+        ++reader;
+      }
+    }
+    connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                     [](const std::weak_ptr<SocketConnection>& connection) { return connection.expired(); }),
+                      connections.end());
+
+    std::shared_ptr<SocketConnection> connection = std::make_shared<SocketConnection>(clientSocket);
+    connections.push_back(connection);
+    Reader reader;
+    reader.finished = std::make_shared<std::atomic<bool> >(false);
+    std::shared_ptr<std::atomic<bool> > finished = reader.finished;
+    const int wakeupDescriptor = wakeupPipe[1];
+    reader.thread = std::thread([&server, connection, finished, wakeupDescriptor]() {
+      string line;
+      while(connection->readLine(line)){
+        server.handleRequest(line, connection);
+        if(server.isShutdownRequested()){
+          const char wakeup = 0;
+          if(::write(wakeupDescriptor, &wakeup, 1) < 0)
+            cerr << "ERROR: cannot wake up the server: " << strerror(errno) << endl;
+          break;
+        }
+      }
+      *finished = true;
+    });
+    readers.push_back(std::move(reader));
+  }
+
+  for(size_t i=0;i<connections.size();i++){
+    std::shared_ptr<SocketConnection> connection = connections[i].lock();
+    if(connection)
+      connection->stopReading();
+  }
+  for(size_t i=0;i<readers.size();i++)
+    readers[i].thread.join();
+  server.stop();
+  close(wakeupPipe[0]);
+  close(wakeupPipe[1]);
+  close(listenSocket);
+  unlink(socketPath.c_str());
+  return EXIT_SUCCESS;
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+  PARSE_ARGS;
+
+  // In stdin mode standard output carries the responses; the log output of the
+  // converters goes to standard error instead
+  std::streambuf* responseBuffer = std::cout.rdbuf();
+  if(socketPath.empty())
+    std::cout.rdbuf(std::cerr.rdbuf());
+
+  std::cout << dcmqi_INFO << std::endl;
+
+  if (verbose) {
+    // Display DCMTK debug, warning, and error logs in the console
+    dcmtk::log4cplus::BasicConfigurator::doConfigure();
+  }
+
+  if(numberOfWorkers < 1){
+    cerr << "ERROR: --workers must be at least 1" << endl;
+    std::cout.rdbuf(responseBuffer);
+    return EXIT_FAILURE;
+  }
+
+  DcmRLEDecoderRegistration::registerCodecs();
+  DcmRLEEncoderRegistration::registerCodecs();
+
+  int returnCode = EXIT_SUCCESS;
+  {
+    Server server(static_cast<unsigned>(numberOfWorkers), static_cast<size_t>(std::max(0, cacheSize)));
+    if(socketPath.empty()){
+      serveStream(server, responseBuffer);
+    } else {
+#ifndef _WIN32
+      returnCode = serveSocket(server, socketPath);
+#else
+      cerr << "ERROR: --socket is not supported on Windows, requests are read from standard input" << endl;
+      returnCode = EXIT_FAILURE;
+#endif
+    }
+  }
+
+  DcmRLEDecoderRegistration::cleanup();
+  DcmRLEEncoderRegistration::cleanup();
+  std::cout.rdbuf(responseBuffer);
+  return returnCode;
+}
@@ -18,8 +18,13 @@
 #include <dcmtk/dcmdata/dcdeftag.h>
 
 // STD includes
+#include <algorithm>
 #include <iostream>
 #include <exception>
+#include <fstream>
+
+// ITK includes
+#include <itkMultiThreaderBase.h>
 
 #include <json/json.h>
 
@@ -29,6 +34,7 @@
 #include "dcmqi/QIICRUIDs.h"
 #include "dcmqi/internal/VersionConfigure.h"
 #include "dcmqi/Helper.h"
+#include "dcmqi/Instrumentation.h"
 #include "dcmqi/TID1500Reader.h"
 
 using namespace std;
@@ -43,84 +49,230 @@ static OFLogger dcemfinfLogger = OFLog::getLogger("qiicr.apps");
 
 #define STATIC_ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
 
-bool isCompositeEvidence(OFString& sopClassUID) {
-  const char* compositeContextSOPClasses[] = {UID_SegmentationStorage, UID_RealWorldValueMappingStorage};
-  for( unsigned int i=0; i<STATIC_ARRAY_SIZE(compositeContextSOPClasses); i++)
-    if (sopClassUID == compositeContextSOPClasses[i])
-      return true;
-  return false;
+// Reads the metadata and measurements of a TID 1500 SR into the JSON structure
+// written by tid1500reader. Returns false if the file cannot be read as DICOM
+// or its SOP Class is not a structured report.
+bool readSRMetadata(const string& fileName, DSRDocument& doc, Json::Value& metaRoot){
+  // first read the dataset
+  DcmFileFormat sliceFF;
+  OFCondition loadCond;
+  {
+    dcmqi::Profiler::Scope profilerScope("loadFile");
+    loadCond = sliceFF.loadFile(fileName.c_str());
+  }
+  OFString sopClassUID;
+  if (loadCond.bad() || sliceFF.getDataset()->findAndGetOFString(DCM_SOPClassUID, sopClassUID).bad()
+      || DSRTypes::sopClassUIDToDocumentType(sopClassUID) == DSRTypes::DT_invalid)
+    return false;
+  TID1500Reader::readReport(*sliceFF.getDataset(), doc, metaRoot);
+  return true;
 }
 
-int main(int argc, char** argv){
-  std::cout << dcmqi_INFO << std::endl;
+// Columns of the measurement table written in batch mode (--outputTable), one
+// row per measurement. Codes are written as CodingSchemeDesignator:CodeValue,
+// with the CodeMeaning in a separate column where it is useful for reading.
+const char* measurementColumns[] = {
+  "file", "SOPInstanceUID", "SeriesDescription", "measurementGroup",
+  "TrackingIdentifier", "TrackingUniqueIdentifier",
+  "Finding", "FindingMeaning", "FindingSite", "FindingSiteMeaning",
+  "segmentationSOPInstanceUID", "ReferencedSegment", "SourceSeriesForImageSegmentation",
+  "quantity", "quantityMeaning", "derivationModifier", "derivationModifierMeaning",
+  "value", "units"
+};
 
-  PARSE_ARGS;
+typedef vector<string> TableRow;
 
-  if(dcmqi::Helper::isUndefinedOrPathDoesNotExist(inputSRFileName, "Input DICOM file")) {
-    return EXIT_FAILURE;
+string jsonToString(const Json::Value& value){
+  if (value.isString() || value.isNumeric() || value.isBool())
+    return value.asString();
+  return string();
+}
+
+string codeToString(const Json::Value& code){
+  if (!code.isObject())
+    return string();
+  return jsonToString(code["CodingSchemeDesignator"]) + ":" + jsonToString(code["CodeValue"]);
+}
+
+// Flattens the "Measurements" of the JSON written by tid1500reader into table rows
+void getMeasurementRows(const string& fileName, const string& sopInstanceUID, const Json::Value& metaRoot,
+                        vector<TableRow>& rows){
+  const Json::Value& measurements = metaRoot["Measurements"];
+  for (Json::ArrayIndex groupNumber = 0; groupNumber < measurements.size(); groupNumber++) {
+    const Json::Value& group = measurements[groupNumber];
+    const Json::Value& items = group["measurementItems"];
+    for (Json::ArrayIndex itemNumber = 0; itemNumber < items.size(); itemNumber++) {
+      const Json::Value& item = items[itemNumber];
+      TableRow row;
+      row.push_back(fileName);
+      row.push_back(sopInstanceUID);
+      row.push_back(jsonToString(metaRoot["SeriesDescription"]));
+      row.push_back(to_string(groupNumber + 1));
+      row.push_back(jsonToString(group["TrackingIdentifier"]));
+      row.push_back(jsonToString(group["TrackingUniqueIdentifier"]));
+      row.push_back(codeToString(group["Finding"]));
+      row.push_back(jsonToString(group["Finding"]["CodeMeaning"]));
+      row.push_back(codeToString(group["FindingSite"]));
+      row.push_back(jsonToString(group["FindingSite"]["CodeMeaning"]));
+      row.push_back(jsonToString(group["segmentationSOPInstanceUID"]));
+      row.push_back(jsonToString(group["ReferencedSegment"]));
+      row.push_back(jsonToString(group["SourceSeriesForImageSegmentation"]));
+      row.push_back(codeToString(item["quantity"]));
+      row.push_back(jsonToString(item["quantity"]["CodeMeaning"]));
+      row.push_back(codeToString(item["derivationModifier"]));
+      row.push_back(jsonToString(item["derivationModifier"]["CodeMeaning"]));
+      row.push_back(jsonToString(item["value"]));
+      row.push_back(jsonToString(item["units"]["CodeValue"]));
+      rows.push_back(row);
+    }
   }
+}
 
-  Json::Value metaRoot;
+// RFC 4180: fields with separators, quotes or line breaks are quoted
+string formatCSVRow(const TableRow& row){
+  string line;
+  for (size_t i = 0; i < row.size(); i++) {
+    if (i)
+      line += ',';
+    if (row[i].find_first_of(",\"\r\n") == string::npos) {
+      line += row[i];
+    } else {
+      line += '"';
+      for (size_t c = 0; c < row[i].size(); c++) {
+        if (row[i][c] == '"')
+          line += '"';
+        line += row[i][c];
+      }
+      line += '"';
+    }
+  }
+  return line + "\n";
+}
 
-  // first read the dataset
-  DcmFileFormat sliceFF;
-  CHECK_COND(sliceFF.loadFile(inputSRFileName.c_str()));
-  DcmDataset& dataset = *sliceFF.getDataset();
+string formatJSONLinesRow(const TableRow& row, const Json::StreamWriterBuilder& builder){
+  Json::Value object(Json::objectValue);
+  for (size_t i = 0; i < row.size(); i++)
+    object[measurementColumns[i]] = row[i];
+  return Json::writeString(builder, object) + "\n";
+}
 
-  // then, read the SR document from the DICOM dataset
-  DSRDocument doc;
-  if (doc.read(dataset).good()) {
-    TID1500Reader reader(doc.getTree());
+// Extracts the measurements of all files into one table. Files are read in
+// parallel in blocks of a fixed size and the rows of a block are written (in
+// input order) before the next block is read, so memory use does not grow with
+// the number of files.
+int writeMeasurementTable(const vector<string>& fileNames, const string& outputFileName,
+                          bool jsonLines, unsigned numberOfThreads){
+  ofstream table(outputFileName.c_str(), ios_base::binary);
+  if (!table) {
+    cerr << "ERROR: cannot write " << outputFileName << endl;
+    return EXIT_FAILURE;
+  }
+  const size_t numberOfColumns = STATIC_ARRAY_SIZE(measurementColumns);
+  if (!jsonLines)
+    table << formatCSVRow(TableRow(measurementColumns, measurementColumns + numberOfColumns));
 
-    Json::Value procedureCode;
-    procedureCode = reader.getProcedureReported();
-    if(procedureCode.isMember("CodeValue")){
-      metaRoot["procedureReported"] = procedureCode;
-    }
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+
+  itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+  if (numberOfThreads) {
+    threader->SetMaximumNumberOfThreads(numberOfThreads);
+    threader->SetNumberOfWorkUnits(numberOfThreads);
+  }
+  const size_t blockSize = 16 * threader->GetNumberOfWorkUnits();
+
+  size_t numberOfFailures = 0, numberOfSkipped = 0, numberOfRows = 0;
+  for (size_t blockStart = 0; blockStart < fileNames.size(); blockStart += blockSize) {
+    const size_t blockEnd = std::min(fileNames.size(), blockStart + blockSize);
+    vector<string> blockText(blockEnd - blockStart);
+    vector<size_t> blockRows(blockEnd - blockStart, 0);
+    vector<char> blockFailed(blockEnd - blockStart, 0);
+    vector<char> blockSkipped(blockEnd - blockStart, 0);
 
-    Json::Value observerContext = reader.getObserverContext();
-    metaRoot["observerContext"] = observerContext;
+    threader->ParallelizeArray(blockStart, blockEnd,
+      [&](itk::SizeValueType fileNumber) {
+        const size_t i = fileNumber - blockStart;
+        DSRDocument doc;
+        Json::Value metaRoot;
+        if (!readSRMetadata(fileNames[fileNumber], doc, metaRoot)) {
+          blockSkipped[i] = 1;
+          return;
+        }
+        if (!metaRoot.isMember("Measurements")) {
+          blockFailed[i] = 1;
+          return;
+        }
+        OFString sopInstanceUID;
+        doc.getSOPInstanceUID(sopInstanceUID);
 
-    //DSRDocumentTreeNodeCursor rootCursor;
-    //if(doc.getTree().getCursorToRootNode(rootCursor) == 1)
-    //  std::cout << "Have root node: " << rootCursor.getNode()->getNodeID() << std::endl;
+        vector<TableRow> rows;
+        getMeasurementRows(fileNames[fileNumber], sopInstanceUID.c_str(), metaRoot, rows);
+        for (size_t r = 0; r < rows.size(); r++)
+          blockText[i] += jsonLines ? formatJSONLinesRow(rows[r], builder) : formatCSVRow(rows[r]);
+        blockRows[i] = rows.size();
+      }, nullptr);
 
-    metaRoot["Measurements"] = reader.getMeasurements();
+    for (size_t i = 0; i < blockText.size(); i++) {
+      // other files in a directory of reports are not an error
+      if (blockSkipped[i]) {
+        cerr << "WARNING: " << fileNames[blockStart + i] << " is not a DICOM SR, skipping it" << endl;
+        numberOfSkipped++;
+        continue;
+      }
+      if (blockFailed[i]) {
+        cerr << "ERROR: no TID 1500 measurements could be read from " << fileNames[blockStart + i] << endl;
+        numberOfFailures++;
+        continue;
+      }
+      table << blockText[i];
+      numberOfRows += blockRows[i];
+    }
+    table.flush();
   }
 
-  OFString temp;
-  doc.getSeriesDescription(temp);
-  metaRoot["SeriesDescription"] = temp.c_str();
-  doc.getSeriesNumber(temp);
-  metaRoot["SeriesNumber"] = temp.c_str();
-  doc.getInstanceNumber(temp);
-  metaRoot["InstanceNumber"] = temp.c_str();
+  cout << "Wrote " << numberOfRows << " measurements from " << fileNames.size() - numberOfFailures - numberOfSkipped
+       << " of " << fileNames.size() << " files to " << outputFileName;
+  if (numberOfSkipped)
+    cout << " (" << numberOfSkipped << " files are not DICOM SR)";
+  cout << endl;
+  return numberOfFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
-  metaRoot["VerificationFlag"] = DSRTypes::verificationFlagToEnumeratedValue(doc.getVerificationFlag());
-  metaRoot["CompletionFlag"] = DSRTypes::completionFlagToEnumeratedValue(doc.getCompletionFlag());
+int main(int argc, char** argv){
+  std::cout << dcmqi_INFO << std::endl;
 
-  Json::Value compositeContextUIDs(Json::arrayValue);
-  Json::Value imageLibraryUIDs(Json::arrayValue);
+  PARSE_ARGS;
 
-  // TODO: We need to think about that, because actually the file names are stored in the json and not the UIDs
-  DSRSOPInstanceReferenceList &evidenceList = doc.getCurrentRequestedProcedureEvidence();
-  OFCondition cond = evidenceList.gotoFirstItem();
-  OFString sopInstanceUID;
-  OFString sopClassUID;
-  while(cond.good()) {
-    evidenceList.getSOPClassUID(sopClassUID);
-    evidenceList.getSOPInstanceUID(sopInstanceUID).c_str();
-    if (isCompositeEvidence(sopClassUID)) {
-      compositeContextUIDs.append(sopInstanceUID.c_str());
-    }else {
-      imageLibraryUIDs.append(sopInstanceUID.c_str());
+  dcmqi::Profiler::Session profilerSession(profileFileName);
+
+  if (!outputTableFileName.empty()) {
+    vector<string> fileNames = inputSRFileNames;
+    if (!inputSRFileName.empty())
+      fileNames.insert(fileNames.begin(), inputSRFileName);
+    if (!inputSRDirectory.empty()) {
+      if (!dcmqi::Helper::pathExists(inputSRDirectory))
+        return EXIT_FAILURE;
+      vector<string> directoryFiles = dcmqi::Helper::getFileListRecursively(inputSRDirectory.c_str());
+      fileNames.insert(fileNames.end(), directoryFiles.begin(), directoryFiles.end());
+    }
+    if (fileNames.empty()) {
+      cerr << "Error: No input DICOM files specified!" << endl;
+      return EXIT_FAILURE;
     }
-    cond = evidenceList.gotoNextItem();
+    return writeMeasurementTable(fileNames, outputTableFileName, tableFormat == "jsonl",
+                                 static_cast<unsigned>(std::max(0, numberOfThreads)));
+  }
+
+  if(dcmqi::Helper::isUndefinedOrPathDoesNotExist(inputSRFileName, "Input DICOM file")) {
+    return EXIT_FAILURE;
+  }
+
+  Json::Value metaRoot;
+  DSRDocument doc;
+  if (!readSRMetadata(inputSRFileName, doc, metaRoot)) {
+    cerr << "ERROR: " << inputSRFileName << " cannot be read as a DICOM SR" << endl;
+    return EXIT_FAILURE;
   }
-  if (!imageLibraryUIDs.empty())
-    metaRoot["imageLibrary"] = imageLibraryUIDs;
-  if (!compositeContextUIDs.empty())
-    metaRoot["compositeContext"] = compositeContextUIDs;
 
   ofstream outputFile;
 
@@ -0,0 +1,173 @@
+#ifndef DCMQI_COMPRESSION_H
+#define DCMQI_COMPRESSION_H
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdatset.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcpixseq.h>
+#include <dcmtk/ofstd/ofcond.h>
+
+// ITK includes
+#include <itkMultiThreaderBase.h>
+
+// STD includes
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+namespace dcmqi {
+
+  /**
+   * @brief Compression helpers used when writing and reading DICOM objects.
+   *
+   * DCMTK's RLE codec encodes frames one after another. Labelmap segmentations
+   * routinely have hundreds of frames consisting almost entirely of long runs,
+   * so the frames are encoded independently here and on several threads.
+   *
+   * Deflate follows the same idea: the dataset is cut into fixed size blocks
+   * which are compressed independently and concatenated into a single raw
+   * deflate stream (as done by pigz), so any standard inflater can read the
+   * result. Streams with that block structure are inflated in parallel when
+   * read back, all other deflated files are handed to DCMTK unchanged.
+   */
+  class Compression {
+
+  public:
+
+    /**
+     * @brief Encode the native PixelData of a dataset as RLE Lossless.
+     *
+     * Every frame becomes a single fragment of the encapsulated pixel data and
+     * a Basic Offset Table is written. Frames are encoded in parallel. Only
+     * 8 and 16 bit single sample pixel data is supported; 1 bit (binary SEG)
+     * pixel data cannot be RLE encoded.
+     *
+     * After a successful call the dataset must be saved with EXS_RLELossless.
+     *
+     * @param dataset dataset holding uncompressed PixelData
+     * @param numThreads number of threads to use, 0 uses the ITK default
+     * @return EC_Normal on success, an error otherwise
+     */
+    static OFCondition encodeRLE(DcmDataset* dataset, unsigned int numThreads = 0);
+
+    /**
+     * @brief RLE Lossless encode a single frame (PS3.5 Annex G).
+     *
+     * @param frame pointer to the first pixel of the frame
+     * @param rows number of rows
+     * @param columns number of columns
+     * @param bytesPerSample 1 or 2; for 2 the frame is read as Uint16 values in
+     *        machine byte order
+     * @param result receives the RLE header followed by the encoded segments
+     */
+    static void encodeRLEFrame(const void* frame, const Uint16 rows, const Uint16 columns,
+                               const unsigned bytesPerSample, vector<Uint8>& result);
+
+    /**
+     * @brief Decode RLE Lossless PixelData of a dataset in place, one frame per thread.
+     *
+     * The compressed fragments are copied aside (they are small compared to the
+     * decoded frames), the native PixelData is allocated once and every frame is
+     * decoded directly into its slot. DCMTK's codec would otherwise decode the
+     * frames one after another when dcmseg/dcmpmap ask for native pixel data.
+     *
+     * A frame may be split into several fragments if the Basic Offset Table
+     * tells where the frames start, or if there is only one frame. Datasets that
+     * are not RLE encoded, RLE datasets whose fragments cannot be assigned to
+     * frames, and pixels other than 8 or 16 bit single sample ones are left
+     * unchanged for DCMTK to handle.
+     *
+     * @param dataset dataset as loaded from file
+     * @param numThreads number of threads to use, 0 uses the ITK default
+     * @return EC_Normal on success or if nothing was done, an error for corrupt data
+     */
+    static OFCondition decodeRLE(DcmDataset* dataset, unsigned int numThreads = 0);
+
+    /**
+     * @brief Decode one RLE Lossless frame (PS3.5 Annex G) into native pixels.
+     *
+     * @param data the frame fragment, starting with the RLE header
+     * @param length length of the fragment in bytes
+     * @param numberOfPixels number of pixels in the frame
+     * @param bytesPerSample 1 or 2
+     * @param frame destination, Uint8 or Uint16 (machine byte order) depending on bytesPerSample
+     * @return false if the fragment is inconsistent with the frame size
+     */
+    static bool decodeRLEFrame(const Uint8* data, const size_t length, const size_t numberOfPixels,
+                               const unsigned bytesPerSample, void* frame);
+
+    /**
+     * @brief Save a file with the Deflated Explicit VR Little Endian transfer syntax.
+     *
+     * The dataset is deflated in blocks of DeflateBlockSize bytes on several threads.
+     * If dcmqi was built without zlib, the file is saved by DCMTK instead.
+     *
+     * @param fileFormat file to save; the meta header is updated for the deflated transfer syntax
+     * @param fileName output file name
+     * @param numThreads number of threads to use, 0 uses the ITK default
+     * @return EC_Normal on success, an error otherwise
+     */
+    static OFCondition saveDeflated(DcmFileFormat& fileFormat, const string& fileName, unsigned int numThreads = 0);
+
+    /**
+     * @brief Encode a file with the Deflated Explicit VR Little Endian transfer syntax into memory.
+     *
+     * Same encoding as saveDeflated(), the result holds the complete file
+     * (preamble, meta header and the deflated dataset).
+     *
+     * @return EC_Normal on success, an error otherwise (always if dcmqi was built without zlib)
+     */
+    static OFCondition encodeDeflated(DcmFileFormat& fileFormat, vector<Uint8>& result, unsigned int numThreads = 0);
+
+    /**
+     * @brief Load a DICOM file, inflating Deflated Explicit VR Little Endian datasets in parallel.
+     *
+     * Files in any other transfer syntax, and deflated files that were not written in
+     * independent blocks, are loaded with DcmFileFormat::loadFile(). RLE Lossless pixel
+     * data is decoded with decodeRLE() afterwards.
+     *
+     * @param fileFormat receives the meta header and dataset
+     * @param fileName input file name
+     * @param numThreads number of threads to use, 0 uses the ITK default
+     * @return EC_Normal on success, an error otherwise
+     */
+    static OFCondition loadFile(DcmFileFormat& fileFormat, const string& fileName, unsigned int numThreads = 0);
+
+    /**
+     * @brief Compress a buffer into a raw deflate stream made of independent blocks.
+     */
+    static OFCondition deflateParallel(const Uint8* data, const size_t length, vector<Uint8>& result,
+                                       unsigned int numThreads = 0);
+
+    /**
+     * @brief Inflate a raw deflate stream.
+     *
+     * The stream is split after each empty stored block (the marker written by a
+     * Z_SYNC_FLUSH or Z_FULL_FLUSH) and the pieces are inflated in parallel. If any
+     * piece cannot be inflated on its own, the stream is inflated serially instead.
+     */
+    static OFCondition inflateParallel(const Uint8* data, const size_t length, vector<Uint8>& result,
+                                       unsigned int numThreads = 0);
+
+    /// Uncompressed size of the independently deflated blocks
+    static const size_t DeflateBlockSize = 1 << 20;
+
+  protected:
+    static void encodeRLERow(const Uint8* row, const size_t length, vector<Uint8>& result);
+
+    static itk::MultiThreaderBase::Pointer createThreader(unsigned int numThreads);
+
+    /// Concatenated fragments of every frame, false if they cannot be assigned to the frames
+    static bool getRLEFrameFragments(DcmPixelSequence* pixelSequence, const Sint32 numberOfFrames,
+                                     vector<vector<Uint8> >& frames);
+
+    static OFCondition loadAndInflate(DcmFileFormat& fileFormat, const string& fileName, unsigned int numThreads);
+
+    static bool inflateBlock(const Uint8* data, const size_t length, const bool lastBlock, vector<Uint8>& result);
+  };
+
+}
+
+#endif //DCMQI_COMPRESSION_H
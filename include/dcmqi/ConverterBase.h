@@ -24,12 +24,14 @@
 #include <dcmtk/dcmdata/dcrledrg.h>
 
 // ITK includes
+#include <itkImageBase.h>
 #include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
 #include <itkLabelImageToLabelMapFilter.h>
 
 // DCMQI includes
 #include "dcmqi/Exceptions.h"
+#include "dcmqi/Instrumentation.h"
 #include "dcmqi/JSONMetaInformationHandlerBase.h"
 #include "dcmqi/QIICRUIDs.h"
 #include "dcmqi/QIICRConstants.h"
@@ -41,6 +43,8 @@ typedef unsigned char CharPixelType;
 typedef itk::Image<ShortPixelType, 3> ShortImageType;
 typedef itk::Image<CharPixelType, 3> CharImageType;
 typedef itk::ImageFileReader<ShortImageType> ShortReaderType;
+// Geometry of a 3D image (origin, spacing, direction, size) without pixel data
+typedef itk::ImageBase<3> ImageGeometryType;
 
 namespace dcmqi {
 
@@ -96,7 +100,7 @@ namespace dcmqi {
   protected:
     static IODGeneralEquipmentModule::EquipmentInfo getEquipmentInfo();
     static IODEnhGeneralEquipmentModule::EquipmentInfo getEnhEquipmentInfo();
-    static ContentIdentificationMacro createContentIdentificationInformation(JSONMetaInformationHandlerBase &metaInfo);
+    static ContentIdentificationMacro createContentIdentificationInformation(const JSONMetaInformationHandlerBase &metaInfo);
 
     template <class T>
     static int getImageDirections(FGInterface &fgInterface, T &dir){
@@ -130,8 +134,10 @@ namespace dcmqi {
       vnl_vector<double> sliceDirection = vnl_cross_3d(rowDirection, colDirection);
       sliceDirection.normalize();
 
-      cout << "Row direction: " << rowDirection << endl;
-      cout << "Col direction: " << colDirection << endl;
+      if(Verbosity::isEnabled(Verbosity::Detail)){
+        cout << "Row direction: " << rowDirection << endl;
+        cout << "Col direction: " << colDirection << endl;
+      }
 
       for(int i=0;i<3;i++){
         dir[i][0] = rowDirection[i];
@@ -139,7 +145,8 @@ namespace dcmqi {
         dir[i][2] = sliceDirection[i];
       }
 
-      cout << "Z direction: " << sliceDirection << endl;
+      if(Verbosity::isEnabled(Verbosity::Detail))
+        cout << "Z direction: " << sliceDirection << endl;
 
       return 0;
     }
@@ -251,7 +258,8 @@ namespace dcmqi {
         }
       }
 
-      cout << "Total frames: " << numFrames << endl;
+      if(Verbosity::isEnabled(Verbosity::Detail))
+        cout << "Total frames: " << numFrames << endl;
 
       // it IS possible to have a segmentation object containing just one frame!
       if(numFrames>1){
@@ -296,8 +304,10 @@ namespace dcmqi {
             if(it->second>1)
               overlappingFramesCnt++;
         }
-        cout << "Total frames with unique IPP: " << originDistances.size() << endl;
-        cout << "Total overlapping frames: " << overlappingFramesCnt << endl;
+        if(Verbosity::isEnabled(Verbosity::Detail)){
+          cout << "Total frames with unique IPP: " << originDistances.size() << endl;
+          cout << "Total overlapping frames: " << overlappingFramesCnt << endl;
+        }
       }
       else{
         // Single frame has zero extent
@@ -306,9 +316,11 @@ namespace dcmqi {
         // if specified in the file
         sliceSpacing = 1.0;
       }
-      cout << "Origin: " << imageOrigin << endl;
-      cout << "Slice extent: " << sliceExtent << endl;
-      cout << "Slice spacing: " << sliceSpacing << endl;
+      if(Verbosity::isEnabled(Verbosity::Detail)){
+        cout << "Origin: " << imageOrigin << endl;
+        cout << "Slice extent: " << sliceExtent << endl;
+        cout << "Slice spacing: " << sliceSpacing << endl;
+      }
 
 
       return 0;
@@ -344,42 +356,46 @@ namespace dcmqi {
       return 0;
     }
 
-    // AF: I could not quickly figure out how to template this function over image type - suggestions are welcomed!
+    /**
+     * @brief Copies origin, spacing, direction and largest possible region of an image.
+     *
+     * The returned geometry has no pixel buffer, so it is cheap to create for images
+     * of any pixel type and for image adaptors, whose geometry is only available
+     * through the (virtual) getters used here. For images with more than three
+     * dimensions (e.g. a stack of volumes) the geometry of the first three is used.
+     */
     template<class ImageSourceType>
-    static vector<vector<int> > getSliceMapForSegmentation2DerivationImage(const vector<DcmItem*> dcmDatasets,
-                                                                                       const ImageSourceType& labelImage) {
-      // Find mapping from the segmentation slice number to the derivation image
-      // Assume that orientation of the segmentation is the same as the source series
-      unsigned numLabelSlices = labelImage->GetLargestPossibleRegion().GetSize()[2];
-      vector<vector<int> > slice2derimg(numLabelSlices);
-      vector<bool> slice2derimgPresent(numLabelSlices, false);
-
-      int slicesMapped = 0;
-      for(size_t i=0;i<dcmDatasets.size();i++){
-        OFString ippStr;
-        ShortImageType::PointType ippPoint;
-        ShortImageType::IndexType ippIndex;
-        for(int j=0;j<3;j++){
-          CHECK_COND(dcmDatasets[i]->findAndGetOFString(DCM_ImagePositionPatient, ippStr, j));
-          ippPoint[j] = atof(ippStr.c_str());
-        }
-        if(!labelImage->TransformPhysicalPointToIndex(ippPoint, ippIndex)){
-          // if certain DICOM instance does not map to a label slice, just skip it
-          continue;
-        }
-        OFString sopInstanceUID;
-        CHECK_COND(dcmDatasets[i]->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUID));
-        // TODO: show the below when verbose mode is selected!
-        // cout << "SOPInstanceUID " << sopInstanceUID << " mapped" << endl;
-        slice2derimg[ippIndex[2]].push_back(i);
-        if(slice2derimgPresent[ippIndex[2]] == false)
-          slicesMapped++;
-        slice2derimgPresent[ippIndex[2]] = true;
+    static ImageGeometryType::Pointer getImageGeometry(const ImageSourceType& image) {
+      ImageGeometryType::PointType origin;
+      ImageGeometryType::SpacingType spacing;
+      ImageGeometryType::DirectionType direction;
+      ImageGeometryType::IndexType index;
+      ImageGeometryType::SizeType size;
+      for(unsigned i=0;i<3;i++){
+        origin[i] = image->GetOrigin()[i];
+        spacing[i] = image->GetSpacing()[i];
+        index[i] = image->GetLargestPossibleRegion().GetIndex()[i];
+        size[i] = image->GetLargestPossibleRegion().GetSize()[i];
+        for(unsigned j=0;j<3;j++)
+          direction[i][j] = image->GetDirection()[i][j];
       }
-      cout << slicesMapped << " of " << slice2derimgPresent.size() << " slices mapped to source DICOM images" << endl;
-      return slice2derimg;
+      ImageGeometryType::RegionType region(index, size);
+
+      ImageGeometryType::Pointer geometry = ImageGeometryType::New();
+      geometry->SetOrigin(origin);
+      geometry->SetSpacing(spacing);
+      geometry->SetDirection(direction);
+      geometry->SetLargestPossibleRegion(region);
+      return geometry;
     }
 
+    /**
+     * @brief Maps each slice of an image geometry to the indices of the datasets whose
+     *        Image Position (Patient) falls into that slice.
+     */
+    static vector<vector<int> > getSliceMapForSegmentation2DerivationImage(const vector<DcmItem*>& dcmDatasets,
+                                                                           const ImageGeometryType* geometry);
+
   };
 
 }
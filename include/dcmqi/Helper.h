@@ -7,6 +7,12 @@
 #include <dcmtk/dcmseg/segdoc.h>
 #include <dcmtk/dcmsr/dsrcodtn.h>
 
+// ITK includes
+#include <itkImageIOBase.h>
+
+// JSON includes
+#include <json/json.h>
+
 // STD includes
 #include <sstream>
 #include <string>
@@ -47,6 +53,15 @@ namespace dcmqi {
     static vector<string> getFileListRecursively(string directory);
     static vector<DcmItem*> loadDatasets(const vector<string>& dicomImageFiles);
 
+    // Pixel type the label image files are read with: the component type of the
+    // files if it is the same for all of them (or one that holds all of them
+    // without loss), int32 otherwise. UNKNOWNCOMPONENTTYPE if a file cannot be
+    // read or has more than one channel.
+    static itk::IOComponentEnum getLabelComponentType(const vector<string>& fileNames);
+    // Orders the label image files like the entries of segmentAttributes, as
+    // given by segmentAttributesFileMapping. False if a file cannot be mapped.
+    static bool applySegmentAttributesFileMapping(const Json::Value& metaRoot, vector<string>& segImageFiles);
+
     static string floatToStr(float f);
     static void tokenizeString(string str, vector<string> &tokens, string delimiter);
     static void splitString(string str, string &head, string &tail, string delimiter);
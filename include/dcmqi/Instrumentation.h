@@ -0,0 +1,179 @@
+#ifndef DCMQI_INSTRUMENTATION_H
+#define DCMQI_INSTRUMENTATION_H
+
+// STD includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <json/json.h>
+
+using namespace std;
+
+
+namespace dcmqi {
+
+  /**
+   * @brief Wall time, CPU time, counters and peak memory of the phases of the converters.
+   *
+   * The converters mark their phases with Profiler::Scope objects and report
+   * what a phase processed (frames, bytes, labels) with Profiler::count(). Both
+   * do nothing unless profiling is enabled: with profiling off, a phase costs one
+   * relaxed atomic load. The command line tools profile a conversion with a
+   * Session when --profileJSON is given.
+   *
+   * A phase entered while another one is active on the same thread is reported
+   * as "outer/inner". Phases with the same path are summed up, e.g. the label
+   * scan of every input file of a segmentation. CPU time is that of the whole
+   * process, so it includes the worker threads of a phase (and anything else
+   * that runs at the same time).
+   */
+  class Profiler {
+
+  public:
+
+    /// Enabling profiling discards what was recorded before
+    static void enable(bool enabled = true);
+
+    static bool isEnabled() {
+      return enabled.load(std::memory_order_relaxed);
+    }
+
+    /// Discards all phases and counters, and restarts the total times
+    static void reset();
+
+    /**
+     * @brief Adds to a counter of the innermost active phase of the calling thread.
+     *
+     * The total of the counter over all phases is part of the profile as well.
+     * Call it once per phase with the sum, not from within the loops of a phase.
+     */
+    static void count(const char* counter, uint64_t value) {
+      if (isEnabled())
+        addCount(counter, value);
+    }
+
+    /**
+     * @brief Profile recorded since profiling was enabled.
+     *
+     * @return total wall and CPU time, peak RSS, the totals of the counters, and
+     *   per phase (in the order the phases were first entered) its path, number
+     *   of calls, wall and CPU time, counters and the peak RSS when it ended
+     */
+    static Json::Value getProfile();
+
+    /// Writes getProfile() to a JSON file, false if the file cannot be written
+    static bool writeProfile(const string& fileName);
+
+    /// Peak resident set size of the process in bytes, 0 where it cannot be determined
+    static size_t getPeakRSS();
+
+    /// User and system CPU time of the process in seconds
+    static double getCPUSeconds();
+
+    /// Measures a phase from construction to destruction
+    class Scope {
+
+    public:
+
+      /// @param name name of the phase, a string literal
+      explicit Scope(const char* name) : active(Profiler::isEnabled()) {
+        if (active)
+          begin(name);
+      }
+
+      ~Scope() {
+        if (active)
+          end();
+      }
+
+      /// Ends the phase before the scope does, e.g. after a loop in a longer function
+      void stop() {
+        if (active)
+          end();
+        active = false;
+      }
+
+    private:
+
+      Scope(const Scope&);
+      Scope& operator=(const Scope&);
+
+      void begin(const char* name);
+      void end();
+
+      bool active;
+      size_t parentPathLength;
+      std::chrono::steady_clock::time_point wallStart;
+      double cpuStart;
+    };
+
+    /**
+     * @brief Profiles a command line tool from construction to destruction.
+     *
+     * Nothing is done for an empty file name, so that the tools can create a
+     * session for their --profileJSON argument unconditionally.
+     */
+    class Session {
+
+    public:
+
+      explicit Session(const string& fileName) : fileName(fileName) {
+        if (!fileName.empty())
+          Profiler::enable();
+      }
+
+      ~Session() {
+        if (!fileName.empty())
+          Profiler::writeProfile(fileName);
+      }
+
+    private:
+
+      Session(const Session&);
+      Session& operator=(const Session&);
+
+      const string fileName;
+    };
+
+  private:
+
+    static void addCount(const char* counter, uint64_t value);
+
+    static std::atomic<bool> enabled;
+  };
+
+  /**
+   * @brief Amount of console output of the converters.
+   *
+   * Normal output describes a conversion as a whole. Detailed output adds lines
+   * per label, frame, slice or file and the geometry computations; on large
+   * inputs that is a lot of output, so it is only shown on request (--verbose
+   * of the command line tools).
+   */
+  class Verbosity {
+
+  public:
+
+    enum Level {
+      Normal = 1,
+      Detail = 2
+    };
+
+    static void setLevel(Level level) {
+      currentLevel.store(level, std::memory_order_relaxed);
+    }
+
+    static bool isEnabled(Level level) {
+      return level <= currentLevel.load(std::memory_order_relaxed);
+    }
+
+  private:
+
+    static std::atomic<int> currentLevel;
+  };
+
+}
+
+#endif //DCMQI_INSTRUMENTATION_H
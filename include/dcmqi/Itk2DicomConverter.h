@@ -20,19 +20,31 @@
 // DCMQI includes
 #include "dcmqi/ConverterBase.h"
 
+// STD includes
+#include <set>
+
 
 using namespace std;
 
 typedef itk::LabelImageToLabelMapFilter<ShortImageType> LabelToLabelMapFilterType;
 
+// label image types accepted by itkimage2dcmSegmentation besides ShortImageType
+// and CharImageType (uint8)
+typedef itk::Image<Uint16, 3> UShortLabelImageType;
+typedef itk::Image<Sint32, 3> IntLabelImageType;
+
+// probability (or occupancy) maps accepted by itkimage2dcmFractionalSegmentation
+typedef itk::Image<float, 3> FractionalImageType;
+
 namespace dcmqi {
 
-  // Forward declaration: the handler overload of itkimage2dcmSegmentation takes
-  // this only by reference and the template definition lives in the .cpp, so the
-  // full header is not needed here. Callers that want to use the handler overload
-  // must include JSONSegmentationMetaInformationHandler.h themselves to construct
-  // an instance.
+  // Forward declarations: the handler and plan overloads of itkimage2dcmSegmentation
+  // take these only by reference and the template definitions live in the .cpp, so
+  // the full headers are not needed here. Callers that want to use these overloads
+  // must include JSONSegmentationMetaInformationHandler.h or
+  // SegmentationMetadataPlan.h themselves to construct an instance.
   class JSONSegmentationMetaInformationHandler;
+  class SegmentationMetadataPlan;
 
   /**
    * @brief The Itk2DicomConverter class provides methods to convert from itk images to DICOM Segmentation objects.
@@ -46,6 +58,10 @@ namespace dcmqi {
     /**
      * @brief Converts itk images data into a DICOM Segmentation object.
      *
+     * Instantiated for label images with uint8 (CharImageType), uint16
+     * (UShortLabelImageType), int16 (ShortImageType) and int32 (IntLabelImageType)
+     * pixels, and for int16 channels of a vector image (VectorImageToImageAdaptor).
+     *
      * @param dcmDatasets A vector of DICOM datasets with the images that the segmentation is based on.
      * @param segmentations A vector of itk images to be converted.
      * @param metaData A string containing the metadata to be used for the DICOM Segmentation object.
@@ -103,7 +119,7 @@ namespace dcmqi {
      *         conversion fails (NULL is returned).
      * @return A pointer to the resulting DICOM Segmentation object.
      */
-    template<class ImageSourceType, std::enable_if_t<std::is_same_v<short, typename ImageSourceType::PixelType>, bool> = 0>
+    template<class ImageSourceType>
     static DcmDataset* itkimage2dcmSegmentation(vector<DcmItem*> dcmDatasets,
                           vector<itk::SmartPointer<const ImageSourceType>> segmentations,
                           const string &metaData,
@@ -117,26 +133,124 @@ namespace dcmqi {
      * @brief In-memory metadata overload of itkimage2dcmSegmentation.
      *
      * Accepts a fully-populated JSONSegmentationMetaInformationHandler instead
-     * of a JSON string. This is the core implementation; the string overload
-     * is a thin wrapper that parses its JSON argument into a handler and
-     * delegates here. Use this overload when the metadata is already held
+     * of a JSON string. Use this overload when the metadata is already held
      * programmatically and serialising it just to re-parse would be wasteful
-     * or lossy.
+     * or lossy. The metadata is compiled into a SegmentationMetadataPlan and
+     * converted with the plan overload.
+     *
+     * Parameter semantics are identical to the string overload.
+     */
+    template<class ImageSourceType>
+    static DcmDataset* itkimage2dcmSegmentation(vector<DcmItem*> dcmDatasets,
+                          vector<itk::SmartPointer<const ImageSourceType>> segmentations,
+                          const JSONSegmentationMetaInformationHandler& metaInfo,
+                          bool skipEmptySlices=true,
+                          bool useLabelIDAsSegmentNumber=false,
+                          bool referencesGeometryCheck=true,
+                          bool doDicomValueChecks=true,
+                          bool outputLabelMap=false);
+
+    /**
+     * @brief Compiled metadata overload of itkimage2dcmSegmentation.
+     *
+     * This is the core implementation; the string and handler overloads compile
+     * their metadata into a plan and delegate here. Compile the plan once with
+     * SegmentationMetadataPlan::compile() to convert many segmentations that
+     * share the same metadata, possibly in parallel.
      *
      * Parameter semantics are identical to the string overload.
      */
-    template<class ImageSourceType, std::enable_if_t<std::is_same_v<short, typename ImageSourceType::PixelType>, bool> = 0>
+    template<class ImageSourceType>
     static DcmDataset* itkimage2dcmSegmentation(vector<DcmItem*> dcmDatasets,
                           vector<itk::SmartPointer<const ImageSourceType>> segmentations,
-                          JSONSegmentationMetaInformationHandler& metaInfo,
+                          const SegmentationMetadataPlan& plan,
                           bool skipEmptySlices=true,
                           bool useLabelIDAsSegmentNumber=false,
                           bool referencesGeometryCheck=true,
                           bool doDicomValueChecks=true,
                           bool outputLabelMap=false);
 
+    /**
+     * @brief Converts probability or occupancy maps into a DICOM FRACTIONAL Segmentation object.
+     *
+     * Every input image is one segment, described by the single item of the
+     * corresponding "segmentAttributes" entry; Segment Numbers are assigned from 1
+     * in input order. Values are expected in [0,1] and are quantized to
+     * 0..maxFractionalValue (rounded to nearest, values outside of [0,1] and NaN
+     * are clamped). Slices are quantized in parallel, and frames that are zero
+     * after quantization are not stored if skipEmptySlices is set.
+     *
+     * Instantiated for FractionalImageType and for float channels of a vector
+     * image (VectorImageToImageAdaptor).
+     *
+     * @param fractionalType DcmSegTypes::SFT_PROBABILITY or DcmSegTypes::SFT_OCCUPANCY
+     * @param maxFractionalValue value that represents a fraction of 1 (at most 255)
+     *
+     * The remaining parameters have the same meaning as for itkimage2dcmSegmentation.
+     */
+    template<class ImageSourceType>
+    static DcmDataset* itkimage2dcmFractionalSegmentation(vector<DcmItem*> dcmDatasets,
+                          vector<itk::SmartPointer<const ImageSourceType>> fractionalMaps,
+                          const string &metaData,
+                          DcmSegTypes::E_SegmentationFractionalType fractionalType=DcmSegTypes::SFT_PROBABILITY,
+                          Uint16 maxFractionalValue=255,
+                          bool skipEmptySlices=true,
+                          bool referencesGeometryCheck=true,
+                          bool doDicomValueChecks=true);
+
+    /**
+     * @brief In-memory metadata overload of itkimage2dcmFractionalSegmentation.
+     */
+    template<class ImageSourceType>
+    static DcmDataset* itkimage2dcmFractionalSegmentation(vector<DcmItem*> dcmDatasets,
+                          vector<itk::SmartPointer<const ImageSourceType>> fractionalMaps,
+                          const JSONSegmentationMetaInformationHandler& metaInfo,
+                          DcmSegTypes::E_SegmentationFractionalType fractionalType=DcmSegTypes::SFT_PROBABILITY,
+                          Uint16 maxFractionalValue=255,
+                          bool skipEmptySlices=true,
+                          bool referencesGeometryCheck=true,
+                          bool doDicomValueChecks=true);
+
+    /**
+     * @brief Compiled metadata overload of itkimage2dcmFractionalSegmentation.
+     */
+    template<class ImageSourceType>
+    static DcmDataset* itkimage2dcmFractionalSegmentation(vector<DcmItem*> dcmDatasets,
+                          vector<itk::SmartPointer<const ImageSourceType>> fractionalMaps,
+                          const SegmentationMetadataPlan& plan,
+                          DcmSegTypes::E_SegmentationFractionalType fractionalType=DcmSegTypes::SFT_PROBABILITY,
+                          Uint16 maxFractionalValue=255,
+                          bool skipEmptySlices=true,
+                          bool referencesGeometryCheck=true,
+                          bool doDicomValueChecks=true);
+
   protected:
 
+    /// Adds Plane Orientation (Patient) and Pixel Measures of the image as shared functional groups
+    template<class ImageSourceType>
+    static void addSharedFunctionalGroups(DcmSegmentation* segdoc, const ImageSourceType* image);
+
+    /** Adds a derivation image item referencing the given source images to fgder, and
+     *  records the referenced instances for the Common Instance Reference Module.
+     */
+    static void addDerivationImageReferences(FGDerivationImage* fgder, OFVector<DcmItem*>& siVector,
+                                             OFVector<SOPInstanceReferenceMacro*>& refinstances,
+                                             set<OFString>& instanceUIDs);
+
+    /** Writes the segmentation document into a new dataset and patches in the series
+     *  level information from the metadata (and Body Part Examined from sourceDataset).
+     *  @return the new dataset, NULL if writing failed
+     */
+    static DcmDataset* writeSegmentationDataset(DcmSegmentation* segdoc, DcmItem* sourceDataset,
+                                                const JSONSegmentationMetaInformationHandler& metaInfo,
+                                                bool doDicomValueChecks);
+
+    /** Quantizes fractional values in [0,1] to 0..maxFractionalValue.
+     *  The loop has no branches or early exits, so that compilers vectorize it.
+     *  @return true if any of the quantized values is non-zero
+     */
+    static bool quantizeFractionalFrame(const float* values, size_t count, float maxFractionalValue, Uint8* frame);
+
     /** This method takes an existing DICOM segmentation dataset and a mapping from
      *  (existing) segment number to new segment number (i.e. original label ID).
      *  Therefore it will go through all frames in the dataset, and for each frame
@@ -33,6 +33,12 @@ namespace dcmqi {
     vector<map<unsigned,SegmentAttributes*> > segmentsAttributesMappingList;
 
     void read();
+    /**
+     * Reads the metadata from an already parsed JSON document instead of the
+     * JSON string. The document is moved into metaInfoRoot, not copied.
+     * Throws JSONReadErrorException like read().
+     */
+    void read(Json::Value&& root);
     bool write(string filename);
 
     // segGroupNumber starts with 0 and refers to the item in segmentsAttributesMappingList.
@@ -49,6 +55,9 @@ namespace dcmqi {
 
     void readSegmentAttributes();
 
+    /// Prints the details of a parse error and throws JSONReadErrorException
+    static void reportReadError(const exception& e);
+
     Json::Value createAndGetSegmentAttributesJSON();
   };
 
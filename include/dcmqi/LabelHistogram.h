@@ -0,0 +1,134 @@
+#ifndef DCMQI_LABEL_HISTOGRAM_H
+#define DCMQI_LABEL_HISTOGRAM_H
+
+// ITK includes
+#include <itkImageRegionConstIterator.h>
+#include <itkMultiThreaderBase.h>
+#include <itkNumericTraits.h>
+
+// STD includes
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+
+namespace dcmqi {
+
+  /**
+   * @brief Enumerates the distinct labels of a label image.
+   *
+   * itk::LabelImageToLabelMapFilter builds a run-length encoded LabelObject for
+   * every label, which is expensive for parcellations with hundreds or thousands
+   * of labels when all that is needed are the label values and the slices they
+   * occur in. Here every slice is scanned on its own (in parallel) into a bitmap
+   * over the pixel value range, and the per-slice label sets are merged at the end.
+   * For 32 bit pixels the value range is too large for a bitmap; the distinct
+   * values of a slice are collected and sorted instead.
+   */
+  class LabelHistogram {
+
+  public:
+
+    /// First and last slice (both inclusive) a label occurs in
+    struct SliceRange {
+      unsigned first;
+      unsigned last;
+    };
+
+    /**
+     * @brief Computes the distinct pixel values of an image and their slice ranges.
+     *
+     * Works for images and image adaptors (e.g. a channel of a vector image). The
+     * background value is reported like any other value; callers remove it if needed.
+     *
+     * @param image label image with an integer pixel type of at most 32 bit
+     * @return slice range per label, ordered by label value
+     */
+    template<class ImageSourceType>
+    static map<typename ImageSourceType::PixelType, SliceRange> compute(const ImageSourceType* image) {
+      typedef typename ImageSourceType::PixelType PixelType;
+      static_assert(std::is_integral_v<PixelType> && sizeof(PixelType) <= 4,
+                    "LabelHistogram supports integer label images of up to 32 bit only");
+
+      const typename ImageSourceType::RegionType region = image->GetBufferedRegion();
+      const unsigned numberOfSlices = region.GetSize()[2];
+      vector<vector<PixelType> > sliceLabels(numberOfSlices);
+
+      itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+      threader->ParallelizeArray(0, static_cast<itk::SizeValueType>(numberOfSlices),
+        [&](itk::SizeValueType slice) {
+          typename ImageSourceType::RegionType sliceRegion = region;
+          sliceRegion.SetIndex(2, region.GetIndex()[2] + slice);
+          sliceRegion.SetSize(2, 1);
+
+          getSliceLabels(image, sliceRegion, sliceLabels[slice]);
+        }, nullptr);
+
+      map<PixelType, SliceRange> ranges;
+      for(unsigned slice = 0; slice < numberOfSlices; slice++){
+        for(size_t i = 0; i < sliceLabels[slice].size(); i++){
+          typename map<PixelType, SliceRange>::iterator rangeIt = ranges.find(sliceLabels[slice][i]);
+          if(rangeIt == ranges.end()){
+            SliceRange range = {slice, slice};
+            ranges.insert(make_pair(sliceLabels[slice][i], range));
+          } else {
+            // slices are visited in increasing order
+            rangeIt->second.last = slice;
+          }
+        }
+      }
+      return ranges;
+    }
+
+  protected:
+
+    /// Appends the distinct values of a slice to labels, in increasing order
+    template<class ImageSourceType>
+    static void getSliceLabels(const ImageSourceType* image, const typename ImageSourceType::RegionType& sliceRegion,
+                               vector<typename ImageSourceType::PixelType>& labels) {
+      typedef typename ImageSourceType::PixelType PixelType;
+      itk::ImageRegionConstIterator<ImageSourceType> it(image, sliceRegion);
+
+      if constexpr (sizeof(PixelType) <= 2) {
+        const size_t numberOfValues = size_t(1) << (8 * sizeof(PixelType));
+        const long minValue = static_cast<long>(itk::NumericTraits<PixelType>::NonpositiveMin());
+        vector<uint64_t> bitmap((numberOfValues + 63) / 64, 0);
+        bool first = true;
+        PixelType previous = PixelType();
+        for(it.GoToBegin(); !it.IsAtEnd(); ++it){
+          const PixelType value = it.Get();
+          // labels come in runs, most pixels repeat their predecessor
+          if(!first && value == previous)
+            continue;
+          const size_t bin = static_cast<size_t>(static_cast<long>(value) - minValue);
+          bitmap[bin >> 6] |= uint64_t(1) << (bin & 63);
+          previous = value;
+          first = false;
+        }
+
+        for(size_t word = 0; word < bitmap.size(); word++){
+          uint64_t bits = bitmap[word];
+          for(size_t bit = 0; bits; bit++, bits >>= 1){
+            if(bits & 1)
+              labels.push_back(static_cast<PixelType>(static_cast<long>(word * 64 + bit) + minValue));
+          }
+        }
+      } else {
+        for(it.GoToBegin(); !it.IsAtEnd(); ++it){
+          const PixelType value = it.Get();
+          if(labels.empty() || value != labels.back())
+            labels.push_back(value);
+        }
+        sort(labels.begin(), labels.end());
+        labels.erase(unique(labels.begin(), labels.end()), labels.end());
+      }
+    }
+  };
+
+}
+
+#endif //DCMQI_LABEL_HISTOGRAM_H
@@ -0,0 +1,123 @@
+#ifndef DCMQI_MEMORY_BUDGET_H
+#define DCMQI_MEMORY_BUDGET_H
+
+// DCMTK includes
+#include <dcmtk/dcmseg/segtypes.h>
+
+// JSON includes
+#include <json/json.h>
+
+// STD includes
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+namespace dcmqi {
+
+  /**
+   * @brief Estimates the peak memory of a conversion before it is started.
+   *
+   * A segmentation conversion holds several representations of the same voxels
+   * at once: the input images, the frames of the DcmSegmentation, the written
+   * DcmDataset and, while it is saved, the buffers of the compression. The
+   * estimate is computed from the geometry of the input images and the segment
+   * count of the metadata only, so it can be printed and checked against a
+   * budget before any image is read.
+   *
+   * Binary and fractional frames are estimated as if every segment was present
+   * on every slice, so for sparse segmentations the estimate is an upper bound.
+   * Only segmentations are estimated: parametric maps have a single save
+   * strategy, and the input of bin2labelsegimage is only known once it is read.
+   */
+  class MemoryBudget {
+
+  public:
+
+    /// What the memory of a segmentation conversion depends on
+    struct SegmentationInput {
+      SegmentationInput();
+
+      DcmSegTypes::E_SegmentationType segmentationType;
+      size_t rows;
+      size_t columns;
+      size_t slices;
+      /// input label images, channels or probability maps
+      size_t volumes;
+      /// bytes per voxel of the input images as they are read
+      size_t bytesPerVoxel;
+      /// segments of the metadata
+      size_t segments;
+      /// labelmap output with 16 instead of 8 bits per pixel
+      bool labelmap16Bit;
+      /// none, rle or deflate
+      string compress;
+      /// the input images are released after the conversion, before the file is saved
+      bool inputsReleasedBeforeSave;
+    };
+
+    /// Estimated bytes per representation, and the peak for the chosen strategy
+    struct Estimate {
+      Estimate();
+
+      size_t inputImages;
+      /// frames and per-frame functional groups of the DcmSegmentation
+      size_t frames;
+      /// written DcmDataset
+      size_t dataset;
+      /// compression buffers while the file is saved
+      size_t saveBuffers;
+      /// inputs, frames and dataset while the dataset is written, or dataset and save buffers while it is saved
+      size_t peak;
+      /// the deflated file is written through DCMTK's zlib stream instead of in parallel blocks in memory
+      bool streamingWrite;
+    };
+
+    /**
+     * @brief Estimates the peak memory of a segmentation conversion.
+     *
+     * @param input geometry, segment count and output options of the conversion
+     * @param streamingWrite estimate a streamed instead of a parallel deflate
+     */
+    static Estimate estimateSegmentation(const SegmentationInput& input, bool streamingWrite = false);
+
+    /**
+     * @brief Chooses the fastest strategy whose estimated peak fits into a budget.
+     *
+     * The strategies are tried from the fastest to the one with the smallest
+     * footprint: parallel deflate, then streamed deflate (for --compress deflate
+     * only, the other outputs have a single strategy).
+     *
+     * @param input geometry, segment count and output options of the conversion
+     * @param maxBytes budget in bytes, 0 for no limit
+     * @param estimate receives the estimate of the chosen strategy, or of the
+     *   smallest one if none fits
+     * @return false if no strategy fits into the budget
+     */
+    static bool selectSegmentationStrategy(const SegmentationInput& input, size_t maxBytes, Estimate& estimate);
+
+    /**
+     * @brief Reads rows, columns and slices of the input images from their headers.
+     *
+     * Files with fewer slices are counted with the slices of the largest one.
+     *
+     * @return false if a file cannot be read
+     */
+    static bool readSegmentationGeometry(const vector<string>& fileNames, SegmentationInput& input);
+
+    /// Number of segments in the segmentation metadata and the largest label ID among them
+    static void countSegments(const Json::Value& metaRoot, size_t& segments, size_t& maxLabelID);
+
+    /// Prints the estimate in MB, one representation per line
+    static void printEstimate(const Estimate& estimate, ostream& out);
+
+    /// Approximate memory of the functional groups of one frame, in the DcmSegmentation and again in the dataset
+    static const size_t PerFrameOverhead = 4096;
+  };
+
+}
+
+#endif //DCMQI_MEMORY_BUDGET_H
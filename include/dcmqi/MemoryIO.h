@@ -0,0 +1,180 @@
+#ifndef DCMQI_MEMORYIO_H
+#define DCMQI_MEMORYIO_H
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdatset.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmsr/dsrdoc.h>
+#include <dcmtk/ofstd/ofcond.h>
+
+// ITK includes
+#include <itkImage.h>
+
+// STD includes
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+
+namespace dcmqi {
+
+  /**
+   * @brief Reading and writing DICOM objects and volumes in memory instead of files.
+   *
+   * All converters work on DcmDataset/DcmItem objects and ITK images, the
+   * command line tools only add the file handling around them. The methods
+   * here replace that file handling for applications that receive DICOM
+   * objects as byte buffers (e.g. over DICOMweb) and hold volumes as voxel
+   * buffers:
+   *
+   * - SEG: readDatasets() and importVolume() give the input of
+   *   Itk2DicomConverter::itkimage2dcmSegmentation(), writeDICOM() serializes
+   *   the result. readDICOM() gives the input of
+   *   Dicom2ItkConverter::getConverter(), getVoxels() the voxels of the
+   *   resulting images.
+   * - Parametric maps: the same with ParaMapConverter::itkimage2paramap() and
+   *   ParaMapConverter::paramap2itkimage().
+   * - TID 1500: readDatasets() gives the referenced objects for
+   *   TID1500Writer::writeReport(), writeDICOM() serializes the report.
+   *   readStructuredReport() gives the document for TID1500Reader.
+   *
+   * Voxel buffers are not copied: importVolume() returns an image that refers
+   * to the caller's buffer, getVoxels() points into the pixel buffer of an
+   * image. DICOM buffers are parsed into DCMTK objects, which hold their own
+   * copy of the element values, so the buffers can be released after reading.
+   */
+  class MemoryIO {
+
+  public:
+
+    /// Size and position of a volume in patient coordinates, as in itk::Image
+    struct VolumeGeometry {
+      unsigned size[3];
+      double origin[3];
+      double spacing[3];
+      /// direction cosines, row major (direction[3*row+column]), columns are the image axes
+      double direction[9];
+    };
+
+    /// Encoded DICOM object held by the caller
+    typedef pair<const Uint8*, size_t> Buffer;
+
+    /**
+     * @brief Parse a DICOM object from memory.
+     *
+     * The buffer holds a DICOM file (preamble, meta header and dataset) or a
+     * dataset without meta header. Deflated datasets are inflated, RLE Lossless
+     * pixel data is decoded as by Compression::loadFile().
+     *
+     * @param data encoded object
+     * @param length length of the encoded object in bytes
+     * @param fileFormat new (empty) object that receives the meta header and dataset
+     * @param numThreads number of threads for RLE decoding, 0 uses the ITK default
+     * @return EC_Normal on success, an error otherwise
+     */
+    static OFCondition readDICOM(const Uint8* data, size_t length, DcmFileFormat& fileFormat,
+                                 unsigned int numThreads = 0);
+
+    /**
+     * @brief Parse the source image datasets of a conversion from memory.
+     *
+     * Same as Helper::loadDatasets() for files: objects without PixelData and
+     * repeated SOP instances are skipped.
+     *
+     * @return the datasets, owned by the caller
+     */
+    static vector<DcmItem*> readDatasets(const vector<Buffer>& buffers);
+
+    /**
+     * @brief Parse a structured report from memory.
+     *
+     * @param document receives the document, e.g. for TID1500Reader
+     * @return EC_Normal on success, an error otherwise
+     */
+    static OFCondition readStructuredReport(const Uint8* data, size_t length, DSRDocument& document);
+
+    /**
+     * @brief Encode a DICOM file into memory.
+     *
+     * EXS_RLELossless pixel data is encoded with Compression::encodeRLE() and
+     * EXS_DeflatedLittleEndianExplicit with Compression::encodeDeflated(); the
+     * dataset of fileFormat is changed accordingly.
+     *
+     * @param fileFormat file to encode, the meta header is updated for xfer
+     * @param result receives preamble, meta header and dataset
+     * @param xfer transfer syntax of the dataset
+     * @param numThreads number of threads for compression, 0 uses the ITK default
+     * @return EC_Normal on success, an error otherwise
+     */
+    static OFCondition writeDICOM(DcmFileFormat& fileFormat, vector<Uint8>& result,
+                                  E_TransferSyntax xfer = EXS_LittleEndianExplicit, unsigned int numThreads = 0);
+
+    /**
+     * @brief Create an image that uses a voxel buffer of the caller.
+     *
+     * The voxels are not copied, the buffer must outlive the image and all
+     * images derived from it without copying (e.g. channel adaptors). Voxels
+     * are ordered x fastest, then y, then z.
+     *
+     * @param voxels geometry.size[0]*geometry.size[1]*geometry.size[2] voxels
+     * @return image for the converters, which do not modify their input
+     */
+    template<class PixelType>
+    static typename itk::Image<PixelType, 3>::ConstPointer importVolume(const PixelType* voxels,
+                                                                        const VolumeGeometry& geometry) {
+      typedef itk::Image<PixelType, 3> ImageType;
+      typename ImageType::RegionType region;
+      typename ImageType::PointType origin;
+      typename ImageType::SpacingType spacing;
+      typename ImageType::DirectionType direction;
+      size_t numberOfVoxels = 1;
+      for(unsigned i=0;i<3;i++){
+        region.SetSize(i, geometry.size[i]);
+        origin[i] = geometry.origin[i];
+        spacing[i] = geometry.spacing[i];
+        for(unsigned j=0;j<3;j++)
+          direction[i][j] = geometry.direction[3*i+j];
+        numberOfVoxels *= geometry.size[i];
+      }
+
+      typename ImageType::PixelContainerPointer container = ImageType::PixelContainer::New();
+      // the image is only handed out as const, the buffer is never written
+      container->SetImportPointer(const_cast<PixelType*>(voxels), numberOfVoxels, false);
+      typename ImageType::Pointer image = ImageType::New();
+      image->SetRegions(region);
+      image->SetOrigin(origin);
+      image->SetSpacing(spacing);
+      image->SetDirection(direction);
+      image->SetPixelContainer(container);
+      return image.GetPointer();
+    }
+
+    /**
+     * @brief Voxels and geometry of an image, e.g. a result of Dicom2ItkConverter.
+     *
+     * @param geometry receives the geometry of the image
+     * @return pointer to the voxels of the buffered region, valid as long as the image
+     */
+    template<class ImageType>
+    static const typename ImageType::PixelType* getVoxels(const ImageType* image, VolumeGeometry& geometry) {
+      const typename ImageType::RegionType region = image->GetBufferedRegion();
+      for(unsigned i=0;i<3;i++){
+        geometry.size[i] = static_cast<unsigned>(region.GetSize()[i]);
+        geometry.spacing[i] = image->GetSpacing()[i];
+        for(unsigned j=0;j<3;j++)
+          geometry.direction[3*i+j] = image->GetDirection()[i][j];
+      }
+      // the origin of the first buffered voxel, which differs from the image
+      // origin if the buffered region does not start at index 0
+      typename ImageType::PointType origin;
+      image->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+      for(unsigned i=0;i<3;i++)
+        geometry.origin[i] = origin[i];
+      return image->GetBufferPointer();
+    }
+  };
+
+}
+
+#endif //DCMQI_MEMORYIO_H
@@ -11,11 +11,13 @@
 #include <dcmtk/dcmpmap/dpmparametricmapiod.h>
 
 // STD includes
+#include <functional>
 #include <stdlib.h>
 
 // ITK includes
 #include <itkImageRegionConstIteratorWithIndex.h>
 #include <itkMinimumMaximumImageCalculator.h>
+#include <itkVectorImage.h>
 
 // DCMQI includes
 #include "dcmqi/ConverterBase.h"
@@ -26,6 +28,16 @@ typedef itk::Image<FloatPixelType, 3> FloatImageType;
 typedef itk::ImageFileReader<FloatImageType> FloatReaderType;
 typedef itk::MinimumMaximumImageCalculator<FloatImageType> MinMaxCalculatorType;
 
+typedef IODDoubleFloatingPointImagePixelModule::value_type DoublePixelType;
+typedef itk::Image<DoublePixelType, 3> DoubleImageType;
+typedef itk::Image<Uint16, 3> UShortImageType;
+
+// multi-volume parametric maps: the fourth dimension enumerates the volumes
+typedef itk::Image<Sint16, 4> Short4DImageType;
+typedef itk::Image<Uint16, 4> UShort4DImageType;
+typedef itk::Image<FloatPixelType, 4> Float4DImageType;
+typedef itk::Image<DoublePixelType, 4> Double4DImageType;
+
 using namespace std;
 
 
@@ -34,12 +46,90 @@ namespace dcmqi {
   class ParaMapConverter : public ConverterBase {
 
   public:
-    static DcmDataset* itkimage2paramap(const FloatImageType::Pointer &parametricMapImage, vector<DcmItem*> dcmDatasets,
+    /**
+     * @brief Converts an ITK image into a DICOM Parametric Map.
+     *
+     * The frames are stored in the pixel type of the input image: ShortImageType
+     * and UShortImageType produce integer Pixel Data (with an identity Pixel Value
+     * Transformation), FloatImageType produces Float Pixel Data and DoubleImageType
+     * Double Float Pixel Data. In all cases the Real World Value Mapping uses the
+     * slope and intercept from the metadata and the range of the stored values.
+     *
+     * 4D images are converted into a single multi-volume Parametric Map: every
+     * volume is a stack of frames (Stack ID is the 1-based volume number, used as
+     * second dimension index) with a Real World Value Mapping of its own.
+     */
+    template<class ImageType>
+    static DcmDataset* itkimage2paramap(const itk::SmartPointer<ImageType> &parametricMapImage, vector<DcmItem*> dcmDatasets,
                                         const string &metaData,
                                         const bool doDicomValueChecks = true);
 
+    /**
+     * @brief Converts a vector image into a multi-volume DICOM Parametric Map.
+     *
+     * Every component becomes a volume, like the fourth dimension of a 4D image. The
+     * components are extracted one at a time, so the interleaved input is not copied
+     * as a whole. All volumes are described by the single quantity of the metadata.
+     */
+    template<typename PixelType>
+    static DcmDataset* itkvectorimage2paramap(const itk::SmartPointer<itk::VectorImage<PixelType, 3> > &parametricMapImage,
+                                              vector<DcmItem*> dcmDatasets, const string &metaData,
+                                              const bool doDicomValueChecks = true);
+
+    /**
+     * @brief Converts a DICOM Parametric Map into an ITK image.
+     *
+     * Integer and double precision frames are converted to float; stored values are
+     * copied as they are, without applying the Real World Value Mapping. Maps with
+     * more than one volume are rejected, use paramap2itkimage4D() for those.
+     */
     static pair <FloatImageType::Pointer, string> paramap2itkimage(DcmDataset *pmapDataset);
+
+    /**
+     * @brief Converts a (multi-volume) DICOM Parametric Map into a 4D ITK image.
+     *
+     * Volumes are identified by the Stack ID of the frames and ordered by it; a map
+     * without stacks results in a 4D image with a single volume.
+     */
+    static pair <Float4DImageType::Pointer, string> paramap2itkimage4D(DcmDataset *pmapDataset);
+
+    /**
+     * @brief Returns the first volume of a 4D image as 3D image sharing its pixel buffer.
+     */
+    static FloatImageType::Pointer getFirstVolume(const Float4DImageType::Pointer &image);
   protected:
+    /**
+     * @brief Computes the slice of the ITK image for every frame.
+     *
+     * The volume of a frame is given by its Stack ID, the slice within the volume by
+     * round((d - d0) / sliceSpacing), with d and d0 the projections of the Image Position
+     * (Patient) of the frame and of the image origin on the slice direction. Slices are
+     * counted across volumes. Unless every volume has exactly numberOfSlices frames,
+     * each at a different slice within the volume, the frames of a volume are placed
+     * in the order they are stored and numberOfSlices becomes the number of frames per
+     * volume. Fails if the volumes have different numbers of frames.
+     */
+    static int getFrameSliceIndices(FGInterface &fgInterface, const vnl_vector<double> &sliceDirection,
+                                    const vnl_vector<double> &imageOrigin, const double sliceSpacing,
+                                    unsigned &numberOfSlices,
+                                    vector<unsigned> &frameSlice, unsigned &numberOfVolumes);
+
+    /**
+     * @brief Converts the volumes of a map, given by their geometry and an accessor.
+     *
+     * getVolume returns the contiguous pixels of a volume; the pointer only has to stay
+     * valid until the next call.
+     */
+    template<typename PixelType>
+    static DcmDataset* itkvolumes2paramap(const ImageGeometryType::Pointer &geometry, const unsigned numberOfVolumes,
+                                          const function<PixelType*(unsigned)> &getVolume,
+                                          vector<DcmItem*> dcmDatasets, const string &metaData,
+                                          const bool doDicomValueChecks);
+
+    template<typename PixelType>
+    static void copyFramesToImage(DPMParametricMapIOD::Frames<PixelType>& frames, const vector<unsigned>& frameSlice,
+                                  const size_t frameSize, FloatPixelType* buffer);
+
     static OFCondition addFrame(DPMParametricMapIOD &map, const FloatImageType::Pointer &parametricMapImage,
                                 const JSONParametricMapMetaInformationHandler &metaInfo, const unsigned long frameNo, OFVector<FGBase*> perFrameGroups);
 
@@ -0,0 +1,126 @@
+#ifndef DCMQI_SEGMENTATION_METADATA_PLAN_H
+#define DCMQI_SEGMENTATION_METADATA_PLAN_H
+
+// DCMTK includes
+#include <dcmtk/dcmseg/segment.h>
+#include <dcmtk/dcmseg/segtypes.h>
+
+// STD includes
+#include <memory>
+#include <string>
+#include <vector>
+
+// DCMQI includes
+#include "dcmqi/JSONSegmentationMetaInformationHandler.h"
+
+using namespace std;
+
+namespace dcmqi {
+
+  /**
+   * @brief Segmentation metadata compiled once and reused for many conversions.
+   *
+   * JSONSegmentationMetaInformationHandler keeps one heap allocated
+   * SegmentAttributes per segment, from which every conversion derives the
+   * algorithm type, segment label, codes and CIELab color again. A plan holds
+   * all of that in the form it is written to DICOM: segments in flat arrays per
+   * input, looked up by label ID through a dense index, with validated codes and
+   * colors already converted. A plan is immutable once compiled, so one instance
+   * can be shared by conversions running concurrently.
+   */
+  class SegmentationMetadataPlan {
+
+  public:
+
+    /// Code as written to a Code Sequence item
+    struct Code {
+      OFString value;
+      OFString designator;
+      OFString meaning;
+    };
+
+    /// Attributes of one segment, resolved for writing
+    struct Segment {
+      unsigned labelID;
+      /// SegmentLabel, or SegmentDescription or the meaning of the property type if not given
+      OFString segmentLabel;
+      OFString segmentDescription;
+      DcmSegTypes::E_SegmentAlgoType algorithmType;
+      OFString algorithmName;
+      OFString trackingIdentifier;
+      OFString trackingUniqueIdentifier;
+      Code category;
+      Code type;
+      // optional codes, only set if the corresponding flag is true
+      bool hasTypeModifier;
+      Code typeModifier;
+      bool hasAnatomicRegion;
+      Code anatomicRegion;
+      bool hasAnatomicRegionModifier;
+      Code anatomicRegionModifier;
+      /// RecommendedDisplayRGBValue converted to integer scaled CIELab
+      Uint16 cielab[3];
+      /// why the segment cannot be written, empty if it is valid
+      string error;
+    };
+
+    typedef std::shared_ptr<const SegmentationMetadataPlan> ConstPointer;
+
+    /**
+     * @brief Compiles a plan from the JSON segmentation metadata.
+     *
+     * Segments are only validated when they are created, so metadata with an
+     * invalid segment can still be converted as long as no label uses it.
+     *
+     * @throw JSONReadErrorException if the metadata cannot be parsed
+     */
+    static ConstPointer compile(const string& metaData);
+
+    /// Compiles a plan from metadata that has been read already
+    static ConstPointer compile(const JSONSegmentationMetaInformationHandler& metaInfo);
+
+    /// Number of inputs (segmentation files or channels) described by the metadata
+    size_t getNumberOfInputs() const { return inputs.size(); }
+
+    /// Segments of an input, ordered by label ID
+    const vector<Segment>& getSegments(size_t input) const { return inputs[input].segments; }
+
+    /// Segment of an input for a label ID, NULL if the metadata has none
+    const Segment* findSegment(size_t input, long labelID) const;
+
+    /// Series level attributes (SeriesDescription, ContentCreatorName, ...)
+    const JSONSegmentationMetaInformationHandler& getSeriesInformation() const { return seriesInformation; }
+
+    /**
+     * @brief Creates the DICOM segment for a compiled segment.
+     *
+     * The code items are created from the plan, so segments can be created
+     * from the same plan in several threads at the same time.
+     *
+     * @return new segment owned by the caller, NULL on error, e.g. if the
+     *         metadata of the segment is incomplete (the reason is printed)
+     */
+    static DcmSegment* createSegment(const Segment& segment);
+
+  protected:
+
+    SegmentationMetadataPlan() {}
+
+    /// Label IDs below this value are looked up in a dense index, larger ones are searched
+    static constexpr unsigned DenseLabelRange = 65536;
+
+    struct Input {
+      vector<Segment> segments;
+      /// position in segments by label ID, -1 for labels without segment
+      vector<int> segmentIndex;
+    };
+
+    static bool compileCode(CodeSequenceMacro* codeSequence, Code& code);
+
+    vector<Input> inputs;
+    JSONSegmentationMetaInformationHandler seriesInformation;
+  };
+
+}
+
+#endif //DCMQI_SEGMENTATION_METADATA_PLAN_H
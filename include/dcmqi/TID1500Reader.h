@@ -22,6 +22,9 @@
 
 #include <json/json.h>
 
+#include <string>
+#include <unordered_map>
+
 
 // Based on the code provided by @jriesmeier, see
 //  https://gist.github.com/fedorov/41e42c1e701d74b2391792241809fe62
@@ -42,10 +45,30 @@ class TID1500Reader
 
     void initSegmentationContentItems(DSRDocumentTreeNodeCursor cursor, Json::Value &json);
 
+    /// Reads the metadata and measurements of a TID 1500 SR dataset into the
+    /// JSON structure written by tid1500reader. Series attributes and evidence
+    /// are read even if the document tree is not a valid SR.
+    static void readReport(DcmItem &dataset, DSRDocument &doc, Json::Value &metaRoot);
+
     using DSRDocumentTree::gotoNamedChildNode;
 
   protected:
 
+    /// Direct child nodes of a content item by concept name (first occurrence wins)
+    typedef std::unordered_map<std::string, const DSRDocumentTreeNode *> ConceptIndex;
+
+    /// Key identifying a concept name: coding scheme designator, version and code value
+    static std::string getConceptKey(const DSRCodedEntryValue &conceptName);
+
+    static const DSRDocumentTreeNode *findConcept(const ConceptIndex &index,
+                                                  const DSRCodedEntryValue &conceptName);
+
+    /// Converts the value of a TEXT, UIDREF, CODE, IMAGE or PNAME content item
+    static Json::Value getContentItemValue(const DSRDocumentTreeNode *node,
+                                           const DSRCodedEntryValue &conceptName);
+
+    static void initSegmentationContentItems(const DSRDocumentTreeNode *node, Json::Value &json);
+
     size_t gotoNamedChildNode(const DSRCodedEntryValue &conceptName,
                               DSRDocumentTreeNodeCursor &cursor);
 };
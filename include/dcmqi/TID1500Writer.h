@@ -0,0 +1,39 @@
+#ifndef DCMQI_TID1500WRITER_H
+#define DCMQI_TID1500WRITER_H
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmdata/dcdatset.h"
+
+#include <json/json.h>
+
+#include <string>
+#include <vector>
+
+
+// Creates DICOM SR TID 1500 (Measurement Report) documents from the JSON
+// metadata accepted by tid1500writer
+class TID1500Writer
+{
+  public:
+    /// Creates the report described by metaRoot. The files listed in
+    /// "imageLibrary" and "compositeContext" are read from the given
+    /// directories (relative to the working directory if a directory is empty);
+    /// Patient and Study modules are copied from the last composite context file.
+    /// Returns the report dataset (owned by the caller), or NULL if the report
+    /// is not valid. DCMTK errors are thrown (CHECK_COND).
+    static DcmDataset* writeReport(const Json::Value &metaRoot,
+                                   const std::string &imageLibraryDataDir,
+                                   const std::string &compositeContextDataDir);
+
+    /// Creates the report described by metaRoot from referenced objects that
+    /// are already parsed, e.g. from memory (see dcmqi::MemoryIO). The datasets
+    /// take the place of the files listed in "compositeContext" and
+    /// "imageLibrary", in the same order; they are not modified and stay owned
+    /// by the caller.
+    static DcmDataset* writeReport(const Json::Value &metaRoot,
+                                   const std::vector<DcmItem*> &compositeContextDatasets,
+                                   const std::vector<DcmItem*> &imageLibraryDatasets);
+};
+
+#endif // DCMQI_TID1500WRITER_H
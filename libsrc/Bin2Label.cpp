@@ -1,5 +1,6 @@
 #include "dcmtk/config/osconfig.h" // include OS configuration first
 #include "dcmqi/Bin2Label.h"
+#include "dcmqi/Instrumentation.h"
 #include "dcmtk/dcmdata/dcuid.h"
 #include "dcmtk/dcmfg/fgfact.h"
 #include "dcmtk/dcmfg/fgfracon.h"
@@ -79,8 +80,13 @@ OFCondition DcmBinToLabelConverter::convert(const ConversionFlags& convFlags)
 {
     // Check whether input is set appropriately; loads input segmentation (if necessary)
     // and checks whether its a binary segmentation object
+    Profiler::Scope profilerScope("DcmBinToLabelConverter::convert");
     m_convFlags = convFlags;
-    OFCondition result = loadInput();
+    OFCondition result;
+    {
+        Profiler::Scope loadScope("loadInput");
+        result = loadInput();
+    }
     if (result.bad())
     {
         clear();
@@ -99,10 +105,13 @@ OFCondition DcmBinToLabelConverter::convert(const ConversionFlags& convFlags)
     }
 
     // Check for overlaps which would prevent conversion
-    m_overlapUtil.setSegmentationObject(m_inputSeg);
-    if (m_overlapUtil.hasOverlappingSegments())
     {
-        return SG_EC_OverlappingSegments;
+        Profiler::Scope overlapScope("overlapCheck");
+        m_overlapUtil.setSegmentationObject(m_inputSeg);
+        if (m_overlapUtil.hasOverlappingSegments())
+        {
+            return SG_EC_OverlappingSegments;
+        }
     }
     // Get number of segments to find out whether we need 16 bit data. The input is
     // a binary segmentation, so its segments are numbered 1..N without gaps and are
@@ -194,7 +203,13 @@ OFCondition DcmBinToLabelConverter::convert(const ConversionFlags& convFlags)
     if (result.good())
     {
         DCMSEG_DEBUG("Copying per-frame information (pixel data and FGs) to output segmentation");
+        Profiler::Scope framesScope("frames");
         result = createFramesWithMetadata(m_inputSeg);
+        if (result.good())
+        {
+            Profiler::count("frames", m_outputSeg->getNumberOfFrames());
+            Profiler::count("segments", numSegments);
+        }
     }
 
     // Designate pixel value 0 as background (Background segment with number 0 plus
@@ -660,6 +675,7 @@ OFCondition DcmBinToLabelConverter::getOutputSegmentation(OFshared_ptr<DcmSegmen
 
 OFCondition DcmBinToLabelConverter::getOutputDataset(DcmItem& outputDataset)
 {
+    Profiler::Scope profilerScope("DcmBinToLabelConverter::getOutputDataset");
     outputDataset.clear();
     if (m_outputSeg)
     {
@@ -674,6 +690,9 @@ OFCondition DcmBinToLabelConverter::getOutputDataset(DcmItem& outputDataset)
             outputDataset.clear();
             return result;
         }
+        DcmElement* pixelData = OFnullptr;
+        if (Profiler::isEnabled() && outputDataset.findAndGetElement(DCM_PixelData, pixelData).good())
+            Profiler::count("bytes", pixelData->getLength());
     }
     return EC_Normal;
 }
@@ -0,0 +1,692 @@
+
+// DCMQI includes
+#include "dcmqi/Compression.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcofsetl.h>
+#include <dcmtk/dcmdata/dcpixel.h>
+#include <dcmtk/dcmdata/dcpixseq.h>
+#include <dcmtk/dcmdata/dcpxitem.h>
+#include <dcmtk/dcmdata/dcistrmb.h>
+#include <dcmtk/dcmdata/dcostrmb.h>
+
+// STD includes
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#ifdef DCMQI_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace dcmqi {
+
+#ifdef DCMQI_WITH_ZLIB
+  namespace {
+    // zlib counts the input and output of a call in uInt, larger buffers are handed over in pieces
+    const size_t MaxZlibChunk = numeric_limits<uInt>::max();
+  }
+#endif
+
+  OFCondition Compression::encodeRLE(DcmDataset* dataset, unsigned int numThreads) {
+    Uint16 rows = 0, columns = 0, bitsAllocated = 0, samplesPerPixel = 1;
+    Sint32 numberOfFrames = 1;
+    if (dataset->findAndGetUint16(DCM_Rows, rows).bad() ||
+        dataset->findAndGetUint16(DCM_Columns, columns).bad() ||
+        dataset->findAndGetUint16(DCM_BitsAllocated, bitsAllocated).bad()) {
+      cerr << "ERROR: Rows, Columns or Bits Allocated missing, cannot RLE encode pixel data" << endl;
+      return EC_MissingAttribute;
+    }
+    dataset->findAndGetUint16(DCM_SamplesPerPixel, samplesPerPixel);
+    dataset->findAndGetSint32(DCM_NumberOfFrames, numberOfFrames);
+    if ((bitsAllocated != 8 && bitsAllocated != 16) || samplesPerPixel != 1) {
+      cerr << "ERROR: RLE encoding is only supported for 8 and 16 bit single sample pixel data, "
+           << "found Bits Allocated " << bitsAllocated << " and Samples per Pixel " << samplesPerPixel << endl;
+      return EC_CannotChangeRepresentation;
+    }
+    if (numberOfFrames < 1) {
+      numberOfFrames = 1;
+    }
+
+    DcmElement* element = NULL;
+    if (dataset->findAndGetElement(DCM_PixelData, element).bad() || element == NULL) {
+      cerr << "ERROR: Dataset has no Pixel Data, cannot RLE encode" << endl;
+      return EC_MissingAttribute;
+    }
+    DcmPixelData* pixelData = OFstatic_cast(DcmPixelData*, element);
+
+    const unsigned bytesPerSample = bitsAllocated / 8;
+    const size_t pixelsPerFrame = static_cast<size_t>(rows) * columns;
+    const size_t bytesPerFrame = pixelsPerFrame * bytesPerSample;
+    if (static_cast<size_t>(pixelData->getLength()) < bytesPerFrame * numberOfFrames) {
+      cerr << "ERROR: Pixel Data is shorter than " << numberOfFrames << " frames of "
+           << rows << "x" << columns << " pixels" << endl;
+      return EC_CorruptedData;
+    }
+
+    const Uint8* pixels8 = NULL;
+    const Uint16* pixels16 = NULL;
+    OFCondition cond;
+    if (bytesPerSample == 1) {
+      Uint8* data = NULL;
+      cond = pixelData->getUint8Array(data);
+      pixels8 = data;
+    } else {
+      Uint16* data = NULL;
+      cond = pixelData->getUint16Array(data);
+      pixels16 = data;
+    }
+    if (cond.bad() || (pixels8 == NULL && pixels16 == NULL)) {
+      cerr << "ERROR: Failed to access native Pixel Data: " << cond.text() << endl;
+      return cond.bad() ? cond : EC_CorruptedData;
+    }
+
+    vector<vector<Uint8> > encodedFrames(numberOfFrames);
+
+    itk::MultiThreaderBase::Pointer threader = createThreader(numThreads);
+    threader->ParallelizeArray(0, static_cast<itk::SizeValueType>(numberOfFrames),
+      [&](itk::SizeValueType frameNo) {
+        const void* frame = (bytesPerSample == 1)
+                          ? static_cast<const void*>(pixels8 + frameNo * pixelsPerFrame)
+                          : static_cast<const void*>(pixels16 + frameNo * pixelsPerFrame);
+        encodeRLEFrame(frame, rows, columns, bytesPerSample, encodedFrames[frameNo]);
+      }, nullptr);
+
+    // assemble the encapsulated pixel data: offset table item followed by one fragment per frame
+    DcmPixelSequence* pixelSequence = new DcmPixelSequence(DCM_PixelSequenceTag);
+    DcmPixelItem* offsetTable = new DcmPixelItem(DCM_PixelItemTag);
+    pixelSequence->insert(offsetTable);
+
+    DcmOffsetList offsetList;
+    unsigned long long totalLength = 0;
+    for (size_t frameNo = 0; frameNo < encodedFrames.size(); frameNo++) {
+      vector<Uint8>& encoded = encodedFrames[frameNo];
+      totalLength += encoded.size() + 8;
+      cond = pixelSequence->storeCompressedFrame(offsetList, encoded.data(), OFstatic_cast(Uint32, encoded.size()), 0);
+      vector<Uint8>().swap(encoded);
+      if (cond.bad()) {
+        cerr << "ERROR: Failed to store RLE frame " << frameNo << ": " << cond.text() << endl;
+        delete pixelSequence;
+        return cond;
+      }
+    }
+
+    // Basic Offset Table entries are 32 bit, leave the table empty if the offsets do not fit
+    if (totalLength <= 0xFFFFFFFFULL) {
+      cond = offsetTable->createOffsetTable(offsetList);
+      if (cond.bad()) {
+        cerr << "ERROR: Failed to create Basic Offset Table: " << cond.text() << endl;
+        delete pixelSequence;
+        return cond;
+      }
+    } else {
+      cerr << "WARNING: Encapsulated Pixel Data exceeds 4 GB, Basic Offset Table left empty" << endl;
+    }
+
+    pixelData->putOriginalRepresentation(EXS_RLELossless, NULL, pixelSequence);
+    return EC_Normal;
+  }
+
+  void Compression::encodeRLEFrame(const void* frame, const Uint16 rows, const Uint16 columns,
+                                   const unsigned bytesPerSample, vector<Uint8>& result) {
+    // RLE header: number of segments followed by 15 segment offsets, all 32 bit little endian
+    const size_t headerSize = 64;
+    result.assign(headerSize, 0);
+    result[0] = static_cast<Uint8>(bytesPerSample);
+
+    vector<Uint8> row(columns);
+    for (unsigned segment = 0; segment < bytesPerSample; segment++) {
+      const Uint32 offset = static_cast<Uint32>(result.size());
+      for (unsigned b = 0; b < 4; b++) {
+        result[4 + 4 * segment + b] = static_cast<Uint8>(offset >> (8 * b));
+      }
+      // segments are ordered from the most to the least significant byte
+      const unsigned shift = 8 * (bytesPerSample - 1 - segment);
+      for (size_t r = 0; r < rows; r++) {
+        const size_t rowStart = r * columns;
+        if (bytesPerSample == 1) {
+          const Uint8* pixels = static_cast<const Uint8*>(frame) + rowStart;
+          encodeRLERow(pixels, columns, result);
+        } else {
+          const Uint16* pixels = static_cast<const Uint16*>(frame) + rowStart;
+          for (size_t c = 0; c < columns; c++) {
+            row[c] = static_cast<Uint8>(pixels[c] >> shift);
+          }
+          encodeRLERow(row.data(), columns, result);
+        }
+      }
+      // each segment has even length
+      if (result.size() % 2) {
+        result.push_back(0);
+      }
+    }
+  }
+
+  void Compression::encodeRLERow(const Uint8* row, const size_t length, vector<Uint8>& result) {
+    // PackBits as specified in PS3.5 G.3.1; runs never cross a row boundary
+    size_t i = 0;
+    while (i < length) {
+      size_t run = 1;
+      while (i + run < length && run < 128 && row[i + run] == row[i]) {
+        run++;
+      }
+      if (run > 1) {
+        result.push_back(static_cast<Uint8>(257 - run));
+        result.push_back(row[i]);
+        i += run;
+      } else {
+        const size_t start = i;
+        size_t literal = 0;
+        while (i < length && literal < 128) {
+          if (i + 1 < length && row[i] == row[i + 1]) {
+            break;
+          }
+          i++;
+          literal++;
+        }
+        result.push_back(static_cast<Uint8>(literal - 1));
+        result.insert(result.end(), row + start, row + start + literal);
+      }
+    }
+  }
+
+  OFCondition Compression::decodeRLE(DcmDataset* dataset, unsigned int numThreads) {
+    if (dataset->getOriginalXfer() != EXS_RLELossless)
+      return EC_Normal;
+
+    DcmElement* element = NULL;
+    if (dataset->findAndGetElement(DCM_PixelData, element).bad() || element == NULL)
+      return EC_Normal;
+    DcmPixelData* pixelData = OFstatic_cast(DcmPixelData*, element);
+
+    Uint16 rows = 0, columns = 0, bitsAllocated = 0, samplesPerPixel = 1;
+    Sint32 numberOfFrames = 1;
+    dataset->findAndGetUint16(DCM_Rows, rows);
+    dataset->findAndGetUint16(DCM_Columns, columns);
+    dataset->findAndGetUint16(DCM_BitsAllocated, bitsAllocated);
+    dataset->findAndGetUint16(DCM_SamplesPerPixel, samplesPerPixel);
+    dataset->findAndGetSint32(DCM_NumberOfFrames, numberOfFrames);
+    if (numberOfFrames < 1)
+      numberOfFrames = 1;
+    if ((bitsAllocated != 8 && bitsAllocated != 16) || samplesPerPixel != 1 || rows == 0 || columns == 0)
+      return EC_Normal;
+
+    DcmPixelSequence* pixelSequence = NULL;
+    if (pixelData->getEncapsulatedRepresentation(EXS_RLELossless, NULL, pixelSequence).bad() || pixelSequence == NULL)
+      return EC_Normal;
+    vector<vector<Uint8> > fragments;
+    if (!getRLEFrameFragments(pixelSequence, numberOfFrames, fragments))
+      return EC_Normal;
+
+    // replaces the encapsulated representation by an uninitialized native one
+    const unsigned bytesPerSample = bitsAllocated / 8;
+    const size_t pixelsPerFrame = static_cast<size_t>(rows) * columns;
+    const size_t numberOfPixels = pixelsPerFrame * numberOfFrames;
+    if (numberOfPixels * bytesPerSample > 0xFFFFFFFEUL)
+      return EC_Normal;
+    Uint8* pixels8 = NULL;
+    Uint16* pixels16 = NULL;
+    OFCondition cond;
+    if (bytesPerSample == 1)
+      cond = pixelData->createUint8Array(OFstatic_cast(Uint32, numberOfPixels), pixels8);
+    else
+      cond = pixelData->createUint16Array(OFstatic_cast(Uint32, numberOfPixels), pixels16);
+    if (cond.bad()) {
+      cerr << "ERROR: Failed to allocate native Pixel Data: " << cond.text() << endl;
+      return cond;
+    }
+
+    std::atomic<bool> failed(false);
+    itk::MultiThreaderBase::Pointer threader = createThreader(numThreads);
+    threader->ParallelizeArray(0, static_cast<itk::SizeValueType>(numberOfFrames),
+      [&](itk::SizeValueType frameNo) {
+        void* frame = (bytesPerSample == 1) ? static_cast<void*>(pixels8 + frameNo * pixelsPerFrame)
+                                            : static_cast<void*>(pixels16 + frameNo * pixelsPerFrame);
+        const vector<Uint8>& fragment = fragments[frameNo];
+        if (!decodeRLEFrame(fragment.data(), fragment.size(), pixelsPerFrame, bytesPerSample, frame))
+          failed = true;
+      }, nullptr);
+
+    if (failed) {
+      cerr << "ERROR: RLE Lossless Pixel Data is corrupt" << endl;
+      return EC_CorruptedData;
+    }
+    dataset->updateOriginalXfer();
+    return EC_Normal;
+  }
+
+  bool Compression::getRLEFrameFragments(DcmPixelSequence* pixelSequence, const Sint32 numberOfFrames,
+                                         vector<vector<Uint8> >& frames) {
+    // the first item is the Basic Offset Table
+    const unsigned long numberOfFragments = pixelSequence->card() > 0 ? pixelSequence->card() - 1 : 0;
+    if (numberOfFragments < static_cast<unsigned long>(numberOfFrames))
+      return false;
+
+    DcmPixelItem* item = NULL;
+    Uint8* itemData = NULL;
+    if (pixelSequence->getItem(item, 0).bad() || item == NULL)
+      return false;
+    // offsets of the first fragment of every frame, relative to the first fragment item
+    vector<Uint32> frameOffsets;
+    const Uint32 offsetTableLength = item->getLength();
+    if (offsetTableLength > 0) {
+      if (item->getUint8Array(itemData).bad() || itemData == NULL ||
+          offsetTableLength != 4 * static_cast<Uint32>(numberOfFrames))
+        return false;
+      for (Uint32 i = 0; i < offsetTableLength; i += 4)
+        frameOffsets.push_back(itemData[i] | (itemData[i + 1] << 8) | (itemData[i + 2] << 16) |
+                               (static_cast<Uint32>(itemData[i + 3]) << 24));
+      if (frameOffsets[0] != 0)
+        return false;
+    } else if (numberOfFragments != static_cast<unsigned long>(numberOfFrames) && numberOfFrames != 1) {
+      // without an offset table the frame boundaries are only known for
+      // one fragment per frame (PS3.5 A.4.2), or all fragments of a single frame
+      return false;
+    }
+
+    frames.assign(numberOfFrames, vector<Uint8>());
+    Sint32 frameNo = -1;
+    size_t position = 0;
+    for (unsigned long fragmentNo = 0; fragmentNo < numberOfFragments; fragmentNo++) {
+      if (frameOffsets.empty()) {
+        if (numberOfFragments == static_cast<unsigned long>(numberOfFrames) || frameNo < 0)
+          frameNo++;
+      } else if (frameNo + 1 < numberOfFrames && position == frameOffsets[frameNo + 1]) {
+        frameNo++;
+      } else if (frameNo + 1 < numberOfFrames && position > frameOffsets[frameNo + 1]) {
+        // an offset that does not point to the start of a fragment
+        return false;
+      }
+
+      if (pixelSequence->getItem(item, fragmentNo + 1).bad() || item == NULL ||
+          item->getUint8Array(itemData).bad())
+        return false;
+      if (itemData != NULL)
+        frames[frameNo].insert(frames[frameNo].end(), itemData, itemData + item->getLength());
+      // item tag and length precede the fragment data
+      position += 8 + item->getLength();
+    }
+    return frameNo == numberOfFrames - 1;
+  }
+
+  bool Compression::decodeRLEFrame(const Uint8* data, const size_t length, const size_t numberOfPixels,
+                                   const unsigned bytesPerSample, void* frame) {
+    const size_t headerSize = 64;
+    if (length < headerSize)
+      return false;
+    Uint32 header[16];
+    for (unsigned i = 0; i < 16; i++) {
+      header[i] = data[4 * i] | (data[4 * i + 1] << 8) | (data[4 * i + 2] << 16) | (static_cast<Uint32>(data[4 * i + 3]) << 24);
+    }
+    if (header[0] != bytesPerSample)
+      return false;
+
+    vector<Uint8> segmentBytes(bytesPerSample == 1 ? 0 : numberOfPixels);
+    for (unsigned segment = 0; segment < bytesPerSample; segment++) {
+      const size_t start = header[1 + segment];
+      const size_t end = (segment + 1 < bytesPerSample) ? header[2 + segment] : length;
+      if (start < headerSize || start > end || end > length)
+        return false;
+
+      // a single byte segment decodes straight into the frame
+      Uint8* out = (bytesPerSample == 1) ? static_cast<Uint8*>(frame) : segmentBytes.data();
+      size_t produced = 0;
+      size_t pos = start;
+      while (produced < numberOfPixels && pos < end) {
+        const int n = static_cast<signed char>(data[pos++]);
+        if (n >= 0) {
+          const size_t count = static_cast<size_t>(n) + 1;
+          if (pos + count > end || produced + count > numberOfPixels)
+            return false;
+          memcpy(out + produced, data + pos, count);
+          pos += count;
+          produced += count;
+        } else if (n != -128) {
+          const size_t count = static_cast<size_t>(1 - n);
+          if (pos >= end || produced + count > numberOfPixels)
+            return false;
+          memset(out + produced, data[pos++], count);
+          produced += count;
+        }
+      }
+      if (produced != numberOfPixels)
+        return false;
+
+      if (bytesPerSample == 2) {
+        // segments are ordered from the most to the least significant byte
+        Uint16* pixels = static_cast<Uint16*>(frame);
+        if (segment == 0) {
+          for (size_t i = 0; i < numberOfPixels; i++)
+            pixels[i] = static_cast<Uint16>(segmentBytes[i] << 8);
+        } else {
+          for (size_t i = 0; i < numberOfPixels; i++)
+            pixels[i] |= segmentBytes[i];
+        }
+      }
+    }
+    return true;
+  }
+
+  itk::MultiThreaderBase::Pointer Compression::createThreader(unsigned int numThreads) {
+    itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+    if (numThreads > 0) {
+      threader->SetMaximumNumberOfThreads(numThreads);
+      threader->SetNumberOfWorkUnits(numThreads);
+    }
+    return threader;
+  }
+
+  OFCondition Compression::saveDeflated(DcmFileFormat& fileFormat, const string& fileName, unsigned int numThreads) {
+#ifdef DCMQI_WITH_ZLIB
+    vector<Uint8> encoded;
+    OFCondition cond = encodeDeflated(fileFormat, encoded, numThreads);
+    if (cond.bad())
+      return cond;
+
+    ofstream out(fileName.c_str(), ios_base::binary);
+    out.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+    out.close();
+    if (!out) {
+      cerr << "ERROR: Failed to write " << fileName << endl;
+      return EC_InvalidStream;
+    }
+    return EC_Normal;
+#else
+    (void)numThreads;
+    return fileFormat.saveFile(fileName.c_str(), EXS_DeflatedLittleEndianExplicit);
+#endif
+  }
+
+  OFCondition Compression::encodeDeflated(DcmFileFormat& fileFormat, vector<Uint8>& result, unsigned int numThreads) {
+#ifdef DCMQI_WITH_ZLIB
+    DcmDataset* dataset = fileFormat.getDataset();
+    // the deflated transfer syntax compresses an Explicit VR Little Endian encoded dataset
+    OFCondition cond = dataset->chooseRepresentation(EXS_LittleEndianExplicit, NULL);
+    if (cond.good())
+      cond = fileFormat.validateMetaInfo(EXS_DeflatedLittleEndianExplicit);
+    if (cond.bad()) {
+      cerr << "ERROR: Failed to prepare dataset for deflate: " << cond.text() << endl;
+      return cond;
+    }
+
+    // serialize the meta header and the dataset to memory
+    vector<Uint8> metaHeader, encodedDataset;
+    vector<Uint8> buffer(DeflateBlockSize);
+    DcmItem* items[2] = { fileFormat.getMetaInfo(), dataset };
+    vector<Uint8>* targets[2] = { &metaHeader, &encodedDataset };
+    for (int i = 0; i < 2; i++) {
+      DcmOutputBufferStream stream(buffer.data(), buffer.size());
+      void* written = NULL;
+      offile_off_t writtenLength = 0;
+      items[i]->transferInit();
+      cond = items[i]->write(stream, EXS_LittleEndianExplicit, EET_ExplicitLength, NULL);
+      while (cond == EC_StreamNotifyBuffer) {
+        stream.flushBuffer(written, writtenLength);
+        targets[i]->insert(targets[i]->end(), static_cast<Uint8*>(written), static_cast<Uint8*>(written) + writtenLength);
+        cond = items[i]->write(stream, EXS_LittleEndianExplicit, EET_ExplicitLength, NULL);
+      }
+      items[i]->transferEnd();
+      if (cond.bad()) {
+        cerr << "ERROR: Failed to encode dataset: " << cond.text() << endl;
+        return cond;
+      }
+      stream.flush();
+      stream.flushBuffer(written, writtenLength);
+      targets[i]->insert(targets[i]->end(), static_cast<Uint8*>(written), static_cast<Uint8*>(written) + writtenLength);
+    }
+
+    vector<Uint8> deflated;
+    cond = deflateParallel(encodedDataset.data(), encodedDataset.size(), deflated, numThreads);
+    if (cond.bad())
+      return cond;
+    vector<Uint8>().swap(encodedDataset);
+
+    result.swap(metaHeader);
+    result.insert(result.end(), deflated.begin(), deflated.end());
+    return EC_Normal;
+#else
+    (void)fileFormat;
+    (void)result;
+    (void)numThreads;
+    cerr << "ERROR: dcmqi was built without zlib, cannot encode deflated datasets" << endl;
+    return EC_UnsupportedEncoding;
+#endif
+  }
+
+  OFCondition Compression::loadFile(DcmFileFormat& fileFormat, const string& fileName, unsigned int numThreads) {
+    OFCondition cond = loadAndInflate(fileFormat, fileName, numThreads);
+    if (cond.good())
+      cond = decodeRLE(fileFormat.getDataset(), numThreads);
+    return cond;
+  }
+
+  OFCondition Compression::loadAndInflate(DcmFileFormat& fileFormat, const string& fileName, unsigned int numThreads) {
+#ifdef DCMQI_WITH_ZLIB
+    OFCondition cond = fileFormat.loadFile(fileName.c_str(), EXS_Unknown, EGL_noChange, DCM_MaxReadLength, ERM_metaOnly);
+    OFString transferSyntaxUID;
+    if (cond.bad() ||
+        fileFormat.getMetaInfo()->findAndGetOFString(DCM_TransferSyntaxUID, transferSyntaxUID).bad() ||
+        DcmXfer(transferSyntaxUID.c_str()).getXfer() != EXS_DeflatedLittleEndianExplicit) {
+      return fileFormat.loadFile(fileName.c_str());
+    }
+
+    ifstream in(fileName.c_str(), ios_base::binary);
+    vector<Uint8> fileData((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    // the meta header is Explicit VR Little Endian, find where group 0002 ends
+    size_t offset = 132;
+    if (fileData.size() < offset || memcmp(&fileData[128], "DICM", 4) != 0)
+      return fileFormat.loadFile(fileName.c_str());
+    while (offset + 8 <= fileData.size() && fileData[offset] == 0x02 && fileData[offset + 1] == 0x00) {
+      const string vr(reinterpret_cast<const char*>(&fileData[offset + 4]), 2);
+      if (DcmVR(vr.c_str()).usesExtendedLengthEncoding()) {
+        if (offset + 12 > fileData.size())
+          break;
+        const Uint32 length = fileData[offset + 8] | (fileData[offset + 9] << 8) |
+                              (fileData[offset + 10] << 16) | (static_cast<Uint32>(fileData[offset + 11]) << 24);
+        offset += 12 + length;
+      } else {
+        const Uint16 length = fileData[offset + 6] | (fileData[offset + 7] << 8);
+        offset += 8 + length;
+      }
+    }
+    if (offset > fileData.size())
+      return fileFormat.loadFile(fileName.c_str());
+
+    vector<Uint8> inflated;
+    cond = inflateParallel(fileData.data() + offset, fileData.size() - offset, inflated, numThreads);
+    vector<Uint8>().swap(fileData);
+    if (cond.bad())
+      return fileFormat.loadFile(fileName.c_str());
+
+    DcmDataset* dataset = fileFormat.getDataset();
+    dataset->clear();
+    DcmInputBufferStream stream;
+    stream.setBuffer(inflated.data(), inflated.size());
+    stream.setEos();
+    dataset->transferInit();
+    // read all element values now, the buffer does not outlive this call
+    cond = dataset->read(stream, EXS_LittleEndianExplicit, EGL_noChange, OFstatic_cast(Uint32, -1));
+    dataset->transferEnd();
+    if (cond.bad()) {
+      cerr << "WARNING: Failed to parse inflated dataset (" << cond.text() << "), falling back to DCMTK" << endl;
+      return fileFormat.loadFile(fileName.c_str());
+    }
+    return EC_Normal;
+#else
+    (void)numThreads;
+    return fileFormat.loadFile(fileName.c_str());
+#endif
+  }
+
+  OFCondition Compression::deflateParallel(const Uint8* data, const size_t length, vector<Uint8>& result,
+                                           unsigned int numThreads) {
+#ifdef DCMQI_WITH_ZLIB
+    const size_t numBlocks = max<size_t>(1, (length + DeflateBlockSize - 1) / DeflateBlockSize);
+    vector<vector<Uint8> > blocks(numBlocks);
+    std::atomic<bool> failed(false);
+
+    itk::MultiThreaderBase::Pointer threader = createThreader(numThreads);
+    threader->ParallelizeArray(0, static_cast<itk::SizeValueType>(numBlocks),
+      [&](itk::SizeValueType blockNo) {
+        const size_t start = blockNo * DeflateBlockSize;
+        const size_t blockLength = min(DeflateBlockSize, length - start);
+        const bool lastBlock = (blockNo + 1 == numBlocks);
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // negative window bits: raw deflate without zlib header or checksum, as required by PS3.5 A.5
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+          failed = true;
+          return;
+        }
+        vector<Uint8>& block = blocks[blockNo];
+        // room for the flush marker in addition to the worst case expansion
+        block.resize(deflateBound(&zs, static_cast<uLong>(blockLength)) + 16);
+        zs.next_in = const_cast<Bytef*>(data + start);
+        size_t remainingIn = blockLength, produced = 0;
+        int status = Z_OK;
+        while (status == Z_OK) {
+          if (zs.avail_in == 0) {
+            const size_t chunkIn = min(remainingIn, MaxZlibChunk);
+            zs.avail_in = static_cast<uInt>(chunkIn);
+            remainingIn -= chunkIn;
+          }
+          const size_t chunkOut = min(block.size() - produced, MaxZlibChunk);
+          zs.next_out = block.data() + produced;
+          zs.avail_out = static_cast<uInt>(chunkOut);
+          // every block but the last ends byte aligned with an empty stored block, so the blocks
+          // can be concatenated and each one can be inflated without the data preceding it
+          const int flush = remainingIn ? Z_NO_FLUSH : (lastBlock ? Z_FINISH : Z_FULL_FLUSH);
+          status = deflate(&zs, flush);
+          produced += chunkOut - zs.avail_out;
+          // the flush is complete once deflate leaves room in the output
+          if (flush == Z_FULL_FLUSH && zs.avail_in == 0 && zs.avail_out != 0)
+            break;
+        }
+        if (status != (lastBlock ? Z_STREAM_END : Z_OK) || remainingIn != 0 || zs.avail_in != 0)
+          failed = true;
+        block.resize(produced);
+        deflateEnd(&zs);
+      }, nullptr);
+
+    if (failed) {
+      cerr << "ERROR: zlib failed to deflate the dataset" << endl;
+      return EC_CorruptedData;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < blocks.size(); i++)
+      total += blocks[i].size();
+    result.clear();
+    result.reserve(total);
+    for (size_t i = 0; i < blocks.size(); i++) {
+      result.insert(result.end(), blocks[i].begin(), blocks[i].end());
+      vector<Uint8>().swap(blocks[i]);
+    }
+    return EC_Normal;
+#else
+    (void)data; (void)length; (void)result; (void)numThreads;
+    return EC_NoEncodingLibrary;
+#endif
+  }
+
+  OFCondition Compression::inflateParallel(const Uint8* data, const size_t length, vector<Uint8>& result,
+                                           unsigned int numThreads) {
+#ifdef DCMQI_WITH_ZLIB
+    // candidate block boundaries follow the 00 00 FF FF of an empty stored block
+    vector<size_t> boundaries(1, 0);
+    for (size_t i = 4; i < length; i++) {
+      if (data[i - 1] == 0xFF && data[i - 2] == 0xFF && data[i - 3] == 0x00 && data[i - 4] == 0x00)
+        boundaries.push_back(i);
+    }
+    boundaries.push_back(length);
+
+    const size_t numBlocks = boundaries.size() - 1;
+    vector<vector<Uint8> > blocks(numBlocks);
+    std::atomic<bool> failed(false);
+    if (numBlocks > 1) {
+      itk::MultiThreaderBase::Pointer threader = createThreader(numThreads);
+      threader->ParallelizeArray(0, static_cast<itk::SizeValueType>(numBlocks),
+        [&](itk::SizeValueType blockNo) {
+          if (failed)
+            return;
+          if (!inflateBlock(data + boundaries[blockNo], boundaries[blockNo + 1] - boundaries[blockNo],
+                            blockNo + 1 == numBlocks, blocks[blockNo]))
+            failed = true;
+        }, nullptr);
+    }
+
+    result.clear();
+    if (numBlocks == 1 || failed) {
+      // not written in independent blocks, inflate the stream as a whole
+      if (!inflateBlock(data, length, true, result)) {
+        cerr << "ERROR: Failed to inflate deflated dataset" << endl;
+        return EC_CorruptedData;
+      }
+      return EC_Normal;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < blocks.size(); i++)
+      total += blocks[i].size();
+    result.reserve(total);
+    for (size_t i = 0; i < blocks.size(); i++) {
+      result.insert(result.end(), blocks[i].begin(), blocks[i].end());
+      vector<Uint8>().swap(blocks[i]);
+    }
+    return EC_Normal;
+#else
+    (void)data; (void)length; (void)result; (void)numThreads;
+    return EC_NoEncodingLibrary;
+#endif
+  }
+
+  bool Compression::inflateBlock(const Uint8* data, const size_t length, const bool lastBlock, vector<Uint8>& result) {
+#ifdef DCMQI_WITH_ZLIB
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+      return false;
+    zs.next_in = const_cast<Bytef*>(data);
+    size_t remainingIn = length;
+    result.resize(max<size_t>(length * 4, 4096));
+    size_t produced = 0;
+    int status = Z_OK;
+    while (true) {
+      if (zs.avail_in == 0 && remainingIn != 0) {
+        const size_t chunkIn = min(remainingIn, MaxZlibChunk);
+        zs.avail_in = static_cast<uInt>(chunkIn);
+        remainingIn -= chunkIn;
+      }
+      if (produced == result.size())
+        result.resize(result.size() * 2);
+      const size_t chunkOut = min(result.size() - produced, MaxZlibChunk);
+      zs.next_out = result.data() + produced;
+      zs.avail_out = static_cast<uInt>(chunkOut);
+      status = inflate(&zs, Z_NO_FLUSH);
+      produced += chunkOut - zs.avail_out;
+      if (status == Z_STREAM_END || (status != Z_OK && status != Z_BUF_ERROR))
+        break;
+      if (zs.avail_in == 0 && remainingIn == 0 && zs.avail_out != 0)
+        break;
+    }
+    // a block boundary is genuine if inflate consumed all input and stopped between two
+    // deflate blocks on a byte boundary (data_type: 128 = at block boundary, low bits = unused bits)
+    const bool valid = lastBlock ? (status == Z_STREAM_END)
+                                 : ((status == Z_OK || status == Z_BUF_ERROR) && zs.avail_in == 0 && remainingIn == 0
+                                    && zs.data_type == 128);
+    inflateEnd(&zs);
+    result.resize(produced);
+    return valid;
+#else
+    (void)data; (void)length; (void)lastBlock; (void)result;
+    return false;
+#endif
+  }
+
+}
@@ -110,19 +110,54 @@ namespace dcmqi {
   }
 
   // TODO: defaults for sub classes needs to be defined
-  ContentIdentificationMacro ConverterBase::createContentIdentificationInformation(JSONMetaInformationHandlerBase &metaInfo) {
+  ContentIdentificationMacro ConverterBase::createContentIdentificationInformation(const JSONMetaInformationHandlerBase &metaInfo) {
     ContentIdentificationMacro ident;
     CHECK_COND(ident.setContentCreatorName("dcmqi"));
-    if(metaInfo.metaInfoRoot["seriesAttributes"].isMember("ContentDescription")){
-      CHECK_COND(ident.setContentDescription(metaInfo.metaInfoRoot["seriesAttributes"]["ContentDescription"].asCString()));
+    const Json::Value& seriesAttributes = metaInfo.metaInfoRoot["seriesAttributes"];
+    if(seriesAttributes.isMember("ContentDescription")){
+      CHECK_COND(ident.setContentDescription(seriesAttributes["ContentDescription"].asCString()));
     } else {
       CHECK_COND(ident.setContentDescription("DCMQI"));
     }
-    if(metaInfo.metaInfoRoot["seriesAttributes"].isMember("ContentLabel")){
-      CHECK_COND(ident.setContentLabel(metaInfo.metaInfoRoot["seriesAttributes"]["ContentLabel"].asCString()));
+    if(seriesAttributes.isMember("ContentLabel")){
+      CHECK_COND(ident.setContentLabel(seriesAttributes["ContentLabel"].asCString()));
     } else {
       CHECK_COND(ident.setContentLabel("DCMQI"));
     }
     return ident;
   }
+
+  vector<vector<int> > ConverterBase::getSliceMapForSegmentation2DerivationImage(const vector<DcmItem*>& dcmDatasets,
+                                                                                 const ImageGeometryType* geometry) {
+    // Find mapping from the segmentation slice number to the derivation image
+    // Assume that orientation of the segmentation is the same as the source series
+    unsigned numLabelSlices = geometry->GetLargestPossibleRegion().GetSize()[2];
+    vector<vector<int> > slice2derimg(numLabelSlices);
+    vector<bool> slice2derimgPresent(numLabelSlices, false);
+
+    int slicesMapped = 0;
+    for(size_t i=0;i<dcmDatasets.size();i++){
+      OFString ippStr;
+      ImageGeometryType::PointType ippPoint;
+      ImageGeometryType::IndexType ippIndex;
+      for(int j=0;j<3;j++){
+        CHECK_COND(dcmDatasets[i]->findAndGetOFString(DCM_ImagePositionPatient, ippStr, j));
+        ippPoint[j] = atof(ippStr.c_str());
+      }
+      if(!geometry->TransformPhysicalPointToIndex(ippPoint, ippIndex)){
+        // if certain DICOM instance does not map to a label slice, just skip it
+        continue;
+      }
+      OFString sopInstanceUID;
+      CHECK_COND(dcmDatasets[i]->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUID));
+      if(Verbosity::isEnabled(Verbosity::Detail))
+        cout << "SOPInstanceUID " << sopInstanceUID << " mapped" << endl;
+      slice2derimg[ippIndex[2]].push_back(i);
+      if(slice2derimgPresent[ippIndex[2]] == false)
+        slicesMapped++;
+      slice2derimgPresent[ippIndex[2]] = true;
+    }
+    cout << slicesMapped << " of " << slice2derimgPresent.size() << " slices mapped to source DICOM images" << endl;
+    return slice2derimg;
+  }
 }
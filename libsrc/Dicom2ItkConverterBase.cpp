@@ -3,6 +3,7 @@
 #include "dcmqi/Dicom2ItkConverterBin.h"
 #include "dcmqi/Dicom2ItkConverterLabel.h"
 #include "dcmqi/ColorUtilities.h"
+#include "dcmqi/Instrumentation.h"
 
 // DCMTK includes
 #include <cstddef>
@@ -60,18 +61,31 @@ Dicom2ItkConverterBase::Dicom2ItkConverterBase()
 OFCondition
 Dicom2ItkConverterBase::dcmSegmentation2itkimage(DcmDataset* segDataset, std::string& metaInfo, const bool mergeSegments)
 {
+    Profiler::Scope profilerScope("Dicom2ItkConverter::dcmSegmentation2itkimage");
     DcmSegmentation* segdoc = NULL;
 
     // Load the DICOM segmentation dataset into DcmSegmentation member
-    OFCondition cond = DcmSegmentation::loadDataset(*segDataset, segdoc);
+    OFCondition cond;
+    {
+        Profiler::Scope loadScope("loadDataset");
+        DcmElement* pixelData = NULL;
+        if (Profiler::isEnabled() && segDataset->findAndGetElement(DCM_PixelData, pixelData).good())
+            Profiler::count("bytes", pixelData->getLength());
+        cond = DcmSegmentation::loadDataset(*segDataset, segdoc);
+    }
     if (!segdoc)
     {
         cerr << "ERROR: Failed to load segmentation dataset! " << cond.text() << endl;
         throw -1;
     }
     m_segDoc.reset(segdoc);
+    Profiler::count("frames", segdoc->getNumberOfFrames());
+    Profiler::count("segments", segdoc->getNumberOfSegments());
 
-    cond = extractBasicSegmentationInfo();
+    {
+        Profiler::Scope geometryScope("geometry");
+        cond = extractBasicSegmentationInfo();
+    }
     if (cond.bad())
     {
         cerr << "ERROR: Failed to extract basic segmentation information! " << cond.text() << endl;
@@ -84,7 +98,11 @@ Dicom2ItkConverterBase::dcmSegmentation2itkimage(DcmDataset* segDataset, std::st
     // Call the actual conversion, implemented in the subclasses.
     // The conversion will populate the meta information member with segment-specific metadata
     // as well, which we then convert to string and return as output.
-    OFCondition result = dcmSegmentation2itkimage(mergeSegments);
+    OFCondition result;
+    {
+        Profiler::Scope segmentsScope("segments");
+        result = dcmSegmentation2itkimage(mergeSegments);
+    }
     if (result.good())
     {
         metaInfo = m_metaInfo.getJSONOutputAsString();
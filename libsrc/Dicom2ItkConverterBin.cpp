@@ -1,6 +1,7 @@
 // DCMQI includes
 #include "dcmqi/Dicom2ItkConverterBin.h"
 #include "dcmqi/ColorUtilities.h"
+#include "dcmqi/Instrumentation.h"
 
 // DCMTK includes
 #include <cstddef>
@@ -63,6 +64,7 @@ itk::SmartPointer<ShortImageType> Dicom2ItkConverterBin::begin16Bit()
 // -------------------------------------------------------------------------------------
 itk::SmartPointer<ShortImageType> Dicom2ItkConverterBin::next16Bit()
 {
+    Profiler::Scope profilerScope("Dicom2ItkConverter::nextImage");
     OFCondition result;
     ShortImageType::Pointer itkImage = nullptr;
     if (m_groupIterator != m_segmentGroups.end())
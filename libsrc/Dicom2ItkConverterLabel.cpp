@@ -1,6 +1,7 @@
 // DCMQI includes
 #include "dcmqi/Dicom2ItkConverterLabel.h"
 #include "dcmqi/ColorUtilities.h"
+#include "dcmqi/Instrumentation.h"
 
 // DCMTK includes
 #include <cstddef>
@@ -160,6 +161,7 @@ itk::SmartPointer<CharImageType> Dicom2ItkConverterLabel::next8Bit()
 template<typename TImageType, typename TPixelType>
 itk::SmartPointer<TImageType> Dicom2ItkConverterLabel::nextImpl()
 {
+    Profiler::Scope profilerScope("Dicom2ItkConverter::nextImage");
     // For Labelmaps, every frame is already a complete labelmap image, so we can just convert each frame into an ITK
     // image and return it as is (without having to worry about merging multiple segments into one image as in the
     // binary case).
@@ -1,10 +1,14 @@
 
 // DCMQI includes
 #include "dcmqi/Helper.h"
+#include "dcmqi/Instrumentation.h"
 
 // DCMTK includes
 #include <dcmtk/ofstd/oflist.h>
 
+// ITK includes
+#include <itkImageIOFactory.h>
+
 namespace dcmqi {
 
   bool Helper::isUndefinedOrPathDoesNotExist(const string &var, const string &humanReadableName) {
@@ -68,6 +72,7 @@ namespace dcmqi {
   }
 
   vector<DcmItem*> Helper::loadDatasets(const vector<string>& dicomImageFiles) {
+    Profiler::Scope profilerScope("Helper::loadDatasets");
     vector<DcmItem*> dcmDatasets;
     OFString tmp, sopInstanceUID;
     DcmFileFormat* sliceFF = new DcmFileFormat();
@@ -98,10 +103,69 @@ namespace dcmqi {
       }
     }
     delete sliceFF;
+    Profiler::count("files", dcmDatasets.size());
     return dcmDatasets;
   }
 
 
+  itk::IOComponentEnum Helper::getLabelComponentType(const vector<string>& fileNames) {
+    itk::IOComponentEnum labelType = itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE;
+    for(size_t i=0;i<fileNames.size();i++){
+      itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO(fileNames[i].c_str(), itk::IOFileModeEnum::ReadMode);
+      if(imageIO.IsNull()){
+        cerr << "Error: cannot read " << fileNames[i] << endl;
+        return itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE;
+      }
+      imageIO->SetFileName(fileNames[i]);
+      imageIO->ReadImageInformation();
+      if(imageIO->GetNumberOfComponents() > 1 || imageIO->GetNumberOfDimensions() > 3){
+        cerr << "Error: multi-channel segmentations are only supported as the only input file: " << fileNames[i] << endl;
+        return itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE;
+      }
+
+      itk::IOComponentEnum fileType = imageIO->GetComponentType();
+      if(fileType != itk::IOComponentEnum::UCHAR && fileType != itk::IOComponentEnum::USHORT
+         && fileType != itk::IOComponentEnum::SHORT)
+        fileType = itk::IOComponentEnum::INT;
+
+      if(labelType == itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE || labelType == itk::IOComponentEnum::UCHAR)
+        labelType = fileType;
+      else if(fileType != labelType && fileType != itk::IOComponentEnum::UCHAR)
+        labelType = itk::IOComponentEnum::INT;
+    }
+    return labelType;
+  }
+
+  bool Helper::applySegmentAttributesFileMapping(const Json::Value& metaRoot, vector<string>& segImageFiles) {
+    const Json::Value& mapping = metaRoot["segmentAttributesFileMapping"];
+    if(mapping.size() != metaRoot["segmentAttributes"].size() || mapping.size() != segImageFiles.size()){
+      cerr << "Number of files in segmentAttributesFileMapping should match the number of entries in segmentAttributes!" << endl;
+      return false;
+    }
+    // re-order the input files to match the order of the entries in segmentAttributesFileMapping
+    vector<int> fileOrder(segImageFiles.size(), -1);
+    for(size_t filePosition=0;filePosition<segImageFiles.size();filePosition++){
+      for(Json::ArrayIndex mappingPosition=0;mappingPosition<mapping.size();mappingPosition++){
+        if(segImageFiles[filePosition].rfind(mapping[mappingPosition].asString()) != string::npos){
+          fileOrder[filePosition] = static_cast<int>(mappingPosition);
+          break;
+        }
+      }
+      if(fileOrder[filePosition] == -1){
+        cerr << "Failed to map " << segImageFiles[filePosition] << " from the segmentAttributesFileMapping attribute to an input file name!" << endl;
+        return false;
+      }
+    }
+    cout << "Order of input ITK images updated as shown below based on the segmentAttributesFileMapping attribute:" << endl;
+    vector<string> segImageFilesReordered(segImageFiles.size());
+    for(size_t i=0;i<segImageFiles.size();i++){
+      cout << " image " << i << " moved to position " << fileOrder[i] << endl;
+      segImageFilesReordered[fileOrder[i]] = segImageFiles[i];
+    }
+    segImageFiles = segImageFilesReordered;
+    return true;
+  }
+
   string Helper::floatToStr(float f) {
     ostringstream sstream;
     sstream.imbue(std::locale::classic());
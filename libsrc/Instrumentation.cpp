@@ -0,0 +1,202 @@
+
+// DCMQI includes
+#include "dcmqi/Instrumentation.h"
+
+// STD includes
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace dcmqi {
+
+  std::atomic<bool> Profiler::enabled(false);
+  std::atomic<int> Verbosity::currentLevel(Verbosity::Normal);
+
+  namespace {
+
+    struct Phase {
+      Phase() : calls(0), wallSeconds(0), cpuSeconds(0), peakRSS(0) {}
+      uint64_t calls;
+      double wallSeconds;
+      double cpuSeconds;
+      size_t peakRSS;
+      map<string, uint64_t> counters;
+    };
+
+    struct Profile {
+      std::mutex mutex;
+      // paths in the order the phases were first entered
+      vector<string> order;
+      map<string, Phase> phases;
+      map<string, uint64_t> counters;
+      std::chrono::steady_clock::time_point wallStart;
+      double cpuStart;
+    };
+
+    Profile& getProfileData() {
+      static Profile profile;
+      return profile;
+    }
+
+    // path of the innermost active phase of the thread, "" outside of all phases
+    thread_local string currentPath;
+
+    Json::Value countersToJson(const map<string, uint64_t>& counters) {
+      Json::Value value(Json::objectValue);
+      for (map<string, uint64_t>::const_iterator it = counters.begin(); it != counters.end(); ++it)
+        value[it->first] = Json::UInt64(it->second);
+      return value;
+    }
+
+  }
+
+  void Profiler::enable(bool enable) {
+    if (enable && !isEnabled())
+      reset();
+    enabled.store(enable, std::memory_order_relaxed);
+  }
+
+  void Profiler::reset() {
+    Profile& profile = getProfileData();
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    profile.order.clear();
+    profile.phases.clear();
+    profile.counters.clear();
+    profile.wallStart = std::chrono::steady_clock::now();
+    profile.cpuStart = getCPUSeconds();
+  }
+
+  void Profiler::addCount(const char* counter, uint64_t value) {
+    Profile& profile = getProfileData();
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    profile.counters[counter] += value;
+    if (!currentPath.empty())
+      profile.phases[currentPath].counters[counter] += value;
+  }
+
+  Json::Value Profiler::getProfile() {
+    const double cpuSeconds = getCPUSeconds();
+    const size_t peakRSS = getPeakRSS();
+
+    Profile& profile = getProfileData();
+    std::lock_guard<std::mutex> lock(profile.mutex);
+
+    Json::Value root(Json::objectValue);
+    root["wallSeconds"] = std::chrono::duration<double>(std::chrono::steady_clock::now() - profile.wallStart).count();
+    root["cpuSeconds"] = cpuSeconds - profile.cpuStart;
+    root["peakRSSBytes"] = Json::UInt64(peakRSS);
+    root["counters"] = countersToJson(profile.counters);
+
+    Json::Value phases(Json::arrayValue);
+    for (vector<string>::const_iterator it = profile.order.begin(); it != profile.order.end(); ++it) {
+      const Phase& phase = profile.phases[*it];
+      Json::Value value(Json::objectValue);
+      value["name"] = *it;
+      value["calls"] = Json::UInt64(phase.calls);
+      value["wallSeconds"] = phase.wallSeconds;
+      value["cpuSeconds"] = phase.cpuSeconds;
+      value["peakRSSBytes"] = Json::UInt64(phase.peakRSS);
+      value["counters"] = countersToJson(phase.counters);
+      phases.append(value);
+    }
+    root["phases"] = phases;
+    return root;
+  }
+
+  bool Profiler::writeProfile(const string& fileName) {
+    ofstream outputFile(fileName.c_str());
+    if (!outputFile) {
+      cerr << "ERROR: Failed to open " << fileName << " for writing the profile" << endl;
+      return false;
+    }
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "  ";
+    outputFile << Json::writeString(builder, getProfile()) << endl;
+    if (!outputFile) {
+      cerr << "ERROR: Failed to write the profile to " << fileName << endl;
+      return false;
+    }
+    return true;
+  }
+
+  size_t Profiler::getPeakRSS() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+      return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+#ifdef __APPLE__
+    // bytes on macOS
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    // kilobytes on Linux and the BSDs
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+  }
+
+  double Profiler::getCPUSeconds() {
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+      return 0;
+    // 100 ns intervals
+    const double kernel = (static_cast<uint64_t>(kernelTime.dwHighDateTime) << 32 | kernelTime.dwLowDateTime) * 1e-7;
+    const double user = (static_cast<uint64_t>(userTime.dwHighDateTime) << 32 | userTime.dwLowDateTime) * 1e-7;
+    return kernel + user;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+#endif
+  }
+
+  void Profiler::Scope::begin(const char* name) {
+    parentPathLength = currentPath.size();
+    if (!currentPath.empty())
+      currentPath += '/';
+    currentPath += name;
+    {
+      Profile& profile = getProfileData();
+      std::lock_guard<std::mutex> lock(profile.mutex);
+      if (profile.phases.insert(make_pair(currentPath, Phase())).second)
+        profile.order.push_back(currentPath);
+    }
+    cpuStart = getCPUSeconds();
+    wallStart = std::chrono::steady_clock::now();
+  }
+
+  void Profiler::Scope::end() {
+    const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    const double cpuSeconds = getCPUSeconds() - cpuStart;
+    const size_t peakRSS = getPeakRSS();
+    {
+      Profile& profile = getProfileData();
+      std::lock_guard<std::mutex> lock(profile.mutex);
+      // created by begin(), unless the profile was reset in between
+      Phase& phase = profile.phases[currentPath];
+      phase.calls++;
+      phase.wallSeconds += wallSeconds;
+      phase.cpuSeconds += cpuSeconds;
+      phase.peakRSS = std::max(phase.peakRSS, peakRSS);
+    }
+    currentPath.resize(parentPathLength);
+  }
+
+}
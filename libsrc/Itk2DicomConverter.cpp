@@ -1,8 +1,10 @@
 
 // DCMQI includes
 #include "dcmqi/Itk2DicomConverter.h"
-#include "dcmqi/ColorUtilities.h"
+#include "dcmqi/Instrumentation.h"
 #include "dcmqi/JSONSegmentationMetaInformationHandler.h"
+#include "dcmqi/LabelHistogram.h"
+#include "dcmqi/SegmentationMetadataPlan.h"
 
 // DCMTK includes
 #include <dcmtk/config/osconfig.h>
@@ -26,7 +28,7 @@ namespace dcmqi {
 
   // -------------------------------------------------------------------------------------
 
-  template<class ImageSourceType, std::enable_if_t<std::is_same_v<short, typename ImageSourceType::PixelType>, bool>>
+  template<class ImageSourceType>
   DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation(vector<DcmItem*> dcmDatasets,
                                                           vector<itk::SmartPointer<const ImageSourceType>> segmentations,
                                                           const string &metaData,
@@ -48,23 +50,50 @@ namespace dcmqi {
 
   // -------------------------------------------------------------------------------------
 
-  template<class ImageSourceType, std::enable_if_t<std::is_same_v<short, typename ImageSourceType::PixelType>, bool>>
+  template<class ImageSourceType>
   DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation(vector<DcmItem*> dcmDatasets,
                                                           vector<itk::SmartPointer<const ImageSourceType>> segmentations,
-                                                          JSONSegmentationMetaInformationHandler& metaInfo,
+                                                          const JSONSegmentationMetaInformationHandler& metaInfo,
                                                           bool skipEmptySlices,
                                                           bool useLabelIDAsSegmentNumber,
                                                           bool referencesGeometryCheck,
                                                           bool doDicomValueChecks,
                                                           bool outputLabelMap) {
+    SegmentationMetadataPlan::ConstPointer plan = SegmentationMetadataPlan::compile(metaInfo);
+    if(!plan)
+      return NULL;
+    return itkimage2dcmSegmentation(dcmDatasets, segmentations, *plan,
+                                    skipEmptySlices, useLabelIDAsSegmentNumber,
+                                    referencesGeometryCheck, doDicomValueChecks,
+                                    outputLabelMap);
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  template<class ImageSourceType>
+  DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation(vector<DcmItem*> dcmDatasets,
+                                                          vector<itk::SmartPointer<const ImageSourceType>> segmentations,
+                                                          const SegmentationMetadataPlan& plan,
+                                                          bool skipEmptySlices,
+                                                          bool useLabelIDAsSegmentNumber,
+                                                          bool referencesGeometryCheck,
+                                                          bool doDicomValueChecks,
+                                                          bool outputLabelMap) {
+    Profiler::Scope profilerScope("Itk2DicomConverter::itkimage2dcmSegmentation");
+
+    // label values are handled as long below, wide enough for all supported pixel types
+    typedef typename ImageSourceType::PixelType LabelPixelType;
+    static_assert(std::is_integral_v<LabelPixelType> && sizeof(LabelPixelType) <= 4,
+                  "itkimage2dcmSegmentation supports integer label images of up to 32 bit only");
 
     auto inputSize = segmentations[0]->GetBufferedRegion().GetSize();
 
-    if(metaInfo.segmentsAttributesMappingList.size() != segmentations.size()){
+    if(plan.getNumberOfInputs() != segmentations.size()){
       cerr << "Mismatch between the number of input segmentation files and the size of metainfo list!" << endl;
       return NULL;
     };
 
+    const JSONSegmentationMetaInformationHandler& metaInfo = plan.getSeriesInformation();
     IODGeneralEquipmentModule::EquipmentInfo eq = getEquipmentInfo();
     ContentIdentificationMacro ident = createContentIdentificationInformation(metaInfo);
     CHECK_COND(ident.setInstanceNumber(metaInfo.getInstanceNumber().c_str()));
@@ -79,7 +108,7 @@ namespace dcmqi {
 
     // For labelmap output, this map stores for every input file and label ID
     // the resulting Segment Number used in output pixel data.
-    vector<map<short, Uint16> > fileLabelToSegmentNumber;
+    vector<map<long, Uint16> > fileLabelToSegmentNumber;
     if (outputLabelMap)
       fileLabelToSegmentNumber.resize(segmentations.size());
 
@@ -94,14 +123,14 @@ namespace dcmqi {
       // may contain gaps), the number of segments otherwise (sequential 1..N).
       size_t maxSegmentNumber = 0;
       size_t numSegmentsMetadata = 0;
-      for (size_t segFileNumber = 0; segFileNumber < metaInfo.segmentsAttributesMappingList.size(); segFileNumber++)
+      for (size_t segFileNumber = 0; segFileNumber < plan.getNumberOfInputs(); segFileNumber++)
       {
-        const map<unsigned, SegmentAttributes*>& fileAttributes = metaInfo.segmentsAttributesMappingList[segFileNumber];
-        numSegmentsMetadata += fileAttributes.size();
-        if (useLabelIDAsSegmentNumber && !fileAttributes.empty())
+        const vector<SegmentationMetadataPlan::Segment>& fileSegments = plan.getSegments(segFileNumber);
+        numSegmentsMetadata += fileSegments.size();
+        if (useLabelIDAsSegmentNumber && !fileSegments.empty())
         {
-          // map is ordered by key, so the last entry holds the highest label ID
-          maxSegmentNumber = std::max(maxSegmentNumber, static_cast<size_t>(fileAttributes.rbegin()->first));
+          // segments are ordered by label ID, so the last one holds the highest label ID
+          maxSegmentNumber = std::max(maxSegmentNumber, static_cast<size_t>(fileSegments.back().labelID));
         }
       }
       if (!useLabelIDAsSegmentNumber)
@@ -132,6 +161,10 @@ namespace dcmqi {
           ident));   // content identification
     }
 
+    // the frames are released when the dataset has been written, so they are
+    // not held any more while the caller saves the file
+    std::unique_ptr<DcmSegmentation> segdocOwner(segdoc);
+
     // import Patient, Study and Frame of Reference; do not import Series
     // attributes
     CHECK_COND(segdoc->importHierarchy(*dcmDatasets[0], OFTrue, OFTrue, OFTrue, OFFalse));
@@ -156,38 +189,7 @@ namespace dcmqi {
     /* Initialize shared functional groups */
     const unsigned frameSize = inputSize[0] * inputSize[1];
 
-    // Shared FGs: PlaneOrientationPatientSequence
-    {
-      auto labelDirMatrix = segmentations[0]->GetDirection();
-
-      FGPlaneOrientationPatient *planor =
-          FGPlaneOrientationPatient::createMinimal(
-              Helper::floatToStr(labelDirMatrix[0][0]).c_str(),
-              Helper::floatToStr(labelDirMatrix[1][0]).c_str(),
-              Helper::floatToStr(labelDirMatrix[2][0]).c_str(),
-              Helper::floatToStr(labelDirMatrix[0][1]).c_str(),
-              Helper::floatToStr(labelDirMatrix[1][1]).c_str(),
-              Helper::floatToStr(labelDirMatrix[2][1]).c_str());
-
-      CHECK_COND(segdoc->addForAllFrames(*planor));
-    }
-
-    // Shared FGs: PixelMeasuresSequence
-    {
-      FGPixelMeasures *pixmsr = new FGPixelMeasures();
-
-      auto labelSpacing = segmentations[0]->GetSpacing();
-      ostringstream spacingSStream;
-      spacingSStream << scientific << labelSpacing[1] << "\\" << labelSpacing[0];
-      CHECK_COND(pixmsr->setPixelSpacing(spacingSStream.str().c_str()));
-
-      spacingSStream.clear(); spacingSStream.str("");
-      spacingSStream << scientific << labelSpacing[2];
-      CHECK_COND(pixmsr->setSpacingBetweenSlices(spacingSStream.str().c_str()));
-      CHECK_COND(pixmsr->setSliceThickness(spacingSStream.str().c_str()));
-      CHECK_COND(segdoc->addForAllFrames(*pixmsr));
-      delete pixmsr;
-    }
+    addSharedFunctionalGroups(segdoc, segmentations[0].GetPointer());
 
     // Iterate over the files and labels available in each file, create a segment for each label,
     // initialize segment frames and add to the document
@@ -241,17 +243,17 @@ namespace dcmqi {
       delete fgder;
     }
 
-    int uidfound = 0, uidnotfound = 0;
-
     bool hasDerivationImages = false;
     bool hasDerivationImagesAny = false;
     vector<vector<vector<int> > > slice2derimgPerFile;
     if (referencesGeometryCheck)
     {
+      Profiler::Scope profilerScope("referenceGeometry");
       slice2derimgPerFile.resize(segmentations.size());
       for (size_t segFileNumber = 0; segFileNumber < segmentations.size(); segFileNumber++)
       {
-        slice2derimgPerFile[segFileNumber] = getSliceMapForSegmentation2DerivationImage(dcmDatasets, segmentations[segFileNumber]);
+        slice2derimgPerFile[segFileNumber] = getSliceMapForSegmentation2DerivationImage(dcmDatasets,
+                                                                                          getImageGeometry(segmentations[segFileNumber]));
         for (vector<vector<int> >::const_iterator vI = slice2derimgPerFile[segFileNumber].begin(); vI != slice2derimgPerFile[segFileNumber].end(); ++vI)
           if ((*vI).size() > 0)
             hasDerivationImagesAny = true;
@@ -283,26 +285,22 @@ namespace dcmqi {
       if(hasDerivationImages)
         perFrameFGs.push_back(fgder);
 
-      // note that labels are the same in the input and output image produced
-      // by this filter, see https://itk.org/Doxygen/html/classitk_1_1LabelImageToLabelMapFilter.html
-      using LabelToLabelMapFilterType2 = itk::LabelImageToLabelMapFilter<ImageSourceType>;
-      typename LabelToLabelMapFilterType2::Pointer l2lm = LabelToLabelMapFilterType2::New();
-      l2lm->SetInput(segmentations[segFileNumber]);
-      l2lm->Update();
-
-      typedef typename LabelToLabelMapFilterType2::OutputImageType::LabelObjectType LabelType;
-      typedef itk::LabelStatisticsImageFilter<ImageSourceType,ImageSourceType> LabelStatisticsType;
-
-      typename LabelStatisticsType::Pointer labelStats = LabelStatisticsType::New();
+      // only the label values and the slices they occur in are needed, see
+      // LabelHistogram for why no label map is built for this
+      map<LabelPixelType, LabelHistogram::SliceRange> labelSliceRanges;
+      {
+        Profiler::Scope profilerScope("labelScan");
+        labelSliceRanges = LabelHistogram::compute(segmentations[segFileNumber].GetPointer());
+        labelSliceRanges.erase(0);
+        Profiler::count("labels", labelSliceRanges.size());
+      }
 
-      cout << "Found " << l2lm->GetOutput()->GetNumberOfLabelObjects() << " label(s)" << endl;
-      labelStats->SetInput(segmentations[segFileNumber]);
-      labelStats->SetLabelInput(segmentations[segFileNumber]);
-      labelStats->Update();
+      cout << "Found " << labelSliceRanges.size() << " label(s)" << endl;
 
       bool cropSegmentsBBox = false;
       if(cropSegmentsBBox){
         cout << "WARNING: Crop operation enabled - WIP" << endl;
+        typedef itk::LabelStatisticsImageFilter<ImageSourceType,ImageSourceType> LabelStatisticsType;
         typedef itk::BinaryThresholdImageFilter<ImageSourceType,ImageSourceType> ThresholdType;
         typename ThresholdType::Pointer thresh = ThresholdType::New();
         thresh->SetInput(segmentations[segFileNumber]);
@@ -327,116 +325,47 @@ namespace dcmqi {
         return NULL;
       }
 
-      for(unsigned segLabelNumber=0 ; segLabelNumber<l2lm->GetOutput()->GetNumberOfLabelObjects();segLabelNumber++){
-        LabelType* labelObject = l2lm->GetOutput()->GetNthLabelObject(segLabelNumber);
-        short label = labelObject->GetLabel();
+      for(typename map<LabelPixelType, LabelHistogram::SliceRange>::const_iterator labelIt = labelSliceRanges.begin();
+          labelIt != labelSliceRanges.end(); ++labelIt){
+        const long label = static_cast<long>(labelIt->first);
 
-        if(!label){
-          continue;
-        }
+        if (Verbosity::isEnabled(Verbosity::Detail))
+          cout << "Processing label " << label << endl;
 
-        cout << "Processing label " << label << endl;
-
-        auto bbox = labelStats->GetBoundingBox(label);
         unsigned firstSlice, lastSlice;
         //bool skipEmptySlices = true; // TODO: what to do with that line?
         //bool skipEmptySlices = false; // TODO: what to do with that line?
         if(skipEmptySlices){
-          firstSlice = bbox[4];
-          lastSlice = bbox[5]+1;
+          firstSlice = labelIt->second.first;
+          lastSlice = labelIt->second.last+1;
         } else {
           firstSlice = 0;
           lastSlice = inputSize[2];
         }
 
-        cout << "Total non-empty slices that will be encoded in SEG for label " <<
-        label << " is " << lastSlice-firstSlice+1 << endl <<
-        " (inclusive from " << firstSlice << " to " <<
-        lastSlice << ")" << endl;
+        if (Verbosity::isEnabled(Verbosity::Detail))
+          cout << "Total non-empty slices that will be encoded in SEG for label " <<
+          label << " is " << lastSlice-firstSlice+1 << endl <<
+          " (inclusive from " << firstSlice << " to " <<
+          lastSlice << ")" << endl;
 
-        DcmSegment* segment = NULL;
-        if(metaInfo.segmentsAttributesMappingList[segFileNumber].find(label) == metaInfo.segmentsAttributesMappingList[segFileNumber].end()){
+        const SegmentationMetadataPlan::Segment* segmentMetadata = plan.findSegment(segFileNumber, label);
+        if(segmentMetadata == NULL){
           cerr << "ERROR: Failed to match label from image to the segment metadata!" << endl;
           return NULL;
         }
 
-        SegmentAttributes* segmentAttributes = metaInfo.segmentsAttributesMappingList[segFileNumber][label];
-
-        DcmSegTypes::E_SegmentAlgoType algoType = DcmSegTypes::SAT_UNKNOWN;
-        string algoName = "";
-        string algoTypeStr = segmentAttributes->getSegmentAlgorithmType();
-        if(algoTypeStr == "MANUAL"){
-          algoType = DcmSegTypes::SAT_MANUAL;
-        } else {
-          if(algoTypeStr == "AUTOMATIC")
-            algoType = DcmSegTypes::SAT_AUTOMATIC;
-          if(algoTypeStr == "SEMIAUTOMATIC")
-            algoType = DcmSegTypes::SAT_SEMIAUTOMATIC;
-
-          algoName = segmentAttributes->getSegmentAlgorithmName();
-          if(algoName == ""){
-            cerr << "ERROR: Algorithm name must be specified for non-manual algorithm types!" << endl;
-            return NULL;
-          }
-        }
-
-        CodeSequenceMacro* typeCode = segmentAttributes->getSegmentedPropertyTypeCodeSequence();
-        CodeSequenceMacro* categoryCode = segmentAttributes->getSegmentedPropertyCategoryCodeSequence();
-        assert(typeCode != NULL && categoryCode!= NULL);
-        OFString segmentLabel;
-
-        if(segmentAttributes->getSegmentLabel().length() > 0){
-          cout << "Populating segment label to " << segmentAttributes->getSegmentLabel() << endl;
-          segmentLabel = segmentAttributes->getSegmentLabel().c_str();
-        } else if(segmentAttributes->getSegmentDescription().length() > 0){
-          cout << "Populating segment label from SegmentDescription to " << segmentAttributes->getSegmentDescription() << endl;
-          segmentLabel = segmentAttributes->getSegmentDescription().c_str();
-        } else
-          CHECK_COND(typeCode->getCodeMeaning(segmentLabel));
-
-        CHECK_COND(DcmSegment::create(segment, segmentLabel, *categoryCode, *typeCode, algoType, algoName.c_str()));
-
-        if(segmentAttributes->getSegmentDescription().length() > 0)
-          segment->setSegmentDescription(segmentAttributes->getSegmentDescription().c_str());
-
-        if(segmentAttributes->getTrackingIdentifier().length() > 0)
-          segment->setTrackingID(segmentAttributes->getTrackingIdentifier().c_str());
-
-        if(segmentAttributes->getTrackingUniqueIdentifier().length() > 0)
-          segment->setTrackingUID(segmentAttributes->getTrackingUniqueIdentifier().c_str());
-
-        CodeSequenceMacro* typeModifierCode = segmentAttributes->getSegmentedPropertyTypeModifierCodeSequence();
-        if (typeModifierCode != NULL) {
-          OFVector<CodeSequenceMacro*>& modifiersVector = segment->getSegmentedPropertyTypeModifierCode();
-          modifiersVector.push_back(typeModifierCode);
-        }
-
-        GeneralAnatomyMacro &anatomyMacro = segment->getGeneralAnatomyCode();
-        if (segmentAttributes->getAnatomicRegionSequence() != NULL){
-          OFVector<CodeSequenceMacro*>& anatomyMacroModifiersVector = anatomyMacro.getAnatomicRegionModifier();
-          CodeSequenceMacro& anatomicRegionSequence = anatomyMacro.getAnatomicRegion();
-          anatomicRegionSequence = *segmentAttributes->getAnatomicRegionSequence();
-
-          if(segmentAttributes->getAnatomicRegionModifierSequence() != NULL){
-            CodeSequenceMacro* anatomicRegionModifierSequence = segmentAttributes->getAnatomicRegionModifierSequence();
-            anatomyMacroModifiersVector.push_back(anatomicRegionModifierSequence);
-          }
-        }
-
-        unsigned* rgb = segmentAttributes->getRecommendedDisplayRGBValue();
-        int cielab[3];
-
-        ColorUtilities::getIntegerScaledCIELabPCSFromSRGB(cielab[0], cielab[1], cielab[2], rgb[0], rgb[1], rgb[2]);
-        //IODCIELabUtil::rgb2DicomLab(cielab[0], cielab[1], cielab[2], rgb[0], rgb[1], rgb[2]);
-
-        CHECK_COND(segment->setRecommendedDisplayCIELabValue(cielab[0],cielab[1],cielab[2]));
+        // owned here until the segmentation takes it over
+        std::unique_ptr<DcmSegment> segment(SegmentationMetadataPlan::createSegment(*segmentMetadata));
+        if(!segment)
+          return NULL;
 
         Uint16 segmentNumber = 0;
         if (useLabelIDAsSegmentNumber)
         {
-          if (label < 0)
+          if (label < 0 || label > 65535)
           {
-            cerr << "ERROR: Cannot use label ID " << label << " as segment number: label IDs must be positive!" << endl;
+            cerr << "ERROR: Cannot use label ID " << label << " as segment number: label IDs must be between 1 and 65535!" << endl;
             return NULL;
           }
           segmentNumber = static_cast<Uint16>(label);
@@ -454,8 +383,9 @@ namespace dcmqi {
         }
         else
           segmentNumber = nextSegmentNumber++;
-        CHECK_COND(segdoc->addSegment(segment, segmentNumber /* returns logical segment number */));
-        segNum2Label.insert(make_pair(segmentNumber, label));
+        CHECK_COND(segdoc->addSegment(segment.get(), segmentNumber /* returns logical segment number */));
+        segment.release();
+        segNum2Label.insert(make_pair(segmentNumber, static_cast<Uint16>(label)));
 
         if (outputLabelMap)
         {
@@ -465,6 +395,7 @@ namespace dcmqi {
 
         // TODO: make it possible to skip empty frames (optional)
         // iterate over slices for an individual label and populate output frames
+        Profiler::Scope framesScope("frames");
         for(unsigned sliceNumber=firstSlice;sliceNumber<lastSlice;sliceNumber++){
 
           // PerFrame FG: FrameContentSequence
@@ -532,39 +463,8 @@ namespace dcmqi {
                 siVector.push_back(dcmDatasets[slice2derimg[sliceNumber][derImageInstanceNum]]);
               }
 
-              if(siVector.size()>0){
-
-                DerivationImageItem *derimgItem;
-          DSRBasicCodedEntry code_seg=CODE_DCM_Segmentation_113076;
-                CHECK_COND(fgder->addDerivationImageItem(CodeSequenceMacro(code_seg.CodeValue,code_seg.CodingSchemeDesignator,
-            code_seg.CodeMeaning),"",derimgItem));
-
-          DSRBasicCodedEntry code = CODE_DCM_SourceImageForImageProcessingOperation;
-                OFVector<SourceImageItem*> srcimgItems;
-                CHECK_COND(derimgItem->addSourceImageItems(siVector,
-                                                        CodeSequenceMacro(code.CodeValue, code.CodingSchemeDesignator,
-                                code.CodeMeaning),
-                                                        srcimgItems));
-
-                {
-                  // initialize class UID and series instance UID
-                  ImageSOPInstanceReferenceMacro &instRef = srcimgItems[0]->getImageSOPInstanceReference();
-                  OFString instanceUID;
-                  CHECK_COND(instRef.getReferencedSOPClassUID(classUID));
-                  CHECK_COND(instRef.getReferencedSOPInstanceUID(instanceUID));
-
-                  if(instanceUIDs.find(instanceUID) == instanceUIDs.end()){
-                    SOPInstanceReferenceMacro *refinstancesItem = new SOPInstanceReferenceMacro();
-                    CHECK_COND(refinstancesItem->setReferencedSOPClassUID(classUID));
-                    CHECK_COND(refinstancesItem->setReferencedSOPInstanceUID(instanceUID));
-                    refinstances.push_back(refinstancesItem);
-                    instanceUIDs.insert(instanceUID);
-                    uidnotfound++;
-                  } else {
-                    uidfound++;
-                  }
-                }
-              }
+              if(siVector.size()>0)
+                addDerivationImageReferences(fgder, siVector, refinstances, instanceUIDs);
             }
 
             OFCondition frameAdded = segdoc->addFrame(frameData.data(), segmentNumber, perFrameFGs);
@@ -584,6 +484,7 @@ namespace dcmqi {
 
     if (outputLabelMap)
     {
+      Profiler::Scope profilerScope("frames");
       const size_t numSegmentsMetadata = segNum2Label.size();
       const bool labelMapUse16Bit = numSegmentsMetadata > 255;
       unsigned outputFrameNumber = 1;
@@ -627,11 +528,11 @@ namespace dcmqi {
           itk::ImageRegionConstIteratorWithIndex<ImageSourceType> sliceIterator(segmentations[segFileNumber], sliceRegion);
           for (sliceIterator.GoToBegin(); !sliceIterator.IsAtEnd(); ++sliceIterator, ++framePixelCnt)
           {
-            short inputLabel = sliceIterator.Get();
+            const long inputLabel = static_cast<long>(sliceIterator.Get());
             if (inputLabel == 0)
               continue;
 
-            map<short, Uint16>::const_iterator mappingIt = fileLabelToSegmentNumber[segFileNumber].find(inputLabel);
+            map<long, Uint16>::const_iterator mappingIt = fileLabelToSegmentNumber[segFileNumber].find(inputLabel);
             if (mappingIt == fileLabelToSegmentNumber[segFileNumber].end())
             {
               cerr << "ERROR: Failed to map input label " << inputLabel << " to output segment number!" << endl;
@@ -712,43 +613,7 @@ namespace dcmqi {
           if (siVector.size() > 0)
           {
             perFrameFGs.push_back(fgder);
-            DerivationImageItem* derimgItem;
-            DSRBasicCodedEntry code_seg = CODE_DCM_Segmentation_113076;
-            CHECK_COND(fgder->addDerivationImageItem(CodeSequenceMacro(code_seg.CodeValue,
-                                                                       code_seg.CodingSchemeDesignator,
-                                                                       code_seg.CodeMeaning),
-                                                     "",
-                                                     derimgItem));
-
-            DSRBasicCodedEntry code = CODE_DCM_SourceImageForImageProcessingOperation;
-            OFVector<SourceImageItem*> srcimgItems;
-            CHECK_COND(derimgItem->addSourceImageItems(siVector,
-                                                       CodeSequenceMacro(code.CodeValue,
-                                                                         code.CodingSchemeDesignator,
-                                                                         code.CodeMeaning),
-                                                       srcimgItems));
-
-            if (!srcimgItems.empty())
-            {
-              ImageSOPInstanceReferenceMacro& instRef = srcimgItems[0]->getImageSOPInstanceReference();
-              OFString instanceUID;
-              CHECK_COND(instRef.getReferencedSOPClassUID(classUID));
-              CHECK_COND(instRef.getReferencedSOPInstanceUID(instanceUID));
-
-              if (instanceUIDs.find(instanceUID) == instanceUIDs.end())
-              {
-                SOPInstanceReferenceMacro* refinstancesItem = new SOPInstanceReferenceMacro();
-                CHECK_COND(refinstancesItem->setReferencedSOPClassUID(classUID));
-                CHECK_COND(refinstancesItem->setReferencedSOPInstanceUID(instanceUID));
-                refinstances.push_back(refinstancesItem);
-                instanceUIDs.insert(instanceUID);
-                uidnotfound++;
-              }
-              else
-              {
-                uidfound++;
-              }
-            }
+            addDerivationImageReferences(fgder, siVector, refinstances, instanceUIDs);
           }
         }
 
@@ -780,6 +645,8 @@ namespace dcmqi {
       cerr << "If you would like to encode background label, please see https://github.com/QIICR/dcmqi/issues/490" << endl;
       return NULL;
     }
+    Profiler::count("frames", framesAdded);
+    Profiler::count("segments", segNum2Label.size());
 
     // add ReferencedSeriesItem only if it is not empty
     if(refinstances.size())
@@ -789,6 +656,360 @@ namespace dcmqi {
     delete fgppp;
     delete fgder;
 
+    // Ensure dataset memory is cleaned up on exit
+    std::unique_ptr<DcmDataset> segdocDataset(writeSegmentationDataset(segdoc, dcmDatasets[0], metaInfo, doDicomValueChecks));
+    if(!segdocDataset)
+      return NULL;
+
+    {
+      string segmentsOverlap;
+      if (outputLabelMap)
+        segmentsOverlap = "NO";
+      else if(segmentations.size() == 1)
+        segmentsOverlap = "NO";
+      else
+        segmentsOverlap = "UNDEFINED";
+      CHECK_COND(segdocDataset->putAndInsertString(DCM_SegmentsOverlap, segmentsOverlap.c_str()));
+    }
+
+    if (useLabelIDAsSegmentNumber && !outputLabelMap)
+    {
+      // Binary segmentations require Segment Numbers to start at 1 and increase
+      // monotonically by 1, so re-mapping to label IDs only works for label IDs
+      // that satisfy the same constraint.
+      if (!checkLabelNumbering(segNum2Label))
+      {
+        return NULL;
+      }
+      mapLabelIDsToSegmentNumbers(segdocDataset.get(), segNum2Label);
+    }
+    // For labelmap output the label IDs were used as segment numbers directly when
+    // the segments were added. LABELMAP only requires segment numbers to be unique
+    // (enforced at insertion), not consecutive, so gaps in the label IDs are
+    // allowed (https://github.com/QIICR/dcmqi/issues/537).
+
+    return segdocDataset.release();
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  template<class ImageSourceType>
+  DcmDataset* Itk2DicomConverter::itkimage2dcmFractionalSegmentation(vector<DcmItem*> dcmDatasets,
+                                                                    vector<itk::SmartPointer<const ImageSourceType>> fractionalMaps,
+                                                                    const string &metaData,
+                                                                    DcmSegTypes::E_SegmentationFractionalType fractionalType,
+                                                                    Uint16 maxFractionalValue,
+                                                                    bool skipEmptySlices,
+                                                                    bool referencesGeometryCheck,
+                                                                    bool doDicomValueChecks) {
+    JSONSegmentationMetaInformationHandler metaInfo(metaData);
+    metaInfo.read();
+    return itkimage2dcmFractionalSegmentation(dcmDatasets, fractionalMaps, metaInfo, fractionalType,
+                                              maxFractionalValue, skipEmptySlices, referencesGeometryCheck,
+                                              doDicomValueChecks);
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  template<class ImageSourceType>
+  DcmDataset* Itk2DicomConverter::itkimage2dcmFractionalSegmentation(vector<DcmItem*> dcmDatasets,
+                                                                    vector<itk::SmartPointer<const ImageSourceType>> fractionalMaps,
+                                                                    const JSONSegmentationMetaInformationHandler& metaInfo,
+                                                                    DcmSegTypes::E_SegmentationFractionalType fractionalType,
+                                                                    Uint16 maxFractionalValue,
+                                                                    bool skipEmptySlices,
+                                                                    bool referencesGeometryCheck,
+                                                                    bool doDicomValueChecks) {
+    SegmentationMetadataPlan::ConstPointer plan = SegmentationMetadataPlan::compile(metaInfo);
+    if(!plan)
+      return NULL;
+    return itkimage2dcmFractionalSegmentation(dcmDatasets, fractionalMaps, *plan, fractionalType,
+                                              maxFractionalValue, skipEmptySlices, referencesGeometryCheck,
+                                              doDicomValueChecks);
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  template<class ImageSourceType>
+  DcmDataset* Itk2DicomConverter::itkimage2dcmFractionalSegmentation(vector<DcmItem*> dcmDatasets,
+                                                                    vector<itk::SmartPointer<const ImageSourceType>> fractionalMaps,
+                                                                    const SegmentationMetadataPlan& plan,
+                                                                    DcmSegTypes::E_SegmentationFractionalType fractionalType,
+                                                                    Uint16 maxFractionalValue,
+                                                                    bool skipEmptySlices,
+                                                                    bool referencesGeometryCheck,
+                                                                    bool doDicomValueChecks) {
+    Profiler::Scope profilerScope("Itk2DicomConverter::itkimage2dcmFractionalSegmentation");
+    static_assert(std::is_same_v<float, typename ImageSourceType::PixelType>,
+                  "itkimage2dcmFractionalSegmentation supports float images only");
+
+    const auto inputSize = fractionalMaps[0]->GetBufferedRegion().GetSize();
+    const size_t frameSize = inputSize[0] * inputSize[1];
+
+    if(plan.getNumberOfInputs() != fractionalMaps.size()){
+      cerr << "Mismatch between the number of input fractional maps and the size of metainfo list!" << endl;
+      return NULL;
+    }
+    for(size_t mapNumber=0; mapNumber<fractionalMaps.size(); mapNumber++){
+      if(plan.getSegments(mapNumber).size() != 1){
+        cerr << "ERROR: Every fractional map is a single segment, the metadata of map " << mapNumber+1
+             << " has " << plan.getSegments(mapNumber).size() << " items!" << endl;
+        return NULL;
+      }
+      if(fractionalMaps[mapNumber]->GetBufferedRegion().GetSize() != inputSize){
+        cerr << "ERROR: Dimensions of the fractional maps are inconsistent!" << endl;
+        return NULL;
+      }
+    }
+    if(maxFractionalValue < 1 || maxFractionalValue > 255){
+      cerr << "ERROR: Maximum fractional value must be between 1 and 255!" << endl;
+      return NULL;
+    }
+
+    const JSONSegmentationMetaInformationHandler& metaInfo = plan.getSeriesInformation();
+    IODGeneralEquipmentModule::EquipmentInfo eq = getEquipmentInfo();
+    ContentIdentificationMacro ident = createContentIdentificationInformation(metaInfo);
+    CHECK_COND(ident.setInstanceNumber(metaInfo.getInstanceNumber().c_str()));
+
+    DcmSegmentation *segdoc = NULL;
+    CHECK_COND(DcmSegmentation::createFractionalSegmentation(
+        segdoc,
+        inputSize[1],
+        inputSize[0],
+        fractionalType,
+        maxFractionalValue,
+        eq,
+        ident));
+
+    // the frames are released when the dataset has been written, so they are
+    // not held any more while the caller saves the file
+    std::unique_ptr<DcmSegmentation> segdocOwner(segdoc);
+
+    // import Patient, Study and Frame of Reference; do not import Series
+    // attributes
+    CHECK_COND(segdoc->importHierarchy(*dcmDatasets[0], OFTrue, OFTrue, OFTrue, OFFalse));
+
+    char dimUID[128];
+    dcmGenerateUniqueIdentifier(dimUID, QIICR_UID_ROOT);
+    IODMultiframeDimensionModule &mfdim = segdoc->getDimensions();
+    CHECK_COND(mfdim.addDimensionIndex(DCM_ReferencedSegmentNumber, dimUID, DCM_SegmentIdentificationSequence,
+                       DcmTag(DCM_ReferencedSegmentNumber).getTagName()));
+    CHECK_COND(mfdim.addDimensionIndex(DCM_ImagePositionPatient, dimUID, DCM_PlanePositionSequence,
+                       DcmTag(DCM_ImagePositionPatient).getTagName()));
+
+    addSharedFunctionalGroups(segdoc, fractionalMaps[0].GetPointer());
+
+    OFString seriesInstanceUID;
+    set<OFString> instanceUIDs;
+    IODCommonInstanceReferenceModule &commref = segdoc->getCommonInstanceReference();
+    OFVector<IODSeriesAndInstanceReferenceMacro::ReferencedSeriesItem*> &refseries = commref.getReferencedSeriesItems();
+    // the functional groups and the series item are owned here until the item is
+    // handed over to the instance references, also on the early returns below
+    std::unique_ptr<IODSeriesAndInstanceReferenceMacro::ReferencedSeriesItem> refseriesItem(
+        new IODSeriesAndInstanceReferenceMacro::ReferencedSeriesItem);
+    OFVector<SOPInstanceReferenceMacro*> &refinstances = refseriesItem->getReferencedInstanceItems();
+    CHECK_COND(dcmDatasets[0]->findAndGetOFString(DCM_SeriesInstanceUID, seriesInstanceUID));
+    CHECK_COND(refseriesItem->setSeriesInstanceUID(seriesInstanceUID));
+
+    vector<vector<int> > slice2derimg;
+    if(referencesGeometryCheck){
+      Profiler::Scope profilerScope("referenceGeometry");
+      slice2derimg = getSliceMapForSegmentation2DerivationImage(dcmDatasets, getImageGeometry(fractionalMaps[0]));
+    }
+
+    std::unique_ptr<FGPlanePosPatient> fgppp(FGPlanePosPatient::createMinimal("1","1","1"));
+    std::unique_ptr<FGFrameContent> fgfc(new FGFrameContent());
+    std::unique_ptr<FGDerivationImage> fgder(new FGDerivationImage());
+    OFVector<FGBase*> perFrameFGs;
+    unsigned framesAdded = 0;
+
+    // frames of one segment, quantized in parallel before they are added in slice order
+    vector<vector<Uint8> > frames(inputSize[2]);
+    vector<char> frameHasContent(inputSize[2]);
+    itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+
+    for(size_t mapNumber=0; mapNumber<fractionalMaps.size(); mapNumber++){
+      Profiler::Scope framesScope("frames");
+      const ImageSourceType* fractionalMap = fractionalMaps[mapNumber].GetPointer();
+      const Uint16 segmentNumber = static_cast<Uint16>(mapNumber + 1);
+
+      threader->ParallelizeArray(0, static_cast<itk::SizeValueType>(inputSize[2]),
+        [&](itk::SizeValueType slice) {
+          frames[slice].resize(frameSize);
+          if constexpr (std::is_same_v<ImageSourceType, FractionalImageType>) {
+            // contiguous slices can be quantized in place
+            const float* sliceValues = fractionalMap->GetBufferPointer() + slice * frameSize;
+            frameHasContent[slice] = quantizeFractionalFrame(sliceValues, frameSize, maxFractionalValue, frames[slice].data());
+          } else {
+            typename ImageSourceType::RegionType sliceRegion = fractionalMap->GetBufferedRegion();
+            sliceRegion.SetIndex(2, sliceRegion.GetIndex()[2] + slice);
+            sliceRegion.SetSize(2, 1);
+            vector<float> sliceValues(frameSize);
+            itk::ImageRegionConstIterator<ImageSourceType> it(fractionalMap, sliceRegion);
+            size_t pixel = 0;
+            for(it.GoToBegin(); !it.IsAtEnd(); ++it, ++pixel)
+              sliceValues[pixel] = it.Get();
+            frameHasContent[slice] = quantizeFractionalFrame(sliceValues.data(), frameSize, maxFractionalValue, frames[slice].data());
+          }
+        }, nullptr);
+
+      unsigned firstSlice = 0;
+      while(skipEmptySlices && firstSlice < inputSize[2] && !frameHasContent[firstSlice])
+        firstSlice++;
+      if(firstSlice == inputSize[2]){
+        cout << "WARNING: fractional map " << mapNumber+1 << " is empty, no segment will be created for it" << endl;
+        continue;
+      }
+
+      std::unique_ptr<DcmSegment> segment(SegmentationMetadataPlan::createSegment(plan.getSegments(mapNumber).front()));
+      if(!segment)
+        return NULL;
+      Uint16 logicalSegmentNumber = segmentNumber;
+      CHECK_COND(segdoc->addSegment(segment.get(), logicalSegmentNumber));
+      segment.release();
+
+      for(unsigned sliceNumber=firstSlice; sliceNumber<inputSize[2]; sliceNumber++){
+        if(skipEmptySlices && !frameHasContent[sliceNumber])
+          continue;
+
+        CHECK_COND(fgfc->setDimensionIndexValues(logicalSegmentNumber, 0));
+        CHECK_COND(fgfc->setDimensionIndexValues(sliceNumber-firstSlice+1, 1));
+
+        typename ImageSourceType::PointType sliceOriginPoint;
+        typename ImageSourceType::IndexType sliceOriginIndex;
+        sliceOriginIndex.Fill(0);
+        sliceOriginIndex[2] = sliceNumber;
+        fractionalMap->TransformIndexToPhysicalPoint(sliceOriginIndex, sliceOriginPoint);
+        fgppp->setImagePositionPatient(
+            Helper::floatToStr(sliceOriginPoint[0]).c_str(),
+            Helper::floatToStr(sliceOriginPoint[1]).c_str(),
+            Helper::floatToStr(sliceOriginPoint[2]).c_str());
+
+        perFrameFGs.clear();
+        perFrameFGs.push_back(fgppp.get());
+        perFrameFGs.push_back(fgfc.get());
+
+        OFVector<DcmItem*> siVector;
+        if(referencesGeometryCheck && sliceNumber < slice2derimg.size()){
+          for(size_t derImageInstanceNum=0; derImageInstanceNum<slice2derimg[sliceNumber].size(); derImageInstanceNum++)
+            siVector.push_back(dcmDatasets[slice2derimg[sliceNumber][derImageInstanceNum]]);
+          if(siVector.size()>0){
+            perFrameFGs.push_back(fgder.get());
+            addDerivationImageReferences(fgder.get(), siVector, refinstances, instanceUIDs);
+          }
+        }
+
+        if(segdoc->addFrame(frames[sliceNumber].data(), logicalSegmentNumber, perFrameFGs).good())
+          framesAdded++;
+
+        if(siVector.size()>0)
+          fgder->clearData();
+      }
+    }
+
+    if(framesAdded == 0){
+      cerr << "FATAL ERROR: All fractional maps are empty!" << endl;
+      return NULL;
+    }
+    Profiler::count("frames", framesAdded);
+    Profiler::count("segments", segdoc->getNumberOfSegments());
+
+    if(refinstances.size())
+      refseries.push_back(refseriesItem.release());
+
+    std::unique_ptr<DcmDataset> segdocDataset(writeSegmentationDataset(segdoc, dcmDatasets[0], metaInfo, doDicomValueChecks));
+    if(!segdocDataset)
+      return NULL;
+
+    CHECK_COND(segdocDataset->putAndInsertString(DCM_SegmentsOverlap, fractionalMaps.size() == 1 ? "NO" : "UNDEFINED"));
+
+    return segdocDataset.release();
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  template<class ImageSourceType>
+  void Itk2DicomConverter::addSharedFunctionalGroups(DcmSegmentation* segdoc, const ImageSourceType* image) {
+    // Shared FGs: PlaneOrientationPatientSequence
+    {
+      auto labelDirMatrix = image->GetDirection();
+
+      FGPlaneOrientationPatient *planor =
+          FGPlaneOrientationPatient::createMinimal(
+              Helper::floatToStr(labelDirMatrix[0][0]).c_str(),
+              Helper::floatToStr(labelDirMatrix[1][0]).c_str(),
+              Helper::floatToStr(labelDirMatrix[2][0]).c_str(),
+              Helper::floatToStr(labelDirMatrix[0][1]).c_str(),
+              Helper::floatToStr(labelDirMatrix[1][1]).c_str(),
+              Helper::floatToStr(labelDirMatrix[2][1]).c_str());
+
+      CHECK_COND(segdoc->addForAllFrames(*planor));
+    }
+
+    // Shared FGs: PixelMeasuresSequence
+    {
+      FGPixelMeasures *pixmsr = new FGPixelMeasures();
+
+      auto labelSpacing = image->GetSpacing();
+      ostringstream spacingSStream;
+      spacingSStream << scientific << labelSpacing[1] << "\\" << labelSpacing[0];
+      CHECK_COND(pixmsr->setPixelSpacing(spacingSStream.str().c_str()));
+
+      spacingSStream.clear(); spacingSStream.str("");
+      spacingSStream << scientific << labelSpacing[2];
+      CHECK_COND(pixmsr->setSpacingBetweenSlices(spacingSStream.str().c_str()));
+      CHECK_COND(pixmsr->setSliceThickness(spacingSStream.str().c_str()));
+      CHECK_COND(segdoc->addForAllFrames(*pixmsr));
+      delete pixmsr;
+    }
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  void Itk2DicomConverter::addDerivationImageReferences(FGDerivationImage* fgder, OFVector<DcmItem*>& siVector,
+                                                        OFVector<SOPInstanceReferenceMacro*>& refinstances,
+                                                        set<OFString>& instanceUIDs) {
+    DerivationImageItem* derimgItem;
+    DSRBasicCodedEntry code_seg = CODE_DCM_Segmentation_113076;
+    CHECK_COND(fgder->addDerivationImageItem(CodeSequenceMacro(code_seg.CodeValue,
+                                                               code_seg.CodingSchemeDesignator,
+                                                               code_seg.CodeMeaning),
+                                             "",
+                                             derimgItem));
+
+    DSRBasicCodedEntry code = CODE_DCM_SourceImageForImageProcessingOperation;
+    OFVector<SourceImageItem*> srcimgItems;
+    CHECK_COND(derimgItem->addSourceImageItems(siVector,
+                                               CodeSequenceMacro(code.CodeValue,
+                                                                 code.CodingSchemeDesignator,
+                                                                 code.CodeMeaning),
+                                               srcimgItems));
+
+    if (!srcimgItems.empty())
+    {
+      // initialize class UID and series instance UID
+      ImageSOPInstanceReferenceMacro& instRef = srcimgItems[0]->getImageSOPInstanceReference();
+      OFString classUID, instanceUID;
+      CHECK_COND(instRef.getReferencedSOPClassUID(classUID));
+      CHECK_COND(instRef.getReferencedSOPInstanceUID(instanceUID));
+
+      if (instanceUIDs.find(instanceUID) == instanceUIDs.end())
+      {
+        SOPInstanceReferenceMacro* refinstancesItem = new SOPInstanceReferenceMacro();
+        CHECK_COND(refinstancesItem->setReferencedSOPClassUID(classUID));
+        CHECK_COND(refinstancesItem->setReferencedSOPInstanceUID(instanceUID));
+        refinstances.push_back(refinstancesItem);
+        instanceUIDs.insert(instanceUID);
+      }
+    }
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  DcmDataset* Itk2DicomConverter::writeSegmentationDataset(DcmSegmentation* segdoc, DcmItem* sourceDataset,
+                                                           const JSONSegmentationMetaInformationHandler& metaInfo,
+                                                           bool doDicomValueChecks) {
+    Profiler::Scope profilerScope("writeDataset");
     segdoc->getSeries().setSeriesNumber(metaInfo.getSeriesNumber().c_str());
 
     OFString frameOfRefUID;
@@ -804,8 +1025,6 @@ namespace dcmqi {
     // ourselves to put together valid datasets
     segdoc->setCheckFGOnWrite(OFFalse);
 
-    // Ensure dataset memory is cleaned up on exit, and avoid the copy on
-    // return that was performed before
     std::unique_ptr<DcmDataset> segdocDataset(new DcmDataset());
     std::cout << "Checking DICOM attribute values before writing: " << (doDicomValueChecks ? "enabled" : "disabled") << std::endl;
     segdoc->setValueCheckOnWrite(doDicomValueChecks);
@@ -818,6 +1037,9 @@ namespace dcmqi {
       cerr << " Please report the problem to the developers, ideally accompanied by a de-identified dataset allowing to reproduce the problem!" << endl;
       return NULL;
     }
+    DcmElement* pixelData = NULL;
+    if(Profiler::isEnabled() && segdocDataset->findAndGetElement(DCM_PixelData, pixelData).good())
+      Profiler::count("bytes", pixelData->getLength());
 
     // Set reader/session/timepoint information
     std::cout << "Patching in extra meta information into DICOM dataset" << std::endl;
@@ -834,7 +1056,7 @@ namespace dcmqi {
       string bodyPartAssigned = metaInfo.getBodyPartExamined();
 
       // inherit BodyPartExamined from the source image dataset, if available
-      if(dcmDatasets[0]->findAndGetOFString(DCM_BodyPartExamined, bodyPartStr).good())
+      if(sourceDataset->findAndGetOFString(DCM_BodyPartExamined, bodyPartStr).good())
       if(string(bodyPartStr.c_str()).size())
         bodyPartAssigned = bodyPartStr.c_str();
 
@@ -856,37 +1078,24 @@ namespace dcmqi {
       segdoc->getGeneralImage().setContentTime(contentTime.c_str());
     }
 
-    {
-      string segmentsOverlap;
-      if (outputLabelMap)
-        segmentsOverlap = "NO";
-      else if(segmentations.size() == 1)
-        segmentsOverlap = "NO";
-      else
-        segmentsOverlap = "UNDEFINED";
-      CHECK_COND(segdocDataset->putAndInsertString(DCM_SegmentsOverlap, segmentsOverlap.c_str()));
-    }
-
-    if (useLabelIDAsSegmentNumber && !outputLabelMap)
-    {
-      // Binary segmentations require Segment Numbers to start at 1 and increase
-      // monotonically by 1, so re-mapping to label IDs only works for label IDs
-      // that satisfy the same constraint.
-      if (!checkLabelNumbering(segNum2Label))
-      {
-        return NULL;
-      }
-      mapLabelIDsToSegmentNumbers(segdocDataset.get(), segNum2Label);
-    }
-    // For labelmap output the label IDs were used as segment numbers directly when
-    // the segments were added. LABELMAP only requires segment numbers to be unique
-    // (enforced at insertion), not consecutive, so gaps in the label IDs are
-    // allowed (https://github.com/QIICR/dcmqi/issues/537).
-
     return segdocDataset.release();
   }
 
 
+  // -------------------------------------------------------------------------------------
+
+  bool Itk2DicomConverter::quantizeFractionalFrame(const float* values, size_t count, float maxFractionalValue, Uint8* frame) {
+    Uint8 nonZero = 0;
+    for(size_t i = 0; i < count; i++){
+      // std::max/std::min in this order also map NaN to 0
+      const float scaled = std::min(maxFractionalValue, std::max(0.f, values[i] * maxFractionalValue + 0.5f));
+      const Uint8 quantized = static_cast<Uint8>(scaled);
+      frame[i] = quantized;
+      nonZero |= quantized;
+    }
+    return nonZero != 0;
+  }
+
   bool Itk2DicomConverter::mapLabelIDsToSegmentNumbers(DcmDataset* dset, map<Uint16,Uint16> segNum2Label)
   {
     cout << "Mapping Label IDs to Segment Numbers" << endl;
@@ -1038,7 +1247,107 @@ namespace dcmqi {
   template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<ShortImageType>(
       vector<DcmItem*> dcmDatasets,
       vector<ShortImageType::ConstPointer> segmentations,
-      JSONSegmentationMetaInformationHandler& metaInfo,
+      const JSONSegmentationMetaInformationHandler& metaInfo,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<ShortImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<ShortImageType::ConstPointer> segmentations,
+      const SegmentationMetadataPlan& plan,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<CharImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<CharImageType::ConstPointer> segmentations,
+      const string& metaData,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<CharImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<CharImageType::ConstPointer> segmentations,
+      const JSONSegmentationMetaInformationHandler& metaInfo,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<CharImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<CharImageType::ConstPointer> segmentations,
+      const SegmentationMetadataPlan& plan,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<UShortLabelImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<UShortLabelImageType::ConstPointer> segmentations,
+      const string& metaData,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<UShortLabelImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<UShortLabelImageType::ConstPointer> segmentations,
+      const JSONSegmentationMetaInformationHandler& metaInfo,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<UShortLabelImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<UShortLabelImageType::ConstPointer> segmentations,
+      const SegmentationMetadataPlan& plan,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<IntLabelImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<IntLabelImageType::ConstPointer> segmentations,
+      const string& metaData,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<IntLabelImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<IntLabelImageType::ConstPointer> segmentations,
+      const JSONSegmentationMetaInformationHandler& metaInfo,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<IntLabelImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<IntLabelImageType::ConstPointer> segmentations,
+      const SegmentationMetadataPlan& plan,
       bool skipEmptySlices,
       bool useLabelIDAsSegmentNumber,
       bool referencesGeometryCheck,
@@ -1059,10 +1368,81 @@ namespace dcmqi {
   template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<VectorImageAdapter>(
       vector<DcmItem*> dcmDatasets,
       vector<VectorImageAdapter::ConstPointer> segmentations,
-      JSONSegmentationMetaInformationHandler& metaInfo,
+      const JSONSegmentationMetaInformationHandler& metaInfo,
+      bool skipEmptySlices,
+      bool useLabelIDAsSegmentNumber,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks,
+      bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmSegmentation<VectorImageAdapter>(
+      vector<DcmItem*> dcmDatasets,
+      vector<VectorImageAdapter::ConstPointer> segmentations,
+      const SegmentationMetadataPlan& plan,
       bool skipEmptySlices,
       bool useLabelIDAsSegmentNumber,
       bool referencesGeometryCheck,
       bool doDicomValueChecks,
       bool outputLabelMap);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmFractionalSegmentation<FractionalImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<FractionalImageType::ConstPointer> fractionalMaps,
+      const string& metaData,
+      DcmSegTypes::E_SegmentationFractionalType fractionalType,
+      Uint16 maxFractionalValue,
+      bool skipEmptySlices,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmFractionalSegmentation<FractionalImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<FractionalImageType::ConstPointer> fractionalMaps,
+      const JSONSegmentationMetaInformationHandler& metaInfo,
+      DcmSegTypes::E_SegmentationFractionalType fractionalType,
+      Uint16 maxFractionalValue,
+      bool skipEmptySlices,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmFractionalSegmentation<FractionalImageType>(
+      vector<DcmItem*> dcmDatasets,
+      vector<FractionalImageType::ConstPointer> fractionalMaps,
+      const SegmentationMetadataPlan& plan,
+      DcmSegTypes::E_SegmentationFractionalType fractionalType,
+      Uint16 maxFractionalValue,
+      bool skipEmptySlices,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks);
+
+  using FractionalVectorImageAdapter = itk::VectorImageToImageAdaptor<float, 3U>;
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmFractionalSegmentation<FractionalVectorImageAdapter>(
+      vector<DcmItem*> dcmDatasets,
+      vector<FractionalVectorImageAdapter::ConstPointer> fractionalMaps,
+      const string& metaData,
+      DcmSegTypes::E_SegmentationFractionalType fractionalType,
+      Uint16 maxFractionalValue,
+      bool skipEmptySlices,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmFractionalSegmentation<FractionalVectorImageAdapter>(
+      vector<DcmItem*> dcmDatasets,
+      vector<FractionalVectorImageAdapter::ConstPointer> fractionalMaps,
+      const JSONSegmentationMetaInformationHandler& metaInfo,
+      DcmSegTypes::E_SegmentationFractionalType fractionalType,
+      Uint16 maxFractionalValue,
+      bool skipEmptySlices,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks);
+
+  template DcmDataset* Itk2DicomConverter::itkimage2dcmFractionalSegmentation<FractionalVectorImageAdapter>(
+      vector<DcmItem*> dcmDatasets,
+      vector<FractionalVectorImageAdapter::ConstPointer> fractionalMaps,
+      const SegmentationMetadataPlan& plan,
+      DcmSegTypes::E_SegmentationFractionalType fractionalType,
+      Uint16 maxFractionalValue,
+      bool skipEmptySlices,
+      bool referencesGeometryCheck,
+      bool doDicomValueChecks);
 }
@@ -183,6 +183,8 @@ namespace dcmqi {
     data["InstanceNumber"] = this->instanceNumber;
     data["BodyPartExamined"] = this->bodyPartExamined;
     data["RealWorldValueSlope"] = this->realWorldValueSlope;
+    if (!this->realWorldValueIntercept.empty())
+      data["RealWorldValueIntercept"] = this->realWorldValueIntercept;
     data["DerivedPixelContrast"] = this->derivedPixelContrast;
     data["FrameLaterality"] = this->frameLaterality;
     data["DerivationDescription"] = this->derivationDescription;
@@ -39,9 +39,20 @@ namespace dcmqi {
   }
 
   void JSONSegmentationMetaInformationHandler::read() {
+    Json::Value root;
     try {
       istringstream metainfoStream(this->jsonInput);
-      metainfoStream >> this->metaInfoRoot;
+      metainfoStream >> root;
+    } catch (exception& e) {
+      reportReadError(e);
+    }
+    this->read(std::move(root));
+  }
+
+  void JSONSegmentationMetaInformationHandler::read(Json::Value&& root) {
+    // take over the parsed tree without copying it
+    this->metaInfoRoot.swap(root);
+    try {
       this->contentCreatorName = this->metaInfoRoot.get("ContentCreatorName", "Reader1").asString();
       this->coordinatingCenterName =  this->metaInfoRoot.get("ClinicalTrialCoordinatingCenterName", "").asString();
       this->clinicalTrialSeriesID = this->metaInfoRoot.get("ClinicalTrialSeriesID", "Session1").asString();
@@ -53,13 +64,17 @@ namespace dcmqi {
 
       this->readSegmentAttributes();
     } catch (exception& e) {
-      cerr << "ERROR: JSON parameter file could not be parsed!" << std::endl;
-      cerr << "You can validate the JSON file here: http://qiicr.org/dcmqi/#/validators" << std::endl;
-      cerr << "Exception details (probably not very useful): " << e.what() << endl;
-      throw JSONReadErrorException();
+      reportReadError(e);
     }
   }
 
+  void JSONSegmentationMetaInformationHandler::reportReadError(const exception& e) {
+    cerr << "ERROR: JSON parameter file could not be parsed!" << std::endl;
+    cerr << "You can validate the JSON file here: http://qiicr.org/dcmqi/#/validators" << std::endl;
+    cerr << "Exception details (probably not very useful): " << e.what() << endl;
+    throw JSONReadErrorException();
+  }
+
   bool JSONSegmentationMetaInformationHandler::write(string filename) {
     ofstream outputFile;
     outputFile.open(filename.c_str());
@@ -0,0 +1,131 @@
+
+// DCMQI includes
+#include "dcmqi/MemoryBudget.h"
+
+// ITK includes
+#include <itkImageIOFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+
+namespace dcmqi {
+
+  MemoryBudget::SegmentationInput::SegmentationInput()
+    : segmentationType(DcmSegTypes::ST_BINARY), rows(0), columns(0), slices(0), volumes(0),
+      bytesPerVoxel(0), segments(0), labelmap16Bit(false), compress("none"), inputsReleasedBeforeSave(false) {
+  }
+
+  MemoryBudget::Estimate::Estimate()
+    : inputImages(0), frames(0), dataset(0), saveBuffers(0), peak(0), streamingWrite(false) {
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  MemoryBudget::Estimate MemoryBudget::estimateSegmentation(const SegmentationInput& input, bool streamingWrite) {
+    const size_t framePixels = input.rows * input.columns;
+    const bool labelmap = input.segmentationType == DcmSegTypes::ST_LABELMAP;
+
+    // labelmap frames hold all segments of a slice, the others one segment each
+    const size_t numberOfFrames = labelmap ? input.slices : input.segments * input.slices;
+    size_t pixelDataBytes = 0;
+    if (input.segmentationType == DcmSegTypes::ST_BINARY)
+      pixelDataBytes = (numberOfFrames * framePixels + 7) / 8;
+    else if (labelmap)
+      pixelDataBytes = numberOfFrames * framePixels * (input.labelmap16Bit ? 2 : 1);
+    else
+      pixelDataBytes = numberOfFrames * framePixels;
+    const size_t functionalGroupBytes = numberOfFrames * PerFrameOverhead;
+
+    Estimate estimate;
+    estimate.streamingWrite = streamingWrite;
+    estimate.inputImages = input.volumes * input.slices * framePixels * input.bytesPerVoxel;
+    estimate.frames = pixelDataBytes + functionalGroupBytes;
+    // the fractional maps are quantized one volume at a time
+    if (input.segmentationType == DcmSegTypes::ST_FRACTIONAL)
+      estimate.frames += input.slices * framePixels;
+    estimate.dataset = pixelDataBytes + functionalGroupBytes;
+
+    if (input.compress == "rle") {
+      // encoded frames next to the native pixel data, at most as large for segmentations
+      estimate.saveBuffers = pixelDataBytes;
+    } else if (input.compress == "deflate" && !streamingWrite) {
+      // serialized dataset and its deflated blocks
+      estimate.saveBuffers = 2 * estimate.dataset;
+    }
+
+    const size_t writePeak = estimate.inputImages + estimate.frames + estimate.dataset;
+    const size_t savePeak = (input.inputsReleasedBeforeSave ? 0 : estimate.inputImages)
+                          + estimate.dataset + estimate.saveBuffers;
+    estimate.peak = std::max(writePeak, savePeak);
+    return estimate;
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  bool MemoryBudget::selectSegmentationStrategy(const SegmentationInput& input, size_t maxBytes, Estimate& estimate) {
+    estimate = estimateSegmentation(input, false);
+    if (maxBytes == 0 || estimate.peak <= maxBytes)
+      return true;
+
+    if (input.compress == "deflate") {
+      estimate = estimateSegmentation(input, true);
+      if (estimate.peak <= maxBytes)
+        return true;
+    }
+    return false;
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  bool MemoryBudget::readSegmentationGeometry(const vector<string>& fileNames, SegmentationInput& input) {
+    for (size_t i = 0; i < fileNames.size(); i++) {
+      itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO(fileNames[i].c_str(), itk::IOFileModeEnum::ReadMode);
+      if (imageIO.IsNull()) {
+        cerr << "Error: cannot read " << fileNames[i] << endl;
+        return false;
+      }
+      imageIO->SetFileName(fileNames[i]);
+      imageIO->ReadImageInformation();
+      input.columns = imageIO->GetDimensions(0);
+      input.rows = imageIO->GetNumberOfDimensions() > 1 ? imageIO->GetDimensions(1) : 1;
+      const size_t slices = imageIO->GetNumberOfDimensions() > 2 ? imageIO->GetDimensions(2) : 1;
+      input.slices = std::max(input.slices, slices);
+    }
+    return true;
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  void MemoryBudget::countSegments(const Json::Value& metaRoot, size_t& segments, size_t& maxLabelID) {
+    segments = 0;
+    maxLabelID = 0;
+    const Json::Value& segmentAttributes = metaRoot["segmentAttributes"];
+    for (Json::ArrayIndex i = 0; i < segmentAttributes.size(); i++) {
+      segments += segmentAttributes[i].size();
+      for (Json::ArrayIndex j = 0; j < segmentAttributes[i].size(); j++)
+        maxLabelID = std::max(maxLabelID, static_cast<size_t>(segmentAttributes[i][j].get("labelID", 0).asUInt()));
+    }
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  void MemoryBudget::printEstimate(const Estimate& estimate, ostream& out) {
+    const double MB = 1024.0 * 1024.0;
+    const ios_base::fmtflags flags = out.flags();
+    const streamsize precision = out.precision();
+    out << fixed << setprecision(1);
+    out << "Estimated memory (MB):" << endl;
+    out << "  input images:     " << estimate.inputImages / MB << endl;
+    out << "  frames:           " << estimate.frames / MB << endl;
+    out << "  dataset:          " << estimate.dataset / MB << endl;
+    out << "  save buffers:     " << estimate.saveBuffers / MB << endl;
+    out << "  peak:             " << estimate.peak / MB << endl;
+    out << "  deflate strategy: " << (estimate.streamingWrite ? "streamed" : "parallel blocks") << endl;
+    out.flags(flags);
+    out.precision(precision);
+  }
+
+}
@@ -0,0 +1,112 @@
+
+// DCMQI includes
+#include "dcmqi/MemoryIO.h"
+#include "dcmqi/Compression.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcistrmb.h>
+#include <dcmtk/dcmdata/dcostrmb.h>
+
+// STD includes
+#include <iostream>
+#include <set>
+
+namespace dcmqi {
+
+  namespace {
+    // size of the chunks the encoded objects are written in
+    const size_t WriteBufferSize = 1 << 20;
+  }
+
+  OFCondition MemoryIO::readDICOM(const Uint8* data, size_t length, DcmFileFormat& fileFormat,
+                                  unsigned int numThreads) {
+    DcmInputBufferStream stream;
+    stream.setBuffer(data, static_cast<offile_off_t>(length));
+    stream.setEos();
+    fileFormat.transferInit();
+    // read all element values now, the buffer is owned by the caller
+    OFCondition cond = fileFormat.read(stream, EXS_Unknown, EGL_noChange, OFstatic_cast(Uint32, -1));
+    fileFormat.transferEnd();
+    if (cond.good())
+      cond = Compression::decodeRLE(fileFormat.getDataset(), numThreads);
+    return cond;
+  }
+
+  vector<DcmItem*> MemoryIO::readDatasets(const vector<Buffer>& buffers) {
+    vector<DcmItem*> dcmDatasets;
+    set<OFString> sopInstanceUIDs;
+    for (size_t bufferNumber = 0; bufferNumber < buffers.size(); bufferNumber++) {
+      DcmFileFormat fileFormat;
+      if (readDICOM(buffers[bufferNumber].first, buffers[bufferNumber].second, fileFormat).bad()) {
+        cerr << "Failed to read DICOM object " << bufferNumber + 1 << " from memory. Skipping it." << endl;
+        continue;
+      }
+      DcmDataset* dataset = fileFormat.getDataset();
+      if (!dataset->tagExistsWithValue(DCM_PixelData)) {
+        cerr << "Source DICOM object " << bufferNumber + 1 << " does not contain PixelData, skipping it" << endl;
+        continue;
+      }
+      OFString sopInstanceUID;
+      dataset->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUID);
+      if (!sopInstanceUIDs.insert(sopInstanceUID).second) {
+        cout << "DICOM object " << bufferNumber + 1 << " with SOPInstanceUID: " << sopInstanceUID
+             << " already exists" << endl;
+        continue;
+      }
+      dcmDatasets.push_back(fileFormat.getAndRemoveDataset());
+    }
+    return dcmDatasets;
+  }
+
+  OFCondition MemoryIO::readStructuredReport(const Uint8* data, size_t length, DSRDocument& document) {
+    DcmFileFormat fileFormat;
+    OFCondition cond = readDICOM(data, length, fileFormat);
+    if (cond.good())
+      cond = document.read(*fileFormat.getDataset());
+    return cond;
+  }
+
+  OFCondition MemoryIO::writeDICOM(DcmFileFormat& fileFormat, vector<Uint8>& result,
+                                   E_TransferSyntax xfer, unsigned int numThreads) {
+    result.clear();
+    if (xfer == EXS_DeflatedLittleEndianExplicit)
+      return Compression::encodeDeflated(fileFormat, result, numThreads);
+
+    DcmDataset* dataset = fileFormat.getDataset();
+    OFCondition cond;
+    if (xfer == EXS_RLELossless)
+      cond = Compression::encodeRLE(dataset, numThreads);
+    else
+      cond = dataset->chooseRepresentation(xfer, NULL);
+    if (cond.good())
+      cond = fileFormat.validateMetaInfo(xfer);
+    if (cond.bad()) {
+      cerr << "ERROR: Failed to prepare dataset for encoding: " << cond.text() << endl;
+      return cond;
+    }
+
+    vector<Uint8> buffer(WriteBufferSize);
+    DcmOutputBufferStream stream(buffer.data(), buffer.size());
+    void* written = NULL;
+    offile_off_t writtenLength = 0;
+    fileFormat.transferInit();
+    cond = fileFormat.write(stream, xfer, EET_ExplicitLength, NULL);
+    while (cond == EC_StreamNotifyBuffer) {
+      stream.flushBuffer(written, writtenLength);
+      result.insert(result.end(), static_cast<Uint8*>(written), static_cast<Uint8*>(written) + writtenLength);
+      cond = fileFormat.write(stream, xfer, EET_ExplicitLength, NULL);
+    }
+    fileFormat.transferEnd();
+    if (cond.bad()) {
+      cerr << "ERROR: Failed to encode dataset: " << cond.text() << endl;
+      result.clear();
+      return cond;
+    }
+    stream.flush();
+    stream.flushBuffer(written, writtenLength);
+    result.insert(result.end(), static_cast<Uint8*>(written), static_cast<Uint8*>(written) + writtenLength);
+    return EC_Normal;
+  }
+
+}
@@ -1,10 +1,12 @@
 
 // ITK includes
 #include <itkImageDuplicator.h>
-#include <itkCastImageFilter.h>
+#include <itkMultiThreaderBase.h>
+#include <itkVectorIndexSelectionCastImageFilter.h>
 
 // DCMQI includes
 #include "dcmqi/ParaMapConverter.h"
+#include "dcmqi/Instrumentation.h"
 
 // DCMTK includes
 #include <dcmtk/config/osconfig.h>
@@ -22,23 +24,176 @@
 #include <dcmtk/dcmsr/codes/sct.h>
 #include <dcmtk/dcmsr/codes/ucum.h>
 
+// STD includes
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+
 using namespace std;
 
 namespace dcmqi {
 
-  DcmDataset* ParaMapConverter::itkimage2paramap(const FloatImageType::Pointer &parametricMapImage, vector<DcmItem*> dcmDatasets,
+  // Maps the ITK pixel type to the DCMTK image pixel module and the Real World Value
+  // Mapping attributes used for it
+  template<typename PixelType>
+  struct ParaMapPixelTraits;
+
+  template<>
+  struct ParaMapPixelTraits<Sint16> {
+    typedef IODImagePixelModule<Sint16> PixelModuleType;
+    static const bool isInteger = true;
+    static void setValuesMapped(FGRealWorldValueMapping::RWVMItem& item, const Sint16 first, const Sint16 last) {
+      item.setRealWorldValueFirstValueMappedSigned(first);
+      item.setRealWorldValueLastValueMappedSigned(last);
+    }
+  };
+
+  template<>
+  struct ParaMapPixelTraits<Uint16> {
+    typedef IODImagePixelModule<Uint16> PixelModuleType;
+    static const bool isInteger = true;
+    static void setValuesMapped(FGRealWorldValueMapping::RWVMItem& item, const Uint16 first, const Uint16 last) {
+      item.setRealWorldValueFirstValueMappedUnsigned(first);
+      item.setRealWorldValueLastValueMappedUnsigned(last);
+    }
+  };
+
+  template<>
+  struct ParaMapPixelTraits<Float32> {
+    typedef IODFloatingPointImagePixelModule PixelModuleType;
+    static const bool isInteger = false;
+    // the (US or SS) Real World Value First/Last Value Mapped cannot hold float values
+    static void setValuesMapped(FGRealWorldValueMapping::RWVMItem& item, const Float32 first, const Float32 last) {
+      item.setDoubleFloatRealWorldValueFirstValueMapped(first);
+      item.setDoubleFloatRealWorldValueLastValueMapped(last);
+    }
+  };
+
+  template<>
+  struct ParaMapPixelTraits<Float64> {
+    typedef IODDoubleFloatingPointImagePixelModule PixelModuleType;
+    static const bool isInteger = false;
+    // the (US or SS) Real World Value First/Last Value Mapped cannot hold float values
+    static void setValuesMapped(FGRealWorldValueMapping::RWVMItem& item, const Float64 first, const Float64 last) {
+      item.setDoubleFloatRealWorldValueFirstValueMapped(first);
+      item.setDoubleFloatRealWorldValueLastValueMapped(last);
+    }
+  };
+
+  // -------------------------------------------------------------------------------------
+
+  // Range of the pixel values of a volume, computed per slice in parallel and then
+  // reduced. Like itk::MinimumMaximumImageCalculator, NaN values are ignored.
+  template<typename PixelType>
+  void computeValueRange(const PixelType* buffer, const size_t numberOfSlices, const size_t frameSize,
+                         PixelType &minimum, PixelType &maximum) {
+    vector<PixelType> sliceMinimum(numberOfSlices, itk::NumericTraits<PixelType>::max());
+    vector<PixelType> sliceMaximum(numberOfSlices, itk::NumericTraits<PixelType>::NonpositiveMin());
+    itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+    threader->ParallelizeArray(0, static_cast<itk::SizeValueType>(numberOfSlices),
+      [&](itk::SizeValueType slice) {
+        const PixelType* pixel = buffer + slice * frameSize;
+        const PixelType* end = pixel + frameSize;
+        PixelType sMin = sliceMinimum[slice], sMax = sliceMaximum[slice];
+        for(;pixel!=end;++pixel){
+          if(*pixel < sMin)
+            sMin = *pixel;
+          if(*pixel > sMax)
+            sMax = *pixel;
+        }
+        sliceMinimum[slice] = sMin;
+        sliceMaximum[slice] = sMax;
+      }, nullptr);
+
+    minimum = itk::NumericTraits<PixelType>::max();
+    maximum = itk::NumericTraits<PixelType>::NonpositiveMin();
+    for(size_t slice=0;slice<numberOfSlices;slice++){
+      minimum = min(minimum, sliceMinimum[slice]);
+      maximum = max(maximum, sliceMaximum[slice]);
+    }
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  template<class ImageType>
+  DcmDataset* ParaMapConverter::itkimage2paramap(const itk::SmartPointer<ImageType> &parametricMapImage, vector<DcmItem*> dcmDatasets,
                                          const string &metaData,
                                          const bool doDicomValueChecks) {
+    typedef typename ImageType::PixelType PixelType;
+
+    // 3D maps hold a single volume, 4D maps a stack of volumes sharing the geometry
+    // of the first three dimensions; volumes are contiguous in the buffer
+    ImageGeometryType::Pointer geometry = getImageGeometry(parametricMapImage);
+    const ImageGeometryType::SizeType inputSize = geometry->GetLargestPossibleRegion().GetSize();
+    const unsigned numberOfVolumes = (ImageType::ImageDimension > 3)
+                                     ? parametricMapImage->GetBufferedRegion().GetSize()[ImageType::ImageDimension-1] : 1;
+    const size_t volumeSize = inputSize[0] * inputSize[1] * inputSize[2];
+    PixelType* buffer = parametricMapImage->GetBufferPointer();
+
+    return itkvolumes2paramap<PixelType>(geometry, numberOfVolumes,
+                                         [buffer, volumeSize](unsigned volume) { return buffer + volume * volumeSize; },
+                                         dcmDatasets, metaData, doDicomValueChecks);
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  template<typename PixelType>
+  DcmDataset* ParaMapConverter::itkvectorimage2paramap(const itk::SmartPointer<itk::VectorImage<PixelType, 3> > &parametricMapImage,
+                                                       vector<DcmItem*> dcmDatasets, const string &metaData,
+                                                       const bool doDicomValueChecks) {
+    typedef itk::VectorImage<PixelType, 3> VectorImageType;
+    typedef itk::Image<PixelType, 3> VolumeImageType;
+    typedef itk::VectorIndexSelectionCastImageFilter<VectorImageType, VolumeImageType> SelectionFilterType;
+
+    // the components are extracted one at a time when the converter asks for a
+    // volume (once for its range and once for its frames), so at most one volume
+    // is held next to the interleaved input
+    typename VolumeImageType::Pointer volumeImage;
+    auto getVolume = [&parametricMapImage, &volumeImage](unsigned volume) {
+      volumeImage = NULL;
+      typename SelectionFilterType::Pointer selection = SelectionFilterType::New();
+      selection->SetInput(parametricMapImage);
+      selection->SetIndex(volume);
+      selection->Update();
+      volumeImage = selection->GetOutput();
+      return volumeImage->GetBufferPointer();
+    };
+
+    return itkvolumes2paramap<PixelType>(getImageGeometry(parametricMapImage),
+                                         parametricMapImage->GetNumberOfComponentsPerPixel(), getVolume,
+                                         dcmDatasets, metaData, doDicomValueChecks);
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  template<typename PixelType>
+  DcmDataset* ParaMapConverter::itkvolumes2paramap(const ImageGeometryType::Pointer &geometry, const unsigned numberOfVolumes,
+                                                   const function<PixelType*(unsigned)> &getVolume,
+                                                   vector<DcmItem*> dcmDatasets, const string &metaData,
+                                                   const bool doDicomValueChecks) {
+    Profiler::Scope profilerScope("ParaMapConverter::itkimage2paramap");
 
-    MinMaxCalculatorType::Pointer calculator = MinMaxCalculatorType::New();
-    calculator->SetImage(parametricMapImage);
-    calculator->Compute();
+    typedef ParaMapPixelTraits<PixelType> PixelTraits;
+
+    const ImageGeometryType::SizeType inputSize = geometry->GetLargestPossibleRegion().GetSize();
+    const size_t frameSize = inputSize[0] * inputSize[1];
+
+    vector<PixelType> volumeMinimum(numberOfVolumes), volumeMaximum(numberOfVolumes);
+    for(unsigned volume=0;volume<numberOfVolumes;volume++)
+      computeValueRange(getVolume(volume), inputSize[2], frameSize, volumeMinimum[volume], volumeMaximum[volume]);
+    const PixelType minimumValue = *min_element(volumeMinimum.begin(), volumeMinimum.end());
+    const PixelType maximumValue = *max_element(volumeMaximum.begin(), volumeMaximum.end());
 
     JSONParametricMapMetaInformationHandler metaInfo(metaData);
     metaInfo.read();
 
-    metaInfo.setFirstValueMapped(calculator->GetMinimum());
-    metaInfo.setLastValueMapped(calculator->GetMaximum());
+    // the meta information only holds the integer range
+    if(PixelTraits::isInteger) {
+      metaInfo.setFirstValueMapped(static_cast<short>(minimumValue));
+      metaInfo.setLastValueMapped(static_cast<short>(maximumValue));
+    }
 
     IODEnhGeneralEquipmentModule::EquipmentInfo eq = getEnhEquipmentInfo();
     ContentIdentificationMacro contentID = createContentIdentificationInformation(metaInfo);
@@ -54,11 +209,10 @@ namespace dcmqi {
     // TODO: initialize modality from the source / add to schema?
     OFString modality = "MR";
 
-    FloatImageType::SizeType inputSize = parametricMapImage->GetBufferedRegion().GetSize();
-    cout << "Input image size: " << inputSize << endl;
+    cout << "Input image size: " << inputSize << ", volumes: " << numberOfVolumes << endl;
 
     OFvariant<OFCondition,DPMParametricMapIOD> obj =
-        DPMParametricMapIOD::create<IODFloatingPointImagePixelModule>(modality, metaInfo.getSeriesNumber().c_str(),
+        DPMParametricMapIOD::create<typename PixelTraits::PixelModuleType>(modality, metaInfo.getSeriesNumber().c_str(),
                                                                       metaInfo.getInstanceNumber().c_str(),
                                                                       inputSize[1], inputSize[0], eq, contentID,
                                                                       imageFlavor, pixContrast, DPMTypes::CQ_RESEARCH);
@@ -83,12 +237,16 @@ namespace dcmqi {
     IODMultiframeDimensionModule &mfdim = pMapDoc->getIODMultiframeDimensionModule();
     OFCondition result = mfdim.addDimensionIndex(DCM_ImagePositionPatient, dimUID,
                                                  DCM_RealWorldValueMappingSequence, "Frame position");
+    if(numberOfVolumes > 1){
+      // every volume is a stack of its own
+      CHECK_COND(mfdim.addDimensionIndex(DCM_StackID, dimUID, DCM_FrameContentSequence, "Volume"));
+    }
 
     // Shared FGs: PixelMeasuresSequence
     {
       FGPixelMeasures *pixmsr = new FGPixelMeasures();
 
-      FloatImageType::SpacingType labelSpacing = parametricMapImage->GetSpacing();
+      ImageGeometryType::SpacingType labelSpacing = geometry->GetSpacing();
       ostringstream spacingSStream;
       spacingSStream << scientific << labelSpacing[0] << "\\" << labelSpacing[1];
       CHECK_COND(pixmsr->setPixelSpacing(spacingSStream.str().c_str()));
@@ -104,9 +262,10 @@ namespace dcmqi {
     {
       OFString imageOrientationPatientStr;
 
-      FloatImageType::DirectionType labelDirMatrix = parametricMapImage->GetDirection();
+      ImageGeometryType::DirectionType labelDirMatrix = geometry->GetDirection();
 
-      cout << "Directions: " << labelDirMatrix << endl;
+      if(Verbosity::isEnabled(Verbosity::Detail))
+        cout << "Directions: " << labelDirMatrix << endl;
 
       FGPlaneOrientationPatient *planor =
           FGPlaneOrientationPatient::createMinimal(
@@ -134,7 +293,13 @@ namespace dcmqi {
     CHECK_COND(pMapDoc->addForAllFrames(frameAnaFG));
 
     FGPixelValueTransformation idTransFG;
-    // Rescale Intercept, Rescale Slope, Rescale Type are missing here
+    if (PixelTraits::isInteger) {
+      // integer Pixel Data requires the Identity Pixel Value Transformation, the
+      // stored values are mapped to real world values by the RWVM item below
+      CHECK_COND(idTransFG.setRescaleIntercept("0"));
+      CHECK_COND(idTransFG.setRescaleSlope("1"));
+      CHECK_COND(idTransFG.setRescaleType("US"));
+    }
     CHECK_COND(pMapDoc->addForAllFrames(idTransFG));
 
     FGParametricMapFrameType frameTypeFG;
@@ -152,8 +317,7 @@ namespace dcmqi {
     realWorldValueMappingItem->setRealWorldValueSlope(atof(metaInfo.getRealWorldValueSlope().c_str()));
     realWorldValueMappingItem->setRealWorldValueIntercept(atof(metaInfo.getRealWorldValueIntercept().c_str()));
 
-    realWorldValueMappingItem->setRealWorldValueFirstValueMappedSigned(metaInfo.getFirstValueMapped());
-    realWorldValueMappingItem->setRealWorldValueLastValueMappedSigned(metaInfo.getLastValueMapped());
+    PixelTraits::setValuesMapped(*realWorldValueMappingItem, minimumValue, maximumValue);
 
     CodeSequenceMacro* measurementUnitCode = metaInfo.getMeasurementUnitsCode();
     if (measurementUnitCode != NULL) {
@@ -248,27 +412,39 @@ namespace dcmqi {
     }
 
     rwvmFG.getRealWorldValueMapping().push_back(realWorldValueMappingItem);
-    CHECK_COND(pMapDoc->addForAllFrames(rwvmFG));
+    // with several volumes, each volume gets a Real World Value Mapping of its own
+    // (with the range of that volume), which is added to the frames of the volume
+    vector<OFunique_ptr<FGRealWorldValueMapping> > volumeRwvmFGs;
+    if(numberOfVolumes > 1){
+      for(unsigned volume=0;volume<numberOfVolumes;volume++){
+        volumeRwvmFGs.push_back(OFunique_ptr<FGRealWorldValueMapping>(OFstatic_cast(FGRealWorldValueMapping*, rwvmFG.clone())));
+        if(!volumeRwvmFGs.back() || volumeRwvmFGs.back()->getRealWorldValueMapping().empty())
+          return NULL;
+        PixelTraits::setValuesMapped(*volumeRwvmFGs.back()->getRealWorldValueMapping()[0],
+                                     volumeMinimum[volume], volumeMaximum[volume]);
+      }
+    } else {
+      CHECK_COND(pMapDoc->addForAllFrames(rwvmFG));
+    }
 
     /* Map referenced instances to the ITK parametric map slices */
-    // this is a hack - the function below needs to be factored out
     vector<vector<int> > slice2derimg;
     bool hasDerivationImages = false;
     {
-
-      typedef itk::CastImageFilter<FloatImageType,ShortImageType> CastFilterType;
-      CastFilterType::Pointer cast = CastFilterType::New();
-      cast->SetInput(parametricMapImage);
-      cast->Update();
-      slice2derimg = getSliceMapForSegmentation2DerivationImage(dcmDatasets, cast->GetOutput());
-      cout << "Mapping from the ITK image slices to the DICOM instances in the input list" << endl;
-      for(size_t i=0;i<slice2derimg.size();i++){
-        cout << "  Slice " << i << ": ";
-        for(size_t j=0;j<slice2derimg[i].size();j++){
-          cout << slice2derimg[i][j] << " ";
+      Profiler::Scope geometryScope("referenceGeometry");
+      // only the geometry of the map is needed, its pixels are not touched
+      slice2derimg = getSliceMapForSegmentation2DerivationImage(dcmDatasets, geometry);
+      for(size_t i=0;i<slice2derimg.size();i++)
+        if(!slice2derimg[i].empty())
           hasDerivationImages = true;
+      if(Verbosity::isEnabled(Verbosity::Detail)){
+        cout << "Mapping from the ITK image slices to the DICOM instances in the input list" << endl;
+        for(size_t i=0;i<slice2derimg.size();i++){
+          cout << "  Slice " << i << ": ";
+          for(size_t j=0;j<slice2derimg[i].size();j++)
+            cout << slice2derimg[i][j] << " ";
+          cout << endl;
         }
-        cout << endl;
       }
     }
 
@@ -295,7 +471,26 @@ namespace dcmqi {
     if(hasDerivationImages)
       perFrameFGs.push_back(fgder);
 
-    for (unsigned long sliceNumber = 0; result.good() && (sliceNumber < inputSize[2]); sliceNumber++) {
+    const size_t rwvmFGIndex = perFrameFGs.size();
+    if(numberOfVolumes > 1)
+      perFrameFGs.push_back(volumeRwvmFGs[0].get());
+
+    // all volumes derive from the same source instances, reference each of them once
+    set<OFString> instanceUIDs;
+
+    unsigned long framesAdded = 0;
+    PixelType* volumeBuffer = NULL;
+    Profiler::Scope framesScope("frames");
+    // frames are added volume by volume, slice by slice within each volume
+    for (unsigned long frameNumber = 0; result.good() && (frameNumber < numberOfVolumes * inputSize[2]); frameNumber++) {
+      const unsigned volume = frameNumber / inputSize[2];
+      const unsigned long sliceNumber = frameNumber % inputSize[2];
+      if(sliceNumber == 0)
+        volumeBuffer = getVolume(volume);
+      if(numberOfVolumes > 1 && sliceNumber == 0){
+        perFrameFGs[rwvmFGIndex] = volumeRwvmFGs[volume].get();
+        CHECK_COND(fgfc->setStackID(to_string(volume+1).c_str()));
+      }
 
       OFVector<DcmItem*> siVector;
       for(size_t derImageInstanceNum=0;
@@ -308,8 +503,6 @@ namespace dcmqi {
 
       if(siVector.size()>0){
 
-        set<OFString> instanceUIDs;
-
         DerivationImageItem *derimgItem;
 
         // TODO: I know David will not like this ...
@@ -359,35 +552,18 @@ namespace dcmqi {
 
       // addFrame
       {
-        FloatImageType::RegionType sliceRegion;
-        FloatImageType::IndexType sliceIndex;
-        FloatImageType::SizeType inputSize = parametricMapImage->GetBufferedRegion().GetSize();
-
+        ImageGeometryType::IndexType sliceIndex;
         sliceIndex[0] = 0;
         sliceIndex[1] = 0;
         sliceIndex[2] = sliceNumber;
 
-        inputSize[2] = 1;
-
-        sliceRegion.SetIndex(sliceIndex);
-        sliceRegion.SetSize(inputSize);
-
-        const unsigned frameSize = inputSize[0] * inputSize[1];
-
-        OFVector<IODFloatingPointImagePixelModule::value_type> data(frameSize);
-
-        itk::ImageRegionConstIteratorWithIndex<FloatImageType> sliceIterator(parametricMapImage, sliceRegion);
-
-        unsigned framePixelCnt = 0;
-        for(sliceIterator.GoToBegin();!sliceIterator.IsAtEnd(); ++sliceIterator, ++framePixelCnt){
-          data[framePixelCnt] = sliceIterator.Get();
-          FloatImageType::IndexType idx = sliceIterator.GetIndex();
-          //      cout << framePixelCnt << " " << idx[1] << "," << idx[0] << endl;
-        }
+        // slices are contiguous in the volume, so the frame is handed to DCMTK
+        // (which copies it) straight from there
+        PixelType* frameData = volumeBuffer + sliceNumber * frameSize;
 
         // Plane Position
-        FloatImageType::PointType sliceOriginPoint;
-        parametricMapImage->TransformIndexToPhysicalPoint(sliceIndex, sliceOriginPoint);
+        ImageGeometryType::PointType sliceOriginPoint;
+        geometry->TransformIndexToPhysicalPoint(sliceIndex, sliceOriginPoint);
         fgppp->setImagePositionPatient(
             Helper::floatToStr(sliceOriginPoint[0]).c_str(),
             Helper::floatToStr(sliceOriginPoint[1]).c_str(),
@@ -395,6 +571,10 @@ namespace dcmqi {
 
         // Frame Content
         OFCondition result = fgfc->setDimensionIndexValues(sliceNumber+1 /* value within dimension */, 0 /* first dimension */);
+        if(numberOfVolumes > 1){
+          CHECK_COND(fgfc->setInStackPositionNumber(sliceNumber+1));
+          CHECK_COND(fgfc->setDimensionIndexValues(volume+1 /* value within dimension */, 1 /* second dimension */));
+        }
 
 #if ADD_DERIMG
         // Already pushed above if siVector.size > 0
@@ -403,9 +583,12 @@ namespace dcmqi {
 #endif
 
         DPMParametricMapIOD::FramesType frames = pMapDoc->getFrames();
-        result = OFget<DPMParametricMapIOD::Frames<FloatPixelType> >(&frames)->addFrame(&*data.begin(), frameSize, perFrameFGs);
+        result = OFget<DPMParametricMapIOD::Frames<PixelType> >(&frames)->addFrame(frameData, frameSize, perFrameFGs);
 
-        cout << "Frame " << sliceNumber << " added" << endl;
+        if(result.good())
+          framesAdded++;
+        if(Verbosity::isEnabled(Verbosity::Detail))
+          cout << "Frame " << frameNumber << " added" << endl;
       }
 
       // remove derivation image FG from the per-frame FGs, only if applicable!
@@ -414,6 +597,8 @@ namespace dcmqi {
         fgder->clearData();
       }
     }
+    framesScope.stop();
+    Profiler::count("frames", framesAdded);
 
     // add ReferencedSeriesItem only if it is not empty
     if(refinstances.size())
@@ -456,23 +641,250 @@ namespace dcmqi {
     // ourselves to put together valid datasets
     pMapDoc->getFunctionalGroups().setCheckOnWrite(OFFalse);
     pMapDoc->setValueCheckOnWrite(doDicomValueChecks);
-    CHECK_COND(pMapDoc->writeDataset(*output));
+    {
+      Profiler::Scope writeScope("writeDataset");
+      CHECK_COND(pMapDoc->writeDataset(*output));
+    }
+    if(Profiler::isEnabled()){
+      DcmElement* pixelData = NULL;
+      if(output->findAndGetElement(DCM_FloatPixelData, pixelData).good() ||
+         output->findAndGetElement(DCM_PixelData, pixelData).good())
+        Profiler::count("bytes", pixelData->getLength());
+    }
     return output;
   }
 
+  template DcmDataset* ParaMapConverter::itkimage2paramap<ShortImageType>(
+      const ShortImageType::Pointer &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkimage2paramap<UShortImageType>(
+      const UShortImageType::Pointer &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkimage2paramap<FloatImageType>(
+      const FloatImageType::Pointer &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkimage2paramap<DoubleImageType>(
+      const DoubleImageType::Pointer &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkimage2paramap<Short4DImageType>(
+      const Short4DImageType::Pointer &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkimage2paramap<UShort4DImageType>(
+      const UShort4DImageType::Pointer &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkimage2paramap<Float4DImageType>(
+      const Float4DImageType::Pointer &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkimage2paramap<Double4DImageType>(
+      const Double4DImageType::Pointer &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkvectorimage2paramap<Sint16>(
+      const itk::SmartPointer<itk::VectorImage<Sint16, 3> > &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkvectorimage2paramap<Uint16>(
+      const itk::SmartPointer<itk::VectorImage<Uint16, 3> > &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkvectorimage2paramap<FloatPixelType>(
+      const itk::SmartPointer<itk::VectorImage<FloatPixelType, 3> > &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  template DcmDataset* ParaMapConverter::itkvectorimage2paramap<DoublePixelType>(
+      const itk::SmartPointer<itk::VectorImage<DoublePixelType, 3> > &parametricMapImage, vector<DcmItem*> dcmDatasets,
+      const string &metaData, const bool doDicomValueChecks);
+
+  // -------------------------------------------------------------------------------------
+
+  int ParaMapConverter::getFrameSliceIndices(FGInterface &fgInterface, const vnl_vector<double> &sliceDirection,
+                                              const vnl_vector<double> &imageOrigin, const double sliceSpacing,
+                                              unsigned &numberOfSlices,
+                                              vector<unsigned> &frameSlice, unsigned &numberOfVolumes) {
+    const unsigned numberOfFrames = fgInterface.getNumberOfFrames();
+
+    // Frames of multi-volume maps carry the (1-based) volume as Stack ID
+    vector<OFString> frameStackID(numberOfFrames);
+    vector<OFString> stackIDs;
+    for(unsigned frameId=0;frameId<numberOfFrames;frameId++){
+      FGFrameContent *fracon = OFstatic_cast(FGFrameContent*, fgInterface.get(frameId, DcmFGTypes::EFG_FRAMECONTENT));
+      if(fracon)
+        fracon->getStackID(frameStackID[frameId]);
+      stackIDs.push_back(frameStackID[frameId]);
+    }
+    sort(stackIDs.begin(), stackIDs.end(), [](const OFString& a, const OFString& b) {
+      const long aNum = atol(a.c_str()), bNum = atol(b.c_str());
+      return aNum != bNum ? aNum < bNum : a < b;
+    });
+    stackIDs.erase(unique(stackIDs.begin(), stackIDs.end()), stackIDs.end());
+    numberOfVolumes = static_cast<unsigned>(stackIDs.size());
+
+    vector<unsigned> frameVolume(numberOfFrames, 0);
+    vector<unsigned> volumeFrames(numberOfVolumes, 0);
+    for(unsigned frameId=0;frameId<numberOfFrames;frameId++){
+      frameVolume[frameId] = static_cast<unsigned>(find(stackIDs.begin(), stackIDs.end(), frameStackID[frameId]) - stackIDs.begin());
+      volumeFrames[frameVolume[frameId]]++;
+    }
+    for(unsigned volume=1;volume<numberOfVolumes;volume++){
+      if(volumeFrames[volume] != volumeFrames[0]){
+        cerr << "ERROR: Volume (stack) " << volume+1 << " of the parametric map has " << volumeFrames[volume]
+             << " frames, but volume 1 has " << volumeFrames[0] << "!" << endl;
+        return EXIT_FAILURE;
+      }
+    }
+
+    // The slice of a frame follows from the distance of its Image Position (Patient)
+    // to the image origin along the slice direction, so the order in which frames are
+    // stored does not matter. Slices are counted across volumes.
+    const double originDistance = dot_product(imageOrigin, sliceDirection);
+    frameSlice.resize(numberOfFrames);
+    bool placed = volumeFrames[0] == numberOfSlices;
+    vector<bool> sliceCovered(numberOfVolumes * numberOfSlices, false);
+    for(unsigned frameId=0;placed && frameId<numberOfFrames;frameId++){
+      FGPlanePosPatient *planposfg = OFstatic_cast(FGPlanePosPatient*,
+                                                   fgInterface.get(frameId, DcmFGTypes::EFG_PLANEPOSPATIENT));
+      if(!planposfg){
+        cerr << "ERROR: Plane Position (Patient) is missing for frame " << frameId << endl;
+        return EXIT_FAILURE;
+      }
+      vnl_vector<double> origin(3);
+      for(int j=0;j<3;j++){
+        OFString planposStr;
+        if(planposfg->getImagePositionPatient(planposStr, j).bad()){
+          cerr << "ERROR: Failed to get Image Position (Patient) of frame " << frameId << endl;
+          return EXIT_FAILURE;
+        }
+        origin[j] = atof(planposStr.c_str());
+      }
+
+      const double sliceOffset = sliceSpacing > 0
+                                 ? round((dot_product(origin, sliceDirection) - originDistance) / sliceSpacing) : 0;
+      if(sliceOffset < 0 || sliceOffset >= numberOfSlices){
+        placed = false;
+        break;
+      }
+      const unsigned slice = frameVolume[frameId] * numberOfSlices + static_cast<unsigned>(sliceOffset);
+      if(sliceCovered[slice]){
+        placed = false;
+        break;
+      }
+      sliceCovered[slice] = true;
+      frameSlice[frameId] = slice;
+    }
+    if(placed)
+      return 0;
+
+    // Frames that do not fall onto separate slices of a regular grid (e.g. irregular
+    // spacing) are placed in the order they are stored, one slice per frame
+    cerr << "WARNING: Frames of the parametric map do not fall onto separate slices at a spacing of "
+         << sliceSpacing << ", placing them in the order they are stored!" << endl;
+    numberOfSlices = volumeFrames[0];
+    vector<unsigned> volumeSlices(numberOfVolumes, 0);
+    for(unsigned frameId=0;frameId<numberOfFrames;frameId++)
+      frameSlice[frameId] = frameVolume[frameId] * numberOfSlices + volumeSlices[frameVolume[frameId]]++;
+    return 0;
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  template<typename PixelType>
+  void ParaMapConverter::copyFramesToImage(DPMParametricMapIOD::Frames<PixelType>& frames, const vector<unsigned>& frameSlice,
+                                           const size_t frameSize, FloatPixelType* buffer) {
+    // every frame fills one contiguous slice of the ITK buffer, so frames are
+    // independent and copied in bulk on several threads
+    atomic<bool> failed(false);
+    itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+    threader->ParallelizeArray(0, static_cast<itk::SizeValueType>(frameSlice.size()),
+      [&](itk::SizeValueType frameId) {
+        const PixelType* frame = frames.getFrame(frameId);
+        if(!frame){
+          failed = true;
+          return;
+        }
+        FloatPixelType* slice = buffer + frameSlice[frameId] * frameSize;
+        if(is_same<PixelType, FloatPixelType>::value)
+          memcpy(slice, frame, frameSize * sizeof(FloatPixelType));
+        else
+          copy(frame, frame + frameSize, slice);
+      }, nullptr);
+
+    if(failed){
+      cerr << "ERROR: Failed to get parametric map frame data" << endl;
+      throw -1;
+    }
+  }
+
+  // -------------------------------------------------------------------------------------
+
   pair <FloatImageType::Pointer, string> ParaMapConverter::paramap2itkimage(DcmDataset *pmapDataset) {
+    pair <Float4DImageType::Pointer, string> result = paramap2itkimage4D(pmapDataset);
+    if(result.first->GetLargestPossibleRegion().GetSize()[3] > 1){
+      cerr << "ERROR: The parametric map holds " << result.first->GetLargestPossibleRegion().GetSize()[3]
+           << " volumes, it can only be converted into a 4D image!" << endl;
+      throw -1;
+    }
+    return pair <FloatImageType::Pointer, string>(getFirstVolume(result.first), result.second);
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  FloatImageType::Pointer ParaMapConverter::getFirstVolume(const Float4DImageType::Pointer &image) {
+    FloatImageType::RegionType region;
+    FloatImageType::PointType origin;
+    FloatImageType::SpacingType spacing;
+    FloatImageType::DirectionType direction;
+    for(unsigned i=0;i<3;i++){
+      region.SetSize(i, image->GetLargestPossibleRegion().GetSize()[i]);
+      origin[i] = image->GetOrigin()[i];
+      spacing[i] = image->GetSpacing()[i];
+      for(unsigned j=0;j<3;j++)
+        direction[i][j] = image->GetDirection()[i][j];
+    }
+
+    // the first volume is at the start of the 4D buffer, so the pixel container
+    // is shared instead of copied; the volume keeps it alive
+    FloatImageType::Pointer volume = FloatImageType::New();
+    volume->SetRegions(region);
+    volume->SetOrigin(origin);
+    volume->SetSpacing(spacing);
+    volume->SetDirection(direction);
+    volume->SetPixelContainer(image->GetPixelContainer());
+    return volume;
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  pair <Float4DImageType::Pointer, string> ParaMapConverter::paramap2itkimage4D(DcmDataset *pmapDataset) {
+    Profiler::Scope profilerScope("ParaMapConverter::paramap2itkimage");
 
     DcmRLEDecoderRegistration::registerCodecs();
 
     OFLogger dcemfinfLogger = OFLog::getLogger("qiicr.apps");
     dcemfinfLogger.setLogLevel(dcmtk::log4cplus::OFF_LOG_LEVEL);
 
-    OFvariant<OFCondition,DPMParametricMapIOD*> result = DPMParametricMapIOD::loadDataset(*pmapDataset);
-    if (OFget<OFCondition>(&result)) {
-      throw -1;
+    if(Profiler::isEnabled()){
+      DcmElement* pixelData = NULL;
+      if(pmapDataset->findAndGetElement(DCM_FloatPixelData, pixelData).good() ||
+         pmapDataset->findAndGetElement(DCM_PixelData, pixelData).good())
+        Profiler::count("bytes", pixelData->getLength());
     }
 
-    DPMParametricMapIOD* pMapDoc = *OFget<DPMParametricMapIOD*>(&result);
+    DPMParametricMapIOD* pMapDoc = NULL;
+    {
+      Profiler::Scope loadScope("loadDataset");
+      OFvariant<OFCondition,DPMParametricMapIOD*> result = DPMParametricMapIOD::loadDataset(*pmapDataset);
+      if (OFget<OFCondition>(&result)) {
+        throw -1;
+      }
+      pMapDoc = *OFget<DPMParametricMapIOD*>(&result);
+    }
 
     // Directions
     FGInterface &fgInterface = pMapDoc->getFunctionalGroups();
@@ -510,8 +922,23 @@ namespace dcmqi {
            " Declared = " << imageSpacing[2] << " Computed = " << computedSliceSpacing << endl;
     }
 
-    // Region size
-    FloatImageType::SizeType imageSize;
+    // Slices are computed from the extent and the spacing of the frame positions, like
+    // for segmentations; the declared spacing may be the slice thickness instead
+    unsigned numberOfSlices = computedSliceSpacing > 0 ? static_cast<unsigned>(round(computedVolumeExtent / computedSliceSpacing)) + 1 : 1;
+
+    vector<unsigned> frameSlice;
+    unsigned numberOfVolumes = 1;
+    vnl_vector<double> originVector(3);
+    for(unsigned i=0;i<3;i++)
+      originVector[i] = imageOrigin[i];
+    if(getFrameSliceIndices(fgInterface, sliceDirection, originVector, computedSliceSpacing, numberOfSlices,
+                            frameSlice, numberOfVolumes)){
+      cerr << "ERROR: Failed to order frames by their position!" << endl;
+      throw -1;
+    }
+
+    // Region size; the fourth dimension enumerates the volumes
+    Float4DImageType::SizeType imageSize;
     {
       OFString str;
 
@@ -520,17 +947,32 @@ namespace dcmqi {
       if(pmapDataset->findAndGetOFString(DCM_Columns, str).good())
         imageSize[0] = atoi(str.c_str());
     }
-    imageSize[2] = fgInterface.getNumberOfFrames();
+    imageSize[2] = numberOfSlices;
+    imageSize[3] = numberOfVolumes;
+
+    Float4DImageType::PointType origin4D;
+    Float4DImageType::SpacingType spacing4D;
+    Float4DImageType::DirectionType direction4D;
+    direction4D.SetIdentity();
+    origin4D[3] = 0;
+    spacing4D[3] = 1;
+    for(unsigned i=0;i<3;i++){
+      origin4D[i] = imageOrigin[i];
+      spacing4D[i] = imageSpacing[i];
+      for(unsigned j=0;j<3;j++)
+        direction4D[i][j] = direction[i][j];
+    }
 
-    FloatImageType::RegionType imageRegion;
+    Float4DImageType::RegionType imageRegion;
     imageRegion.SetSize(imageSize);
-    FloatImageType::Pointer pmImage = FloatImageType::New();
+    Float4DImageType::Pointer pmImage = Float4DImageType::New();
     pmImage->SetRegions(imageRegion);
-    pmImage->SetOrigin(imageOrigin);
-    pmImage->SetSpacing(imageSpacing);
-    pmImage->SetDirection(direction);
+    pmImage->SetOrigin(origin4D);
+    pmImage->SetSpacing(spacing4D);
+    pmImage->SetDirection(direction4D);
+    // no need to initialize the buffer, getFrameSliceIndices() made sure that every
+    // slice receives exactly one frame
     pmImage->Allocate();
-    pmImage->FillBuffer(0);
 
     JSONParametricMapMetaInformationHandler metaInfo;
     populateMetaInformationFromDICOM(pmapDataset, metaInfo);
@@ -540,42 +982,28 @@ namespace dcmqi {
       throw -1;
     }
 
-    DPMParametricMapIOD::Frames<FloatPixelType> frames = *OFget<DPMParametricMapIOD::Frames<FloatPixelType> >(&obj);
-
-    for(unsigned int frameId=0;frameId<fgInterface.getNumberOfFrames();frameId++){
-
-      FloatPixelType *frame = frames.getFrame(frameId);
-
-      bool isPerFrame;
-
-      FGPlanePosPatient *planposfg =
-          OFstatic_cast(FGPlanePosPatient*,fgInterface.get(frameId, DcmFGTypes::EFG_PLANEPOSPATIENT, isPerFrame));
-      assert(planposfg);
-
-      FGFrameContent *fracon =
-          OFstatic_cast(FGFrameContent*,fgInterface.get(frameId, DcmFGTypes::EFG_FRAMECONTENT, isPerFrame));
-      assert(fracon);
-
-      // populate meta information needed for Slicer ScalarVolumeNode initialization
-      {
-      }
-
-      FloatImageType::IndexType index;
-      // initialize slice with the frame content
-      for(unsigned int row=0;row<imageSize[1];row++){
-        index[1] = row;
-        index[2] = frameId;
-        for(unsigned int col=0;col<imageSize[0];col++){
-          unsigned pixelPosition = row*imageSize[0] + col;
-          index[0] = col;
-          pmImage->SetPixel(index, frame[pixelPosition]);
-        }
-      }
+    const size_t frameSize = imageSize[0] * imageSize[1];
+    FloatPixelType* buffer = pmImage->GetBufferPointer();
+    Profiler::Scope framesScope("frames");
+    Profiler::count("frames", frameSlice.size());
+    if (DPMParametricMapIOD::Frames<FloatPixelType>* floatFrames = OFget<DPMParametricMapIOD::Frames<FloatPixelType> >(&obj)) {
+      copyFramesToImage(*floatFrames, frameSlice, frameSize, buffer);
+    } else if (DPMParametricMapIOD::Frames<DoublePixelType>* doubleFrames = OFget<DPMParametricMapIOD::Frames<DoublePixelType> >(&obj)) {
+      copyFramesToImage(*doubleFrames, frameSlice, frameSize, buffer);
+    } else if (DPMParametricMapIOD::Frames<Sint16>* shortFrames = OFget<DPMParametricMapIOD::Frames<Sint16> >(&obj)) {
+      copyFramesToImage(*shortFrames, frameSlice, frameSize, buffer);
+    } else if (DPMParametricMapIOD::Frames<Uint16>* ushortFrames = OFget<DPMParametricMapIOD::Frames<Uint16> >(&obj)) {
+      copyFramesToImage(*ushortFrames, frameSlice, frameSize, buffer);
+    } else {
+      cerr << "ERROR: Unsupported pixel type of parametric map frames" << endl;
+      throw -1;
     }
 
-    return pair <FloatImageType::Pointer, string>(pmImage, metaInfo.getJSONOutputAsString());
+    return pair <Float4DImageType::Pointer, string>(pmImage, metaInfo.getJSONOutputAsString());
   }
 
+  // -------------------------------------------------------------------------------------
+
   OFCondition ParaMapConverter::addFrame(DPMParametricMapIOD &map, const FloatImageType::Pointer &parametricMapImage,
                                          const JSONParametricMapMetaInformationHandler &itkNotUsed(metaInfo),
                                          const unsigned long frameNo, OFVector<FGBase*> groups)
@@ -675,6 +1103,11 @@ namespace dcmqi {
 //        item->getRealWorldValueSlope(slope);
         item->getData().findAndGetOFString(DCM_RealWorldValueSlope, slope);
         metaInfo.setRealWorldValueSlope(slope.c_str());
+        // the intercept is only reported if the stored values are offset, e.g.
+        // integer maps that were scaled with an intercept
+        OFString intercept;
+        if (item->getData().findAndGetOFString(DCM_RealWorldValueIntercept, intercept).good() && atof(intercept.c_str()) != 0)
+          metaInfo.setRealWorldValueIntercept(intercept.c_str());
 
         for(unsigned int quantIdx=0; quantIdx<item->getEntireQuantityDefinitionSequence().size(); quantIdx++) {
           ContentItemMacro* macro = item->getEntireQuantityDefinitionSequence()[quantIdx];
@@ -0,0 +1,204 @@
+
+// DCMQI includes
+#include "dcmqi/SegmentationMetadataPlan.h"
+#include "dcmqi/ColorUtilities.h"
+#include "dcmqi/Instrumentation.h"
+
+// STD includes
+#include <algorithm>
+#include <memory>
+
+
+namespace dcmqi {
+
+  SegmentationMetadataPlan::ConstPointer SegmentationMetadataPlan::compile(const string& metaData) {
+    JSONSegmentationMetaInformationHandler metaInfo(metaData);
+    metaInfo.read();
+    return compile(metaInfo);
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  SegmentationMetadataPlan::ConstPointer SegmentationMetadataPlan::compile(const JSONSegmentationMetaInformationHandler& metaInfo) {
+    Profiler::Scope profilerScope("SegmentationMetadataPlan::compile");
+    std::shared_ptr<SegmentationMetadataPlan> plan(new SegmentationMetadataPlan());
+
+    // series level attributes; the segment attributes are only kept in compiled form
+    JSONSegmentationMetaInformationHandler& series = plan->seriesInformation;
+    series.setContentCreatorName(metaInfo.getContentCreatorName());
+    series.setClinicalTrialCoordinatingCenterName(metaInfo.getClinicalTrialCoordinatingCenterName());
+    series.setClinicalTrialSeriesID(metaInfo.getClinicalTrialSeriesID());
+    series.setClinicalTrialTimePointID(metaInfo.getClinicalTrialTimePointID());
+    series.setSeriesDescription(metaInfo.getSeriesDescription());
+    series.setSeriesNumber(metaInfo.getSeriesNumber());
+    series.setInstanceNumber(metaInfo.getInstanceNumber());
+    series.setBodyPartExamined(metaInfo.getBodyPartExamined());
+    if(metaInfo.metaInfoRoot.isObject()){
+      const vector<string> members = metaInfo.metaInfoRoot.getMemberNames();
+      for(size_t i=0;i<members.size();i++){
+        if(members[i] != "segmentAttributes")
+          series.metaInfoRoot[members[i]] = metaInfo.metaInfoRoot[members[i]];
+      }
+    }
+
+    plan->inputs.resize(metaInfo.segmentsAttributesMappingList.size());
+    for(size_t inputNumber=0;inputNumber<metaInfo.segmentsAttributesMappingList.size();inputNumber++){
+      const map<unsigned,SegmentAttributes*>& inputAttributes = metaInfo.segmentsAttributesMappingList[inputNumber];
+      Input& input = plan->inputs[inputNumber];
+      input.segments.reserve(inputAttributes.size());
+
+      // the map is ordered by label ID, and so are the compiled segments
+      for(map<unsigned,SegmentAttributes*>::const_iterator mIt=inputAttributes.begin();mIt!=inputAttributes.end();++mIt){
+        SegmentAttributes* attributes = mIt->second;
+        Segment segment;
+        segment.labelID = mIt->first;
+
+        segment.algorithmType = DcmSegTypes::SAT_UNKNOWN;
+        const string algorithmType = attributes->getSegmentAlgorithmType();
+        if(algorithmType == "MANUAL"){
+          segment.algorithmType = DcmSegTypes::SAT_MANUAL;
+        } else {
+          if(algorithmType == "AUTOMATIC")
+            segment.algorithmType = DcmSegTypes::SAT_AUTOMATIC;
+          if(algorithmType == "SEMIAUTOMATIC")
+            segment.algorithmType = DcmSegTypes::SAT_SEMIAUTOMATIC;
+
+          segment.algorithmName = attributes->getSegmentAlgorithmName().c_str();
+          if(segment.algorithmName.empty())
+            segment.error = "Algorithm name must be specified for non-manual algorithm types!";
+        }
+
+        // segments without these codes cannot be written, which only matters if
+        // their label is used, so the error is reported by createSegment()
+        if(!compileCode(attributes->getSegmentedPropertyCategoryCodeSequence(), segment.category))
+          segment.error = "SegmentedPropertyCategoryCodeSequence must be specified for every segment!";
+        else if(!compileCode(attributes->getSegmentedPropertyTypeCodeSequence(), segment.type))
+          segment.error = "SegmentedPropertyTypeCodeSequence must be specified for every segment!";
+
+        segment.hasTypeModifier = attributes->getSegmentedPropertyTypeModifierCodeSequence() != NULL;
+        if(segment.hasTypeModifier)
+          compileCode(attributes->getSegmentedPropertyTypeModifierCodeSequence(), segment.typeModifier);
+        // the anatomic region modifier is only used together with an anatomic region
+        segment.hasAnatomicRegion = attributes->getAnatomicRegionSequence() != NULL;
+        segment.hasAnatomicRegionModifier = segment.hasAnatomicRegion && attributes->getAnatomicRegionModifierSequence() != NULL;
+        if(segment.hasAnatomicRegion)
+          compileCode(attributes->getAnatomicRegionSequence(), segment.anatomicRegion);
+        if(segment.hasAnatomicRegionModifier)
+          compileCode(attributes->getAnatomicRegionModifierSequence(), segment.anatomicRegionModifier);
+
+        segment.segmentDescription = attributes->getSegmentDescription().c_str();
+        if(attributes->getSegmentLabel().length() > 0){
+          if(Verbosity::isEnabled(Verbosity::Detail))
+            cout << "Populating segment label to " << attributes->getSegmentLabel() << endl;
+          segment.segmentLabel = attributes->getSegmentLabel().c_str();
+        } else if(attributes->getSegmentDescription().length() > 0){
+          if(Verbosity::isEnabled(Verbosity::Detail))
+            cout << "Populating segment label from SegmentDescription to " << attributes->getSegmentDescription() << endl;
+          segment.segmentLabel = attributes->getSegmentDescription().c_str();
+        } else
+          segment.segmentLabel = segment.type.meaning;
+
+        segment.trackingIdentifier = attributes->getTrackingIdentifier().c_str();
+        segment.trackingUniqueIdentifier = attributes->getTrackingUniqueIdentifier().c_str();
+
+        unsigned* rgb = attributes->getRecommendedDisplayRGBValue();
+        int cielab[3];
+        ColorUtilities::getIntegerScaledCIELabPCSFromSRGB(cielab[0], cielab[1], cielab[2], rgb[0], rgb[1], rgb[2]);
+        for(unsigned i=0;i<3;i++)
+          segment.cielab[i] = static_cast<Uint16>(cielab[i]);
+
+        input.segments.push_back(segment);
+      }
+
+      if(!input.segments.empty()){
+        const unsigned indexSize = std::min(DenseLabelRange, input.segments.back().labelID + 1);
+        input.segmentIndex.assign(indexSize, -1);
+        for(size_t i=0;i<input.segments.size() && input.segments[i].labelID<indexSize;i++)
+          input.segmentIndex[input.segments[i].labelID] = static_cast<int>(i);
+      }
+    }
+
+    return plan;
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  const SegmentationMetadataPlan::Segment* SegmentationMetadataPlan::findSegment(size_t input, long labelID) const {
+    if(input >= inputs.size() || labelID < 0)
+      return NULL;
+    const Input& in = inputs[input];
+    if(labelID < static_cast<long>(in.segmentIndex.size())){
+      const int index = in.segmentIndex[labelID];
+      return index < 0 ? NULL : &in.segments[index];
+    }
+    if(labelID < static_cast<long>(DenseLabelRange))
+      return NULL;
+
+    // labels beyond the dense index are rare (32 bit label images), search them
+    vector<Segment>::const_iterator found = std::lower_bound(in.segments.begin(), in.segments.end(), labelID,
+      [](const Segment& segment, long label) { return static_cast<long>(segment.labelID) < label; });
+    if(found == in.segments.end() || static_cast<long>(found->labelID) != labelID)
+      return NULL;
+    return &(*found);
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  DcmSegment* SegmentationMetadataPlan::createSegment(const Segment& segment) {
+    if(!segment.error.empty()){
+      cerr << "ERROR: " << segment.error << endl;
+      return NULL;
+    }
+
+    DcmSegment* createdSegment = NULL;
+
+    CodeSequenceMacro categoryCode(segment.category.value, segment.category.designator, segment.category.meaning);
+    CodeSequenceMacro typeCode(segment.type.value, segment.type.designator, segment.type.meaning);
+    CHECK_COND(DcmSegment::create(createdSegment, segment.segmentLabel, categoryCode, typeCode,
+                                  segment.algorithmType, segment.algorithmName));
+    // deleted if one of the checks below throws
+    std::unique_ptr<DcmSegment> dcmSegment(createdSegment);
+
+    if(!segment.segmentDescription.empty())
+      dcmSegment->setSegmentDescription(segment.segmentDescription);
+
+    if(!segment.trackingIdentifier.empty())
+      dcmSegment->setTrackingID(segment.trackingIdentifier);
+
+    if(!segment.trackingUniqueIdentifier.empty())
+      dcmSegment->setTrackingUID(segment.trackingUniqueIdentifier);
+
+    // the segment takes ownership of the modifier items
+    if(segment.hasTypeModifier){
+      dcmSegment->getSegmentedPropertyTypeModifierCode().push_back(
+        new CodeSequenceMacro(segment.typeModifier.value, segment.typeModifier.designator, segment.typeModifier.meaning));
+    }
+
+    if(segment.hasAnatomicRegion){
+      GeneralAnatomyMacro &anatomyMacro = dcmSegment->getGeneralAnatomyCode();
+      anatomyMacro.getAnatomicRegion() =
+        CodeSequenceMacro(segment.anatomicRegion.value, segment.anatomicRegion.designator, segment.anatomicRegion.meaning);
+      if(segment.hasAnatomicRegionModifier){
+        anatomyMacro.getAnatomicRegionModifier().push_back(
+          new CodeSequenceMacro(segment.anatomicRegionModifier.value, segment.anatomicRegionModifier.designator,
+                                segment.anatomicRegionModifier.meaning));
+      }
+    }
+
+    CHECK_COND(dcmSegment->setRecommendedDisplayCIELabValue(segment.cielab[0], segment.cielab[1], segment.cielab[2]));
+
+    return dcmSegment.release();
+  }
+
+  // -------------------------------------------------------------------------------------
+
+  bool SegmentationMetadataPlan::compileCode(CodeSequenceMacro* codeSequence, Code& code) {
+    if(codeSequence == NULL)
+      return false;
+    codeSequence->getCodeValue(code.value);
+    codeSequence->getCodingSchemeDesignator(code.designator);
+    codeSequence->getCodeMeaning(code.meaning);
+    return true;
+  }
+
+}
@@ -1,4 +1,9 @@
 #include "dcmqi/TID1500Reader.h"
+#include "dcmqi/Instrumentation.h"
+
+#include "dcmtk/dcmdata/dcuid.h"
+
+#include <unordered_set>
 
 DSRCodedEntryValue json2cev(Json::Value& j){
   return DSRCodedEntryValue(j["CodeValue"].asCString(),
@@ -79,18 +84,18 @@ Json::Value TID1500Reader::getMeasurements() {
   string2code["Finding"] = CODE_DCM_Finding;
   string2code["FindingSite"] = CODE_SCT_FindingSite;
 
-  std::vector<DSRCodedEntryValue> knownConcepts;
+  // concepts that are read from the measurement group (including the algorithm
+  // identification), i.e. TEXT and CODE items that are not qualitative evaluations
+  std::unordered_set<std::string> knownConcepts;
   for(std::map<std::string, DSRCodedEntryValue>::const_iterator mIt=string2code.begin();
         mIt!=string2code.end();++mIt){
-    knownConcepts.push_back(mIt->second);
+    knownConcepts.insert(getConceptKey(mIt->second));
   }
-  knownConcepts.push_back(CODE_SRT_MeasurementMethod);
-  knownConcepts.push_back(CODE_SRT_FindingSite);
-
-  std::vector<DSRCodedEntryValue> algorithmIdentificationConcepts;
-  algorithmIdentificationConcepts.push_back(CODE_DCM_AlgorithmName);
-  algorithmIdentificationConcepts.push_back(CODE_DCM_AlgorithmVersion);
-  algorithmIdentificationConcepts.push_back(CODE_DCM_AlgorithmParameters);
+  knownConcepts.insert(getConceptKey(CODE_SRT_MeasurementMethod));
+  knownConcepts.insert(getConceptKey(CODE_SRT_FindingSite));
+  knownConcepts.insert(getConceptKey(CODE_DCM_AlgorithmName));
+  knownConcepts.insert(getConceptKey(CODE_DCM_AlgorithmVersion));
+  knownConcepts.insert(getConceptKey(CODE_DCM_AlgorithmParameters));
 
   const DSRDocumentTreeNodeCursor cursor(getCursor());
 
@@ -102,42 +107,24 @@ Json::Value TID1500Reader::getMeasurements() {
         Json::Value measurementGroup;
         // remember cursor to current content item (as a starting point)
         const DSRDocumentTreeNodeCursor groupCursor(getCursor());
-        for(std::map<std::string, DSRCodedEntryValue>::const_iterator mIt=string2code.begin();
-            mIt!=string2code.end();++mIt){
-          Json::Value value = getContentItem(mIt->second, groupCursor);
-          if(value!=Json::nullValue)
-            measurementGroup[mIt->first] = value;
-        }
-
-        // NB: only the first AlgorithmParameters item is considered
-        {
-          Json::Value algorithmName = getContentItem(CODE_DCM_AlgorithmName, groupCursor);
-          Json::Value algorithmVersion = getContentItem(CODE_DCM_AlgorithmVersion, groupCursor);
-          Json::Value algorithmParameters = getContentItem(CODE_DCM_AlgorithmParameters, groupCursor);
-          if(algorithmName!=Json::nullValue){
-            if(algorithmVersion == Json::nullValue){
-              std::cerr << "ERROR: AlgorithmName is present, but AlgorithmVersion is not!" << std::endl;
-            }
-            measurementGroup["measurementAlgorithmIdentification"]["AlgorithmName"] = algorithmName;
-            measurementGroup["measurementAlgorithmIdentification"]["AlgorithmVersion"] = algorithmVersion;
-          }
-          if(algorithmParameters!=Json::nullValue){
-            measurementGroup["measurementAlgorithmIdentification"]["AlgorithmParameters"] = Json::arrayValue;
-            measurementGroup["measurementAlgorithmIdentification"]["AlgorithmParameters"].append(algorithmParameters);
-          }
-        }
-
-        initSegmentationContentItems(groupCursor, measurementGroup);
-
         // details on measurement value(s)
         Json::Value measurementItems(Json::arrayValue);
         Json::Value qualitativeEvaluations(Json::arrayValue);
         DSRDocumentTreeNodeCursor cursor(groupCursor);
 
         if (cursor.gotoChild()) {
+          // the child nodes are visited once: the group level items are looked
+          // up in this index afterwards instead of searching the children again
+          ConceptIndex groupConcepts;
+
           // iterate over all direct child nodes
           do {
             const DSRDocumentTreeNode *node = cursor.getNode();
+            if (node == NULL)
+              continue;
+
+            const std::string conceptKey = getConceptKey(node->getConceptName());
+            groupConcepts.insert(std::make_pair(conceptKey, node));
 
             {
               Json::Value laterality = Json::nullValue;
@@ -150,26 +137,25 @@ Json::Value TID1500Reader::getMeasurements() {
             }
 
             /* and check for numeric measurement value content items */
-            if ((node != NULL) && (node->getValueType() == VT_Num)) {
+            if (node->getValueType() == VT_Num) {
               Json::Value singleMeasurement = getSingleMeasurement(*OFstatic_cast(const DSRNumTreeNode *, node), cursor);
               measurementItems.append(singleMeasurement);
-            } else if (( node != NULL) && (node->getValueType() == VT_Text)) {
+            } else if (node->getValueType() == VT_Text) {
               // check if the concept assigned to this item is not in the list of concepts
               // that can be encountered otherwise (same for the below)
               // If not, then conclude this is a qualitative evaluation item
 
-              if(find(knownConcepts.begin(), knownConcepts.end(), node->getConceptName()) == knownConcepts.end() &&
-              find(algorithmIdentificationConcepts.begin(), algorithmIdentificationConcepts.end(), node->getConceptName()) == algorithmIdentificationConcepts.end()){
+              if(knownConcepts.find(conceptKey) == knownConcepts.end()){
                 Json::Value singleQualitativeEvaluation;
-                std::cout << "Found concept that is not known, and as such is qualitative: " << node->getConceptName() << std::endl;
+                if(dcmqi::Verbosity::isEnabled(dcmqi::Verbosity::Detail))
+                  std::cout << "Found concept that is not known, and as such is qualitative: " << node->getConceptName() << std::endl;
                 singleQualitativeEvaluation["conceptCode"] = DSRCodedEntryValue2CodeSequence(node->getConceptName());
                 singleQualitativeEvaluation["conceptValue"] = OFstatic_cast(
                 const DSRTextTreeNode *, node)->getValue().c_str();
                 qualitativeEvaluations.append(singleQualitativeEvaluation);
               }
-            } else if (( node != NULL) && (node->getValueType() == VT_Code)) {
-              if(find(knownConcepts.begin(), knownConcepts.end(), node->getConceptName()) == knownConcepts.end() &&
-              find(algorithmIdentificationConcepts.begin(), algorithmIdentificationConcepts.end(), node->getConceptName()) == algorithmIdentificationConcepts.end() ){
+            } else if (node->getValueType() == VT_Code) {
+              if(knownConcepts.find(conceptKey) == knownConcepts.end()){
                 Json::Value singleQualitativeEvaluation;
                 singleQualitativeEvaluation["conceptCode"] = DSRCodedEntryValue2CodeSequence(node->getConceptName());
                 singleQualitativeEvaluation["conceptValue"] = DSRCodedEntryValue2CodeSequence(OFstatic_cast(
@@ -179,6 +165,36 @@ Json::Value TID1500Reader::getMeasurements() {
             }
           } while (cursor.gotoNext());
 
+          for(std::map<std::string, DSRCodedEntryValue>::const_iterator mIt=string2code.begin();
+              mIt!=string2code.end();++mIt){
+            Json::Value value = getContentItemValue(findConcept(groupConcepts, mIt->second), mIt->second);
+            if(value!=Json::nullValue)
+              measurementGroup[mIt->first] = value;
+          }
+
+          // NB: only the first AlgorithmParameters item is considered
+          {
+            Json::Value algorithmName = getContentItemValue(findConcept(groupConcepts, CODE_DCM_AlgorithmName),
+                                                            CODE_DCM_AlgorithmName);
+            Json::Value algorithmVersion = getContentItemValue(findConcept(groupConcepts, CODE_DCM_AlgorithmVersion),
+                                                               CODE_DCM_AlgorithmVersion);
+            Json::Value algorithmParameters = getContentItemValue(findConcept(groupConcepts, CODE_DCM_AlgorithmParameters),
+                                                                  CODE_DCM_AlgorithmParameters);
+            if(algorithmName!=Json::nullValue){
+              if(algorithmVersion == Json::nullValue){
+                std::cerr << "ERROR: AlgorithmName is present, but AlgorithmVersion is not!" << std::endl;
+              }
+              measurementGroup["measurementAlgorithmIdentification"]["AlgorithmName"] = algorithmName;
+              measurementGroup["measurementAlgorithmIdentification"]["AlgorithmVersion"] = algorithmVersion;
+            }
+            if(algorithmParameters!=Json::nullValue){
+              measurementGroup["measurementAlgorithmIdentification"]["AlgorithmParameters"] = Json::arrayValue;
+              measurementGroup["measurementAlgorithmIdentification"]["AlgorithmParameters"].append(algorithmParameters);
+            }
+          }
+
+          initSegmentationContentItems(findConcept(groupConcepts, CODE_DCM_ReferencedSegment), measurementGroup);
+
           measurementGroup["measurementItems"] = measurementItems;
           if(qualitativeEvaluations.size())
             measurementGroup["qualitativeEvaluations"] = qualitativeEvaluations;
@@ -190,49 +206,78 @@ Json::Value TID1500Reader::getMeasurements() {
   return measurements;
 }
 
+std::string TID1500Reader::getConceptKey(const DSRCodedEntryValue &conceptName)
+{
+  // same criteria as DSRCodedEntryValue::operator==, the code meaning is not compared
+  std::string key(conceptName.getCodingSchemeDesignator().c_str());
+  key += '\\';
+  key += conceptName.getCodingSchemeVersion().c_str();
+  key += '\\';
+  key += conceptName.getCodeValue().c_str();
+  return key;
+}
+
+const DSRDocumentTreeNode *TID1500Reader::findConcept(const ConceptIndex &index,
+                                                      const DSRCodedEntryValue &conceptName)
+{
+  if (!conceptName.isValid())
+    return NULL;
+  ConceptIndex::const_iterator found = index.find(getConceptKey(conceptName));
+  return found == index.end() ? NULL : found->second;
+}
+
 Json::Value TID1500Reader::getContentItem(const DSRCodedEntryValue &conceptName,
                                           DSRDocumentTreeNodeCursor cursor)
 {
-  Json::Value contentValue;
   // try to go to the given content item
-  if (gotoNamedChildNode(conceptName, cursor)) {
-    const DSRDocumentTreeNode *node = cursor.getNode();
-    if (node != NULL) {
-      // use appropriate value for output
-      switch (node->getValueType()) {
-        case VT_Text:
-          contentValue = OFstatic_cast(
-          const DSRTextTreeNode *, node)->getValue().c_str();
-          break;
-        case VT_UIDRef:
-          contentValue = OFstatic_cast(
-          const DSRUIDRefTreeNode *, node)->getValue().c_str();
-          break;
-        case VT_Code:
-          contentValue = DSRCodedEntryValue2CodeSequence(OFstatic_cast(
-          const DSRCodeTreeNode *, node)->getValue());
-          break;
-        case VT_Image:
-          contentValue = OFstatic_cast(
-          const DSRImageTreeNode *, node)->getValue().getSOPInstanceUID().c_str();
-          break;
-        case VT_PName:
-          // TODO: investigate why roundtrip JSON test didn't detect that
-          //  observer name was not recovered!
-          contentValue = OFstatic_cast(
-          const DSRPNameTreeNode *, node)->getValue().c_str();
-          break;
-        default:
-          std::cout << "Error: failed to find content item for " << conceptName.getCodeMeaning() << OFendl;
-      }
+  if (gotoNamedChildNode(conceptName, cursor))
+    return getContentItemValue(cursor.getNode(), conceptName);
+  return Json::Value();
+}
+
+Json::Value TID1500Reader::getContentItemValue(const DSRDocumentTreeNode *node,
+                                               const DSRCodedEntryValue &conceptName)
+{
+  Json::Value contentValue;
+  if (node != NULL) {
+    // use appropriate value for output
+    switch (node->getValueType()) {
+      case VT_Text:
+        contentValue = OFstatic_cast(
+        const DSRTextTreeNode *, node)->getValue().c_str();
+        break;
+      case VT_UIDRef:
+        contentValue = OFstatic_cast(
+        const DSRUIDRefTreeNode *, node)->getValue().c_str();
+        break;
+      case VT_Code:
+        contentValue = DSRCodedEntryValue2CodeSequence(OFstatic_cast(
+        const DSRCodeTreeNode *, node)->getValue());
+        break;
+      case VT_Image:
+        contentValue = OFstatic_cast(
+        const DSRImageTreeNode *, node)->getValue().getSOPInstanceUID().c_str();
+        break;
+      case VT_PName:
+        // TODO: investigate why roundtrip JSON test didn't detect that
+        //  observer name was not recovered!
+        contentValue = OFstatic_cast(
+        const DSRPNameTreeNode *, node)->getValue().c_str();
+        break;
+      default:
+        std::cout << "Error: failed to find content item for " << conceptName.getCodeMeaning() << OFendl;
     }
   }
   return contentValue;
 }
 
 void TID1500Reader::initSegmentationContentItems(DSRDocumentTreeNodeCursor cursor, Json::Value &json){
-  if (gotoNamedChildNode(CODE_DCM_ReferencedSegment, cursor)) {
-    const DSRDocumentTreeNode *node = cursor.getNode();
+  if (gotoNamedChildNode(CODE_DCM_ReferencedSegment, cursor))
+    initSegmentationContentItems(cursor.getNode(), json);
+}
+
+void TID1500Reader::initSegmentationContentItems(const DSRDocumentTreeNode *node, Json::Value &json){
+  if (node != NULL && node->getValueType() == VT_Image) {
     std::string segmentationUID = OFstatic_cast(
     const DSRImageTreeNode *, node)->getValue().getSOPInstanceUID().c_str();
     OFVector <Uint16> items;
@@ -364,3 +409,69 @@ size_t TID1500Reader::gotoNamedChildNode(const DSRCodedEntryValue &conceptName,
   }
   return nodeID;
 }
+
+namespace {
+  bool isCompositeEvidence(const OFString &sopClassUID) {
+    return sopClassUID == UID_SegmentationStorage || sopClassUID == UID_RealWorldValueMappingStorage;
+  }
+}
+
+void TID1500Reader::readReport(DcmItem &dataset, DSRDocument &doc, Json::Value &metaRoot) {
+  dcmqi::Profiler::Scope profilerScope("TID1500Reader::readReport");
+  // read the SR document from the DICOM dataset
+  OFCondition readResult;
+  {
+    dcmqi::Profiler::Scope documentScope("document");
+    readResult = doc.read(dataset);
+  }
+  if (readResult.good()) {
+    TID1500Reader reader(doc.getTree());
+
+    Json::Value procedureCode;
+    procedureCode = reader.getProcedureReported();
+    if(procedureCode.isMember("CodeValue")){
+      metaRoot["procedureReported"] = procedureCode;
+    }
+
+    Json::Value observerContext = reader.getObserverContext();
+    metaRoot["observerContext"] = observerContext;
+
+    dcmqi::Profiler::Scope measurementsScope("measurements");
+    metaRoot["Measurements"] = reader.getMeasurements();
+    dcmqi::Profiler::count("measurementGroups", metaRoot["Measurements"].size());
+  }
+
+  OFString temp;
+  doc.getSeriesDescription(temp);
+  metaRoot["SeriesDescription"] = temp.c_str();
+  doc.getSeriesNumber(temp);
+  metaRoot["SeriesNumber"] = temp.c_str();
+  doc.getInstanceNumber(temp);
+  metaRoot["InstanceNumber"] = temp.c_str();
+
+  metaRoot["VerificationFlag"] = DSRTypes::verificationFlagToEnumeratedValue(doc.getVerificationFlag());
+  metaRoot["CompletionFlag"] = DSRTypes::completionFlagToEnumeratedValue(doc.getCompletionFlag());
+
+  Json::Value compositeContextUIDs(Json::arrayValue);
+  Json::Value imageLibraryUIDs(Json::arrayValue);
+
+  // TODO: We need to think about that, because actually the file names are stored in the json and not the UIDs
+  DSRSOPInstanceReferenceList &evidenceList = doc.getCurrentRequestedProcedureEvidence();
+  OFCondition cond = evidenceList.gotoFirstItem();
+  OFString sopInstanceUID;
+  OFString sopClassUID;
+  while(cond.good()) {
+    evidenceList.getSOPClassUID(sopClassUID);
+    evidenceList.getSOPInstanceUID(sopInstanceUID);
+    if (isCompositeEvidence(sopClassUID)) {
+      compositeContextUIDs.append(sopInstanceUID.c_str());
+    }else {
+      imageLibraryUIDs.append(sopInstanceUID.c_str());
+    }
+    cond = evidenceList.gotoNextItem();
+  }
+  if (!imageLibraryUIDs.empty())
+    metaRoot["imageLibrary"] = imageLibraryUIDs;
+  if (!compositeContextUIDs.empty())
+    metaRoot["compositeContext"] = compositeContextUIDs;
+}
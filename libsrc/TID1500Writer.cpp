@@ -0,0 +1,484 @@
+#include "dcmqi/TID1500Writer.h"
+
+// DCMTK includes
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/dcmdata/dcuid.h"
+#include "dcmtk/dcmdata/dcvrda.h"
+#include "dcmtk/dcmdata/dcvrtm.h"
+#include "dcmtk/dcmiod/modhelp.h"
+#include "dcmtk/dcmsr/cmr/tid1500.h"
+#include "dcmtk/dcmsr/codes/dcm.h"
+#include "dcmtk/dcmsr/codes/sct.h"
+#include "dcmtk/dcmsr/dsrdoc.h"
+#include "dcmtk/dcmsr/dsrnumtn.h"
+#include "dcmtk/dcmsr/dsrtextn.h"
+#include "dcmtk/ofstd/ofstd.h"
+
+// ITK includes
+#include <itkMultiThreaderBase.h>
+
+// STD includes
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// DCMQI includes
+#include "dcmqi/Exceptions.h"
+#include "dcmqi/Instrumentation.h"
+#include "dcmqi/QIICRConstants.h"
+#include "dcmqi/QIICRUIDs.h"
+
+using namespace std;
+
+namespace {
+
+DSRCodedEntryValue json2cev(const Json::Value& j){
+  return DSRCodedEntryValue(j["CodeValue"].asCString(),
+    j["CodingSchemeDesignator"].asCString(),
+    j["CodeMeaning"].asCString());
+}
+
+OFString getReferencedFilePath(const string& dirStr, const string& fileStr){
+  OFString fullPath;
+  if(dirStr.size())
+    OFStandard::combineDirAndFilename(fullPath,dirStr.c_str(),fileStr.c_str());
+  else
+    fullPath = OFString(fileStr.c_str());
+  return fullPath;
+}
+
+// Reads the referenced files in parallel, up to (not including) Pixel Data: the
+// image library, the evidence and the patient/study modules only need the
+// attributes in front of it, and the pixels of a large series would otherwise
+// be read for nothing.
+void loadDatasetHeaders(const vector<OFString>& filePaths, vector<DcmFileFormat>& fileFormats){
+  fileFormats.resize(filePaths.size());
+  vector<OFCondition> conditions(filePaths.size());
+
+  itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+  threader->ParallelizeArray(0, filePaths.size(),
+    [&](itk::SizeValueType i) {
+      conditions[i] = fileFormats[i].loadFileUntilTag(filePaths[i], EXS_Unknown, EGL_noChange,
+                                                      DCM_MaxReadLength, ERM_autoDetect, DCM_PixelData);
+    }, nullptr);
+
+  for(size_t i=0;i<filePaths.size();i++){
+    if(conditions[i].bad())
+      cerr << "ERROR: failed to read " << filePaths[i] << endl;
+    CHECK_COND(conditions[i]);
+  }
+}
+
+}
+
+DcmDataset* TID1500Writer::writeReport(const Json::Value& metaRoot,
+                                       const string& imageLibraryDataDir,
+                                       const string& compositeContextDataDir){
+  dcmqi::Profiler::Scope profilerScope("TID1500Writer::writeReport");
+
+  // All referenced files (composite context first, then image library) are read
+  // once, header only, and used for the image library and the evidence
+  vector<OFString> referencedFilePaths;
+  Json::ArrayIndex numberOfCompositeContextFiles = 0;
+  if(metaRoot.isMember("compositeContext")){
+    numberOfCompositeContextFiles = metaRoot["compositeContext"].size();
+    for(Json::ArrayIndex i=0;i<numberOfCompositeContextFiles;i++)
+      referencedFilePaths.push_back(getReferencedFilePath(compositeContextDataDir, metaRoot["compositeContext"][i].asString()));
+  }
+  if(metaRoot.isMember("imageLibrary")){
+    for(Json::ArrayIndex i=0;i<metaRoot["imageLibrary"].size();i++)
+      referencedFilePaths.push_back(getReferencedFilePath(imageLibraryDataDir, metaRoot["imageLibrary"][i].asString()));
+  }
+  vector<DcmFileFormat> referencedFiles;
+  {
+    dcmqi::Profiler::Scope loadScope("loadReferences");
+    loadDatasetHeaders(referencedFilePaths, referencedFiles);
+    dcmqi::Profiler::count("files", referencedFiles.size());
+  }
+
+  vector<DcmItem*> compositeContextDatasets, imageLibraryDatasets;
+  for(size_t i=0;i<referencedFiles.size();i++)
+    (i < numberOfCompositeContextFiles ? compositeContextDatasets : imageLibraryDatasets).push_back(referencedFiles[i].getDataset());
+  return writeReport(metaRoot, compositeContextDatasets, imageLibraryDatasets);
+}
+
+DcmDataset* TID1500Writer::writeReport(const Json::Value& metaRoot,
+                                       const vector<DcmItem*>& compositeContextDatasets,
+                                       const vector<DcmItem*>& imageLibraryDatasets){
+  TID1500_MeasurementReport report(CMR_CID7021::ImagingMeasurementReport);
+
+  CHECK_COND(report.setLanguage(DSRCodedEntryValue("eng", "RFC5646", "English")));
+
+  /* set details on the observation context */
+  Json::Value observerContext = metaRoot["observerContext"];
+  string observerType = observerContext["ObserverType"].asCString();
+  if(observerType == "PERSON"){
+    CHECK_COND(report.getObservationContext().addPersonObserver(observerContext["PersonObserverName"].asCString(), ""));
+  } else if(observerType == "DEVICE"){
+    std::string deviceUID;
+    if(observerContext.isMember("DeviceObserverUID"))
+      deviceUID = observerContext["DeviceObserverUID"].asString();
+    else {
+      char uid[100];
+      dcmGenerateUniqueIdentifier(uid, QIICR_INSTANCE_UID_ROOT);
+      deviceUID = std::string(uid);
+    }
+    CHECK_COND(report.getObservationContext().addDeviceObserver(
+      deviceUID.c_str(),
+      observerContext.get("DeviceObserverName","").asCString(),
+      observerContext.get("DeviceObserverManufacturer","").asCString(),
+      observerContext.get("DeviceObserverModelName","").asCString(),
+      observerContext.get("DeviceObserverSerialNumber","").asCString()
+      ));
+  }
+
+  // Image library must be present, even if empty
+
+  CHECK_COND(report.getImageLibrary().createNewImageLibrary());
+  CHECK_COND(report.getImageLibrary().addImageGroup());
+
+  for(size_t i=0;i<imageLibraryDatasets.size();i++){
+    CHECK_COND(report.getImageLibrary().addImageEntry(*imageLibraryDatasets[i],
+      TID1600_ImageLibrary::withAllDescriptors));
+  }
+
+  // This call will factor out all of the common entries at the group level
+  CHECK_COND(report.getImageLibrary().moveCommonImageDescriptorsToImageGroups());
+
+  // TODO
+  //  - this is a very narrow procedure code
+  // see duscussion here for improved handling, should be factored out in the
+  // future, and handled by the upper-level application layers:
+  // https://github.com/QIICR/dcmqi/issues/30
+  if(metaRoot.isMember("procedureReported")){
+    CHECK_COND(report.addProcedureReported(json2cev(metaRoot["procedureReported"])));
+  } else {
+    CHECK_COND(report.addProcedureReported(DSRCodedEntryValue("363679005", "SCT", "Imaging procedure")));
+  }
+
+  if(!report.isValid()){
+    cerr << "Report invalid!" << endl;
+    return NULL;
+  }
+
+  // the measurements are read through const references into the parsed JSON,
+  //  so that subtrees are not copied
+  const Json::Value& measurementGroups = metaRoot["Measurements"];
+  std::cout << "Total measurement groups: " << measurementGroups.size() << std::endl;
+  dcmqi::Profiler::count("measurementGroups", measurementGroups.size());
+
+  // measurementNumProperty, measurementPopulationDescription and the group level
+  //   algorithm identification cannot be added via the template-specific API; they
+  //   are attached to the document tree once it is expanded, see below.
+  // One entry per measurement group or measurement, pointing into metaRoot (NULL
+  //   if not applicable)
+  std::vector<const Json::Value*> measurementNumProperties, measurementPopulationDescriptions;
+  std::vector<const Json::Value*> measurementGroupAlgorithmIdentification;
+  measurementGroupAlgorithmIdentification.reserve(measurementGroups.size());
+
+  for(Json::ArrayIndex i=0;i<measurementGroups.size();i++){
+    const Json::Value& measurementGroup = measurementGroups[i];
+
+    CHECK_COND(report.addVolumetricROIMeasurements());
+    /* fill volumetric ROI measurements with data */
+    TID1500_MeasurementReport::TID1411_Measurements &measurements = report.getVolumetricROIMeasurements();
+    //std::cout << measurementGroup["TrackingIdentifier"] << std::endl;
+    CHECK_COND(measurements.setTrackingIdentifier(measurementGroup["TrackingIdentifier"].asCString()));
+
+    if(metaRoot.isMember("activitySession"))
+      CHECK_COND(measurements.setActivitySession(metaRoot["activitySession"].asCString()));
+    if(metaRoot.isMember("timePoint"))
+      CHECK_COND(measurements.setTimePoint(metaRoot["timePoint"].asCString()));
+
+    if(measurementGroup.isMember("TrackingUniqueIdentifier")) {
+      CHECK_COND(measurements.setTrackingUniqueIdentifier(measurementGroup["TrackingUniqueIdentifier"].asCString()));
+    } else {
+      char uid[100];
+      dcmGenerateUniqueIdentifier(uid, QIICR_INSTANCE_UID_ROOT);
+      CHECK_COND(measurements.setTrackingUniqueIdentifier(uid));
+    }
+
+    CHECK_COND(measurements.setSourceSeriesForSegmentation(measurementGroup["SourceSeriesForImageSegmentation"].asCString()));
+
+    if(measurementGroup.isMember("rwvmMapUsedForMeasurement")){
+      CHECK_COND(measurements.setRealWorldValueMap(DSRCompositeReferenceValue(UID_RealWorldValueMappingStorage, measurementGroup["rwvmMapUsedForMeasurement"].asCString())));
+    }
+
+    DSRImageReferenceValue segment(UID_SegmentationStorage, measurementGroup["segmentationSOPInstanceUID"].asCString());
+    segment.getSegmentList().addItem(measurementGroup["ReferencedSegment"].asInt());
+    CHECK_COND(measurements.setReferencedSegment(segment));
+
+    CHECK_COND(measurements.setFinding(json2cev(measurementGroup["Finding"])));
+    if(measurementGroup.isMember("FindingSite")){
+      if(measurementGroup.isMember("Laterality")){
+        CHECK_COND(measurements.addFindingSite(json2cev(measurementGroup["FindingSite"]),
+                                               json2cev(measurementGroup["Laterality"])));
+      } else {
+        CHECK_COND(measurements.addFindingSite(json2cev(measurementGroup["FindingSite"])));
+      }
+    }
+
+    if(measurementGroup.isMember("MeasurementMethod"))
+      CHECK_COND(measurements.setMeasurementMethod(json2cev(measurementGroup["MeasurementMethod"])));
+
+    if(measurementGroup.isMember("measurementAlgorithmIdentification")){
+      measurementGroupAlgorithmIdentification.push_back(&measurementGroup["measurementAlgorithmIdentification"]);
+    } else {
+      measurementGroupAlgorithmIdentification.push_back(NULL);
+    }
+
+    // TODO - handle conditional items!
+    const Json::Value& measurementItems = measurementGroup["measurementItems"];
+    for(Json::ArrayIndex j=0;j<measurementItems.size();j++){
+      const Json::Value& measurement = measurementItems[j];
+      // TODO - add measurement method and derivation!
+      const CMR_TID1411_in_TID1500::MeasurementValue numValue(measurement["value"].asCString(), json2cev(measurement["units"]));
+
+      if(!measurements.addMeasurement(json2cev(measurement["quantity"]), numValue).good()){
+        std::cerr << "WARNING: Skipping measurement with the value of " << measurement["value"].asCString() << std::endl;
+        continue;
+      }
+
+      if(measurement.isMember("derivationModifier")){
+          CHECK_COND(measurements.getMeasurement().setDerivation(json2cev(measurement["derivationModifier"])));
+      }
+
+      if(measurement.isMember("measurementModifiers"))
+        for(Json::ArrayIndex k=0;k<measurement["measurementModifiers"].size();k++)
+          CHECK_COND(measurements.getMeasurement().addModifier(json2cev(measurement["measurementModifiers"][k]["modifier"]),json2cev(measurement["measurementModifiers"][k]["modifierValue"])));
+
+      if(measurement.isMember("measurementDerivationParameters")){
+        for(Json::ArrayIndex k=0;k<measurement["measurementDerivationParameters"].size();k++){
+          const Json::Value& derivationItem = measurement["measurementDerivationParameters"][k];
+          DSRCodedEntryValue derivationParameter =
+            json2cev(measurement["measurementDerivationParameters"][k]["derivationParameter"]);
+
+          CMR_SRNumericMeasurementValue derivationParameterValue =
+            CMR_SRNumericMeasurementValue(derivationItem["derivationParameterValue"].asCString(),
+            json2cev(derivationItem["derivationParameterUnits"]));
+
+          CHECK_COND(measurements.getMeasurement().addDerivationParameter(json2cev(derivationItem["derivationParameter"]), derivationParameterValue));
+        }
+      }
+
+      if(measurement.isMember("measurementNumProperties")){
+        measurementNumProperties.push_back(&measurement["measurementNumProperties"]);
+      } else {
+        measurementNumProperties.push_back(NULL);
+      }
+
+      if(measurement.isMember("measurementPopulationDescription")){
+        measurementPopulationDescriptions.push_back(&measurement["measurementPopulationDescription"]);
+      } else {
+        measurementPopulationDescriptions.push_back(NULL);
+      }
+
+
+      if(measurement.isMember("measurementAlgorithmIdentification")){
+        // TODO: add constraints to the schema - name and version both required if group is present!
+        TID4019_AlgorithmIdentification &measurementAlgorithm = measurements.getMeasurement().getAlgorithmIdentification();
+        measurementAlgorithm.setIdentification(measurement["measurementAlgorithmIdentification"]["AlgorithmName"].asCString(),
+                                               measurement["measurementAlgorithmIdentification"]["AlgorithmVersion"].asCString());
+        if(measurement["measurementAlgorithmIdentification"].isMember("AlgorithmParameters")){
+          const Json::Value& parametersJSON = measurement["measurementAlgorithmIdentification"]["AlgorithmParameters"];
+          for(Json::ArrayIndex parameterId=0;parameterId<parametersJSON.size();parameterId++)
+            CHECK_COND(measurementAlgorithm.addParameter(parametersJSON[parameterId].asCString()));
+        }
+      }
+    }
+
+    if(measurementGroup.isMember("qualitativeEvaluations")){
+      for(Json::ArrayIndex k=0;k<measurementGroup["qualitativeEvaluations"].size();k++){
+        const Json::Value& evaluation = measurementGroup["qualitativeEvaluations"][k];
+        if(evaluation["conceptValue"].type() == Json::stringValue){
+          measurements.addQualitativeEvaluation(json2cev(evaluation["conceptCode"]),
+            evaluation["conceptValue"].asString().c_str());
+        } else {
+          measurements.addQualitativeEvaluation(json2cev(evaluation["conceptCode"]),
+            json2cev(evaluation["conceptValue"]));
+        }
+      }
+    }
+  }
+
+  if(!report.isValid()){
+    cerr << "Report is not valid!" << endl;
+    return NULL;
+  }
+
+  DSRDocument doc;
+  OFCondition cond;
+  {
+    dcmqi::Profiler::Scope documentScope("document");
+    cond = doc.setTreeFromRootTemplate(report, OFTrue /*expandTree*/);
+  }
+  if(cond.bad()){
+    std::cout << "Failure: " << cond.text() << std::endl;
+    return NULL;
+  }
+
+  // cleanup duplicate modality from image descriptor entry
+  //  - if we have any imageLibrary items supplied
+  if(metaRoot.isMember("imageLibrary")){
+    if(metaRoot["imageLibrary"].size()){
+      DSRDocumentTree &st = doc.getTree();
+      size_t nnid = st.gotoAnnotatedNode("TID 1601 - Row 1");
+      while (nnid) {
+        nnid = st.gotoNamedChildNode(CODE_DCM_Modality);
+        if (nnid) {
+          CHECK_COND(st.removeSubTree());
+          nnid = st.gotoNextAnnotatedNode("TID 1601 - Row 1");
+        }
+      }
+    }
+  }
+
+  // Attach the items that could not be added via the template API in a single
+  //  walk over the expanded tree: annotated nodes are visited in the order the
+  //  measurement groups and measurements were added
+  {
+    DSRDocumentTree &st = doc.getTree();
+    size_t groupID = 0, measurementID = 0;
+    size_t nnid = st.gotoRoot();
+    while(nnid){
+      const OFString &annotation = st.getNode()->getAnnotation().getText();
+
+      // add Algorithm identification at the group level - note this is not in the standard,
+      // CP pending
+      if(annotation == "TID 1411 - Row 3"){
+        const Json::Value* thisGroupAlgorithmIdentification = measurementGroupAlgorithmIdentification[groupID++];
+
+        if(thisGroupAlgorithmIdentification != NULL && !thisGroupAlgorithmIdentification->empty()){
+          DSRTextTreeNode* node = new DSRTextTreeNode(DSRTypes::RT_hasConceptMod);
+          node->setConceptName(CODE_DCM_AlgorithmName);
+          node->setValue((*thisGroupAlgorithmIdentification)["AlgorithmName"].asCString());
+          CHECK_COND(st.addContentItem(node, DSRTypes::AM_afterCurrent, OFTrue));
+
+          node = new DSRTextTreeNode(DSRTypes::RT_hasConceptMod);
+          node->setConceptName(CODE_DCM_AlgorithmVersion);
+          node->setValue((*thisGroupAlgorithmIdentification)["AlgorithmVersion"].asCString());
+          CHECK_COND(st.addContentItem(node, DSRTypes::AM_afterCurrent, OFTrue));
+
+          if(thisGroupAlgorithmIdentification->isMember("AlgorithmParameters")){
+            const Json::Value& parameters = (*thisGroupAlgorithmIdentification)["AlgorithmParameters"];
+            for(Json::ArrayIndex k=0;k<parameters.size();k++){
+              node = new DSRTextTreeNode(DSRTypes::RT_hasConceptMod);
+              node->setConceptName(CODE_DCM_AlgorithmParameters);
+              node->setValue(parameters[k].asCString());
+              CHECK_COND(st.addContentItem(node, DSRTypes::AM_afterCurrent, OFTrue));
+            }
+          }
+        }
+      }
+
+      // add measurement properties manually, since they cannot be added via
+      // template-specific API
+      else if(annotation == "TID 1419 - Row 5"){
+        const Json::Value* thisMeasurementNumProperties = measurementNumProperties[measurementID];
+        const Json::Value* thisMeasurementPopulationDescription = measurementPopulationDescriptions[measurementID];
+        measurementID++;
+
+        if(thisMeasurementPopulationDescription != NULL && !thisMeasurementPopulationDescription->empty()){
+          DSRTextTreeNode* node = new DSRTextTreeNode(DSRTypes::RT_hasProperties);
+          node->setConceptName(CODE_DCM_PopulationDescription);
+          node->setValue(thisMeasurementPopulationDescription->asCString());
+
+          if(st.addContentItem(node, DSRTypes::AM_belowCurrent, OFTrue).good()){
+            st.goUp();
+          }
+        }
+
+        if(thisMeasurementNumProperties != NULL){
+          for(Json::ArrayIndex measurementNumPropertyID=0;measurementNumPropertyID<thisMeasurementNumProperties->size();measurementNumPropertyID++){
+            const Json::Value& property = (*thisMeasurementNumProperties)[measurementNumPropertyID];
+            DSRNumTreeNode* node = new DSRNumTreeNode(
+              DSRTypes::RT_hasProperties);
+            node->setValue(property["numPropertyValue"].asCString(), json2cev(property["numPropertyUnits"]));
+            node->setConceptName(json2cev(property["numProperty"]));
+            node->setMeasurementUnit(json2cev(property["numPropertyUnits"]));
+
+            if(st.addContentItem(node, DSRTypes::AM_belowCurrent, OFTrue).good()){
+              st.goUp();
+            }
+          }
+        }
+      }
+
+      nnid = st.iterate();
+    }
+  }
+
+  if(metaRoot.isMember("SeriesDescription")) {
+    CHECK_COND(doc.setSeriesDescription(metaRoot["SeriesDescription"].asCString()));
+  }
+
+  if(metaRoot.isMember("CompletionFlag")) {
+    if (DSRTypes::enumeratedValueToCompletionFlag(metaRoot["CompletionFlag"].asCString())
+        == DSRTypes::CF_Complete) {
+      doc.completeDocument();
+    }
+  }
+
+  // TODO: we should think about storing those information in json as well
+  if(metaRoot.isMember("VerificationFlag") && observerType=="PERSON" && doc.getCompletionFlag() == DSRTypes::CF_Complete) {
+    if (DSRTypes::enumeratedValueToVerificationFlag(metaRoot["VerificationFlag"].asCString()) ==
+        DSRTypes::VF_Verified) {
+      // TODO: get organization from meta information?
+      CHECK_COND(doc.verifyDocument(metaRoot["observerContext"]["PersonObserverName"].asCString(), "QIICR"));
+    }
+  }
+
+  if(metaRoot.isMember("InstanceNumber")) {
+    CHECK_COND(doc.setInstanceNumber(metaRoot["InstanceNumber"].asCString()))
+  }
+
+  if(metaRoot.isMember("SeriesNumber")) {
+    CHECK_COND(doc.setSeriesNumber(metaRoot["SeriesNumber"].asCString()))
+  }
+
+  // WARNING: no consistency checks between the referenced UIDs and the
+  //  referencedDICOMFileNames ...
+  DcmItem* ccDataset = NULL;
+  for(size_t i=0;i<compositeContextDatasets.size();i++){
+    if(dcmqi::Verbosity::isEnabled(dcmqi::Verbosity::Detail))
+      cout << "Adding to compositeContext: " << metaRoot["compositeContext"][Json::ArrayIndex(i)].asString() << endl;
+    ccDataset = compositeContextDatasets[i];
+    CHECK_COND(doc.getCurrentRequestedProcedureEvidence().addItem(*ccDataset));
+  }
+  for(size_t i=0;i<imageLibraryDatasets.size();i++)
+    CHECK_COND(doc.getCurrentRequestedProcedureEvidence().addItem(*imageLibraryDatasets[i]));
+
+  if(doc.getDocumentType() != DSRTypes::DT_EnhancedSR)
+    cerr << "WARNING: unexpected document type " << DSRTypes::documentTypeToReadableName(doc.getDocumentType()) << endl;
+
+  std::unique_ptr<DcmDataset> dataset(new DcmDataset());
+
+  OFString contentDate, contentTime;
+  DcmDate::getCurrentDate(contentDate);
+  DcmTime::getCurrentTime(contentTime);
+
+  CHECK_COND(doc.setManufacturer(QIICR_MANUFACTURER));
+  CHECK_COND(doc.setDeviceSerialNumber(QIICR_DEVICE_SERIAL_NUMBER));
+  CHECK_COND(doc.setManufacturerModelName(QIICR_MANUFACTURER_MODEL_NAME));
+  CHECK_COND(doc.setSoftwareVersions(QIICR_SOFTWARE_VERSIONS));
+
+  CHECK_COND(doc.setSeriesDate(contentDate.c_str()));
+  CHECK_COND(doc.setSeriesTime(contentTime.c_str()));
+
+  {
+    dcmqi::Profiler::Scope writeScope("writeDataset");
+    CHECK_COND(doc.write(*dataset));
+  }
+
+  if(ccDataset != NULL){
+    DcmModuleHelpers::copyPatientModule(*ccDataset,*dataset);
+    DcmModuleHelpers::copyPatientStudyModule(*ccDataset,*dataset);
+    DcmModuleHelpers::copyGeneralStudyModule(*ccDataset,*dataset);
+    cout << "Composite Context has been initialized" << endl;
+  } else {
+    cerr << "WARNING: Composite context not initialized! Patient, Study and General Study modules were NOT propagated!" << endl;
+  }
+
+  return dataset.release();
+}
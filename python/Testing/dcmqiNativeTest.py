@@ -0,0 +1,160 @@
+"""Round trip test for the dcmqi_native Python module.
+
+Reads the example label volume and parametric map from NRRD into NumPy, writes
+a DICOM Segmentation and a DICOM Parametric Map from them in memory, reads
+both back and compares the voxels. Also writes an int16 parametric map, which
+must read back as float32 stored values, and reads a parametric map with two
+volumes, which must read back as one 4D array. Fails if a non-contiguous array
+is accepted (it would have to be copied), or if the voxels differ.
+
+The binding does not copy the converter output into the Volume; that is not
+observable from Python. What is checked is that volume.array and
+numpy.asarray(volume) are views of one buffer held by the Volume, not copies
+made per access, and that a view keeps that buffer alive after the Volume
+and its reader are gone.
+
+Usage:
+  python dcmqiNativeTest.py <moduleDirectory> <seg-example.json> <liver_seg.nrrd>
+    <dicomDirectory> <pm-example.json> <pm-example.nrrd> <pm-example-slice.dcm>
+    <pm-example-4d.nrrd> <pm-example-4d.dcm>
+"""
+
+import argparse
+import gc
+import gzip
+import json
+import os
+import sys
+
+import numpy
+
+
+NRRD_TYPES = {"short": numpy.int16, "unsigned short": numpy.uint16, "float": numpy.float32}
+
+
+def require(condition, message):
+  if not condition:
+    sys.exit("Error: " + message)
+
+
+def readNRRD(fileName):
+  """Volume indexed [z, y, x] (or [volume, z, y, x] for 4D files) and its
+  geometry, for the gzip NRRD files of the test data"""
+  with open(fileName, "rb") as f:
+    content = f.read()
+  headerEnd = content.index(b"\n\n")
+  fields = {}
+  for line in content[:headerEnd].decode("ascii").splitlines()[1:]:
+    if ":" in line and not line.startswith("#"):
+      key, value = line.split(":", 1)
+      fields[key.strip()] = value.strip()
+  require(fields["encoding"] == "gzip" and fields["endian"] == "little", "unsupported NRRD " + fileName)
+
+  def vector(text):
+    return [float(x) for x in text.strip("()").split(",")]
+
+  sizes = [int(x) for x in fields["sizes"].split()]
+  # the spatial axes, without the volume axis of 4D files
+  axes = [vector(v)[:3] for v in fields["space directions"].split()[:3]]
+  spacing = [float(numpy.linalg.norm(axis)) for axis in axes]
+  # columns are the image axes
+  direction = [[axes[j][i] / spacing[j] for j in range(3)] for i in range(3)]
+  voxels = numpy.frombuffer(gzip.decompress(content[headerEnd + 2:]), dtype=NRRD_TYPES[fields["type"]])
+  volume = voxels.reshape(sizes[::-1]).copy()
+  return volume, vector(fields["space origin"])[:3], spacing, direction
+
+
+def readBytes(fileName):
+  with open(fileName, "rb") as f:
+    return f.read()
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  for name in ("moduleDirectory", "segMetadata", "segmentation", "dicomDirectory",
+               "pmMetadata", "parametricMap", "pmSource", "parametricMap4D", "pm4D"):
+    parser.add_argument(name)
+  args = parser.parse_args()
+
+  sys.path.insert(0, args.moduleDirectory)
+  import dcmqi_native
+
+  # Segmentation
+  labels, origin, spacing, direction = readNRRD(args.segmentation)
+  sources = [readBytes(os.path.join(args.dicomDirectory, name)) for name in sorted(os.listdir(args.dicomDirectory))]
+  with open(args.segMetadata) as f:
+    metadata = json.load(f)
+
+  try:
+    dcmqi_native.write_segmentation(sources, [labels[:, :, ::2]], metadata, origin, spacing, direction)
+    sys.exit("Error: a non-contiguous array was accepted")
+  except TypeError:
+    pass
+
+  seg = dcmqi_native.write_segmentation(sources, [labels], metadata, origin, spacing, direction)
+  require(seg[128:132] == b"DICM", "write_segmentation did not return a DICOM file")
+
+  reader = dcmqi_native.SegmentationReader(seg)
+  require(reader.metadata["segmentAttributes"][0][0]["SegmentLabel"] ==
+          metadata["segmentAttributes"][0][0]["SegmentLabel"], "segment metadata was not read back")
+  volumes = list(reader)
+  require(len(volumes) == 1, "expected 1 segment volume, got %d" % len(volumes))
+  segment = volumes[0].array
+  require(segment.shape == labels.shape, "segment shape %s differs from %s" % (segment.shape, labels.shape))
+  require(numpy.array_equal(segment != 0, labels != 0), "segment voxels differ from the input labels")
+  require(numpy.allclose(volumes[0].origin, origin, atol=1e-3), "segment origin differs")
+
+  # every access gives a view of the same voxels: a change made through one
+  # is seen through the others
+  require(not segment.flags.owndata and segment.base is volumes[0], "Volume.array is not a view of the Volume")
+  view = numpy.asarray(volumes[0])
+  require(numpy.shares_memory(segment, view), "Volume.array and the buffer protocol do not share the voxels")
+  index = tuple(numpy.argwhere(labels != 0)[0])
+  original = segment[index]
+  segment[index] = 12345
+  require(view[index] == 12345 and volumes[0].array[index] == 12345, "Volume.array returned a copy")
+  segment[index] = original
+
+  # the view keeps the voxels alive without the Volume and the reader
+  del view, volumes, reader
+  gc.collect()
+  require(numpy.array_equal(segment != 0, labels != 0), "segment voxels changed after the reader was released")
+
+  # Parametric map
+  parametricMap, origin, spacing, direction = readNRRD(args.parametricMap)
+  with open(args.pmMetadata) as f:
+    metadata = json.load(f)
+  pm = dcmqi_native.write_parametric_map([readBytes(args.pmSource)], parametricMap, metadata,
+                                         origin, spacing, direction)
+  volume, pmMetadata = dcmqi_native.read_parametric_map(pm)
+  require(isinstance(pmMetadata, dict), "parametric map metadata is not a dict")
+  values = volume.array
+  require(values.dtype == numpy.float32 and values.shape == parametricMap.shape,
+          "unexpected parametric map %s %s" % (values.dtype, values.shape))
+  require(numpy.array_equal(values, parametricMap.astype(numpy.float32)), "parametric map voxels differ")
+
+  # integer maps read back as the stored values in float32
+  maps4D, origin, spacing, direction = readNRRD(args.parametricMap4D)
+  require(maps4D.dtype == numpy.int16 and maps4D.ndim == 4, "unexpected 4D test map %s" % (maps4D.shape,))
+  pm = dcmqi_native.write_parametric_map([readBytes(args.pmSource)], numpy.ascontiguousarray(maps4D[0]),
+                                         metadata, origin, spacing, direction)
+  volume, pmMetadata = dcmqi_native.read_parametric_map(pm)
+  values = volume.array
+  require(values.dtype == numpy.float32 and values.shape == maps4D[0].shape,
+          "unexpected int16 parametric map %s %s" % (values.dtype, values.shape))
+  require(numpy.array_equal(values, maps4D[0].astype(numpy.float32)), "int16 parametric map voxels differ")
+  require("RealWorldValueSlope" in pmMetadata, "int16 parametric map has no real world value mapping")
+
+  # a map with several volumes reads back as one 4D array
+  volume, pmMetadata = dcmqi_native.read_parametric_map(readBytes(args.pm4D))
+  values = volume.array
+  require(values.dtype == numpy.float32 and values.shape == maps4D.shape,
+          "unexpected 4D parametric map %s %s, expected %s" % (values.dtype, values.shape, maps4D.shape))
+  require(numpy.array_equal(values, maps4D.astype(numpy.float32)), "4D parametric map voxels differ")
+  require(numpy.shares_memory(values, numpy.asarray(volume)), "4D views do not share the voxels")
+
+  print("dcmqi_native: segmentation and parametric maps converted through memory")
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,458 @@
+// Python bindings of the dcmqi converters (module dcmqi_native).
+//
+// DICOM objects are passed as bytes-like objects and parsed with
+// dcmqi::MemoryIO, volumes are passed as NumPy arrays. Voxels are not copied
+// in either direction: input arrays are wrapped by ITK images that use their
+// buffer, and the images produced by the converters are exposed through the
+// buffer protocol. Metadata is passed as dict (or JSON string) and returned as
+// dict.
+
+// pybind11 includes
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+// DCMQI includes
+#undef HAVE_SSTREAM // Avoid redefinition warning
+#include "dcmqi/Dicom2ItkConverterBase.h"
+#include "dcmqi/Itk2DicomConverter.h"
+#include "dcmqi/MemoryIO.h"
+#include "dcmqi/ParaMapConverter.h"
+#include "dcmqi/internal/VersionConfigure.h"
+
+// STD includes
+#include <array>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace py = pybind11;
+
+namespace {
+
+typedef dcmqi::MemoryIO::VolumeGeometry VolumeGeometry;
+typedef std::array<double, 3> Vector3;
+typedef std::array<Vector3, 3> Matrix3;
+
+//-----------------------------------------------------------------------------
+// Metadata
+
+py::object parseJSON(const string& text)
+{
+  return py::module_::import("json").attr("loads")(text);
+}
+
+// Metadata given as dict or as JSON string
+string toJSON(const py::object& metadata)
+{
+  if(py::isinstance<py::str>(metadata))
+    return metadata.cast<string>();
+  return py::module_::import("json").attr("dumps")(metadata).cast<string>();
+}
+
+//-----------------------------------------------------------------------------
+// DICOM objects
+
+// Views of bytes-like objects, valid as long as the objects
+class InputBuffers {
+public:
+  explicit InputBuffers(const vector<py::buffer>& objects)
+  {
+    for(size_t i=0;i<objects.size();i++){
+      views.push_back(objects[i].request());
+      buffers.push_back(getBuffer(views.back()));
+    }
+  }
+
+  static dcmqi::MemoryIO::Buffer getBuffer(const py::buffer_info& view)
+  {
+    if(view.ndim != 1 || view.strides[0] != view.itemsize)
+      throw py::value_error("DICOM objects must be contiguous bytes-like objects");
+    return dcmqi::MemoryIO::Buffer(static_cast<const Uint8*>(view.ptr), static_cast<size_t>(view.size * view.itemsize));
+  }
+
+  vector<dcmqi::MemoryIO::Buffer> buffers;
+
+private:
+  vector<py::buffer_info> views;
+};
+
+// Source datasets of a conversion, released when it is done
+class SourceDatasets {
+public:
+  explicit SourceDatasets(const vector<dcmqi::MemoryIO::Buffer>& buffers)
+    : datasets(dcmqi::MemoryIO::readDatasets(buffers))
+  {
+    if(datasets.empty())
+      throw std::runtime_error("no source image could be read");
+  }
+  ~SourceDatasets() {
+    for(size_t i=0;i<datasets.size();i++)
+      delete datasets[i];
+  }
+
+  const vector<DcmItem*> datasets;
+
+private:
+  SourceDatasets(const SourceDatasets&);
+  SourceDatasets& operator=(const SourceDatasets&);
+};
+
+void readDICOM(const py::buffer& data, DcmFileFormat& fileFormat)
+{
+  py::buffer_info view = data.request();
+  const dcmqi::MemoryIO::Buffer buffer = InputBuffers::getBuffer(view);
+  py::gil_scoped_release release;
+  const OFCondition condition = dcmqi::MemoryIO::readDICOM(buffer.first, buffer.second, fileFormat);
+  if(condition.bad())
+    throw std::runtime_error(string("cannot read DICOM object: ") + condition.text());
+}
+
+// Encodes a result of a converter; the bytes object is the only copy made
+py::bytes encodeDICOM(DcmDataset* dataset, E_TransferSyntax xfer)
+{
+  std::unique_ptr<DcmDataset> result(dataset);
+  vector<Uint8> encoded;
+  {
+    py::gil_scoped_release release;
+    if(!result)
+      throw std::runtime_error("conversion failed, see the log output for details");
+    DcmFileFormat fileFormat(result.get());
+    const OFCondition condition = dcmqi::MemoryIO::writeDICOM(fileFormat, encoded, xfer);
+    if(condition.bad())
+      throw std::runtime_error(string("cannot encode DICOM object: ") + condition.text());
+  }
+  return py::bytes(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+}
+
+E_TransferSyntax getTransferSyntax(const string& compress)
+{
+  if(compress == "none")
+    return EXS_LittleEndianExplicit;
+  if(compress == "rle")
+    return EXS_RLELossless;
+  if(compress == "deflate")
+    return EXS_DeflatedLittleEndianExplicit;
+  throw py::value_error("compress must be 'none', 'rle' or 'deflate'");
+}
+
+//-----------------------------------------------------------------------------
+// Volumes
+
+// Image produced by a converter. Keeps the ITK image alive and exposes its
+// voxels through the buffer protocol, indexed [z, y, x] like a C-ordered
+// NumPy array; origin, spacing and direction are in ITK (x, y, z) order.
+// An image whose pixel container holds several volumes one after the other,
+// like the first volume of a 4D image (ParaMapConverter::getFirstVolume()),
+// is exposed as all of them, indexed [volume, z, y, x].
+class Volume {
+public:
+  template<class ImageType>
+  explicit Volume(const ImageType* image, py::ssize_t numberOfVolumes = 1)
+    : image(image),
+      format(py::format_descriptor<typename ImageType::PixelType>::format()),
+      itemSize(sizeof(typename ImageType::PixelType)),
+      numberOfVolumes(numberOfVolumes)
+  {
+    data = dcmqi::MemoryIO::getVoxels(image, geometry);
+  }
+
+  py::buffer_info getBuffer() const
+  {
+    const py::ssize_t sizeX = geometry.size[0], sizeY = geometry.size[1], sizeZ = geometry.size[2];
+    if(numberOfVolumes > 1)
+      return py::buffer_info(const_cast<void*>(data), itemSize, format, 4,
+                             { numberOfVolumes, sizeZ, sizeY, sizeX },
+                             { itemSize * sizeX * sizeY * sizeZ, itemSize * sizeX * sizeY, itemSize * sizeX, itemSize });
+    return py::buffer_info(const_cast<void*>(data), itemSize, format, 3,
+                           { sizeZ, sizeY, sizeX },
+                           { itemSize * sizeX * sizeY, itemSize * sizeX, itemSize });
+  }
+
+  Vector3 getOrigin() const { return Vector3{{ geometry.origin[0], geometry.origin[1], geometry.origin[2] }}; }
+  Vector3 getSpacing() const { return Vector3{{ geometry.spacing[0], geometry.spacing[1], geometry.spacing[2] }}; }
+  Matrix3 getDirection() const
+  {
+    Matrix3 direction;
+    for(unsigned i=0;i<3;i++)
+      for(unsigned j=0;j<3;j++)
+        direction[i][j] = geometry.direction[3*i+j];
+    return direction;
+  }
+
+private:
+  itk::DataObject::ConstPointer image;
+  const void* data;
+  VolumeGeometry geometry;
+  const string format;
+  const py::ssize_t itemSize;
+  const py::ssize_t numberOfVolumes;
+};
+
+VolumeGeometry makeGeometry(const py::array& first, const Vector3& origin, const Vector3& spacing, const Matrix3& direction)
+{
+  if(first.ndim() != 3)
+    throw py::value_error("volumes must be 3D arrays indexed [z, y, x]");
+  VolumeGeometry geometry;
+  for(unsigned i=0;i<3;i++){
+    geometry.size[i] = static_cast<unsigned>(first.shape(2-i));
+    geometry.origin[i] = origin[i];
+    geometry.spacing[i] = spacing[i];
+    for(unsigned j=0;j<3;j++)
+      geometry.direction[3*i+j] = direction[i][j];
+  }
+  return geometry;
+}
+
+// Wraps the arrays into images without copying, if they all have the pixel
+// type; arrays of other types are rejected rather than converted
+template<class PixelType>
+bool importVolumes(const vector<py::array>& arrays, const VolumeGeometry& geometry,
+                   vector<typename itk::Image<PixelType, 3>::ConstPointer>& images)
+{
+  typedef py::array_t<PixelType, py::array::c_style> ArrayType;
+  if(!py::isinstance<ArrayType>(arrays[0]))
+    return false;
+  for(size_t i=0;i<arrays.size();i++){
+    if(!py::isinstance<ArrayType>(arrays[i]))
+      throw py::type_error("all volumes must have the same dtype and be C-contiguous (numpy.ascontiguousarray)");
+    if(arrays[i].ndim() != 3 || arrays[i].shape(0) != static_cast<py::ssize_t>(geometry.size[2])
+       || arrays[i].shape(1) != static_cast<py::ssize_t>(geometry.size[1])
+       || arrays[i].shape(2) != static_cast<py::ssize_t>(geometry.size[0]))
+      throw py::value_error("all volumes must have the same shape");
+    images.push_back(dcmqi::MemoryIO::importVolume(static_cast<const PixelType*>(arrays[i].data()), geometry));
+  }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Segmentations
+
+struct SegmentationFlags {
+  bool skipEmptySlices;
+  bool useLabelIDAsSegmentNumber;
+  bool referencesGeometryCheck;
+  bool dicomValueChecks;
+  bool labelmap;
+};
+
+template<class PixelType>
+bool convertSegmentations(const vector<py::array>& arrays, const VolumeGeometry& geometry,
+                          const InputBuffers& sources, const string& metadata,
+                          const SegmentationFlags& flags, DcmDataset*& result)
+{
+  typedef itk::Image<PixelType, 3> ImageType;
+  vector<typename ImageType::ConstPointer> images;
+  if(!importVolumes<PixelType>(arrays, geometry, images))
+    return false;
+  py::gil_scoped_release release;
+  SourceDatasets datasets(sources.buffers);
+  result = dcmqi::Itk2DicomConverter::itkimage2dcmSegmentation<ImageType>(
+    datasets.datasets, images, metadata, flags.skipEmptySlices, flags.useLabelIDAsSegmentNumber,
+    flags.referencesGeometryCheck, flags.dicomValueChecks, flags.labelmap);
+  return true;
+}
+
+py::bytes writeSegmentation(const vector<py::buffer>& sourceImages, const vector<py::array>& segmentations,
+                            const py::object& metadata, const Vector3& origin, const Vector3& spacing,
+                            const Matrix3& direction, bool skipEmptySlices, bool useLabelIDAsSegmentNumber,
+                            bool referencesGeometryCheck, bool dicomValueChecks, bool labelmap,
+                            const string& compress)
+{
+  if(segmentations.empty())
+    throw py::value_error("no segmentation given");
+  const E_TransferSyntax xfer = getTransferSyntax(compress);
+  if(xfer == EXS_RLELossless && !labelmap)
+    throw py::value_error("compress='rle' requires labelmap=True");
+  const VolumeGeometry geometry = makeGeometry(segmentations[0], origin, spacing, direction);
+  const InputBuffers sources(sourceImages);
+  const string metadataText = toJSON(metadata);
+  const SegmentationFlags flags = { skipEmptySlices, useLabelIDAsSegmentNumber, referencesGeometryCheck,
+                                    dicomValueChecks, labelmap };
+
+  DcmDataset* result = NULL;
+  if(!convertSegmentations<CharPixelType>(segmentations, geometry, sources, metadataText, flags, result)
+     && !convertSegmentations<Uint16>(segmentations, geometry, sources, metadataText, flags, result)
+     && !convertSegmentations<ShortPixelType>(segmentations, geometry, sources, metadataText, flags, result)
+     && !convertSegmentations<Sint32>(segmentations, geometry, sources, metadataText, flags, result))
+    throw py::type_error("segmentations must be C-contiguous arrays of uint8, uint16, int16 or int32");
+  return encodeDICOM(result, xfer);
+}
+
+// Iterates over the volumes of a DICOM Segmentation, like segimage2itkimage:
+// one volume per segment, or per group of non-overlapping segments with
+// merge_segments, or a single volume for a labelmap
+class SegmentationReader {
+public:
+  SegmentationReader(const py::buffer& data, bool mergeSegments)
+    : fileFormat(new DcmFileFormat()), started(false)
+  {
+    readDICOM(data, *fileFormat);
+    py::gil_scoped_release release;
+    DcmDataset* dataset = fileFormat->getDataset();
+    converter.reset(dcmqi::Dicom2ItkConverter::getConverter(dataset));
+    if(!converter)
+      throw std::runtime_error("not a DICOM Segmentation");
+    const OFCondition condition = converter->dcmSegmentation2itkimage(dataset, metaInfo, mergeSegments);
+    if(condition.bad())
+      throw std::runtime_error(string("cannot convert DICOM Segmentation: ") + condition.text());
+    use8Bit = converter->bytesPerPixel() == 1 && converter->isLabelmap();
+  }
+
+  py::object getMetadata() const { return parseJSON(metaInfo); }
+
+  bool isLabelmap() { return converter->isLabelmap(); }
+
+  Volume next()
+  {
+    std::unique_ptr<Volume> volume;
+    {
+      py::gil_scoped_release release;
+      if(use8Bit){
+        CharImageType::Pointer image = started ? converter->next8Bit() : converter->begin8Bit();
+        if(image)
+          volume.reset(new Volume(image.GetPointer()));
+      } else {
+        ShortImageType::Pointer image = started ? converter->next16Bit() : converter->begin16Bit();
+        if(image)
+          volume.reset(new Volume(image.GetPointer()));
+      }
+      started = true;
+    }
+    if(!volume)
+      throw py::stop_iteration();
+    return *volume;
+  }
+
+private:
+  std::unique_ptr<DcmFileFormat> fileFormat;
+  std::unique_ptr<dcmqi::Dicom2ItkConverterBase> converter;
+  string metaInfo;
+  bool started;
+  bool use8Bit;
+};
+
+//-----------------------------------------------------------------------------
+// Parametric maps
+
+template<class PixelType>
+bool convertParametricMap(const py::array& array, const VolumeGeometry& geometry, const InputBuffers& sources,
+                          const string& metadata, bool dicomValueChecks, DcmDataset*& result)
+{
+  typedef itk::Image<PixelType, 3> ImageType;
+  vector<typename ImageType::ConstPointer> images;
+  if(!importVolumes<PixelType>(vector<py::array>(1, array), geometry, images))
+    return false;
+  py::gil_scoped_release release;
+  SourceDatasets datasets(sources.buffers);
+  // the converter only reads the image, which refers to the caller's array
+  typename ImageType::Pointer image = const_cast<ImageType*>(images[0].GetPointer());
+  result = dcmqi::ParaMapConverter::itkimage2paramap<ImageType>(image, datasets.datasets, metadata, dicomValueChecks);
+  return true;
+}
+
+py::bytes writeParametricMap(const vector<py::buffer>& sourceImages, const py::array& parametricMap,
+                             const py::object& metadata, const Vector3& origin, const Vector3& spacing,
+                             const Matrix3& direction, bool dicomValueChecks)
+{
+  const VolumeGeometry geometry = makeGeometry(parametricMap, origin, spacing, direction);
+  const InputBuffers sources(sourceImages);
+  const string metadataText = toJSON(metadata);
+
+  DcmDataset* result = NULL;
+  if(!convertParametricMap<ShortPixelType>(parametricMap, geometry, sources, metadataText, dicomValueChecks, result)
+     && !convertParametricMap<Uint16>(parametricMap, geometry, sources, metadataText, dicomValueChecks, result)
+     && !convertParametricMap<FloatPixelType>(parametricMap, geometry, sources, metadataText, dicomValueChecks, result)
+     && !convertParametricMap<DoublePixelType>(parametricMap, geometry, sources, metadataText, dicomValueChecks, result))
+    throw py::type_error("parametric maps must be C-contiguous arrays of int16, uint16, float32 or float64");
+  return encodeDICOM(result, EXS_LittleEndianExplicit);
+}
+
+// Like paramap2itkimage, the voxels are the stored values as float, for
+// integer frames without the Real World Value Mapping of the metadata. A map
+// with several volumes gives one Volume of all of them, sharing the 4D buffer.
+py::tuple readParametricMap(const py::buffer& data)
+{
+  DcmFileFormat fileFormat;
+  readDICOM(data, fileFormat);
+  pair<Float4DImageType::Pointer, string> result;
+  FloatImageType::Pointer firstVolume;
+  {
+    py::gil_scoped_release release;
+    result = dcmqi::ParaMapConverter::paramap2itkimage4D(fileFormat.getDataset());
+    if(result.first.IsNotNull())
+      firstVolume = dcmqi::ParaMapConverter::getFirstVolume(result.first);
+  }
+  if(firstVolume.IsNull())
+    throw std::runtime_error("cannot convert DICOM Parametric Map, see the log output for details");
+  const py::ssize_t numberOfVolumes = static_cast<py::ssize_t>(result.first->GetLargestPossibleRegion().GetSize()[3]);
+  return py::make_tuple(Volume(firstVolume.GetPointer(), numberOfVolumes), parseJSON(result.second));
+}
+
+}
+
+//-----------------------------------------------------------------------------
+
+PYBIND11_MODULE(dcmqi_native, m)
+{
+  m.doc() = "Conversion between DICOM objects in memory and NumPy volumes, without intermediate files";
+  m.attr("info") = dcmqi_INFO;
+
+  // CHECK_COND of the converters
+  py::register_exception_translator([](std::exception_ptr exception) {
+    try {
+      if(exception)
+        std::rethrow_exception(exception);
+    } catch (int) {
+      PyErr_SetString(PyExc_RuntimeError, "Fatal error encountered.");
+    }
+  });
+
+  py::class_<Volume>(m, "Volume", py::buffer_protocol(),
+                     "Volume produced by a converter. numpy.asarray(volume) or volume.array is a view of its "
+                     "voxels indexed [z, y, x], or [volume, z, y, x] for a parametric map with several volumes; "
+                     "origin, spacing and direction are in (x, y, z) order.")
+    .def_buffer(&Volume::getBuffer)
+    .def_property_readonly("array", [](py::object self) {
+        const py::buffer_info info = self.cast<const Volume&>().getBuffer();
+        return py::array(py::dtype(info), info.shape, info.strides, info.ptr, self);
+      }, "NumPy view of the voxels, valid as long as it is referenced")
+    .def_property_readonly("origin", &Volume::getOrigin)
+    .def_property_readonly("spacing", &Volume::getSpacing)
+    .def_property_readonly("direction", &Volume::getDirection, "direction cosines, the columns are the image axes");
+
+  py::class_<SegmentationReader>(m, "SegmentationReader",
+                                 "Reads a DICOM Segmentation from a bytes-like object; iterating yields its volumes.")
+    .def(py::init<const py::buffer&, bool>(), py::arg("data"), py::arg("merge_segments") = false)
+    .def_property_readonly("metadata", &SegmentationReader::getMetadata,
+                           "segmentation metadata, as written by segimage2itkimage")
+    .def_property_readonly("is_labelmap", &SegmentationReader::isLabelmap)
+    .def("__iter__", [](SegmentationReader& reader) -> SegmentationReader& { return reader; })
+    .def("__next__", &SegmentationReader::next);
+
+  m.def("write_segmentation", &writeSegmentation,
+        "Creates a DICOM Segmentation from label volumes (uint8, uint16, int16 or int32 arrays indexed [z, y, x]) "
+        "and the metadata accepted by itkimage2segimage; returns the encoded object.",
+        py::arg("source_images"), py::arg("segmentations"), py::arg("metadata"),
+        py::arg("origin") = Vector3{{0, 0, 0}}, py::arg("spacing") = Vector3{{1, 1, 1}},
+        py::arg("direction") = Matrix3{{ {{1, 0, 0}}, {{0, 1, 0}}, {{0, 0, 1}} }},
+        py::arg("skip_empty_slices") = true, py::arg("use_label_id_as_segment_number") = false,
+        py::arg("references_geometry_check") = true, py::arg("dicom_value_checks") = true,
+        py::arg("labelmap") = false, py::arg("compress") = "none");
+
+  m.def("write_parametric_map", &writeParametricMap,
+        "Creates a DICOM Parametric Map from a volume (int16, uint16, float32 or float64 array indexed [z, y, x]) "
+        "and the metadata accepted by itkimage2paramap; returns the encoded object.",
+        py::arg("source_images"), py::arg("parametric_map"), py::arg("metadata"),
+        py::arg("origin") = Vector3{{0, 0, 0}}, py::arg("spacing") = Vector3{{1, 1, 1}},
+        py::arg("direction") = Matrix3{{ {{1, 0, 0}}, {{0, 1, 0}}, {{0, 0, 1}} }},
+        py::arg("dicom_value_checks") = true);
+
+  m.def("read_parametric_map", &readParametricMap,
+        "Reads a DICOM Parametric Map from a bytes-like object; returns (volume, metadata). The voxels are "
+        "float32 for any stored pixel type: integer frames are converted without applying RealWorldValueSlope "
+        "and RealWorldValueIntercept of the metadata. A map with several volumes gives a 4D array indexed "
+        "[volume, z, y, x].",
+        py::arg("data"));
+}
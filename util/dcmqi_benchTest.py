@@ -0,0 +1,66 @@
+"""Smoke test for dcmqi_bench.
+
+Runs all benchmarks once on small volumes, with 3 labels stored in 8 bits and
+with 300 labels stored in 16 bits, and checks the results file of each run.
+Fails if dcmqi_bench fails, if a benchmark is missing from the results or not
+listed as succeeded, or if the labels are not stored in the expected size.
+
+Usage:
+  python dcmqi_benchTest.py <dcmqi_bench> <outputDirectory>
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+BENCHMARKS = ["labelscan", "metadata", "export-binary", "export-labelmap", "write", "write-deflate",
+              "write-rle", "read", "read-labelmap", "bin2label", "paramap-export", "paramap-import",
+              "sr-write", "sr-read"]
+
+# (name, label bits, dcmqi_bench options); there must be at least as many
+# columns as labels
+RUNS = [
+  ("8bit", 8, ["--rows", "48", "--columns", "64", "--slices", "6", "--labels", "3"]),
+  ("16bit", 16, ["--rows", "16", "--columns", "320", "--slices", "4", "--labels", "300"]),
+]
+
+
+def require(condition, message):
+  if not condition:
+    sys.exit("Error: " + message)
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument("bench")
+  parser.add_argument("outputDirectory")
+  args = parser.parse_args()
+
+  for name, labelBits, options in RUNS:
+    resultsFile = os.path.join(args.outputDirectory, "bench-results-%s.json" % name)
+    if os.path.exists(resultsFile):
+      os.remove(resultsFile)
+    command = [args.bench] + options + ["--overlap", "0.25", "--sparsity", "0.5", "--repetitions", "1",
+                                        "--workDirectory", args.outputDirectory,
+                                        "--outputResults", resultsFile]
+    print(" ".join(command))
+    require(subprocess.call(command) == 0, "dcmqi_bench failed (%s)" % name)
+
+    with open(resultsFile) as f:
+      results = json.load(f)
+    require(results.get("labelBits") == labelBits,
+            "labels stored in %s bits instead of %d (%s)" % (results.get("labelBits"), labelBits, name))
+    benchmarks = results.get("benchmarks", [])
+    require([benchmark.get("name") for benchmark in benchmarks] == BENCHMARKS,
+            "unexpected benchmarks %s (%s)" % ([benchmark.get("name") for benchmark in benchmarks], name))
+    for benchmark in benchmarks:
+      require(benchmark.get("status") == "succeeded" and len(benchmark.get("seconds", [])) == 1,
+              "benchmark %s did not succeed (%s): %s" % (benchmark["name"], name, benchmark.get("error", "")))
+
+  print("dcmqi_bench: %d benchmarks succeeded with 8 and 16 bit labels" % len(BENCHMARKS))
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,160 @@
+"""Functional test for dcmqibatch.
+
+Writes a JSON manifest with one job of every conversion, two segmentations
+that share their parameters through "defaults" and a job whose input does not
+exist, runs it and checks the CSV report: every job is reported once, only the
+broken job fails and dcmqibatch exits with an error. Then runs a CSV manifest
+without failing jobs and checks that the JSON lines report carries the results
+and that dcmqibatch succeeds. Finally runs three segmentations with three
+workers within a memory budget that only fits one of them at a time, and checks
+from the report that they ran one after the other.
+
+Usage:
+  python dcmqibatchTest.py <dcmqibatch> <sourceDirectory> <outputDirectory>
+"""
+
+import argparse
+import csv
+import json
+import os
+import subprocess
+import sys
+
+
+def require(condition, message):
+  if not condition:
+    sys.exit("Error: " + message)
+
+
+def runBatch(batch, manifest, report, reportFormat, extraArguments=[]):
+  command = [batch, "--manifest", manifest, "--outputReport", report,
+             "--reportFormat", reportFormat, "--workers", "3"] + extraArguments
+  print(" ".join(command))
+  return subprocess.call(command)
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument("batch")
+  parser.add_argument("sourceDirectory")
+  parser.add_argument("outputDirectory")
+  args = parser.parse_args()
+
+  examples = os.path.join(args.sourceDirectory, "doc", "examples")
+  segmentations = os.path.join(args.sourceDirectory, "data", "segmentations")
+  paramaps = os.path.join(args.sourceDirectory, "data", "paramaps")
+  ctDirectory = os.path.join(segmentations, "ct-3slice")
+  output = args.outputDirectory
+
+  manifest = {
+    "defaults": {
+      "inputMetadata": os.path.join(examples, "seg-example.json"),
+      "inputDICOMDirectory": ctDirectory
+    },
+    "jobs": [
+      {"id": "liver-binary", "method": "itkimage2segimage",
+       "params": {"inputImageList": [os.path.join(segmentations, "liver_seg.nrrd")],
+                  "outputDICOM": os.path.join(output, "batch-liver-binary.dcm")}},
+      {"id": "liver-labelmap", "method": "itkimage2segimage",
+       "params": {"inputImageList": [os.path.join(segmentations, "liver_seg.nrrd")],
+                  "segmentationType": "labelmap", "compress": "rle",
+                  "outputDICOM": os.path.join(output, "batch-liver-labelmap.dcm")}},
+      {"id": "liver-images", "method": "segimage2itkimage",
+       "params": {"inputDICOM": os.path.join(segmentations, "liver.dcm"),
+                  "outputDirectory": output, "prefix": "batch-liver"}},
+      {"id": "pmap", "method": "itkimage2paramap",
+       "params": {"inputImage": os.path.join(paramaps, "pm-example.nrrd"),
+                  "inputMetadata": os.path.join(examples, "pm-example.json"),
+                  "inputDICOMList": [os.path.join(paramaps, "pm-example-slice.dcm")],
+                  "inputDICOMDirectory": "",
+                  "outputDICOM": os.path.join(output, "batch-pmap.dcm")}},
+      {"id": "report", "method": "tid1500writer",
+       "params": {"inputMetadata": os.path.join(examples, "sr-tid1500-ct-liver-example.json"),
+                  "inputImageLibraryDirectory": ctDirectory,
+                  "inputCompositeContextDirectory": segmentations,
+                  "outputDICOM": os.path.join(output, "batch-sr.dcm")}},
+      {"id": "report-metadata", "method": "tid1500reader",
+       "params": {"inputDICOM": os.path.join(args.sourceDirectory, "data", "sr-example", "sr.dcm"),
+                  "outputMetadata": os.path.join(output, "batch-sr.json")}},
+      {"id": "missing-input", "method": "itkimage2segimage",
+       "params": {"inputImageList": [os.path.join(output, "does-not-exist.nrrd")],
+                  "outputDICOM": os.path.join(output, "batch-missing.dcm")}}
+    ]
+  }
+  manifestFile = os.path.join(output, "batch-manifest.json")
+  with open(manifestFile, "w") as f:
+    json.dump(manifest, f, indent=2)
+
+  reportFile = os.path.join(output, "batch-report.csv")
+  returnCode = runBatch(args.batch, manifestFile, reportFile, "csv")
+  require(returnCode != 0, "dcmqibatch succeeded although a job failed")
+
+  with open(reportFile) as f:
+    rows = list(csv.DictReader(f))
+  require(sorted(row["id"] for row in rows) == sorted(job["id"] for job in manifest["jobs"]),
+          "every job must be reported once: %s" % [row["id"] for row in rows])
+  for row in rows:
+    if row["id"] == "missing-input":
+      require(row["status"] == "failed" and "does-not-exist.nrrd" in row["message"],
+              "missing input not reported: %s" % row)
+    else:
+      require(row["status"] == "succeeded", "job failed: %s" % row)
+  for fileName in ("batch-liver-binary.dcm", "batch-liver-labelmap.dcm", "batch-liver-1.nrrd",
+                   "batch-pmap.dcm", "batch-sr.dcm", "batch-sr.json"):
+    require(os.path.exists(os.path.join(output, fileName)), fileName + " was not written")
+
+  # CSV manifest: one job per row, lists as quoted comma-separated values
+  csvManifestFile = os.path.join(output, "batch-manifest.csv")
+  with open(csvManifestFile, "w") as f:
+    f.write("id,method,inputImageList,inputMetadata,inputDICOMDirectory,outputDICOM,inputDICOM,outputDirectory,prefix\n")
+    f.write("seg,itkimage2segimage,\"%s\",%s,%s,%s,,,\n" % (
+      os.path.join(segmentations, "liver_seg.nrrd"), os.path.join(examples, "seg-example.json"),
+      ctDirectory, os.path.join(output, "batch-csv-liver.dcm")))
+    f.write("images,segimage2itkimage,,,,,%s,%s,batch-csv\n" % (
+      os.path.join(segmentations, "liver.dcm"), output))
+
+  jsonReportFile = os.path.join(output, "batch-report.jsonl")
+  returnCode = runBatch(args.batch, csvManifestFile, jsonReportFile, "jsonl")
+  require(returnCode == 0, "dcmqibatch failed on the CSV manifest")
+  with open(jsonReportFile) as f:
+    lines = [json.loads(line) for line in f if line.strip()]
+  require(len(lines) == 2, "expected 2 report lines, got %d" % len(lines))
+  for line in lines:
+    require(line["status"] == "succeeded" and "result" in line, "job failed: %s" % line)
+    if line["id"] == "seg":
+      require(line["result"]["outputDICOM"] == os.path.join(output, "batch-csv-liver.dcm"),
+              "unexpected result %s" % line)
+
+  # Memory budget: every job needs more than half of it, so the three workers
+  # must run the jobs one at a time
+  budgetMB = 100
+  budgetManifest = {
+    "defaults": manifest["defaults"],
+    "jobs": [{"id": "budget-%d" % i, "method": "itkimage2segimage",
+              "params": {"inputImageList": [os.path.join(segmentations, "liver_seg.nrrd")],
+                         "outputDICOM": os.path.join(output, "batch-budget-%d.dcm" % i)}}
+             for i in range(3)]
+  }
+  budgetManifestFile = os.path.join(output, "batch-manifest-budget.json")
+  with open(budgetManifestFile, "w") as f:
+    json.dump(budgetManifest, f, indent=2)
+  budgetReportFile = os.path.join(output, "batch-report-budget.csv")
+  returnCode = runBatch(args.batch, budgetManifestFile, budgetReportFile, "csv", ["--maxMemory", str(budgetMB)])
+  require(returnCode == 0, "dcmqibatch failed within the memory budget")
+  with open(budgetReportFile) as f:
+    rows = sorted(csv.DictReader(f), key=lambda row: float(row["startSeconds"]))
+  require(len(rows) == 3, "expected 3 report rows, got %d" % len(rows))
+  for row in rows:
+    require(row["status"] == "succeeded", "job failed: %s" % row)
+    require(2 * float(row["memoryEstimateMB"]) > budgetMB,
+            "estimate %s MB leaves room for two jobs in %d MB" % (row["memoryEstimateMB"], budgetMB))
+  # the report rounds to milliseconds
+  for previous, row in zip(rows, rows[1:]):
+    require(float(row["startSeconds"]) + 0.002 >= float(previous["startSeconds"]) + float(previous["seconds"]),
+            "jobs ran at the same time within the memory budget: %s, %s" % (previous, row))
+
+  print("dcmqibatch: all jobs reported as expected")
+
+
+if __name__ == "__main__":
+  main()
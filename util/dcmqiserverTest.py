@@ -0,0 +1,224 @@
+"""Functional test for dcmqiserver.
+
+Starts the server in standard input mode and sends JSON-RPC requests one line
+at a time: a SEG conversion of an example segmentation, the conversion of the
+result back into ITK images, a request with a missing input and an unknown
+method. Fails if any response is not as expected, if the second conversion of
+the same source series does not take the source headers from the cache, or if
+the server does not exit after the shutdown request.
+
+Where Unix domain sockets are available, then starts the server in socket mode
+and converts the segmentation from several clients at the same time. Fails if
+a client receives a response to a request of another client, if the jobs are
+not all completed, or if the shutdown request of one client does not close the
+other connections, end the server and remove the socket.
+
+Usage:
+  python dcmqiserverTest.py <dcmqiserver> <seg-example.json> <liver_seg.nrrd>
+    <dicomDirectory> <outputDirectory>
+"""
+
+import argparse
+import json
+import os
+import shutil
+import socket
+import stat
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+
+class Client(object):
+  """Sends requests to the writer and reads the responses from the reader,
+  the standard streams of the server or a socket connection"""
+
+  def __init__(self, writer, reader, firstId=1):
+    self.writer = writer
+    self.reader = reader
+    self.nextId = firstId
+
+  def send(self, method, params=None):
+    request = {"jsonrpc": "2.0", "id": self.nextId, "method": method}
+    if params is not None:
+      request["params"] = params
+    self.writer.write(json.dumps(request) + "\n")
+    self.writer.flush()
+    self.nextId += 1
+    return request["id"]
+
+  def receive(self, ids):
+    """Responses to the given requests, which arrive in any order"""
+    responses = {}
+    while len(responses) < len(ids):
+      line = self.reader.readline()
+      if not line:
+        raise RuntimeError("server closed the connection")
+      response = json.loads(line)
+      if response.get("id") not in ids:
+        raise RuntimeError("unexpected response %s" % line)
+      responses[response["id"]] = response
+    return responses
+
+  def call(self, method, params=None):
+    requestId = self.send(method, params)
+    return self.receive([requestId])[requestId]
+
+
+def require(condition, message, response=None):
+  if not condition:
+    sys.exit("Error: %s %s" % (message, json.dumps(response) if response else ""))
+
+
+def testStream(args):
+  process = subprocess.Popen([args.server, "--workers", "2"], stdin=subprocess.PIPE,
+                             stdout=subprocess.PIPE, universal_newlines=True)
+  client = Client(process.stdin, process.stdout)
+
+  response = client.call("ping")
+  require("result" in response and "version" in response["result"], "ping failed", response)
+
+  # the same series twice, at the same time: both are answered, in any order
+  segFiles = [os.path.join(args.outputDirectory, "server-liver-%d.dcm" % i) for i in (1, 2)]
+  ids = [client.send("itkimage2segimage", {"inputImageList": [args.segmentation],
+                                           "inputMetadata": args.metadata,
+                                           "inputDICOMDirectory": args.dicomDirectory,
+                                           "outputDICOM": segFile})
+         for segFile in segFiles]
+  for response in client.receive(ids).values():
+    require("result" in response, "itkimage2segimage failed", response)
+    require(response["result"]["sourceImages"] == 3, "unexpected number of source images", response)
+  for segFile in segFiles:
+    require(os.path.exists(segFile), "missing output " + segFile)
+
+  # a third conversion of the series is served from the cache
+  response = client.call("itkimage2segimage", {"inputImageList": args.segmentation,
+                                               "inputMetadata": args.metadata,
+                                               "inputDICOMDirectory": args.dicomDirectory,
+                                               "outputDICOM": segFiles[0],
+                                               "compress": "deflate"})
+  require("result" in response, "itkimage2segimage failed", response)
+  response = client.call("stats")
+  require(response["result"]["headerCache"]["hits"] >= 3, "source headers were not cached", response)
+
+  response = client.call("segimage2itkimage", {"inputDICOM": segFiles[0],
+                                               "outputDirectory": args.outputDirectory,
+                                               "prefix": "server"})
+  require("result" in response, "segimage2itkimage failed", response)
+  require(len(response["result"]["outputImages"]) == 1, "unexpected number of segments", response)
+  for fileName in response["result"]["outputImages"] + [response["result"]["outputMetadata"]]:
+    require(os.path.exists(fileName), "missing output " + fileName)
+
+  # failing jobs are reported, the server keeps running
+  response = client.call("segimage2itkimage", {"inputDICOM": os.path.join(args.outputDirectory, "missing.dcm"),
+                                               "outputDirectory": args.outputDirectory})
+  require("error" in response and response["error"]["code"] == -32602, "missing input not reported", response)
+  response = client.call("itkimage2dcm")
+  require("error" in response and response["error"]["code"] == -32601, "unknown method not reported", response)
+  response = client.call("stats")
+  require(response["result"]["jobsCompleted"] == 4 and response["result"]["jobsFailed"] == 1,
+          "unexpected job statistics", response)
+
+  response = client.call("shutdown")
+  require("result" in response, "shutdown failed", response)
+  process.stdin.close()
+  if process.wait(timeout=60) != 0:
+    sys.exit("Error: server exited with %d" % process.returncode)
+  print("dcmqiserver: all requests on standard input answered as expected")
+
+
+def connect(socketPath, firstId):
+  connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+  connection.connect(socketPath)
+  stream = connection.makefile("rw")
+  return connection, Client(stream, stream, firstId)
+
+
+def convertOnConnection(args, socketPath, index, failures):
+  """One client of testSocket, its request IDs do not overlap with those of
+  the other clients"""
+  try:
+    connection, client = connect(socketPath, 1000 * (index + 1))
+    segFile = os.path.join(args.outputDirectory, "server-socket-%d.dcm" % index)
+    response = client.call("itkimage2segimage", {"inputImageList": [args.segmentation],
+                                                 "inputMetadata": args.metadata,
+                                                 "inputDICOMDirectory": args.dicomDirectory,
+                                                 "outputDICOM": segFile})
+    if "result" not in response or response["result"]["sourceImages"] != 3:
+      raise RuntimeError("itkimage2segimage failed %s" % json.dumps(response))
+    if not os.path.exists(segFile):
+      raise RuntimeError("missing output " + segFile)
+    connection.close()
+  except Exception as e:
+    failures.append("client %d: %s" % (index, e))
+
+
+def testSocket(args):
+  # socket paths are limited to about 100 characters, shorter than many build trees
+  socketDirectory = tempfile.mkdtemp(prefix="dcmqi")
+  socketPath = os.path.join(socketDirectory, "server.socket")
+  log = open(os.path.join(args.outputDirectory, "server-socket.log"), "w")
+  process = subprocess.Popen([args.server, "--workers", "2", "--socket", socketPath],
+                             stdout=log, stderr=subprocess.STDOUT)
+  try:
+    deadline = time.time() + 60
+    while not (os.path.exists(socketPath) and stat.S_ISSOCK(os.stat(socketPath).st_mode)):
+      require(process.poll() is None, "server exited with %s before listening" % process.returncode)
+      require(time.time() < deadline, "server does not listen on " + socketPath)
+      time.sleep(0.1)
+
+    # a connection that stays idle must be closed by the shutdown of another one
+    idleConnection, idleClient = connect(socketPath, 1)
+    response = idleClient.call("ping")
+    require("result" in response, "ping failed", response)
+
+    clients = 3
+    failures = []
+    threads = [threading.Thread(target=convertOnConnection, args=(args, socketPath, index, failures))
+               for index in range(clients)]
+    for thread in threads:
+      thread.start()
+    for thread in threads:
+      thread.join(timeout=300)
+    require(not any(thread.is_alive() for thread in threads), "clients were not answered")
+    require(not failures, "; ".join(failures))
+
+    connection, client = connect(socketPath, 100)
+    response = client.call("stats")
+    require(response["result"]["jobsCompleted"] == clients and response["result"]["jobsFailed"] == 0,
+            "unexpected job statistics", response)
+    response = client.call("shutdown")
+    require("result" in response, "shutdown failed", response)
+
+    idleConnection.settimeout(60)
+    require(idleClient.reader.readline() == "", "idle connection was not closed by the shutdown")
+    require(process.wait(timeout=60) == 0, "server exited with %s" % process.returncode)
+    require(not os.path.exists(socketPath), "socket was not removed")
+    connection.close()
+    idleConnection.close()
+  finally:
+    if process.poll() is None:
+      process.kill()
+    log.close()
+    shutil.rmtree(socketDirectory, ignore_errors=True)
+  print("dcmqiserver: %d clients answered on a socket, shut down cleanly" % clients)
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument("server")
+  parser.add_argument("metadata")
+  parser.add_argument("segmentation")
+  parser.add_argument("dicomDirectory")
+  parser.add_argument("outputDirectory")
+  args = parser.parse_args()
+
+  testStream(args)
+  if hasattr(socket, "AF_UNIX"):
+    testSocket(args)
+
+
+if __name__ == "__main__":
+  main()
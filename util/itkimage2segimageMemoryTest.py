@@ -0,0 +1,170 @@
+"""Memory budget test for itkimage2segimage (--maxMemory).
+
+Creates a label image on the grid of the example CT with 200 segments in
+stripes, so that every segment is on every slice and the deflated dataset
+dominates the estimate. Then
+- finds a budget between the estimated peaks of the streamed and the parallel
+  deflate with --dryRun
+- converts with that budget, which must select the streamed deflate, and
+  checks that the output is deflated and reads back with segimage2itkimage
+  into the same labels
+- compares the estimate with the peak resident memory of the conversion from
+  --profileJSON: the difference to a conversion with a single segment must
+  be within the difference of the estimates, give or take the allocator
+
+Usage:
+  python itkimage2segimageMemoryTest.py <itkimage2segimage> <segimage2itkimage>
+    <seg-example.json> <liver_seg.nrrd> <dicomDirectory> <outputDirectory>
+"""
+
+import argparse
+import array
+import copy
+import gzip
+import json
+import os
+import re
+import subprocess
+import sys
+
+SEGMENTS = 200
+DEFLATED_TRANSFER_SYNTAX = b"1.2.840.10008.1.2.1.99"
+NRRD_TYPES = {"unsigned char": "B", "uchar": "B", "short": "h", "unsigned short": "H", "int": "i"}
+MB = 1024.0 * 1024.0
+
+
+def require(condition, message):
+  if not condition:
+    sys.exit("Error: " + message)
+
+
+def readNRRDHeader(fileName):
+  with open(fileName, "rb") as f:
+    content = f.read()
+  headerEnd = content.index(b"\n\n")
+  fields = {}
+  for line in content[:headerEnd].decode("ascii").splitlines()[1:]:
+    if ":" in line and not line.startswith("#"):
+      key, value = line.split(":", 1)
+      fields[key.strip()] = value.strip()
+  return fields, content[headerEnd + 2:]
+
+
+def readNRRD(fileName):
+  fields, data = readNRRDHeader(fileName)
+  # single byte types have no endian field
+  require(fields.get("endian", "little") == "little" and fields["encoding"] in ("raw", "gzip"),
+          "unsupported NRRD " + fileName)
+  voxels = array.array(NRRD_TYPES[fields["type"]])
+  voxels.frombytes(gzip.decompress(data) if fields["encoding"] == "gzip" else data)
+  return [int(x) for x in fields["sizes"].split()], voxels
+
+
+def writeInput(liverSegmentation, exampleMetadata, segments, prefix):
+  """Label image with the geometry of the example and the metadata of its segments"""
+  fields, _ = readNRRDHeader(liverSegmentation)
+  columns, rows, slices = [int(x) for x in fields["sizes"].split()]
+  require(columns >= segments, "more segments than columns")
+  row = bytes(column * segments // columns + 1 for column in range(columns))
+  imageFile = prefix + ".nrrd"
+  with open(imageFile, "wb") as f:
+    f.write(("NRRD0004\ntype: unsigned char\ndimension: 3\nspace: %s\nsizes: %s\nspace directions: %s\n"
+             "kinds: domain domain domain\nendian: little\nencoding: raw\nspace origin: %s\n\n"
+             % (fields["space"], fields["sizes"], fields["space directions"], fields["space origin"])).encode("ascii"))
+    f.write(row * (rows * slices))
+
+  with open(exampleMetadata) as f:
+    metadata = json.load(f)
+  template = metadata["segmentAttributes"][0][0]
+  attributes = []
+  for labelID in range(1, segments + 1):
+    segment = copy.deepcopy(template)
+    segment["labelID"] = labelID
+    segment["SegmentLabel"] = "Stripe %d" % labelID
+    segment["TrackingIdentifier"] = "Stripe %d" % labelID
+    segment["TrackingUniqueIdentifier"] = "1.2.3.%d" % labelID
+    attributes.append(segment)
+  metadata["segmentAttributes"] = [attributes]
+  metadataFile = prefix + ".json"
+  with open(metadataFile, "w") as f:
+    json.dump(metadata, f)
+  return imageFile, metadataFile
+
+
+def convert(args, imageFile, metadataFile, options):
+  command = [args.itkimage2segimage, "--inputImageList", imageFile, "--inputMetadata", metadataFile,
+             "--inputDICOMDirectory", args.dicomDirectory] + options
+  print(" ".join(command))
+  process = subprocess.Popen(command, stdout=subprocess.PIPE, universal_newlines=True)
+  output = process.communicate()[0]
+  peak = re.search(r"peak: +([0-9.]+)", output)
+  strategy = re.search(r"deflate strategy: (\w+)", output)
+  return process.returncode, float(peak.group(1)) if peak else None, strategy.group(1) if strategy else None
+
+
+def convertWithProfile(args, imageFile, metadataFile, outputFile, budget):
+  profileFile = outputFile + ".profile.json"
+  returnCode, peak, strategy = convert(args, imageFile, metadataFile,
+                                       ["--outputDICOM", outputFile, "--compress", "deflate",
+                                        "--maxMemory", str(budget), "--profileJSON", profileFile])
+  require(returnCode == 0 and peak is not None, "conversion of %s failed" % imageFile)
+  with open(profileFile) as f:
+    peakRSS = json.load(f)["peakRSSBytes"] / MB
+  return peak, strategy, peakRSS
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  for name in ("itkimage2segimage", "segimage2itkimage", "metadata", "segmentation", "dicomDirectory",
+               "outputDirectory"):
+    parser.add_argument(name)
+  args = parser.parse_args()
+
+  imageFile, metadataFile = writeInput(args.segmentation, args.metadata, SEGMENTS,
+                                       os.path.join(args.outputDirectory, "budget-stripes"))
+
+  # the estimate without a budget is the parallel deflate; budgets below its
+  # peak select the streamed deflate as long as that fits
+  returnCode, parallelPeak, strategy = convert(args, imageFile, metadataFile, ["--compress", "deflate", "--dryRun"])
+  require(returnCode == 0 and strategy == "parallel", "unexpected estimate without a budget (%s)" % strategy)
+  budget = int(parallelPeak)
+  require(budget < parallelPeak, "the parallel peak of %.1f MB is a whole number" % parallelPeak)
+  returnCode, streamedPeak, strategy = convert(args, imageFile, metadataFile,
+                                               ["--compress", "deflate", "--dryRun", "--maxMemory", str(budget)])
+  require(returnCode == 0 and strategy == "streamed",
+          "no budget between the streamed and the parallel peak below %.1f MB" % parallelPeak)
+  print("budget of %d MB between the streamed peak of %.1f MB and the parallel peak of %.1f MB"
+        % (budget, streamedPeak, parallelPeak))
+
+  outputFile = os.path.join(args.outputDirectory, "budget-stripes.dcm")
+  peak, strategy, peakRSS = convertWithProfile(args, imageFile, metadataFile, outputFile, budget)
+  require(strategy == "streamed", "the conversion did not use the streamed deflate (%s)" % strategy)
+  with open(outputFile, "rb") as f:
+    require(DEFLATED_TRANSFER_SYNTAX in f.read(1024), "the output is not deflated")
+
+  # read back: the stripes do not overlap, so they merge into the input labels
+  prefix = "budget-stripes-readback"
+  command = [args.segimage2itkimage, "--inputDICOM", outputFile, "--outputDirectory", args.outputDirectory,
+             "--prefix", prefix, "--mergeSegments"]
+  print(" ".join(command))
+  require(subprocess.call(command) == 0, "the streamed output cannot be read back")
+  inputSizes, inputVoxels = readNRRD(imageFile)
+  outputSizes, outputVoxels = readNRRD(os.path.join(args.outputDirectory, prefix + "-1.nrrd"))
+  require(outputSizes == inputSizes, "labels read back have the size %s instead of %s" % (outputSizes, inputSizes))
+  require(list(outputVoxels) == list(inputVoxels), "labels read back differ from the input")
+
+  # a single segment on the same grid, for the memory of the process itself
+  singleImageFile, singleMetadataFile = writeInput(args.segmentation, args.metadata, 1,
+                                                   os.path.join(args.outputDirectory, "budget-single"))
+  singlePeak, _, singlePeakRSS = convertWithProfile(args, singleImageFile, singleMetadataFile,
+                                                    os.path.join(args.outputDirectory, "budget-single.dcm"),
+                                                    100000)
+  estimated = peak - singlePeak
+  measured = peakRSS - singlePeakRSS
+  print("%d segments: estimated %.1f MB, measured %.1f MB more than 1 segment" % (SEGMENTS, estimated, measured))
+  require(measured <= 1.25 * estimated + 16, "the estimate of %.1f MB is below the measured %.1f MB" % (estimated, measured))
+  require(measured >= 0.25 * estimated, "the estimate of %.1f MB is far above the measured %.1f MB" % (estimated, measured))
+
+
+if __name__ == "__main__":
+  main()
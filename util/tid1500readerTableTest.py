@@ -0,0 +1,101 @@
+"""Functional test for the measurement tables of tid1500reader (--outputTable).
+
+Extracts the measurements of TID 1500 reports into CSV and JSON Lines tables
+with one and with several threads, with a DICOM image and a file that is not
+DICOM among the inputs. Checks that
+- the non-SR files are skipped and tid1500reader succeeds
+- the CSV header lists the table columns
+- there is one row per measurement item of the reports, in input order
+- the tables do not depend on the number of threads or on the format
+
+Usage:
+  python tid1500readerTableTest.py <tid1500reader> <outputDirectory> <nonSRFile>...
+      --reports <report.dcm> <report.json> [<report.dcm> <report.json> ...]
+
+Every report is given as the DICOM SR and the JSON it was written from.
+"""
+
+import argparse
+import csv
+import json
+import os
+import subprocess
+import sys
+
+COLUMNS = ["file", "SOPInstanceUID", "SeriesDescription", "measurementGroup",
+           "TrackingIdentifier", "TrackingUniqueIdentifier",
+           "Finding", "FindingMeaning", "FindingSite", "FindingSiteMeaning",
+           "segmentationSOPInstanceUID", "ReferencedSegment", "SourceSeriesForImageSegmentation",
+           "quantity", "quantityMeaning", "derivationModifier", "derivationModifierMeaning",
+           "value", "units"]
+
+
+def require(condition, message):
+  if not condition:
+    sys.exit("Error: " + message)
+
+
+def countMeasurements(metadataFile):
+  with open(metadataFile) as f:
+    metadata = json.load(f)
+  return sum(len(group.get("measurementItems", [])) for group in metadata.get("Measurements", []))
+
+
+def writeTable(reader, inputFiles, tableFile, tableFormat, threads):
+  command = [reader, "--inputDICOMList", ",".join(inputFiles), "--outputTable", tableFile,
+             "--tableFormat", tableFormat, "--threads", str(threads)]
+  print(" ".join(command))
+  require(subprocess.call(command) == 0, "tid1500reader failed with %d threads (%s)" % (threads, tableFormat))
+
+
+def readCSV(tableFile):
+  with open(tableFile) as f:
+    rows = list(csv.reader(f))
+  require(len(rows) > 0 and rows[0] == COLUMNS, "unexpected CSV header %s" % (rows[:1],))
+  return [dict(zip(COLUMNS, row)) for row in rows[1:]]
+
+
+def readJSONLines(tableFile):
+  with open(tableFile) as f:
+    rows = [json.loads(line) for line in f if line.strip()]
+  for row in rows:
+    require(sorted(row.keys()) == sorted(COLUMNS), "unexpected JSON Lines columns %s" % sorted(row.keys()))
+  return rows
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument("reader")
+  parser.add_argument("outputDirectory")
+  parser.add_argument("nonSRFiles", nargs="+")
+  parser.add_argument("--reports", nargs="+", required=True)
+  args = parser.parse_args()
+  require(len(args.reports) % 2 == 0, "--reports needs pairs of DICOM SR and JSON files")
+
+  reports = args.reports[0::2]
+  measurements = [countMeasurements(metadataFile) for metadataFile in args.reports[1::2]]
+  # the non-SR files in between the reports
+  inputFiles = [reports[0]] + args.nonSRFiles + reports[1:]
+
+  expectedFiles = []
+  for report, count in zip(reports, measurements):
+    expectedFiles += [report] * count
+
+  tables = []
+  for tableFormat in ("csv", "jsonl"):
+    for threads in (1, 4):
+      tableFile = os.path.join(args.outputDirectory, "tid1500-table-%d.%s" % (threads, tableFormat))
+      writeTable(args.reader, inputFiles, tableFile, tableFormat, threads)
+      rows = readCSV(tableFile) if tableFormat == "csv" else readJSONLines(tableFile)
+      require([row["file"] for row in rows] == expectedFiles,
+              "expected %d rows of %s in input order, got %s" % (len(expectedFiles), reports,
+                                                                 [row["file"] for row in rows]))
+      tables.append(rows)
+  for rows in tables[1:]:
+    require(rows == tables[0], "the tables differ between thread counts or formats")
+
+  print("tid1500reader: %d measurements of %d reports in every table" % (len(expectedFiles), len(reports)))
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,87 @@
+"""Scaling benchmark for tid1500writer.
+
+Replicates the measurement groups of a TID 1500 JSON example until the report
+holds the requested number of measurements, converts reports of 1/8, 1/4, 1/2
+and all of the measurements with tid1500writer and reports the run time per
+measurement. Fails if the writer fails, or if the time per measurement of the
+largest report exceeds that of the smallest one by more than --tolerance
+(i.e. if the writer does not scale linearly).
+
+Usage:
+  python tid1500writerBenchmark.py <tid1500writer> <example.json>
+    <imageLibraryDirectory> <compositeContextDirectory> <outputDirectory>
+    [--measurements 50000] [--tolerance 2.5]
+"""
+
+import argparse
+import copy
+import json
+import os
+import subprocess
+import sys
+import time
+
+
+def makeReport(example, numberOfMeasurements):
+  report = copy.deepcopy(example)
+  groups = example["Measurements"]
+  report["Measurements"] = []
+  added = 0
+  while added < numberOfMeasurements:
+    for group in groups:
+      group = copy.deepcopy(group)
+      number = len(report["Measurements"]) + 1
+      group["TrackingIdentifier"] = "Measurements group %d" % number
+      group.pop("TrackingUniqueIdentifier", None)
+      group["measurementItems"] = group["measurementItems"][:numberOfMeasurements - added]
+      added += len(group["measurementItems"])
+      report["Measurements"].append(group)
+      if added >= numberOfMeasurements:
+        break
+  return report
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument("writer")
+  parser.add_argument("example")
+  parser.add_argument("imageLibraryDirectory")
+  parser.add_argument("compositeContextDirectory")
+  parser.add_argument("outputDirectory")
+  parser.add_argument("--measurements", type=int, default=50000)
+  parser.add_argument("--tolerance", type=float, default=2.5)
+  args = parser.parse_args()
+
+  with open(args.example) as f:
+    example = json.load(f)
+
+  timePerMeasurement = []
+  for fraction in (8, 4, 2, 1):
+    numberOfMeasurements = max(1, args.measurements // fraction)
+    baseName = os.path.join(args.outputDirectory, "sr-tid1500-benchmark-%d" % numberOfMeasurements)
+    with open(baseName + ".json", "w") as f:
+      json.dump(makeReport(example, numberOfMeasurements), f)
+
+    start = time.time()
+    result = subprocess.run([args.writer,
+                             "--inputMetadata", baseName + ".json",
+                             "--inputImageLibraryDirectory", args.imageLibraryDirectory,
+                             "--inputCompositeContextDirectory", args.compositeContextDirectory,
+                             "--outputDICOM", baseName + ".dcm"],
+                            stdout=subprocess.DEVNULL)
+    elapsed = time.time() - start
+    if result.returncode != 0:
+      sys.exit("Error: tid1500writer failed for %d measurements" % numberOfMeasurements)
+
+    timePerMeasurement.append(elapsed / numberOfMeasurements)
+    print("%8d measurements: %8.2f s, %8.1f us per measurement"
+          % (numberOfMeasurements, elapsed, 1e6 * timePerMeasurement[-1]))
+
+  ratio = timePerMeasurement[-1] / timePerMeasurement[0]
+  print("Time per measurement, largest vs. smallest report: %.2f" % ratio)
+  if ratio > args.tolerance:
+    sys.exit("Error: run time grows faster than linearly with the number of measurements")
+
+
+if __name__ == "__main__":
+  main()